@@ -10,6 +10,7 @@
 
 #include <math.h>
 #include <stdio.h>
+#include <string.h>
 #include "base_camera_server.h"
 
 #ifndef	M_PI
@@ -32,6 +33,20 @@ const double M_PI = 2*asin(1.0);
   #include <magick/api.h>
 #endif
 
+#ifdef	_WIN32
+#include <windows.h>
+#endif
+
+unsigned long image_wrapper_next_generation(void)
+{
+  static volatile long next = 0;
+#ifdef	_WIN32
+  return static_cast<unsigned long>(InterlockedIncrement(&next));
+#else
+  return static_cast<unsigned long>(__sync_add_and_fetch(&next, 1));
+#endif
+}
+
 // Sum all the pixels for one color (defaults to the first) in an image.
 double image_wrapper_sum(const image_wrapper &img, unsigned rgb)
 {
@@ -76,38 +91,48 @@ static	vrpn_uint16 offset_scale_and_clamp(const double value, const double gain,
   return (vrpn_uint16)(result);
 }
 
-/// Store the portion of the image that is in memory to a TIFF file.
-bool  image_wrapper::write_to_tiff_file(const char *filename, double scale, double offset, bool sixteen_bits,
-				        const char *magick_files_dir, bool skip_init) const
+bool  image_wrapper_fill_tiff_buffer(const image_wrapper &img, int channel, double scale, double offset,
+                                     std::vector<vrpn_uint16> &buffer, int &numcols, int &numrows)
 {
-  // Make a pointer to the image data adjusted by the scale and offset.
-  vrpn_uint16	  *gain_buffer = NULL;
-  int		  r,c;
-  int minx, maxx, miny, maxy, numcols, numrows;
-  read_range(minx, maxx, miny, maxy);
+  int minx, maxx, miny, maxy;
+  img.read_range(minx, maxx, miny, maxy);
   numcols = maxx-minx+1;
   numrows = maxy-miny+1;
-  gain_buffer = new vrpn_uint16[numcols * numrows * 3];
-  if (gain_buffer == NULL) {
-      fprintf(stderr, "image_wrapper::write_memory_to_tiff_file(): Out of memory\n");
+  if ( (numcols <= 0) || (numrows <= 0) ) {
+      fprintf(stderr, "image_wrapper_fill_tiff_buffer(): Empty image\n");
       return false;
   }
+  unsigned num_colors = (channel < 0) ? 3 : 1;
+  buffer.resize(static_cast<size_t>(numcols) * numrows * num_colors);
+
   // Flip the row values around so that the orientation matches the order expected by ImageMagick.
   // Go ahead and let it sample outside the image, filling in black there.
   // Make sure to flip on the output, not on the pixel read, because the pixel read
   // may have other hidden transforms in there.
+  int r, c;
+  unsigned rgb;
   for (r = 0; r < numrows; r++) {
+    int flip_r = (numrows - 1) - r;
+    vrpn_uint16 *out = &buffer[num_colors * flip_r * numcols];
     for (c = 0; c < numcols; c++) {
-      int flip_r = (numrows - 1) - r;
-      double  value;
-      read_pixel(minx + c, miny + r, value, 0);
-      gain_buffer[0 + 3*(c + flip_r * numcols)] = offset_scale_and_clamp(value, scale, offset);
-      read_pixel(minx + c, miny + r, value, 1);
-      gain_buffer[1 + 3*(c + flip_r * numcols)] = offset_scale_and_clamp(value, scale, offset);
-      read_pixel(minx + c, miny + r, value, 2);
-      gain_buffer[2 + 3*(c + flip_r * numcols)] = offset_scale_and_clamp(value, scale, offset);
+      for (rgb = 0; rgb < num_colors; rgb++) {
+        double  value;
+        img.read_pixel(minx + c, miny + r, value, (channel < 0) ? rgb : channel);
+        *(out++) = offset_scale_and_clamp(value, scale, offset);
+      }
     }
   }
+  return true;
+}
+
+bool  image_wrapper_write_tiff_buffer(const char *filename, const vrpn_uint16 *buffer,
+                                      int numcols, int numrows, unsigned num_colors, bool sixteen_bits,
+                                      const char *magick_files_dir, bool skip_init)
+{
+  if ( (num_colors != 1) && (num_colors != 3) ) {
+      fprintf(stderr, "image_wrapper_write_tiff_buffer(): Invalid number of colors (%u)\n", num_colors);
+      return false;
+  }
 #if !defined(VIDEO_NO_IMAGEMAGICK)
 
 #ifdef	_WIN32
@@ -124,12 +149,12 @@ bool  image_wrapper::write_to_tiff_file(const char *filename, double scale, doub
 
   //Initialize the image info structure.
   GetExceptionInfo(&exception);
-  out_image=ConstituteImage(numcols, numrows, "RGB", ShortPixel, gain_buffer, &exception);
+  out_image=ConstituteImage(numcols, numrows, (num_colors == 3) ? "RGB" : "I", ShortPixel, buffer, &exception);
   if (out_image == (Image *) NULL) {
       // print out something to let us know we are missing the 
       // delegates.mgk or whatever if that is the problem instead of just
       // saying the file can't be written later
-      fprintf(stderr, "image_wrapper::write_memory_to_tiff_file(): Can't make out image: %s: %s\n",
+      fprintf(stderr, "image_wrapper_write_tiff_buffer(): Can't make out image: %s: %s\n",
              exception.reason,exception.description);
       return false;
   }
@@ -147,20 +172,34 @@ bool  image_wrapper::write_to_tiff_file(const char *filename, double scale, doub
       // print out something to let us know we are missing the 
       // delegates.mgk or whatever if that is the problem instead of just
       // saying the file can't be written later
-      fprintf(stderr, "image_wrapper::write_memory_to_tiff_file(): WriteImage failed: %s: %s\n",
+      fprintf(stderr, "image_wrapper_write_tiff_buffer(): WriteImage failed: %s: %s\n",
              exception.reason,exception.description);
       return false;
   }
   DestroyImageInfo(out_image_info);
   DestroyImage(out_image);
-  delete [] gain_buffer;
   return true;
 #else
-  fprintf(stderr,"image_wrapper::write_to_tiff_file(): No ImageMagick implemented\n");
+  fprintf(stderr,"image_wrapper_write_tiff_buffer(): No ImageMagick implemented\n");
   return false;
 #endif
 }
 
+/// Store the portion of the image that is in memory to a TIFF file.
+bool  image_wrapper::write_to_tiff_file(const char *filename, double scale, double offset, bool sixteen_bits,
+				        const char *magick_files_dir, bool skip_init) const
+{
+  // Make a buffer of the image data adjusted by the scale and offset.
+  std::vector<vrpn_uint16> gain_buffer;
+  int numcols, numrows;
+  if (!image_wrapper_fill_tiff_buffer(*this, -1, scale, offset, gain_buffer, numcols, numrows)) {
+      fprintf(stderr, "image_wrapper::write_memory_to_tiff_file(): Could not fill buffer\n");
+      return false;
+  }
+  return image_wrapper_write_tiff_buffer(filename, &gain_buffer[0], numcols, numrows, 3,
+                                         sixteen_bits, magick_files_dir, skip_init);
+}
+
 bool  image_wrapper::write_to_pgm_file(const char *filename, unsigned channel, double gain, bool sixteen_bits) const
 {
   int     r,c;
@@ -215,82 +254,15 @@ bool  image_wrapper::write_to_grayscale_tiff_file(const char *filename, unsigned
       return false;
   }
 
-  // Make a pointer to the image data adjusted by the scale and offset.
-  vrpn_uint16	  *gain_buffer = NULL;
-  int		  r,c;
-  int minx, maxx, miny, maxy, numcols, numrows;
-  read_range(minx, maxx, miny, maxy);
-  numcols = maxx-minx+1;
-  numrows = maxy-miny+1;
-  gain_buffer = new vrpn_uint16[numcols * numrows];
-  if (gain_buffer == NULL) {
-      fprintf(stderr, "image_wrapper::write_to_grayscale_tiff_file(): Out of memory\n");
-      return false;
-  }
-  // Flip the row values around so that the orientation matches the order expected by ImageMagick.
-  // Go ahead and let it sample outside the image, filling in black there.
-  // Make sure to flip on the output, not on the pixel read, because the pixel read
-  // may have other hidden transforms in there.
-  for (r = 0; r < numrows; r++) {
-    for (c = 0; c < numcols; c++) {
-      int flip_r = (numrows - 1) - r;
-      double  value;
-      read_pixel(minx + c, miny + r, value, channel);
-      gain_buffer[c + flip_r * numcols] = offset_scale_and_clamp(value, scale, offset);
-    }
-  }
-
-#if !defined(VIDEO_NO_IMAGEMAGICK)
-
-#ifdef	_WIN32
-  static bool initialized = false;
-  if (!initialized && !skip_init) {
-    InitializeMagick(magick_files_dir);
-    initialized = true;
-  }
-#endif
-
-  ExceptionInfo	  exception;
-  Image		  *out_image;
-  ImageInfo       *out_image_info;
-
-  //Initialize the image info structure.
-  GetExceptionInfo(&exception);
-  out_image=ConstituteImage(numcols, numrows, "I", ShortPixel, gain_buffer, &exception);
-  if (out_image == (Image *) NULL) {
-      // print out something to let us know we are missing the 
-      // delegates.mgk or whatever if that is the problem instead of just
-      // saying the file can't be written later
-      fprintf(stderr, "image_wrapper::write_to_grayscale_tiff_file(): Can't make out image: %s: %s\n",
-             exception.reason,exception.description);
-      return false;
-  }
-  out_image_info=CloneImageInfo((ImageInfo *) NULL);
-  if (sixteen_bits) {
-    out_image_info->depth = 16;
-    out_image->depth = 16;
-  } else {
-    out_image_info->depth = 8;
-    out_image->depth = 8;
-  }
-  strcpy(out_image_info->filename, filename);
-  strcpy(out_image->filename, filename);
-  if (WriteImage(out_image_info, out_image) == 0) {
-      // print out something to let us know we are missing the 
-      // delegates.mgk or whatever if that is the problem instead of just
-      // saying the file can't be written later
-      fprintf(stderr, "image_wrapper::write_to_grayscale_tiff_file(): WriteImage failed: %s: %s\n",
-             exception.reason,exception.description);
+  // Make a buffer of the image data adjusted by the scale and offset.
+  std::vector<vrpn_uint16> gain_buffer;
+  int numcols, numrows;
+  if (!image_wrapper_fill_tiff_buffer(*this, channel, scale, offset, gain_buffer, numcols, numrows)) {
+      fprintf(stderr, "image_wrapper::write_to_grayscale_tiff_file(): Could not fill buffer\n");
       return false;
   }
-  DestroyImageInfo(out_image_info);
-  DestroyImage(out_image);
-  delete [] gain_buffer;
-  return true;
-#else
-  fprintf(stderr,"image_wrapper::write_to_grayscale_tiff_file(): No ImageMagick implemented\n");
-  return false;
-#endif
+  return image_wrapper_write_tiff_buffer(filename, &gain_buffer[0], numcols, numrows, 1,
+                                         sixteen_bits, magick_files_dir, skip_init);
 }
 
 double_image::double_image(int minx, int maxx, int miny, int maxy) :
@@ -321,6 +293,26 @@ double_image::~double_image()
   }
 }
 
+bool double_image::resize(int minx, int maxx, int miny, int maxy)
+{
+  if ( (minx >= maxx) || (miny >= maxy) ) {
+    fprintf(stderr,"double_image::resize(): Bad min/max coordinates (%d,%d; %d,%d)\n",
+      minx, miny, maxx, maxy);
+    return false;
+  }
+  int count = (maxx-minx+1) * (maxy-miny+1);
+  if ( (_image == NULL) || (count != (_maxx-_minx+1) * (_maxy-_miny+1)) ) {
+    if (_image != NULL) { delete [] _image; }
+    if ( (_image = new double[count]) == NULL) {
+      fprintf(stderr,"double_image::resize(): Out of memory\n");
+      _minx = _maxx = _miny = _maxy = 0;
+      return false;
+    }
+  }
+  _minx = minx; _maxx = maxx; _miny = miny; _maxy = maxy;
+  return true;
+}
+
 void double_image::read_range(int &minx, int &maxx, int &miny, int &maxy) const
 {
   minx = _minx; maxx = _maxx; miny = _miny; maxy = _maxy;
@@ -367,6 +359,26 @@ float_image::~float_image()
   }
 }
 
+bool float_image::resize(int minx, int maxx, int miny, int maxy)
+{
+  if ( (minx >= maxx) || (miny >= maxy) ) {
+    fprintf(stderr,"float_image::resize(): Bad min/max coordinates (%d,%d; %d,%d)\n",
+      minx, miny, maxx, maxy);
+    return false;
+  }
+  int count = (maxx-minx+1) * (maxy-miny+1);
+  if ( (_image == NULL) || (count != (_maxx-_minx+1) * (_maxy-_miny+1)) ) {
+    if (_image != NULL) { delete [] _image; }
+    if ( (_image = new float[count]) == NULL) {
+      fprintf(stderr,"float_image::resize(): Out of memory\n");
+      _minx = _maxx = _miny = _maxy = 0;
+      return false;
+    }
+  }
+  _minx = minx; _maxx = maxx; _miny = miny; _maxy = maxy;
+  return true;
+}
+
 void float_image::read_range(int &minx, int &maxx, int &miny, int &maxy) const
 {
   minx = _minx; maxx = _maxx; miny = _miny; maxy = _maxy;
@@ -399,48 +411,221 @@ bool float_image::write_to_opengl_texture(GLuint tex_id)
 }
 
 
+// Storage for the pixels of one or more copy_of_image objects.  It is kept
+// in doubles so that it is aligned for any of the pixel types.  The copies
+// sharing a buffer may be on different threads, so the reference count is
+// changed atomically.
+class copy_of_image_buffer {
+public:
+  copy_of_image_buffer() : refs(1), bytes(0), values(NULL), pool(NULL) {};
+  ~copy_of_image_buffer() { if (values) { delete [] values; values = NULL; } }
+
+  void add_ref(void) {
+#ifdef	_WIN32
+    InterlockedIncrement(&refs);
+#else
+    __sync_add_and_fetch(&refs, 1);
+#endif
+  }
+
+  /// Returns true if that was the last reference.
+  bool drop_ref(void) {
+#ifdef	_WIN32
+    return InterlockedDecrement(&refs) == 0;
+#else
+    return __sync_sub_and_fetch(&refs, 1) == 0;
+#endif
+  }
+
+  volatile long refs;   //< How many copy_of_image objects use this buffer
+  size_t    bytes;      //< Size of the values array in bytes
+  double    *values;    //< The pixels
+  camera_frame_pool *pool;  //< Pool to return to when unused, NULL to delete
+};
+
+static size_t pixel_type_size(image_buffer_view::pixel_type type)
+{
+  switch (type) {
+    case image_buffer_view::UINT8: return sizeof(vrpn_uint8);
+    case image_buffer_view::UINT16: return sizeof(vrpn_uint16);
+    case image_buffer_view::FLOAT: return sizeof(float);
+    default: return sizeof(double);
+  }
+}
+
+// Copy the rows of the view into a packed buffer, one memcpy() per row
+// when the view's pixels are packed as well.
+template <class T>
+static void copy_view_rows(const image_buffer_view &view, int numx, int numcolors, T *dest)
+{
+  size_t row_elements = static_cast<size_t>(numx) * numcolors;
+  int x, y, c;
+  for (y = view.miny; y <= view.maxy; y++) {
+    const T *src = view.pixel<T>(view.minx, y, 0);
+    if (view.x_stride == numcolors) {
+      memcpy(dest, src, row_elements * sizeof(T));
+    } else {
+      for (x = 0; x < numx; x++) {
+        for (c = 0; c < numcolors; c++) {
+          dest[x * numcolors + c] = src[x * view.x_stride + c];
+        }
+      }
+    }
+    dest += row_elements;
+  }
+}
+
+copy_of_image::copy_of_image() :
+  _minx(-1), _maxx(-1), _miny(-1), _maxy(-1),
+  _numx(-1), _numy(-1), _numcolors(0), _type(image_buffer_view::DOUBLE),
+  _buffer(NULL), _image(NULL)
+{
+}
+
 copy_of_image::copy_of_image(const image_wrapper &copyfrom) :
   _minx(-1), _maxx(-1), _miny(-1), _maxy(-1),
-  _numx(-1), _numy(-1), _image(NULL), _numcolors(0)
+  _numx(-1), _numy(-1), _numcolors(0), _type(image_buffer_view::DOUBLE),
+  _buffer(NULL), _image(NULL)
 {
   *this = copyfrom;
 }
 
 copy_of_image::copy_of_image(const copy_of_image &copyfrom) :
+  image_wrapper(),
   _minx(-1), _maxx(-1), _miny(-1), _maxy(-1),
-  _numx(-1), _numy(-1), _image(NULL), _numcolors(0)
+  _numx(-1), _numy(-1), _numcolors(0), _type(image_buffer_view::DOUBLE),
+  _buffer(NULL), _image(NULL)
+{
+  *this = copyfrom;
+}
+
+void copy_of_image::release_buffer()
+{
+  if (_buffer != NULL) {
+    if (_buffer->drop_ref()) {
+      if (_buffer->pool != NULL) {
+        _buffer->pool->return_buffer(_buffer);
+      } else {
+        delete _buffer;
+      }
+    }
+    _buffer = NULL;
+  }
+  _image = NULL;
+}
+
+bool copy_of_image::make_buffer(int minx, int maxx, int miny, int maxy,
+                                int numcolors, image_buffer_view::pixel_type type,
+                                camera_frame_pool *pool)
 {
-  *this = (const image_wrapper &)copyfrom;
+  _minx = minx; _maxx = maxx; _miny = miny; _maxy = maxy;
+  _numx = (_maxx - _minx) + 1;
+  _numy = (_maxy - _miny) + 1;
+  _numcolors = numcolors;
+  _type = type;
+  size_t bytes = static_cast<size_t>(_numx) * _numy * _numcolors * pixel_type_size(type);
+
+  // Keep our buffer if nobody else is using it and it is the right size.
+  if ( (_buffer != NULL) && (_buffer->refs == 1) && (_buffer->bytes == bytes) ) {
+    _image = _buffer->values;
+    return true;
+  }
+  release_buffer();
+  if (pool != NULL) {
+    _buffer = pool->get_buffer(bytes);
+  } else {
+    _buffer = new copy_of_image_buffer();
+    if (_buffer != NULL) {
+      _buffer->values = new double[(bytes + sizeof(double) - 1) / sizeof(double)];
+      _buffer->bytes = bytes;
+    }
+  }
+  if ( (_buffer == NULL) || (_buffer->values == NULL) ) {
+    fprintf(stderr, "copy_of_image::make_buffer(): Out of memory\n");
+    release_buffer();
+    _numx = _numy = _minx = _maxx = _miny = _maxy = _numcolors = 0;
+    return false;
+  }
+  _image = _buffer->values;
+  return true;
+}
+
+const copy_of_image &copy_of_image::operator=(const copy_of_image &copyfrom)
+{
+  if (&copyfrom == this) {
+    return *this;
+  }
+  new_generation();
+  release_buffer();
+  _minx = copyfrom._minx; _maxx = copyfrom._maxx;
+  _miny = copyfrom._miny; _maxy = copyfrom._maxy;
+  _numx = copyfrom._numx; _numy = copyfrom._numy;
+  _numcolors = copyfrom._numcolors;
+  _type = copyfrom._type;
+  _buffer = copyfrom._buffer;
+  _image = copyfrom._image;
+  if (_buffer != NULL) {
+    _buffer->add_ref();
+  }
+  return *this;
 }
 
 void copy_of_image::operator=(const image_wrapper &copyfrom)
 {
-  // If the dimensions don't match, then get a new image buffer
+  copy_from(copyfrom, NULL);
+}
+
+void copy_of_image::copy_from(const image_wrapper &copyfrom, camera_frame_pool *pool)
+{
+  // Another copy can share its pixels with us.
+  const copy_of_image *other = dynamic_cast<const copy_of_image *>(&copyfrom);
+  if (other != NULL) {
+    copy_of_image::operator=(*other);
+    return;
+  }
+
+  new_generation();
   int minx, miny, maxx, maxy;
   copyfrom.read_range(minx, maxx, miny, maxy);
-  if ( (minx != _minx) || (maxx != _maxx) || (miny != _miny) || (maxy != _maxy) ||
-       (get_num_colors() != copyfrom.get_num_colors()) ) {
-    if (_image != NULL) { delete [] _image; _image = NULL; }
-    _minx = minx; _maxx = maxx; _miny = miny; _maxy = maxy;
-    _numx = (_maxx - _minx) + 1;
-    _numy = (_maxy - _miny) + 1;
-    _numcolors = copyfrom.get_num_colors();
-    _image = new double[_numx * _numy * get_num_colors()];
-    if (_image == NULL) {
-      _numx = _numy = _minx = _maxx = _miny = _maxy = _numcolors = 0;
-      return;
+  int numcolors = copyfrom.get_num_colors();
+
+  // Keep the source's own pixel type if it has a buffer that covers the
+  // whole image in the colors it says it has.
+  image_buffer_view view;
+  bool native = copyfrom.get_buffer_view(view) && (view.type != image_buffer_view::NONE) &&
+       (view.minx == minx) && (view.maxx == maxx) && (view.miny == miny) && (view.maxy == maxy) &&
+       (view.num_colors == static_cast<unsigned>(numcolors));
+  if (!make_buffer(minx, maxx, miny, maxy, numcolors,
+                   native ? view.type : image_buffer_view::DOUBLE, pool)) {
+    return;
+  }
+
+  if (native) {
+    switch (view.type) {
+      case image_buffer_view::UINT8:
+        copy_view_rows(view, _numx, _numcolors, reinterpret_cast<vrpn_uint8 *>(_buffer->values));
+        return;
+      case image_buffer_view::UINT16:
+        copy_view_rows(view, _numx, _numcolors, reinterpret_cast<vrpn_uint16 *>(_buffer->values));
+        return;
+      case image_buffer_view::FLOAT:
+        copy_view_rows(view, _numx, _numcolors, reinterpret_cast<float *>(_buffer->values));
+        return;
+      default:
+        copy_view_rows(view, _numx, _numcolors, _buffer->values);
+        return;
     }
   }
 
-  // Copy the values from the image
-  int x, y;
-  unsigned c;
-  for (x = _minx; x <= _maxx; x++) {
-    for (y = _miny; y <= _maxy; y++) {
-      for (c = 0; c < get_num_colors(); c++) {
+  // Copy the values from the image, a row at a time.
+  double *dest = _buffer->values;
+  int x, y, c;
+  for (y = _miny; y <= _maxy; y++) {
+    for (x = _minx; x <= _maxx; x++) {
+      for (c = 0; c < _numcolors; c++) {
 	double val;
 	copyfrom.read_pixel(x, y, val, c);  // Ignore result outside of image.
-	_image[index(x, y, c)] = val;
+	*(dest++) = val;
       }
     }
   }
@@ -448,9 +633,7 @@ void copy_of_image::operator=(const image_wrapper &copyfrom)
 
 copy_of_image::~copy_of_image()
 {
-  if (_image) {
-    delete [] _image; _image = NULL;
-  }
+  release_buffer();
 }
 
 bool  copy_of_image::read_pixel(int x, int y, double &result, unsigned rgb) const
@@ -459,7 +642,7 @@ bool  copy_of_image::read_pixel(int x, int y, double &result, unsigned rgb) cons
     result = 0.0;
     return false;
   }
-  result = _image[index(x, y, rgb)];
+  result = read_pixel_nocheck(x, y, rgb);
   return true;
 }
 
@@ -468,13 +651,127 @@ double	copy_of_image::read_pixel_nocheck(int x, int y, unsigned rgb) const
   if (_image == NULL) {
     return 0.0;
   }
-  return _image[index(x, y, rgb)];
+  switch (_type) {
+    case image_buffer_view::UINT8: return static_cast<const vrpn_uint8 *>(_image)[index(x, y, rgb)];
+    case image_buffer_view::UINT16: return static_cast<const vrpn_uint16 *>(_image)[index(x, y, rgb)];
+    case image_buffer_view::FLOAT: return static_cast<const float *>(_image)[index(x, y, rgb)];
+    default: return static_cast<const double *>(_image)[index(x, y, rgb)];
+  }
+}
+
+camera_frame_pool::camera_frame_pool(unsigned max_free) :
+  d_max_free(max_free), d_in_use(0), d_released(false), d_lock(1)
+{
+}
+
+camera_frame_pool::~camera_frame_pool()
+{
+  size_t i;
+  for (i = 0; i < d_free.size(); i++) {
+    delete d_free[i];
+  }
+  d_free.clear();
+}
+
+copy_of_image_buffer *camera_frame_pool::get_buffer(size_t bytes)
+{
+  // Reuse a free buffer of the right size if there is one; if not, drop
+  // the oldest free one (it is probably from a different image size) and
+  // make a new one.
+  copy_of_image_buffer *buffer = NULL;
+  d_lock.p();
+  size_t i;
+  for (i = 0; i < d_free.size(); i++) {
+    if (d_free[i]->bytes == bytes) {
+      buffer = d_free[i];
+      d_free.erase(d_free.begin() + i);
+      break;
+    }
+  }
+  if (buffer == NULL) {
+    if (d_free.size() >= d_max_free) {
+      delete d_free.front();
+      d_free.erase(d_free.begin());
+    }
+    buffer = new copy_of_image_buffer();
+    if (buffer == NULL) {
+      d_lock.v();
+      return NULL;
+    }
+    buffer->values = new double[(bytes + sizeof(double) - 1) / sizeof(double)];
+    if (buffer->values == NULL) {
+      delete buffer;
+      d_lock.v();
+      return NULL;
+    }
+    buffer->bytes = bytes;
+    buffer->pool = this;
+  }
+  buffer->refs = 1;
+  d_in_use++;
+  d_lock.v();
+  return buffer;
+}
+
+void camera_frame_pool::return_buffer(copy_of_image_buffer *buffer)
+{
+  d_lock.p();
+  d_in_use--;
+  if (d_released || (d_free.size() >= d_max_free)) {
+    delete buffer;
+  } else {
+    d_free.push_back(buffer);
+  }
+  bool done = d_released && (d_in_use == 0);
+  d_lock.v();
+  if (done) {
+    delete this;
+  }
+}
+
+void camera_frame_pool::release()
+{
+  d_lock.p();
+  d_released = true;
+  bool done = (d_in_use == 0);
+  d_lock.v();
+  if (done) {
+    delete this;
+  }
+}
+
+bool camera_frame::fill(const image_wrapper &image, camera_frame_pool *pool,
+                        int frame_number, const struct timeval &timestamp)
+{
+  _frame_number = frame_number;
+  _timestamp = timestamp;
+  copy_from(image, pool);
+  return _image != NULL;
+}
+
+bool base_camera_server::get_frame(camera_frame &frame, int frame_number)
+{
+  if (_frame_pool == NULL) {
+    if ( (_frame_pool = new camera_frame_pool()) == NULL) {
+      fprintf(stderr, "base_camera_server::get_frame(): Out of memory\n");
+      return false;
+    }
+  }
+  struct timeval now;
+  vrpn_gettimeofday(&now, NULL);
+  return frame.fill(*this, _frame_pool, frame_number, now);
 }
 
 subtracted_image::subtracted_image(const image_wrapper &first, const image_wrapper &second, const double offset) :
   _minx(-1), _maxx(-1), _miny(-1), _maxy(-1),
   _numx(-1), _numy(-1), _image(NULL), _numcolors(0)
 {
+  recompute(first, second, offset);
+}
+
+bool subtracted_image::recompute(const image_wrapper &first, const image_wrapper &second, const double offset)
+{
+  new_generation();
   // Check to make sure that the two images match.
   int minx, miny, maxx, maxy;
   first.read_range(minx, maxx, miny, maxy);
@@ -482,32 +779,38 @@ subtracted_image::subtracted_image(const image_wrapper &first, const image_wrapp
   second.read_range(minx2, maxx2, miny2, maxy2);
   if ( (first.get_num_colors() != second.get_num_colors()) ||
        (minx != minx2) || (miny != miny2) || (maxx != maxx2) || (maxy != maxy2) ) {
-    fprintf(stderr,"subtracted_image::subtracted_image(): Two images differ in dimension\n");
-    return;
+    fprintf(stderr,"subtracted_image::recompute(): Two images differ in dimension\n");
+    return false;
   }
 
-  // Get our image buffer
-  _minx = minx; _maxx = maxx; _miny = miny; _maxy = maxy;
-  _numx = (_maxx - _minx) + 1;
-  _numy = (_maxy - _miny) + 1;
-  _numcolors = first.get_num_colors();
-  _image = new float[_numx * _numy * get_num_colors()];
-  if (_image == NULL) {
-    _numx = _numy = _minx = _maxx = _miny = _maxy = _numcolors = 0;
-    fprintf(stderr,"subtracted_image::subtracted_image(): Out of memory\n");
-    return;
+  // Get our image buffer, unless the one we have is already the right size.
+  int numx = (maxx - minx) + 1;
+  int numy = (maxy - miny) + 1;
+  int numcolors = first.get_num_colors();
+  if ( (_image == NULL) || (numx * numy * numcolors != _numx * _numy * _numcolors) ) {
+    if (_image) { delete [] _image; }
+    _image = new float[numx * numy * numcolors];
+    if (_image == NULL) {
+      _numx = _numy = _minx = _maxx = _miny = _maxy = _numcolors = 0;
+      fprintf(stderr,"subtracted_image::recompute(): Out of memory\n");
+      return false;
+    }
   }
+  _minx = minx; _maxx = maxx; _miny = miny; _maxy = maxy;
+  _numx = numx; _numy = numy; _numcolors = numcolors;
 
-  // Subtract the values from the images, offsetting as we go
+  // Subtract the values from the images, offsetting as we go.  Go through
+  // in the order that pixels are stored in our buffer.
   int x, y;
   unsigned c;
-  for (x = _minx; x <= _maxx; x++) {
-    for (y = _miny; y <= _maxy; y++) {
+  for (y = _miny; y <= _maxy; y++) {
+    for (x = _minx; x <= _maxx; x++) {
       for (c = 0; c < get_num_colors(); c++) {
 	_image[index(x, y, c)] = static_cast<float>(first.read_pixel_nocheck(x, y, c) - second.read_pixel_nocheck(x, y, c) + offset);
       }
     }
   }
+  return true;
 }
 
 subtracted_image::~subtracted_image()
@@ -566,6 +869,12 @@ averaged_image::averaged_image(const image_wrapper &first, const image_wrapper &
   _minx(-1), _maxx(-1), _miny(-1), _maxy(-1),
   _numx(-1), _numy(-1), _image(NULL), _numcolors(0)
 {
+  recompute(first, second);
+}
+
+bool averaged_image::recompute(const image_wrapper &first, const image_wrapper &second)
+{
+  new_generation();
   // Check to make sure that the two images match.
   int minx, miny, maxx, maxy;
   first.read_range(minx, maxx, miny, maxy);
@@ -573,32 +882,37 @@ averaged_image::averaged_image(const image_wrapper &first, const image_wrapper &
   second.read_range(minx2, maxx2, miny2, maxy2);
   if ( (first.get_num_colors() != second.get_num_colors()) ||
        (minx != minx2) || (miny != miny2) || (maxx != maxx2) || (maxy != maxy2) ) {
-    fprintf(stderr,"averaged_image::averaged_image(): Two images differ in dimension\n");
-    return;
+    fprintf(stderr,"averaged_image::recompute(): Two images differ in dimension\n");
+    return false;
   }
 
-  // Get our image buffer
-  _minx = minx; _maxx = maxx; _miny = miny; _maxy = maxy;
-  _numx = (_maxx - _minx) + 1;
-  _numy = (_maxy - _miny) + 1;
-  _numcolors = first.get_num_colors();
-  _image = new double[_numx * _numy * get_num_colors()];
-  if (_image == NULL) {
-    _numx = _numy = _minx = _maxx = _miny = _maxy = _numcolors = 0;
-    fprintf(stderr,"averaged_image::averaged_image(): Out of memory\n");
-    return;
+  // Get our image buffer, unless the one we have is already the right size.
+  int numx = (maxx - minx) + 1;
+  int numy = (maxy - miny) + 1;
+  int numcolors = first.get_num_colors();
+  if ( (_image == NULL) || (numx * numy * numcolors != _numx * _numy * _numcolors) ) {
+    if (_image) { delete [] _image; }
+    _image = new double[numx * numy * numcolors];
+    if (_image == NULL) {
+      _numx = _numy = _minx = _maxx = _miny = _maxy = _numcolors = 0;
+      fprintf(stderr,"averaged_image::recompute(): Out of memory\n");
+      return false;
+    }
   }
+  _minx = minx; _maxx = maxx; _miny = miny; _maxy = maxy;
+  _numx = numx; _numy = numy; _numcolors = numcolors;
 
-  // Average the values from the images, offsetting as we go
+  // Average the values from the images, in the order they are stored.
   int x, y;
   unsigned c;
-  for (x = _minx; x <= _maxx; x++) {
-    for (y = _miny; y <= _maxy; y++) {
+  for (y = _miny; y <= _maxy; y++) {
+    for (x = _minx; x <= _maxx; x++) {
       for (c = 0; c < get_num_colors(); c++) {
 	_image[index(x, y, c)] = ( first.read_pixel_nocheck(x, y, c) + second.read_pixel_nocheck(x, y, c) ) / 2;
       }
     }
   }
+  return true;
 }
 
 averaged_image::~averaged_image()
@@ -11,6 +11,7 @@
 #include  <string>
 #include  <vector>
 #include  <vrpn_Types.h>
+#include  <vrpn_Shared.h>   // For struct timeval
 #include  <vrpn_Connection.h>
 #include  <vrpn_Imager.h>
 
@@ -20,6 +21,71 @@
 #include  <GL/gl.h>
 #endif
 
+//----------------------------------------------------------------------------
+// Describes the in-memory pixel buffer behind an image, for those images that
+// have one.  It lets inner loops (the spot-tracker fitness functions, for
+// example) read pixels with a direct pointer dereference rather than through a
+// chain of virtual read_pixel() calls.  The element for pixel (x,y) and color
+// rgb is found at
+//    base[(x - minx) * x_stride + (y - miny) * y_stride + rgb]
+// where the strides are in elements (not bytes) and y_stride may be negative
+// for images that are stored bottom-up.  Only pixels within [minx..maxx] and
+// [miny..maxy] may be read.  A view is valid only until the image it came from
+// is changed (a new frame read, pixels written, or the image destroyed).
+
+class image_buffer_view {
+public:
+  enum pixel_type { NONE, UINT8, UINT16, FLOAT, DOUBLE };
+
+  image_buffer_view() : base(NULL), type(NONE), x_stride(0), y_stride(0),
+    minx(0), maxx(-1), miny(0), maxy(-1), num_colors(0) {};
+
+  const void  *base;                //< Points to color 0 of pixel (minx, miny)
+  pixel_type  type;                 //< What type of element base points to
+  int         x_stride, y_stride;   //< Elements between neighbors in X and Y
+  int         minx, maxx, miny, maxy;  //< Range of pixels that can be read
+  unsigned    num_colors;           //< Number of colors stored per pixel
+
+  // Pointer to the element holding the requested pixel, cast to the type
+  // of the buffer.  Does not check boundaries.
+  template <class T> inline const T *pixel(int x, int y, unsigned rgb) const {
+    return static_cast<const T*>(base) + (x - minx) * x_stride + (y - miny) * y_stride + rgb;
+  }
+};
+
+// Bilinear interpolation directly from a buffer view whose elements have type T.
+// This performs the same math in the same order as
+// image_wrapper::read_pixel_bilerp() below, so it returns identical results
+// for the same image, just without the virtual calls to fetch each pixel.
+// Return a result of zero and false if the coordinate its outside the image.
+template <class T>
+inline bool image_buffer_bilerp(const image_buffer_view &view, double x, double y,
+                                double &result, unsigned rgb = 0)
+{
+  result = 0;	// In case of failure.
+  double xlow = floor(x); int ixlow = (int)xlow;
+  double ylow = floor(y); int iylow = (int)ylow;
+  if ( (ixlow < view.minx) || (ixlow+1 > view.maxx) ||
+       (iylow < view.miny) || (iylow+1 > view.maxy) ) {
+    return false;
+  }
+  double xhighfrac = x - xlow;
+  double yhighfrac = y - ylow;
+  double xlowfrac = 1.0 - xhighfrac;
+  double ylowfrac = 1.0 - yhighfrac;
+
+  const T *p = view.pixel<T>(ixlow, iylow, rgb);
+  double ll = p[0];
+  double lh = p[view.y_stride];
+  double hl = p[view.x_stride];
+  double hh = p[view.x_stride + view.y_stride];
+  result = ll * xlowfrac * ylowfrac +
+	   lh * xlowfrac * yhighfrac +
+	   hl * xhighfrac * ylowfrac +
+	   hh * xhighfrac * yhighfrac;
+  return true;
+}
+
 //----------------------------------------------------------------------------
 // This class forms a basic wrapper for an image.  It treats an image as anything
 // which can support requests on the number of pixels in an image and can
@@ -30,11 +96,16 @@
 // better may be to implement functions that wrap the functions we need to
 // have be fast (like writing to a GL_LUMINANCE OpenGL texture).
 
+// Returns a different value each time it is called (from any thread); these
+// are used as image generation stamps.
+unsigned long image_wrapper_next_generation(void);
+
 class image_wrapper {
 public:
 
   image_wrapper() : _opengl_texture_size_x(0), _opengl_texture_size_y(0),
-    _opengl_texture_have_written(false), _tex_id(65000) {};
+    _opengl_texture_have_written(false), _tex_id(65000),
+    _generation(image_wrapper_next_generation()) {};
 
   // Virtual destructor so that children can de-allocate space as needed.
   virtual ~image_wrapper() {};
@@ -44,6 +115,14 @@ public:
 
   /// Return the number of colors that the image has
   virtual unsigned  get_num_colors() const = 0;
+
+  /// Stamp that is different for each image and that changes when an image
+  // is refilled in place by recompute() and the like, so that results cached
+  // from an image can tell when it has changed.  Images that are changed one
+  // write_pixel() at a time do not get a new stamp.
+  unsigned long get_generation(void) const { return _generation; }
+  void  new_generation(void) { _generation = image_wrapper_next_generation(); }
+
   //XXX These should return the maximum number of possible rows/columns,
   // like the ones in the camera server do.
   virtual unsigned  get_num_rows(void) const { 
@@ -144,6 +223,12 @@ public:
 	   read_pixel_nocheck(ixhigh, iyhigh, rgb) * xhighfrac * yhighfrac;
   };
 
+  /// Describe the raw pixel buffer behind this image, if it has one.
+  // Returns false for images that compute their pixels on the fly (transformed
+  // or synthetic images); callers must then use the read_pixel() methods.
+  // The values read through the view must match those from read_pixel().
+  virtual bool  get_buffer_view(image_buffer_view &view) const { return false; };
+
   /// Store the memory image to a PGM file.
   virtual bool  write_to_pgm_file(const char *filename, unsigned channel = 0, double gain = 1, bool sixteen_bits = false) const;
 
@@ -194,6 +279,7 @@ protected:
   unsigned  _opengl_texture_size_x;
   unsigned  _opengl_texture_size_y;
   unsigned  _opengl_texture_have_written;
+  unsigned long _generation;   //< See get_generation()
 
   // Write the texture to OpenGL, where we've parameterized all of the
   // things we need to tell about the process.  Each derived class should
@@ -221,6 +307,25 @@ double image_wrapper_sum(const image_wrapper &img, unsigned rgb = 0);
 // (defaults to the first) in an image.
 double image_wrapper_square_sum(const image_wrapper &img, unsigned rgb = 0);
 
+//----------------------------------------------------------------------------
+// The two halves of image_wrapper::write_to_tiff_file() and
+// write_to_grayscale_tiff_file(), split so that the pixels can be prepared
+// in one place (a worker thread, for example) and written in another.
+
+// Fill a buffer with the pixels of an image, scaled, offset, and clamped to
+// 16 bits, with the rows flipped into the top-down order used by TIFF files.
+// A channel less than zero stores the first three colors interleaved; other
+// channels store just that color.  Returns false if the image is empty.
+bool  image_wrapper_fill_tiff_buffer(const image_wrapper &img, int channel, double scale, double offset,
+                                     std::vector<vrpn_uint16> &buffer, int &numcols, int &numrows);
+
+// Write a buffer filled in by the above function (with 1 or 3 colors) to a
+// TIFF file using ImageMagick.  8-bit files get the high byte of each value.
+bool  image_wrapper_write_tiff_buffer(const char *filename, const vrpn_uint16 *buffer,
+                                      int numcols, int numrows, unsigned num_colors, bool sixteen_bits,
+                                      const char *magick_files_dir = "C:/nsrg/external/pc_win32/bin/ImageMagick-5.5.7-Q16/MAGIC_DIR_PATH",
+                                      bool skip_init = false);
+
 //----------------------------------------------------------------------------
 // Concrete version of above virtual base class that stores a single-color
 // image in double-precision floating-point values.  Also includes methods for
@@ -231,6 +336,11 @@ public:
   double_image(int minx = 0, int maxx = 255, int miny = 0, int maxy = 255);
   ~double_image();
 
+  // Change the range of the image.  The buffer is only reallocated if the
+  // number of pixels changes.  The pixel values are undefined afterwards.
+  // Returns false (leaving an empty image) on bad coordinates or out of memory.
+  bool  resize(int minx, int maxx, int miny, int maxy);
+
   // Tell what the range is for the image.
   virtual void	read_range(int &minx, int &maxx, int &miny, int &maxy) const;
 
@@ -263,6 +373,16 @@ public:
     _image[(x-_minx) + (y-_miny)*(_maxx-_minx+1)] = value;
   };
 
+  // Hand out a pointer to our buffer so that trackers can read it directly.
+  virtual bool  get_buffer_view(image_buffer_view &view) const {
+    if (_image == NULL) { return false; }
+    view.base = _image; view.type = image_buffer_view::DOUBLE;
+    view.x_stride = 1; view.y_stride = _maxx-_minx+1;
+    view.minx = _minx; view.maxx = _maxx; view.miny = _miny; view.maxy = _maxy;
+    view.num_colors = 1;
+    return true;
+  }
+
 protected:
   int	  _minx, _maxx, _miny, _maxy;
   double  *_image;
@@ -288,6 +408,12 @@ public:
   float_image(int minx = 0, int maxx = 255, int miny = 0, int maxy = 255);
   ~float_image();
 
+  // Change the range of the image.  The buffer is only reallocated if the
+  // number of pixels changes, so images that are recomputed every frame
+  // can reuse it.  The pixel values are undefined afterwards.  Returns
+  // false (leaving an empty image) on bad coordinates or out of memory.
+  bool  resize(int minx, int maxx, int miny, int maxy);
+
   // Tell what the range is for the image.
   virtual void	read_range(int &minx, int &maxx, int &miny, int &maxy) const;
 
@@ -324,6 +450,16 @@ public:
   // camera type.
   virtual bool write_to_opengl_texture(GLuint tex_id);
 
+  // Hand out a pointer to our buffer so that trackers can read it directly.
+  virtual bool  get_buffer_view(image_buffer_view &view) const {
+    if (_image == NULL) { return false; }
+    view.base = _image; view.type = image_buffer_view::FLOAT;
+    view.x_stride = 1; view.y_stride = _maxx-_minx+1;
+    view.minx = _minx; view.maxx = _maxx; view.miny = _miny; view.maxy = _maxy;
+    view.num_colors = 1;
+    return true;
+  }
+
 protected:
   int	  _minx, _maxx, _miny, _maxy;
   float  *_image;
@@ -341,14 +477,26 @@ protected:
 
 //----------------------------------------------------------------------------
 // Concrete version of above virtual base class that creates itself by copying
-// from an existing image.
+// from an existing image.  When the source hands out a buffer view, the copy
+// keeps the source's pixel type and color layout (so a 16-bit camera frame is
+// stored in 16 bits rather than as doubles) and is filled a row at a time,
+// using memcpy() when the source's pixels are packed.  Other sources are
+// copied as doubles through read_pixel().  Copying one copy_of_image from
+// another shares the pixels rather than duplicating them; the shared buffer
+// is only duplicated if one of them is then refilled.  The sharing count is
+// changed atomically, so copies that share pixels can be made, refilled, and
+// destroyed on different threads; each copy_of_image object itself should
+// only be changed by one thread at a time.
+
+class copy_of_image_buffer;
+class camera_frame_pool;
 
 class copy_of_image: public image_wrapper {
 public:
   copy_of_image(const image_wrapper &copyfrom);
   ~copy_of_image();
 
-  // Override the default copy constructor so that it calls the above, deep copy.
+  // Override the default copy constructor so that it shares the pixels.
   copy_of_image(const copy_of_image &copyfrom);
 
   // Tell what the range is for the image.
@@ -367,23 +515,139 @@ public:
   /// Read a pixel from the image into a double; Don't check boundaries.
   virtual double read_pixel_nocheck(int x, int y, unsigned rgb = 0) const;
 
+  // Hand out a pointer to our buffer so that trackers can read it directly.
+  virtual bool  get_buffer_view(image_buffer_view &view) const {
+    if (_image == NULL) { return false; }
+    view.base = _image; view.type = _type;
+    view.x_stride = _numcolors; view.y_stride = _numcolors * _numx;
+    view.minx = _minx; view.maxx = _maxx; view.miny = _miny; view.maxy = _maxy;
+    view.num_colors = _numcolors;
+    return true;
+  }
+
+  /// Type of the values stored in the copy.
+  image_buffer_view::pixel_type pixel_type() const { return _type; }
+
   /// Copy new values from the image that is passed in, reallocating if needed
   void	operator= (const image_wrapper &copyfrom);
 
-  // Override default copy behavior to avoid shallow copy
-  const copy_of_image &operator= (const copy_of_image &copyfrom) { *this = (const image_wrapper &)copyfrom; return *this; }
+  // Share the pixels of another copy rather than copying them.
+  const copy_of_image &operator= (const copy_of_image &copyfrom);
 
 protected:
   int _minx, _maxx, _miny, _maxy;   //< Coordinates for the pixels (copied from other image)
   int _numx, _numy;		    //< Calculated based on the above min/max values
   int _numcolors;		    //< How many colors do we have
-  double  *_image;		    //< Holds the values copied from the other image
+  image_buffer_view::pixel_type _type;  //< Type of the values in _image
+  copy_of_image_buffer *_buffer;    //< Holds the values, possibly shared with other copies
+  const void  *_image;		    //< Points to the values in _buffer
+
+  // Empty image, for derived classes that fill themselves in later.
+  copy_of_image();
 
   inline int index(int x, int y, unsigned rgb) const {
     int xindex = x - _minx;
     int yindex = y - _miny;
-    return rgb + get_num_colors() * (xindex + _numx * yindex);
+    return rgb + _numcolors * (xindex + _numx * yindex);
   };
+
+  // Copy the image, getting a new buffer (if one is needed) from the pool
+  // or, if the pool is NULL, allocating it.
+  void  copy_from(const image_wrapper &copyfrom, camera_frame_pool *pool);
+
+  // Make sure that we have a buffer of our own of the right size and type
+  // for the specified image, dropping our reference to any shared one.
+  bool  make_buffer(int minx, int maxx, int miny, int maxy,
+                    int numcolors, image_buffer_view::pixel_type type,
+                    camera_frame_pool *pool);
+  void  release_buffer();
+};
+
+//----------------------------------------------------------------------------
+// Recycles the pixel buffers used by camera_frame objects, so that a camera
+// that hands out a new frame each time it reads one does not allocate
+// memory once enough buffers are circulating.  A buffer comes back to the
+// pool when the last frame using it lets go of it, and up to max_free of
+// them are kept for reuse.  The pool belongs to the camera that made it;
+// it stays around after the camera is deleted until the last of its frames
+// is gone.  Frames sharing a buffer may be let go of on different threads,
+// so the pool locks its lists.
+
+class camera_frame_pool {
+public:
+  camera_frame_pool(unsigned max_free = 8);
+
+  /// Get a buffer that holds the specified number of bytes, or NULL if
+  // there is no memory for one.  The caller holds the only reference.
+  copy_of_image_buffer  *get_buffer(size_t bytes);
+
+  /// Take back a buffer that nobody is using any more.
+  void  return_buffer(copy_of_image_buffer *buffer);
+
+  /// Called by the owner when it no longer needs the pool; the pool
+  // deletes itself once all of its buffers have come back.
+  void  release();
+
+  /// Number of buffers that are in use by frames.
+  unsigned  num_in_use() const { return d_in_use; }
+
+  /// Number of buffers waiting to be reused.
+  unsigned  num_free() const { return static_cast<unsigned>(d_free.size()); }
+
+protected:
+  std::vector<copy_of_image_buffer *> d_free;  //< Buffers waiting to be reused
+  unsigned  d_max_free;     //< Most buffers to keep for reuse
+  unsigned  d_in_use;       //< Buffers handed out and not yet returned
+  bool      d_released;     //< The owner is done with us
+  vrpn_Semaphore  d_lock;   //< Protects the values above
+
+  ~camera_frame_pool();     //< Use release() rather than deleting
+
+private:
+  // Not copyable.
+  camera_frame_pool(const camera_frame_pool &);
+  camera_frame_pool &operator=(const camera_frame_pool &);
+};
+
+//----------------------------------------------------------------------------
+// A frame read from a camera (see base_camera_server::get_frame()), along
+// with which frame it was and when it was read.  Frames are never changed
+// once they are filled in, so copying one just adds a reference to its
+// pixels; a consumer can keep the last N frames for the cost of the frames
+// themselves.  The pixels go back to the camera's pool when the last copy
+// is deleted or refilled.
+
+class camera_frame: public copy_of_image {
+public:
+  camera_frame() : _frame_number(-1) { _timestamp.tv_sec = 0; _timestamp.tv_usec = 0; };
+  camera_frame(const camera_frame &copyfrom) : copy_of_image(), _frame_number(-1) {
+    *this = copyfrom;
+  }
+
+  /// Share the pixels and information of another frame.
+  const camera_frame &operator= (const camera_frame &copyfrom) {
+    copy_of_image::operator=(copyfrom);
+    _frame_number = copyfrom._frame_number;
+    _timestamp = copyfrom._timestamp;
+    return *this;
+  }
+
+  /// Does this frame hold an image?
+  bool  valid() const { return _image != NULL; }
+
+  /// Frame number that was passed in when the frame was filled in.
+  int   frame_number() const { return _frame_number; }
+
+  /// When the frame was filled in.
+  const struct timeval &timestamp() const { return _timestamp; }
+
+  /// Fill in the frame by copying the image into a buffer from the pool.
+  bool  fill(const image_wrapper &image, camera_frame_pool *pool,
+             int frame_number, const struct timeval &timestamp);
+
+protected:
+  int             _frame_number;  //< Which frame this is
+  struct timeval  _timestamp;     //< When it was read
 };
 
 //----------------------------------------------------------------------------
@@ -584,6 +848,11 @@ public:
   subtracted_image(const image_wrapper &first, const image_wrapper &second, const double offset);
   ~subtracted_image();
 
+  // Recompute from a new pair of images, reusing the buffer if the size
+  // and number of colors have not changed.  Returns false if the images
+  // differ in dimension or we run out of memory.
+  bool  recompute(const image_wrapper &first, const image_wrapper &second, const double offset);
+
   // Tell what the range is for the image.
   virtual void read_range(int &minx, int &maxx, int &miny, int &maxy) const {
     minx = _minx; miny = _miny; maxx = _maxx; maxy = _maxy;
@@ -627,6 +896,11 @@ public:
   averaged_image(const image_wrapper &first, const image_wrapper &second);
   ~averaged_image();
 
+  // Recompute from a new pair of images, reusing the buffer if the size
+  // and number of colors have not changed.  Returns false if the images
+  // differ in dimension or we run out of memory.
+  bool  recompute(const image_wrapper &first, const image_wrapper &second);
+
   // Tell what the range is for the image.
   virtual void read_range(int &minx, int &maxx, int &miny, int &maxy) const {
     minx = _minx; miny = _miny; maxx = _maxx; maxy = _maxy;
@@ -759,7 +1033,9 @@ protected:
 
 class base_camera_server : public image_wrapper {
 public:
-  virtual ~base_camera_server(void) {};
+  virtual ~base_camera_server(void) {
+    if (_frame_pool) { _frame_pool->release(); _frame_pool = NULL; }
+  };
 
   /// Is the camera working properly?
   bool working(void) const { return _status; };
@@ -821,14 +1097,31 @@ public:
   // Require all cameras to implement this function.
   virtual bool write_to_opengl_texture(GLuint tex_id) = 0;
 
+  /// Store the image that is in memory into a frame whose pixels come from
+  // a pool kept by the camera, tagging it with the frame number passed in
+  // and the current time.  Copies of the frame share its pixels, and later
+  // reads into memory do not change it.  Returns false if out of memory.
+  bool  get_frame(camera_frame &frame, int frame_number);
+
+  /// Read an image to memory (see read_image_to_memory()) and then store it
+  // into a frame (see get_frame()).  Returns false if either fails.
+  bool  read_frame(camera_frame &frame, int frame_number,
+                   unsigned minX = 255, unsigned maxX = 0,
+                   unsigned minY = 255, unsigned maxY = 0,
+                   double exposure_time = 250.0) {
+    return read_image_to_memory(minX, maxX, minY, maxY, exposure_time) &&
+           get_frame(frame, frame_number);
+  }
+
 protected:
   bool	    _status;			//< True is working, false is not
   unsigned  _num_rows, _num_columns;    //< Size of the memory buffer
   unsigned  _minX, _minY, _maxX, _maxY; //< Region of the image in memory
   unsigned  _binning;			//< How many camera pixels compressed into image pixel
+  camera_frame_pool *_frame_pool;	//< Buffers for get_frame(), made when first needed
 
   virtual bool	open_and_find_parameters(void) {return false;};
-  base_camera_server(unsigned binning = 1) {
+  base_camera_server(unsigned binning = 1) : _frame_pool(NULL) {
     _binning = binning;
     if (_binning < 1) { _binning = 1; }
   };
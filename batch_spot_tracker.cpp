@@ -0,0 +1,333 @@
+// Tracks spots in one or more video files without a GUI or Tcl, writing the
+// results for each to a .csv file in the same format as video_spot_tracker.
+// It uses the Tracking_Engine from the spot tracker library, so it runs
+// through the frames as fast as they can be read and tracked.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "image_wrapper.h"
+#include "tracking_engine.h"
+#ifdef	_WIN32
+#include <windows.h>
+#endif
+#include <vrpn_Types.h>
+#include <vrpn_FileConnection.h>
+// This pragma tells the compiler not to tell us about truncated debugging info
+// due to name expansion within the string, list, and vector classes.
+#pragma warning( disable : 4786 4995 )
+#include <vector>
+using namespace std;
+#include "controllable_video.h"
+
+//--------------------------------------------------------------------------
+// Version string for this program
+const char *Version_string = "01.00";
+
+//--------------------------------------------------------------------------
+// Global state
+
+base_camera_server  *g_camera = NULL;		  //< Camera used to get an image
+Controllable_Video  *g_video = NULL;		  //< Video controls, if we have them
+unsigned            g_bitdepth = 8;               //< Bit depth of the input image
+float               g_exposure = 0;               //< Exposure for live camera
+int                 g_max_frames = -1;            //< How many frames to track at most?
+unsigned            g_pipeline_depth = 4;         //< Frames in flight when pipelined (0 for not)
+bool                g_print_statistics = false;   //< Print how busy each pipeline stage was?
+
+Tracking_Engine_Settings  g_settings;             //< How to track
+bool                g_invert = false;             //< Look for dark spots?
+double              g_precision = 0.05;           //< Precision of the optimization
+double              g_sampleSpacing = 1;          //< Spacing of kernel samples
+double              g_FIONA_background = 0;       //< Starting background for FIONA
+double              g_Radius = 5;                 //< Radius of new trackers
+bool                g_enable_internal_values = false; //< Log region size and sensitivity?
+
+// Trackers that are placed in each video before it starts.
+typedef struct { double x, y, r; } Initial_Tracker;
+vector<Initial_Tracker> g_initial_trackers;
+
+/// Create a new tracker of the type specified on the command line.
+// Returns NULL on failure.
+spot_tracker_XY  *create_batch_xytracker(double x, double y, double r)
+{
+  spot_tracker_XY *tracker = NULL;
+
+  switch (g_settings.kernel_type) {
+    case KT_FIONA:
+      tracker = new FIONA_spot_tracker(r, g_invert, g_precision, 0.1, g_sampleSpacing, g_FIONA_background, 100);
+      break;
+    case KT_SYMMETRIC:
+      tracker = new symmetric_spot_tracker_interp(r, g_invert, g_precision, 0.1, g_sampleSpacing);
+      break;
+    case KT_CONE:
+      tracker = new cone_spot_tracker_interp(r, g_invert, g_precision, 0.1, g_sampleSpacing);
+      break;
+    default:
+      tracker = new disk_spot_tracker_interp(r, g_invert, g_precision, 0.1, g_sampleSpacing);
+      break;
+  }
+
+  if (tracker != NULL) {
+    tracker->set_location(x,y);
+    tracker->set_radius(r);
+  } else {
+    fprintf(stderr,"create_batch_xytracker(): Out of memory\n");
+  }
+  return tracker;
+}
+
+// Track all of the frames in the named video, writing the results to
+// a .csv file whose name is the video name with .csv added.  Returns
+// true on success.
+static bool track_video(const char *device_name)
+{
+  //------------------------------------------------------------------
+  // Open the camera.  If we have a video file, then press play.
+  if (!get_camera(device_name, &g_bitdepth, &g_exposure, &g_camera, &g_video,
+                  648,484,1,0,0)) {
+    fprintf(stderr,"Cannot open camera/imager %s\n", device_name);
+    return false;
+  }
+  if (!g_camera->working()) {
+    fprintf(stderr,"Could not establish connection to camera %s\n", device_name);
+    return false;
+  }
+  if (g_video) {
+    g_video->play();
+  }
+
+  //------------------------------------------------------------------
+  // If the device name included "file:" then we should only use
+  // the portion after that when naming the output file.
+  const char *base = strstr(device_name, "file://");
+  if (base) {
+    base += strlen("file://");
+  } else if ( (base = strstr(device_name, "file:")) != NULL) {
+    base += strlen("file:");
+  } else {
+    base = device_name;
+  }
+  char  *filename = new char[strlen(base) + 5];
+  if (filename == NULL) {
+    fprintf(stderr, "Out of memory!\n");
+    return false;
+  }
+  sprintf(filename, "%s.csv", base);
+  printf("Tracking %s into %s\n", device_name, filename);
+
+  Tracking_CSV_Sink csv(filename, g_settings, g_enable_internal_values);
+  delete [] filename;
+  if (!csv.working()) {
+    return false;
+  }
+
+  //------------------------------------------------------------------
+  // Place the starting trackers and run the whole video.
+  Tracker_Collection_Manager  trackers(static_cast<float>(g_Radius), 30, 20, 0.0,
+                                       g_settings.color_index, g_invert,
+                                       create_batch_xytracker);
+  size_t i;
+  for (i = 0; i < g_initial_trackers.size(); i++) {
+    trackers.add_tracker(g_initial_trackers[i].x, g_initial_trackers[i].y, g_initial_trackers[i].r);
+  }
+
+  Tracking_Engine engine(trackers, g_settings);
+  engine.add_sink(&csv);
+  Camera_Frame_Source source(g_camera, g_exposure);
+  bool ret;
+  if (g_pipeline_depth) {
+    ret = engine.run_pipelined(source, g_max_frames, g_pipeline_depth);
+    if (g_print_statistics) {
+      engine.pipeline_statistics().print(stdout);
+    }
+  } else {
+    ret = engine.run(source, g_max_frames);
+  }
+  printf("Tracked %d frames\n", engine.frame_number() + 1);
+  return ret;
+}
+
+void Usage(const char *s)
+{
+    fprintf(stderr, "Usage: %s [-kernel disc|cone|symmetric|FIONA] [-dark_spot] [-radius R]\n", s);
+    fprintf(stderr, "           [-tracker X Y R]* [-precision P] [-sample_spacing S] [-FIONA_background B]\n");
+    fprintf(stderr, "           [-lost_behavior B] [-lost_tracking_sensitivity L] [-intensity_lost_sensitivity L]\n");
+    fprintf(stderr, "           [-blur_lost_and_found B] [-center_surround S]\n");
+    fprintf(stderr, "           [-dead_zone_around_border D] [-dead_zone_around_trackers D]\n");
+    fprintf(stderr, "           [-maintain_this_many_beads N] [-candidate_spot_threshold T] [-sliding_window_radius R]\n");
+    fprintf(stderr, "           [-maintain_fluorescent_beads N] [-fluorescent_spot_threshold T]\n");
+    fprintf(stderr, "           [-fluorescent_max_regions N] [-fluorescent_max_region_size N]\n");
+    fprintf(stderr, "           [-check_bead_count_interval N] [-first_frame_autofind]\n");
+    fprintf(stderr, "           [-search_radius R] [-search_pyramid_levels N] [-predict] [-parabolafit] [-fast_optimizer]\n");
+    fprintf(stderr, "           [-fft_search] [-enable_internal_values]\n");
+    fprintf(stderr, "           [-pipeline depth] [-statistics] [-f num] filename [filename...]\n");
+    fprintf(stderr, "       -kernel: Use kernels of the specified type (default symmetric)\n");
+    fprintf(stderr, "       -dark_spot: Track a dark spot (default is bright spot)\n");
+    fprintf(stderr, "       -radius: Radius of automatically-found trackers (default 5)\n");
+    fprintf(stderr, "       -tracker: Start a tracker at X,Y with radius R in every file\n");
+    fprintf(stderr, "       -lost_behavior: 0 stops, 1 deletes lost trackers, 2 makes them hover (default 0)\n");
+    fprintf(stderr, "       -search_pyramid_levels: Do the -search_radius search coarse-to-fine over N levels (default 0, every pixel)\n");
+    fprintf(stderr, "       -fft_search: Do the -search_radius search by FFT correlation (ignored with pyramid levels)\n");
+    fprintf(stderr, "       -fast_optimizer: Levenberg-Marquardt fit for FIONA, Newton steps for symmetric kernels\n");
+    fprintf(stderr, "       -pipeline: Read, track, and log on separate threads with this many frames\n");
+    fprintf(stderr, "                  in flight (default 4, 0 to do everything on one thread)\n");
+    fprintf(stderr, "       -statistics: Print how busy each pipeline stage was\n");
+    fprintf(stderr, "       -f: Track at most this many frames per file (default all)\n");
+    fprintf(stderr, "       The other arguments are as for video_spot_tracker\n");
+    fprintf(stderr, "       The results for each file are stored in filename.csv\n");
+    exit(-1);
+}
+
+//--------------------------------------------------------------------------
+
+int main(int argc, char *argv[])
+{
+  //------------------------------------------------------------------
+  // VRPN state setting so that we don't try to preload a video file
+  // when it is opened, which wastes time.  Also tell it not to
+  // accumulate messages, which can cause us to run out of memory.
+  vrpn_FILE_CONNECTIONS_SHOULD_PRELOAD = false;
+  vrpn_FILE_CONNECTIONS_SHOULD_ACCUMULATE = false;
+
+  //---------------------------------------------------------------
+  // Parse the command line, handling video files as we go.
+  int	i, realparams;		  // How many non-flag command-line arguments
+  realparams = 0;
+  int failures = 0;
+  for (i = 1; i < argc; i++) {
+    if (!strncmp(argv[i], "-kernel", strlen("-kernel"))) {
+      if (++i >= argc) { Usage(argv[0]); }
+      if (!strncmp(argv[i], "disc", strlen("disc"))) {
+        g_settings.kernel_type = KT_DISK;
+      } else if (!strncmp(argv[i], "cone", strlen("cone"))) {
+        g_settings.kernel_type = KT_CONE;
+      } else if (!strncmp(argv[i], "symmetric", strlen("symmetric"))) {
+        g_settings.kernel_type = KT_SYMMETRIC;
+      } else if (!strncmp(argv[i], "FIONA", strlen("FIONA"))) {
+        g_settings.kernel_type = KT_FIONA;
+      } else {
+        Usage(argv[0]);
+      }
+    } else if (!strncmp(argv[i], "-dark_spot", strlen("-dark_spot"))) {
+      g_invert = true;
+    } else if (!strncmp(argv[i], "-precision", strlen("-precision"))) {
+      if (++i >= argc) { Usage(argv[0]); }
+      g_precision = atof(argv[i]);
+    } else if (!strncmp(argv[i], "-sample_spacing", strlen("-sample_spacing"))) {
+      if (++i >= argc) { Usage(argv[0]); }
+      g_sampleSpacing = atof(argv[i]);
+    } else if (!strncmp(argv[i], "-FIONA_background", strlen("-FIONA_background"))) {
+      if (++i >= argc) { Usage(argv[0]); }
+      g_FIONA_background = atof(argv[i]);
+    } else if (!strncmp(argv[i], "-tracker", strlen("-tracker"))) {
+      Initial_Tracker t;
+      if (++i >= argc) { Usage(argv[0]); }
+      t.x = atof(argv[i]);
+      if (++i >= argc) { Usage(argv[0]); }
+      t.y = atof(argv[i]);
+      if (++i >= argc) { Usage(argv[0]); }
+      t.r = atof(argv[i]);
+      g_initial_trackers.push_back(t);
+    } else if (!strncmp(argv[i], "-lost_tracking_sensitivity", strlen("-lost_tracking_sensitivity"))) {
+      if (++i >= argc) { Usage(argv[0]); }
+      g_settings.loss_sensitivity = atof(argv[i]);
+    } else if (!strncmp(argv[i], "-blur_lost_and_found", strlen("-blur_lost_and_found"))) {
+      if (++i >= argc) { Usage(argv[0]); }
+      g_settings.blur_lost_and_found = atof(argv[i]);
+    } else if (!strncmp(argv[i], "-center_surround", strlen("-center_surround"))) {
+      if (++i >= argc) { Usage(argv[0]); }
+      g_settings.surround_lost_and_found = atof(argv[i]);
+    } else if (!strncmp(argv[i], "-intensity_lost_sensitivity", strlen("-intensity_lost_sensitivity"))) {
+      if (++i >= argc) { Usage(argv[0]); }
+      g_settings.intensity_loss_sensitivity = atof(argv[i]);
+    } else if (!strncmp(argv[i], "-dead_zone_around_border", strlen("-dead_zone_around_border"))) {
+      if (++i >= argc) { Usage(argv[0]); }
+      g_settings.border_dead_zone = atof(argv[i]);
+    } else if (!strncmp(argv[i], "-dead_zone_around_trackers", strlen("-dead_zone_around_trackers"))) {
+      if (++i >= argc) { Usage(argv[0]); }
+      g_settings.tracker_dead_zone = atof(argv[i]);
+    } else if (!strncmp(argv[i], "-first_frame_autofind", strlen("-first_frame_autofind"))) {
+      g_settings.first_frame_only_autofind = true;
+    } else if (!strncmp(argv[i], "-maintain_fluorescent_beads", strlen("-maintain_fluorescent_beads"))) {
+      if (++i >= argc) { Usage(argv[0]); }
+      g_settings.find_fluorescent_beads = atoi(argv[i]);
+    } else if (!strncmp(argv[i], "-fluorescent_max_regions", strlen("-fluorescent_max_regions"))) {
+      if (++i >= argc) { Usage(argv[0]); }
+      g_settings.fluorescent_max_regions = atoi(argv[i]);
+    } else if (!strncmp(argv[i], "-fluorescent_max_region_size", strlen("-fluorescent_max_region_size"))) {
+      if (++i >= argc) { Usage(argv[0]); }
+      g_settings.fluorescent_max_region_size = atoi(argv[i]);
+    } else if (!strncmp(argv[i], "-fluorescent_spot_threshold", strlen("-fluorescent_spot_threshold"))) {
+      if (++i >= argc) { Usage(argv[0]); }
+      g_settings.fluorescent_spot_threshold = atof(argv[i]);
+    } else if (!strncmp(argv[i], "-maintain_this_many_beads", strlen("-maintain_this_many_beads"))) {
+      if (++i >= argc) { Usage(argv[0]); }
+      g_settings.find_brightfield_beads = atoi(argv[i]);
+    } else if (!strncmp(argv[i], "-candidate_spot_threshold", strlen("-candidate_spot_threshold"))) {
+      if (++i >= argc) { Usage(argv[0]); }
+      g_settings.candidate_spot_threshold = atof(argv[i]);
+    } else if (!strncmp(argv[i], "-lost_behavior", strlen("-lost_behavior"))) {
+      if (++i >= argc) { Usage(argv[0]); }
+      int behavior = atoi(argv[i]);
+      if ( (behavior < 0) || (behavior > 2) ) { Usage(argv[0]); }
+      g_settings.lost_behavior = static_cast<Tracking_Engine_Settings::Lost_Behavior>(behavior);
+    } else if (!strncmp(argv[i], "-sliding_window_radius", strlen("-sliding_window_radius"))) {
+      if (++i >= argc) { Usage(argv[0]); }
+      g_settings.sliding_window_radius = atoi(argv[i]);
+    } else if (!strncmp(argv[i], "-radius", strlen("-radius"))) {
+      if (++i >= argc) { Usage(argv[0]); }
+      g_Radius = atof(argv[i]);
+    } else if (!strncmp(argv[i], "-check_bead_count_interval", strlen("-check_bead_count_interval"))) {
+      if (++i >= argc) { Usage(argv[0]); }
+      g_settings.check_bead_count_interval = atoi(argv[i]);
+    } else if (!strncmp(argv[i], "-search_radius", strlen("-search_radius"))) {
+      if (++i >= argc) { Usage(argv[0]); }
+      g_settings.search_radius = atof(argv[i]);
+    } else if (!strncmp(argv[i], "-search_pyramid_levels", strlen("-search_pyramid_levels"))) {
+      if (++i >= argc) { Usage(argv[0]); }
+      g_settings.search_pyramid_levels = atoi(argv[i]);
+    } else if (!strncmp(argv[i], "-predict", strlen("-predict"))) {
+      g_settings.predict = true;
+    } else if (!strncmp(argv[i], "-parabolafit", strlen("-parabolafit"))) {
+      g_settings.parabolafit = true;
+    } else if (!strncmp(argv[i], "-fast_optimizer", strlen("-fast_optimizer"))) {
+      g_settings.fast_optimizer = true;
+    } else if (!strncmp(argv[i], "-fft_search", strlen("-fft_search"))) {
+      g_settings.fft_search = true;
+    } else if (!strncmp(argv[i], "-enable_internal_values", strlen("-enable_internal_values"))) {
+      g_enable_internal_values = true;
+    } else if (!strncmp(argv[i], "-pipeline", strlen("-pipeline"))) {
+      if (++i >= argc) { Usage(argv[0]); }
+      g_pipeline_depth = atoi(argv[i]);
+    } else if (!strncmp(argv[i], "-statistics", strlen("-statistics"))) {
+      g_print_statistics = true;
+    } else if (!strcmp(argv[i], "-f")) {
+      if (++i >= argc) { Usage(argv[0]); }
+      g_max_frames = atoi(argv[i]);
+      if (g_max_frames <= 0) {
+        g_max_frames = -1;
+      }
+    } else if (argv[i][0] == '-') {
+      Usage(argv[0]);
+    } else {
+      realparams++;
+
+      //------------------------------------------------------------------
+      // Track this file, cleaning up the camera afterwards so that
+      // the next one starts fresh.
+      if (!track_video(argv[i])) {
+        fprintf(stderr,"Could not track %s\n", argv[i]);
+        failures++;
+      }
+      if (g_camera) { delete g_camera; g_camera = NULL; }
+      g_video = NULL;
+    }
+  }
+  if (realparams == 0) {
+    Usage(argv[0]);
+  }
+
+  return (failures == 0) ? 0 : -1;
+}
@@ -29,6 +29,7 @@
 #include "Tcl_Linkvar.h"
 #include "file_stack_server.h"
 #include "image_wrapper.h"
+#include "image_file_writer.h"
 #include "spot_tracker.h"
 
 #ifdef _WIN32
@@ -97,15 +98,16 @@ Tclvar_int          g_tcl_raw_camera_frameheadersize("raw_frameheadersize");
 char  *g_device_name = NULL;			  //< Name of the device to open
 base_camera_server  *g_camera = NULL;		  //< Camera used to get an image
 image_wrapper	    *g_image_to_display = NULL;	  //< Image that we're supposed to display
-copy_of_image	    *g_last_image = NULL;	  //< Copy of the last image we had, if any
-copy_of_image	    *g_this_image = NULL;	  //< Copy of the current image we are using
-copy_of_image	    *g_next_image = NULL;	  //< Copy of the next image we will use
+camera_frame	    *g_last_image = NULL;	  //< Copy of the last image we had, if any
+camera_frame	    *g_this_image = NULL;	  //< Copy of the current image we are using
+camera_frame	    *g_next_image = NULL;	  //< Copy of the next image we will use
+int		    g_frames_read = 0;		  //< Number of frames read from the camera
 copy_of_image	    *g_subtract_image = NULL;	  //< Image to subtract from the current image
 averaged_image	    *g_averaged_image = NULL;	  //< Averaged image for when we are going neighbor subtraction
 image_metric	    *g_min_image = NULL;	  //< Accumulates minimum of images
 image_metric	    *g_max_image = NULL;	  //< Accumulates maximum of images
 image_metric	    *g_mean_image = NULL;	  //< Accumulates mean of images
-image_wrapper	    *g_calculated_image = NULL;	  //< Image calculated from the camera image and other parameters
+subtracted_image    *g_calculated_image = NULL;	  //< Image calculated from the camera image and other parameters
 float		    g_search_radius = 0;	  //< Search radius for doing local max in before optimizing.
 Controllable_Video  *g_video = NULL;		  //< Video controls, if we have them
 Tclvar_int_with_button	g_frame_number("frame_number",NULL,-1);  //< Keeps track of video frame number
@@ -144,6 +146,7 @@ Tclvar_float_with_scale	g_exposure("exposure_millisecs", "", 1, 1000, 10);
 Tclvar_int_with_button	g_sixteenbits("sixteenbit_log",NULL,1);
 Tclvar_int_with_button	g_monochrome("monochrome_log",NULL,0);
 Tclvar_int_with_button	g_log_pointspread("pointspread_log",NULL,0);
+Tclvar_int_with_button	g_log_stack("stack_log",NULL,0);
 Tclvar_float_with_scale	g_colorIndex("red_green_blue", NULL, 0, 2, 0);
 Tclvar_float_with_scale	g_bitdepth("bit_depth", "", 8, 16, 8);
 Tclvar_float_with_scale g_precision("precision", "", 0.001, 1.0, 0.05, rebuild_trackers);
@@ -174,6 +177,7 @@ char			*g_logfile_base_name = NULL;
 copy_of_image		*g_log_last_image = NULL;
 unsigned		g_log_frame_number_last_logged = -1;
 PSF_File		*g_psf_file = NULL;
+image_file_writer	*g_image_writer = NULL;
 bool g_video_valid = false; // Do we have a valid video frame in memory?
 
 Tclvar_int_with_button	g_show_gain_control("show_gain_control","",0);
@@ -290,28 +294,21 @@ static	bool  save_log_frame(unsigned frame_number)
       }
     }
 
-    // Make a transformed image class to re-index the copied image.
-    // Use the faster, translate-only version if there is no rotation
-    // or scaling.
-    image_wrapper *shifted = NULL;
+    // Describe how to re-index the copied image.  Use the faster,
+    // translate-only version if there is no rotation or scaling.
+    image_file_writer::Transform  transform;
+    transform.dx = g_trackers.front()->xytracker()->get_x() - g_log_offset_x;
+    transform.dy = g_trackers.front()->xytracker()->get_y() - g_log_offset_y;
     if (g_reorient || g_rescale) {
       // Specify the center of rotation and scaling as the current
       // position of the origin tracker.
-      shifted = new affine_transformed_image(*g_log_last_image, 
-	  g_trackers.front()->xytracker()->get_x() - g_log_offset_x,
-	  g_trackers.front()->xytracker()->get_y() - g_log_offset_y,
-	  rotation,
-	  scale,
-	  g_trackers.front()->xytracker()->get_x(),
-	  g_trackers.front()->xytracker()->get_y());
+      transform.kind = image_file_writer::Transform::AFFINE;
+      transform.rotation = rotation;
+      transform.scale = scale;
+      transform.centerx = g_trackers.front()->xytracker()->get_x();
+      transform.centery = g_trackers.front()->xytracker()->get_y();
     } else {
-      shifted = new translated_image(*g_log_last_image, 
-	  g_trackers.front()->xytracker()->get_x() - g_log_offset_x,
-	  g_trackers.front()->xytracker()->get_y() - g_log_offset_y);
-    }
-    if (shifted == NULL) {
-      delete [] filename;
-      return false;
+      transform.kind = image_file_writer::Transform::TRANSLATE;
     }
 
     // Figure out whether the image will be sixteen bits, and also
@@ -339,25 +336,20 @@ static	bool  save_log_frame(unsigned frame_number)
     intensity_gain = 1.0/(g_clip_high - g_clip_low);
     intensity_offset = - g_clip_low * clamp;
 
-    cropped_image crop(*shifted, (int)(*g_minX), (int)(*g_minY), (int)(*g_maxX), (int)(*g_maxY));
-    if (g_monochrome) {
-      if (!crop.write_to_grayscale_tiff_file(filename, g_colorIndex, bitshift_gain*intensity_gain, intensity_offset, do_sixteen)) {
-        delete [] filename;
-        delete shifted;
-        return false;
-      }
-    } else {
-      if (!crop.write_to_tiff_file(filename, bitshift_gain*intensity_gain, intensity_offset, do_sixteen)) {
-        delete [] filename;
-        delete shifted;
-        return false;
-      }
+    // Hand the image to the writer, which crops, transforms, and stores
+    // it in the background.  It keeps its own reference to the pixels,
+    // so we can go ahead and replace our copy with the new image.
+    if (!g_image_writer->write(*g_log_last_image, transform,
+          (int)(*g_minX), (int)(*g_minY), (int)(*g_maxX), (int)(*g_maxY),
+          g_monochrome ? (int)(g_colorIndex) : -1,
+          bitshift_gain*intensity_gain, intensity_offset, do_sixteen, filename)) {
+      delete [] filename;
+      return false;
     }
 
     (*g_log_last_image) = *g_image_to_display;
 
     delete [] filename;
-    delete shifted;
     return true;
 }
 
@@ -396,6 +388,10 @@ static void  dirtyexit(void)
     delete g_psf_file;
     g_psf_file = NULL;
   }
+  if (g_image_writer) {
+    delete g_image_writer;
+    g_image_writer = NULL;
+  }
 
   glutDestroyWindow(g_tracking_window);
 
@@ -686,13 +682,17 @@ void myIdleFunc(void)
     }
   } else {
     // Got a valid video frame.
+    int frame_read = g_frames_read++;
 
     // Make a copy of the image if we don't yet have a "this" image.  Otherwise,
     // it will be copied down below.
+    // The frames all come from the camera's pool of buffers, and copying
+    // one frame to another just shares its pixels, so shifting them along
+    // does not copy or allocate.
     if (g_this_image == NULL) {
-      g_this_image = new copy_of_image(*g_camera);
+      g_this_image = new camera_frame();
 
-      if (g_this_image == NULL) {
+      if ( (g_this_image == NULL) || !g_camera->get_frame(*g_this_image, frame_read) ) {
         fprintf(stderr,"Cannot create current-copy image\n");
         cleanup();
         exit(-1);
@@ -702,7 +702,7 @@ void myIdleFunc(void)
     // Make a copy of "this" frame into the last frame.
     if (g_last_image == NULL) {
       //printf("XXX Creating g_last_image\n");
-      g_last_image = new copy_of_image(*g_this_image);
+      g_last_image = new camera_frame(*g_this_image);
     } else {
       //printf("XXX Copying g_last_image\n");
       *g_last_image = *g_this_image;
@@ -715,17 +715,18 @@ void myIdleFunc(void)
     if (g_next_image) {
       *g_this_image = *g_next_image;
     } else {
-      *g_this_image = *g_camera;
+      g_camera->get_frame(*g_this_image, frame_read);
     }
 
     // If we already have a valid "next" buffer, then store the just-
     // read image there.  If we do not, then try to read another new
     // frame to put into the next image, to prime the pump.
     if (g_next_image) {
-      *g_next_image = *g_camera;
+      g_camera->get_frame(*g_next_image, frame_read);
     } else {
       if (g_camera->read_image_to_memory(1,0, 1,0, g_exposure)) {
-	g_next_image = new copy_of_image(*g_camera);
+	g_next_image = new camera_frame();
+	if (g_next_image) { g_camera->get_frame(*g_next_image, g_frames_read++); }
       }
     }
 
@@ -790,12 +791,12 @@ void myIdleFunc(void)
       // Replace the subtraction image with the average of the next and
       // last images, if they both exist -- then point at the subtracted
       // image as the one to display.
-      if (g_averaged_image) {
-	delete g_averaged_image;
-	g_averaged_image = NULL;
-      }
       if (g_last_image && g_next_image) {
-	g_averaged_image = new averaged_image(*g_last_image, *g_next_image);
+	if (g_averaged_image) {
+	  g_averaged_image->recompute(*g_last_image, *g_next_image);
+	} else {
+	  g_averaged_image = new averaged_image(*g_last_image, *g_next_image);
+	}
 	img = g_averaged_image;
       } else {
 	// If we don't have the images needed to compute the average, then
@@ -805,13 +806,16 @@ void myIdleFunc(void)
       break;
     };
     if (img) {
-      // Get rid of the old calculated image, if we have one
-      if (g_calculated_image) { delete g_calculated_image; g_calculated_image = NULL; }
       // Calculate the new image and then point the image to display at it.
+      // Reuse the calculated image from the last time, if we have one.
       // The offset is determined by the maximum value that can be displayed in an
       // image with half as many values as the present image.
       double offset = (1 << (((unsigned)(g_bitdepth))-1) ) - 1;
-      g_calculated_image = new subtracted_image(*g_this_image, *img, offset);
+      if (g_calculated_image) {
+	g_calculated_image->recompute(*g_this_image, *img, offset);
+      } else {
+	g_calculated_image = new subtracted_image(*g_this_image, *img, offset);
+      }
       if (g_calculated_image == NULL) {
 	fprintf(stderr, "Out of memory when calculating image\n");
 	cleanup();
@@ -1217,6 +1221,15 @@ void  logfilename_changed(char *newvalue, void *)
   }
   g_log_frame_number_last_logged = -1;
   if (g_psf_file) { delete g_psf_file; g_psf_file = NULL; }
+  if (g_image_writer) {
+    g_image_writer->close_stack();
+    if (!g_image_writer->flush()) {
+      fprintf(stderr, "logfile_changed: Could not save some log frames\n");
+    }
+    printf("Log frames: %u written, %u failed, %u waits for the writer\n",
+      g_image_writer->frames_written(), g_image_writer->frames_failed(),
+      g_image_writer->backpressure_waits());
+  }
   
   // If we have an empty name, then clear the global logging base
   // name so that no more files will be saved.
@@ -1234,6 +1247,29 @@ void  logfilename_changed(char *newvalue, void *)
   // it is appropriate to do so.
   g_log_last_image = new copy_of_image(*g_image_to_display);
 
+  // Make the writer that will store the frames, with one thread per
+  // processor to transform them.  Put all of the frames into one file
+  // if we've been asked to.
+  if (g_image_writer == NULL) {
+    g_image_writer = new image_file_writer(vrpn_Thread::number_of_processors());
+    if (g_image_writer == NULL) {
+      fprintf(stderr,"logfilename_changed(): Out of memory\n");
+      return;
+    }
+  }
+  if (g_log_stack) {
+    char	*stackname = new char[strlen(g_logfile_base_name) + 9];
+    if (stackname == NULL) {
+      fprintf(stderr,"logfilename_changed(): Out of memory\n");
+      return;
+    }
+    sprintf(stackname, "%s.opt.tif", g_logfile_base_name);
+    if (!g_image_writer->open_stack(stackname)) {
+      fprintf(stderr,"logfilename_changed(): Cannot write to %s, using one file per frame\n", stackname);
+    }
+    delete [] stackname;
+  }
+
   list<Spot_Information *>::iterator  loop;
   loop = g_trackers.begin();
   spot_tracker_XY *first_tracker = (*loop)->xytracker() ;
@@ -191,6 +191,8 @@ checkbutton .log.sixteenbits -text "Log 16 bits" -variable sixteenbit_log -ancho
 pack .log.sixteenbits -side right -fill x
 checkbutton .log.monochrome -text "Monochrome" -variable monochrome_log -anchor w
 pack .log.monochrome -side right -fill x
+checkbutton .log.stack -text "One stack file" -variable stack_log -anchor w
+pack .log.stack -side right -fill x
 
 # Quit the program if this window is destroyed
 bind .log <Destroy> {global quit ; set quit 1} 
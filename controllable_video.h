@@ -144,7 +144,10 @@ public:
 #ifdef	VST_USE_FFMPEG
 class FFMPEG_Controllable_Video : public Controllable_Video , public ffmpeg_video_server {
 public:
-  FFMPEG_Controllable_Video(const char *filename) : ffmpeg_video_server(filename) {};
+  FFMPEG_Controllable_Video(const char *filename,
+      ffmpeg_video_server::output_format format = ffmpeg_video_server::RGB24,
+      unsigned decode_ahead = 8, unsigned decoder_threads = 0)
+    : ffmpeg_video_server(filename, format, decode_ahead, decoder_threads) {};
   virtual ~FFMPEG_Controllable_Video() {};
   void play(void) { ffmpeg_video_server::play(); }
   void pause(void) { ffmpeg_video_server::pause(); }
@@ -0,0 +1,63 @@
+#ifndef	COUNTING_SEMAPHORE_H
+#define	COUNTING_SEMAPHORE_H
+
+#include <vrpn_Shared.h>
+
+//----------------------------------------------------------------------------
+// A semaphore whose count can start at zero and can grow without limit, for
+// handing work between threads.  A vrpn_Semaphore can't be used for this:
+// asking it for a count of zero gives a count of one, and on Windows its
+// count can never rise above the starting value, so extra v() calls are
+// dropped.  This is built from two vrpn_Semaphores that only ever hold zero
+// or one: a lock around the count and a gate that is open whenever the count
+// is above zero.
+
+class counting_semaphore {
+public:
+  counting_semaphore(int count = 0) : d_lock(1), d_gate(1), d_count(0)
+  {
+    d_gate.p();
+    reset(count);
+  }
+
+  /// Wait until the count is above zero and then decrement it.
+  void p(void)
+  {
+    d_gate.p();
+    d_lock.p();
+    d_count--;
+    if (d_count > 0) { d_gate.v(); }
+    d_lock.v();
+  }
+
+  /// Increment the count, releasing one waiting thread if there are any.
+  void v(void)
+  {
+    d_lock.p();
+    d_count++;
+    if (d_count == 1) { d_gate.v(); }
+    d_lock.v();
+  }
+
+  /// Set the count.  Only call this when no thread is waiting in p().
+  void reset(int count)
+  {
+    d_lock.p();
+    d_count = (count > 0) ? count : 0;
+    d_gate.condP();
+    if (d_count > 0) { d_gate.v(); }
+    d_lock.v();
+  }
+
+protected:
+  vrpn_Semaphore  d_lock;   //< Protects d_count
+  vrpn_Semaphore  d_gate;   //< Available exactly when d_count > 0
+  int             d_count;  //< Number of p() calls that can go through
+
+private:
+  // Not copyable.
+  counting_semaphore(const counting_semaphore &);
+  counting_semaphore &operator=(const counting_semaphore &);
+};
+
+#endif
@@ -19,9 +19,26 @@ extern "C" {
 // This code is written based on the example code from
 // avcodec_sample.0.5.0.c and based on ffplay.c
 
-ffmpeg_video_server::ffmpeg_video_server(const char *filename)
-  : m_img_convert_ctx(NULL)
+ffmpeg_video_server::ffmpeg_video_server(const char *filename, output_format format,
+                                         unsigned decode_ahead, unsigned decoder_threads)
+  : m_pFormatCtx(NULL)
+  , m_pCodecCtx(NULL)
+  , m_pFrame(NULL)
+  , m_packet(NULL)
+  , m_img_convert_ctx(NULL)
+  , m_format(format)
+  , m_decoder_threads(decoder_threads)
+  , m_current(NULL)
   , d_mode(SINGLE)
+  , m_decode_ahead(decode_ahead)
+  , m_ringHead(0)
+  , m_ringTail(0)
+  , m_ringCurrent(-1)
+  , m_atEnd(false)
+  , m_ringFree(0)
+  , m_ringFilled(0)
+  , m_decodeThread(NULL)
+  , m_decodeStop(false)
 {
     _status = false;
 
@@ -49,11 +66,15 @@ ffmpeg_video_server::ffmpeg_video_server(const char *filename)
     _maxY = _num_rows-1;
     _binning = 1;
 
+    // Start decoding frames ahead of when they are asked for.
+    start_decoding();
+
     _status = true;
 }
 
 ffmpeg_video_server::~ffmpeg_video_server()
 {
+  stop_decoding();
   close_video_file();
 
   if (m_filename) {
@@ -101,6 +122,28 @@ bool ffmpeg_video_server::open_video_file(void)
     //printf("dbg: getting codec\n");
     m_pCodecCtx=m_pFormatCtx->streams[m_videoStream]->codec;
 
+    // The luminance plane can only be used directly if the decoder produces
+    // one with 8-bit samples; otherwise we convert to gray ourselves.
+    if (m_format == Y_PLANE) {
+      switch (m_pCodecCtx->pix_fmt) {
+        case AV_PIX_FMT_YUV420P: case AV_PIX_FMT_YUV422P: case AV_PIX_FMT_YUV444P:
+        case AV_PIX_FMT_YUV410P: case AV_PIX_FMT_YUV411P: case AV_PIX_FMT_YUV440P:
+        case AV_PIX_FMT_YUVJ420P: case AV_PIX_FMT_YUVJ422P: case AV_PIX_FMT_YUVJ444P:
+        case AV_PIX_FMT_YUVJ440P: case AV_PIX_FMT_NV12: case AV_PIX_FMT_NV21:
+        case AV_PIX_FMT_GRAY8:
+          // Keep a reference to each decoded frame rather than a copy of it.
+          m_pCodecCtx->refcounted_frames = 1;
+          break;
+        default:
+          fprintf(stderr,"ffmpeg_video_server::open_video_file(): No 8-bit luminance plane, converting to GRAY8\n");
+          m_format = GRAY8;
+      }
+    }
+
+    // Let the codec decode several frames, or parts of a frame, at once.
+    m_pCodecCtx->thread_count = m_decoder_threads;
+    m_pCodecCtx->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+
     // Find the decoder for the video stream
     //printf("dbg: getting decoder\n");
     m_pCodec=avcodec_find_decoder(m_pCodecCtx->codec_id);
@@ -133,26 +176,20 @@ bool ffmpeg_video_server::open_video_file(void)
         return false;
     }
 
-    // Allocate an AVFrame structure
-    m_pFrameRGB=av_frame_alloc();
-    if (m_pFrameRGB==NULL) {
-        fprintf(stderr,"ffmpeg_video_server::open_video_file(): Out of memory allocating RGB video frame\n");
+    // Allocate the frames we'll deliver images in.
+    if (!allocate_ring()) {
         return false;
     }
 
-    // Determine required buffer size and allocate the buffer used
-    // internal to FFMPEG and the one we copy data from there into.
-    int numBytes;
-    numBytes=avpicture_get_size(AV_PIX_FMT_RGB24, m_pCodecCtx->width, m_pCodecCtx->height);
-    m_buffer=new uint8_t[numBytes];
-
-    // Assign appropriate parts of buffer to image planes in pFrameRGB
-    avpicture_fill((AVPicture *)m_pFrameRGB, m_buffer, AV_PIX_FMT_RGB24,
-        m_pCodecCtx->width, m_pCodecCtx->height);
-
     // Initialize our packet
     m_packet = new AVPacket();
-    av_new_packet(m_packet, numBytes);
+    if (m_packet == NULL) {
+        fprintf(stderr,"ffmpeg_video_server::open_video_file(): Out of memory allocating packet\n");
+        return false;
+    }
+    av_init_packet(m_packet);
+    m_packet->data = NULL;
+    m_packet->size = 0;
 
     return true;
 }
@@ -160,51 +197,321 @@ bool ffmpeg_video_server::open_video_file(void)
 // Close and free all things associated with this video file.
 bool ffmpeg_video_server::close_video_file(void)
 {
-    delete m_packet;
+    free_ring();
 
-    if (m_buffer) {
-        delete [] m_buffer;
-        m_buffer = NULL;
-    }
-    if (m_pFrameRGB) {
-        av_free(m_pFrameRGB);
-        m_pFrameRGB = NULL;
+    if (m_packet) {
+        delete m_packet;
+        m_packet = NULL;
     }
     if (m_pFrame) {
-        av_free(m_pFrame);
-        m_pFrame = NULL;
+        av_frame_free(&m_pFrame);
+    }
+
+    if (m_pCodecCtx) {
+        avcodec_close(m_pCodecCtx);
+        m_pCodecCtx = NULL;
+    }
+    if (m_pFormatCtx) {
+        avformat_close_input(&m_pFormatCtx);
+    }
+
+    return true;
+}
+
+// Allocate the frames that images are delivered in.  When we decode on
+// a separate thread, there is one for the frame being shown, one for each
+// frame decoded ahead, and one being decoded into.  When we don't, there
+// is just the one frame, which is decoded into directly.
+bool ffmpeg_video_server::allocate_ring(void)
+{
+    unsigned count = (m_decode_ahead == 0) ? 1 : m_decode_ahead + 2;
+    AVPixelFormat fmt = AV_PIX_FMT_RGB24;
+    if (m_format == GRAY8) { fmt = AV_PIX_FMT_GRAY8; }
+    if (m_format == GRAY16) { fmt = AV_PIX_FMT_GRAY16; }
+    int numBytes = avpicture_get_size(fmt, m_pCodecCtx->width, m_pCodecCtx->height);
+
+    unsigned i;
+    for (i = 0; i < count; i++) {
+        Decoded_Frame slot;
+        slot.buffer = NULL;
+        slot.end_of_video = false;
+        slot.frame = av_frame_alloc();
+        if (slot.frame == NULL) {
+            fprintf(stderr,"ffmpeg_video_server::allocate_ring(): Out of memory allocating video frame\n");
+            return false;
+        }
+        m_ring.push_back(slot);
+
+        // The luminance plane is referenced from the decoder's own frames,
+        // so there is nothing to allocate for it.
+        if (m_format != Y_PLANE) {
+            m_ring.back().buffer = new uint8_t[numBytes];
+            if (m_ring.back().buffer == NULL) {
+                fprintf(stderr,"ffmpeg_video_server::allocate_ring(): Out of memory allocating frame buffer\n");
+                return false;
+            }
+            avpicture_fill((AVPicture *)m_ring.back().frame, m_ring.back().buffer, fmt,
+                m_pCodecCtx->width, m_pCodecCtx->height);
+        }
+    }
+
+    m_ringHead = m_ringTail = 0;
+    m_ringCurrent = -1;
+    m_current = NULL;
+    m_atEnd = false;
+    return true;
+}
+
+void ffmpeg_video_server::free_ring(void)
+{
+    size_t i;
+    for (i = 0; i < m_ring.size(); i++) {
+        if (m_ring[i].frame) {
+            av_frame_free(&m_ring[i].frame);    // Also drops any decoder reference
+        }
+        if (m_ring[i].buffer) {
+            delete [] m_ring[i].buffer;
+        }
+    }
+    m_ring.clear();
+    m_current = NULL;
+}
+
+void ffmpeg_video_server::decode_thread_func(vrpn_ThreadData &threadData)
+{
+    ffmpeg_video_server *me = static_cast<ffmpeg_video_server *>(threadData.pvUD);
+    me->decode_frames();
+}
+
+// Fill ring slots in order until we reach the end of the video or are told
+// to stop.  The slot after the last frame is marked as the end.
+void ffmpeg_video_server::decode_frames(void)
+{
+    while (true) {
+        m_ringFree.p();
+        if (m_decodeStop) {
+            return;
+        }
+        Decoded_Frame &slot = m_ring[m_ringTail];
+        slot.end_of_video = !decode_next_frame(slot);
+        if (m_decodeStop) {
+            return;
+        }
+        m_ringTail = (m_ringTail + 1) % m_ring.size();
+        m_ringFilled.v();
+        if (slot.end_of_video) {
+            return;
+        }
+    }
+}
+
+bool ffmpeg_video_server::start_decoding(void)
+{
+    m_decodeStop = false;
+    if ( (m_decode_ahead == 0) || m_ring.empty() ) {
+        return true;
+    }
+
+    // Every slot but the one that will be shown is free to be filled.
+    m_ringFree.reset(static_cast<int>(m_ring.size()) - 1);
+    m_ringFilled.reset(0);
+
+    vrpn_ThreadData td;
+    td.pvUD = this;
+    m_decodeThread = new vrpn_Thread(decode_thread_func, td);
+    if (m_decodeThread == NULL) {
+        fprintf(stderr,"ffmpeg_video_server::start_decoding(): Can't create decode thread\n");
+        return false;
+    }
+    if (!m_decodeThread->go()) {
+        fprintf(stderr,"ffmpeg_video_server::start_decoding(): Can't run decode thread, decoding as frames are read\n");
+        delete m_decodeThread;
+        m_decodeThread = NULL;
+        return false;
+    }
+    return true;
+}
+
+void ffmpeg_video_server::stop_decoding(void)
+{
+    if (m_decodeThread == NULL) {
+        return;
+    }
+
+    // Tell the thread to exit and wake it up in case it is waiting for a
+    // free slot.  Give it a while to finish the frame it is decoding before
+    // killing it.
+    m_decodeStop = true;
+    m_ringFree.v();
+    int wait;
+    for (wait = 0; (wait < 5000) && m_decodeThread->running(); wait++) {
+        vrpn_SleepMsecs(1);
+    }
+    if (m_decodeThread->running()) {
+        m_decodeThread->kill();
+    }
+    delete m_decodeThread;
+    m_decodeThread = NULL;
+}
+
+// Read and decode the next frame from the video file into the slot passed
+// in, converting it to the output format.  Returns false if there are no
+// more frames (or if something goes wrong).  The slot is left unchanged
+// unless a frame is returned.
+bool ffmpeg_video_server::decode_next_frame(Decoded_Frame &slot)
+{
+    // Read and decode a frame from the video file.  If there are no
+    // complete video frames in the file, then frameFinished will be
+    // 0 at the end of the while loop.
+    int             frameFinished = 0;
+    while(!frameFinished && !m_decodeStop && (av_read_frame(m_pFormatCtx, m_packet)>=0)) {
+        // Is this a packet from the video stream?
+        if(m_packet->stream_index==m_videoStream) {
+            // Decode video frame
+            avcodec_decode_video2(m_pCodecCtx, m_pFrame, &frameFinished, m_packet);
+        }
+
+        // Free the packet that was allocated by av_read_frame
+        av_free_packet(m_packet);
     }
 
-    avcodec_close(m_pCodecCtx);
-    avformat_close_input(&m_pFormatCtx);
+    // At the end of the file, the decoder may still be holding frames
+    // (it always is when it decodes several frames at once).  Each empty
+    // packet we hand it gets one of them back out.
+    if (!frameFinished && !m_decodeStop) {
+        AVPacket flush;
+        av_init_packet(&flush);
+        flush.data = NULL;
+        flush.size = 0;
+        flush.stream_index = m_videoStream;
+        avcodec_decode_video2(m_pCodecCtx, m_pFrame, &frameFinished, &flush);
+    }
+    if (!frameFinished) {
+        return false;
+    }
 
+    // Hold on to the decoder's frame if we're using its luminance plane.
+    if (m_format == Y_PLANE) {
+        av_frame_unref(slot.frame);
+        av_frame_move_ref(slot.frame, m_pFrame);
+        return true;
+    }
+
+    // Construct a conversion context to use to get the format we want.
+    // Gray output only needs the luminance, which is copied (or shifted
+    // in depth) exactly, so there is no reason to filter.
+    if (m_img_convert_ctx == NULL) {
+        int w = m_pCodecCtx->width;
+        int h = m_pCodecCtx->height;
+        AVPixelFormat fmt = AV_PIX_FMT_RGB24;
+        int flags = SWS_BICUBIC;
+        if (m_format == GRAY8) { fmt = AV_PIX_FMT_GRAY8; flags = SWS_POINT; }
+        if (m_format == GRAY16) { fmt = AV_PIX_FMT_GRAY16; flags = SWS_POINT; }
+        m_img_convert_ctx = sws_getContext(w, h, m_pCodecCtx->pix_fmt,
+                                        w, h, fmt, flags,
+                                        NULL, NULL, NULL);
+        if(m_img_convert_ctx == NULL) {
+            fprintf(stderr, "ffmpeg_video_server::decode_next_frame(): Cannot initialize the conversion context!\n");
+            return false;
+        }
+    }
+    sws_scale(m_img_convert_ctx, m_pFrame->data, m_pFrame->linesize, 0,
+              m_pCodecCtx->height, slot.frame->data, slot.frame->linesize);
     return true;
 }
 
+const uint8_t *ffmpeg_video_server::pixel_pointer(unsigned X, unsigned Y) const {
+  unsigned bytes = 1;
+  if (m_format == RGB24) { bytes = 3; }
+  if (m_format == GRAY16) { bytes = 2; }
+  return m_current->data[0] + Y * m_current->linesize[0] + bytes * X;
+}
+
 bool ffmpeg_video_server::write_to_opengl_texture(GLuint tex_id) {
-  const GLint   NUM_COMPONENTS = 3;
-  const GLenum  FORMAT = GL_RGB;
-  const GLenum  TYPE = GL_UNSIGNED_BYTE;
-  const unsigned char*   BASE_BUFFER = m_pFrameRGB->data[0];
-  const void*   SUBSET_BUFFER = &BASE_BUFFER[NUM_COMPONENTS * ( _minX + get_num_columns()*_minY )];
+  if (m_current == NULL) {
+    return false;
+  }
+  GLint   NUM_COMPONENTS = 1;
+  GLenum  FORMAT = GL_LUMINANCE;
+  GLenum  TYPE = GL_UNSIGNED_BYTE;
+  unsigned bytes = 1;
+  if (m_format == RGB24) {
+    NUM_COMPONENTS = 3; FORMAT = GL_RGB; bytes = 3;
+  } else if (m_format == GRAY16) {
+    TYPE = GL_UNSIGNED_SHORT; bytes = 2;
+  }
+
+  // The texture code expects rows that are packed together, which the
+  // decoder's own frames usually are not.
+  const unsigned char*   BASE_BUFFER = m_current->data[0];
+  unsigned row = bytes * get_num_columns();
+  if (m_current->linesize[0] != static_cast<int>(row)) {
+    m_gl_buffer.resize(row * get_num_rows());
+    unsigned y;
+    for (y = 0; y < get_num_rows(); y++) {
+      memcpy(&m_gl_buffer[y * row], BASE_BUFFER + y * m_current->linesize[0], row);
+    }
+    BASE_BUFFER = &m_gl_buffer[0];
+  }
+  const void*   SUBSET_BUFFER = &BASE_BUFFER[bytes * ( _minX + get_num_columns()*_minY )];
   //printf("dbg: Writing OpenGL texture\n");
   return write_to_opengl_texture_generic(tex_id, NUM_COMPONENTS, FORMAT, TYPE,
     BASE_BUFFER, SUBSET_BUFFER, _minX, _minY, _maxX, _maxY);
 }
 
 bool ffmpeg_video_server::get_pixel_from_memory(unsigned int X, unsigned int Y, vrpn_uint8 &val, int RGB) const {
-  if ( (X < _minX) || (Y < _minY) || (X > _maxX) || (Y > _maxY) ) {
+  if ( (X < _minX) || (Y < _minY) || (X > _maxX) || (Y > _maxY) || (m_current == NULL) ) {
     return false;
   }
-  val = *( m_pFrameRGB->data[0] + RGB + 3*(X + _num_columns*Y) );
+  if (m_format == RGB24) {
+    val = pixel_pointer(X, Y)[RGB];
+  } else if (m_format == GRAY16) {
+    val = *reinterpret_cast<const vrpn_uint16 *>(pixel_pointer(X, Y)) >> 8;
+  } else {
+    val = *pixel_pointer(X, Y);
+  }
   return true;
 }
 
 bool ffmpeg_video_server::get_pixel_from_memory(unsigned int X, unsigned int Y, vrpn_uint16 &val, int RGB) const {
-  if ( (X < _minX) || (Y < _minY) || (X > _maxX) || (Y > _maxY) ) {
+  if ( (X < _minX) || (Y < _minY) || (X > _maxX) || (Y > _maxY) || (m_current == NULL) ) {
+    return false;
+  }
+  if (m_format == RGB24) {
+    val = pixel_pointer(X, Y)[RGB];
+  } else if (m_format == GRAY16) {
+    val = *reinterpret_cast<const vrpn_uint16 *>(pixel_pointer(X, Y));
+  } else {
+    val = *pixel_pointer(X, Y);
+  }
+  return true;
+}
+
+// The frame is indexed the same way as in get_pixel_from_memory() above;
+// the rows may be padded, so the Y stride comes from the frame.
+bool ffmpeg_video_server::get_buffer_view(image_buffer_view &view) const {
+  if ( (m_current == NULL) || (m_current->data[0] == NULL) ) {
     return false;
   }
-  val = *( m_pFrameRGB->data[0] + RGB + 3*(X + _num_columns*Y) );
+  view.base = pixel_pointer(_minX, _minY);
+  if (m_format == RGB24) {
+    view.type = image_buffer_view::UINT8;
+    view.x_stride = 3;
+    view.y_stride = m_current->linesize[0];
+    view.num_colors = 3;
+  } else if (m_format == GRAY16) {
+    view.type = image_buffer_view::UINT16;
+    view.x_stride = 1;
+    view.y_stride = m_current->linesize[0] / 2;
+    view.num_colors = 1;
+  } else {
+    view.type = image_buffer_view::UINT8;
+    view.x_stride = 1;
+    view.y_stride = m_current->linesize[0];
+    view.num_colors = 1;
+  }
+  view.minx = _minX; view.maxx = _maxX;
+  view.miny = _minY; view.maxy = _maxY;
   return true;
 }
 
@@ -224,92 +531,93 @@ bool ffmpeg_video_server::read_image_to_memory(unsigned int minX, unsigned int m
       d_mode = PAUSE;
     }
 
-    // Read and decode a frame from the video file.  If there are no
-    // complete video frames in the file, then frameFinished will be
-    // 0 at the end of the while loop.
-    int             frameFinished = 0;
-    while(!frameFinished && (av_read_frame(m_pFormatCtx, m_packet)>=0)) {
-        //printf("dbg: Got a packet\n");
-        // Is this a packet from the video stream?
-        if(m_packet->stream_index==m_videoStream) {
-            // Decode video frame
-            avcodec_decode_video2(m_pCodecCtx, m_pFrame, &frameFinished, m_packet);
-            //printf("dbg: Decoded\n");
-
-            // Did we get a full video frame?
-            if(frameFinished) {
-
-              // Construct a conversion context to use to get the format we want.
-              if (m_img_convert_ctx == NULL) {
-                    int w = m_pCodecCtx->width;
-                    int h = m_pCodecCtx->height;
-                    m_img_convert_ctx = sws_getContext(w, h,
-                                                    m_pCodecCtx->pix_fmt,
-                                                    w, h, AV_PIX_FMT_RGB24, SWS_BICUBIC,
-                                                    NULL, NULL, NULL);
-                    if(m_img_convert_ctx == NULL) {
-                        fprintf(stderr, "ffmpeg_video_server::read_image_to_memory(): Cannot initialize the conversion context!\n");
-                        return false;
-                    }
-                    //printf("dbg: Converter initialized\n");
-              }
-
-              //printf("dbg: Frame finished\n");
-              sws_scale(m_img_convert_ctx, m_pFrame->data, m_pFrame->linesize, 0,
-                        m_pCodecCtx->height, m_pFrameRGB->data, m_pFrameRGB->linesize);
-              //printf("dbg: Scaling done\n");
-            }
-        }
-
-        // Free the packet that was allocated by av_read_frame
-        av_free_packet(m_packet);
-        //printf("dbg: Freed a packet\n");
-    }
-
     // If we've gone past the end of the video, then set the mode to pause
-    // and return false to say that we have no frame.  If we get here without
-    // a finished frame, then we must be at the end.
-    if (!frameFinished) {
+    // and return false to say that we have no frame.
+    if (m_atEnd || m_ring.empty()) {
         d_mode = PAUSE;
         return false;
     }
 
+    if (m_decodeThread == NULL) {
+        // Decode the frame ourselves.
+        if (!decode_next_frame(m_ring[0])) {
+            m_atEnd = true;
+            d_mode = PAUSE;
+            return false;
+        }
+        m_current = m_ring[0].frame;
+    } else {
+        // Wait for the decode thread to have the next frame ready.
+        m_ringFilled.p();
+        Decoded_Frame &slot = m_ring[m_ringHead];
+        if (slot.end_of_video) {
+            m_atEnd = true;
+            d_mode = PAUSE;
+            return false;
+        }
+
+        // Let the decoder have the slot we were showing, now that we've moved on.
+        if (m_ringCurrent >= 0) {
+            m_ringFree.v();
+        }
+        m_ringCurrent = m_ringHead;
+        m_ringHead = (m_ringHead + 1) % m_ring.size();
+        m_current = slot.frame;
+    }
+
     // Store the time at which we read the image.
     vrpn_gettimeofday(&m_timestamp, NULL);
 
-    // The image is now loaded and properly formatted in the m_pFrame, ready
-    // to be copied from m_pFrame->data.
+    // The image is now loaded and properly formatted in m_current.
     //printf("dbg: Got a frame!\n");
     return true;
 }
 
 bool ffmpeg_video_server::send_vrpn_image(vrpn_Imager_Server* svr, vrpn_Connection* svrcon, double g_exposure, int svrchan, int num_chans) {
-	// Make sure we have a valid, open device
-	if (!_status) { return false; };
+	// Make sure we have a valid, open device and a frame to send
+	if (!_status || (m_current == NULL)) { return false; };
 
     unsigned y;
+    const vrpn_uint8 *base = m_current->data[0];
+    unsigned rowStride = m_current->linesize[0];
 
     // Send the current frame over to the client in chunks as big as possible (limited by vrpn_IMAGER_MAX_REGION).
+    // Gray frames only have the one channel to send.
     int nRowsPerRegion=vrpn_IMAGER_MAX_REGIONu8/_num_columns;
     svr->send_begin_frame(0, _num_columns-1, 0, _num_rows-1);
-    for(y=0; y<_num_rows; y+=nRowsPerRegion) {
-      svr->send_region_using_base_pointer(svrchan,0,_num_columns-1,y,min(_num_rows,y+nRowsPerRegion)-1,
-	m_pFrameRGB->data[0]+2 /* Send the red channel */, 3, 3*_num_columns, _num_rows, true);
-      svr->mainloop();
-    }
-    if (num_chans >= 2) {
+    if (m_format == GRAY16) {
+      nRowsPerRegion=vrpn_IMAGER_MAX_REGIONu16/_num_columns;
       for(y=0; y<_num_rows; y+=nRowsPerRegion) {
-        svr->send_region_using_base_pointer(svrchan+1,0,_num_columns-1,y,min(_num_rows,y+nRowsPerRegion)-1,
-	  m_pFrameRGB->data[0]+1 /* Send the green channel */, 3, 3*_num_columns, _num_rows, true);
+        svr->send_region_using_base_pointer(svrchan,0,_num_columns-1,y,min(_num_rows,y+nRowsPerRegion)-1,
+	  reinterpret_cast<const vrpn_uint16 *>(base), 1, rowStride/2, _num_rows, true);
         svr->mainloop();
       }
-    }
-    if (num_chans >= 3) {
+    } else if (m_format != RGB24) {
       for(y=0; y<_num_rows; y+=nRowsPerRegion) {
-        svr->send_region_using_base_pointer(svrchan+2,0,_num_columns-1,y,min(_num_rows,y+nRowsPerRegion)-1,
-	  m_pFrameRGB->data[0]+0 /* Send the blue channel */, 3, 3*_num_columns, _num_rows, true);
+        svr->send_region_using_base_pointer(svrchan,0,_num_columns-1,y,min(_num_rows,y+nRowsPerRegion)-1,
+	  base, 1, rowStride, _num_rows, true);
         svr->mainloop();
       }
+    } else {
+      for(y=0; y<_num_rows; y+=nRowsPerRegion) {
+        svr->send_region_using_base_pointer(svrchan,0,_num_columns-1,y,min(_num_rows,y+nRowsPerRegion)-1,
+	  base+2 /* Send the red channel */, 3, rowStride, _num_rows, true);
+        svr->mainloop();
+      }
+      if (num_chans >= 2) {
+        for(y=0; y<_num_rows; y+=nRowsPerRegion) {
+          svr->send_region_using_base_pointer(svrchan+1,0,_num_columns-1,y,min(_num_rows,y+nRowsPerRegion)-1,
+	    base+1 /* Send the green channel */, 3, rowStride, _num_rows, true);
+          svr->mainloop();
+        }
+      }
+      if (num_chans >= 3) {
+        for(y=0; y<_num_rows; y+=nRowsPerRegion) {
+          svr->send_region_using_base_pointer(svrchan+2,0,_num_columns-1,y,min(_num_rows,y+nRowsPerRegion)-1,
+	    base+0 /* Send the blue channel */, 3, rowStride, _num_rows, true);
+          svr->mainloop();
+        }
+      }
     }
     svr->send_end_frame(0, _num_columns-1, 0, _num_rows-1);
     svr->mainloop();
@@ -350,10 +658,15 @@ void  ffmpeg_video_server::rewind(void)
     }
 */
     // Since we can't seek, close and then re-open the file.  Ugly but works.
+    // The decode thread has to be stopped while we do this, and it starts
+    // over at the beginning of the file.
+    stop_decoding();
     //printf("dbg: closing video file\n");
     close_video_file();
     //printf("dbg: opening video file\n");
-    open_video_file();
+    if (open_video_file()) {
+      start_decoding();
+    }
 
     // Read one frame when we start
     d_mode = SINGLE;
@@ -1,6 +1,8 @@
 #pragma once
 
 #include "base_camera_server.h"
+#include "counting_semaphore.h"
+#include <vector>
 
 // Forward declare classes so other code using this library does not need to include
 // external header files.
@@ -11,13 +13,33 @@ struct AVFrame;
 struct AVPacket;
 struct SwsContext;
 
+// Frames are decoded by a background thread into a ring of buffers that
+// holds up to decode_ahead frames, so read_image_to_memory() usually only
+// has to hand over a frame that is already converted.  Setting decode_ahead
+// to zero decodes on the calling thread instead.  The codec itself is also
+// allowed to use frame and slice threading, with decoder_threads threads
+// (zero lets FFMPEG pick based on the number of processors).
+//
+// By default each frame is converted to packed RGB.  When only one channel
+// is going to be used, the frames can instead be converted to 8- or 16-bit
+// grayscale, or (for planar YUV and gray video) the decoder's own luminance
+// plane can be used in place without any conversion at all.
+
 class ffmpeg_video_server : public base_camera_server {
 public:
-  ffmpeg_video_server(const char *filename);
+  typedef enum { RGB24, GRAY8, GRAY16, Y_PLANE } output_format;
+
+  ffmpeg_video_server(const char *filename, output_format format = RGB24,
+                      unsigned decode_ahead = 8, unsigned decoder_threads = 0);
   virtual ~ffmpeg_video_server(void);
 
   /// Return the number of colors that the device has
-  virtual unsigned  get_num_colors() const { return 3; };
+  virtual unsigned  get_num_colors() const { return (m_format == RGB24) ? 3 : 1; };
+
+  /// Return the format that frames are delivered in.  This may differ from
+  // the one requested if Y_PLANE was asked for on a video that does not store
+  // an 8-bit luminance plane; those are converted to GRAY8 instead.
+  output_format get_output_format(void) const { return m_format; }
 
   /// Read an image to a memory buffer. Max < min means "whole range"
   virtual bool	read_image_to_memory(unsigned minX = 0, unsigned maxX = 0,
@@ -28,6 +50,9 @@ public:
   virtual bool	get_pixel_from_memory(unsigned X, unsigned Y, vrpn_uint8 &val, int RGB = 0) const;
   virtual bool	get_pixel_from_memory(unsigned X, unsigned Y, vrpn_uint16 &val, int RGB = 0) const;
 
+  /// Describe the in-memory frame buffer so that trackers can read it directly.
+  virtual bool  get_buffer_view(image_buffer_view &view) const;
+
   /// Send in-memory image over a vrpn connection
   virtual bool  send_vrpn_image(vrpn_Imager_Server* svr,
     vrpn_Connection* svrcon,double g_exposure,int svrchan, int num_chans = 1);
@@ -60,13 +85,48 @@ protected:
   AVCodec         *m_pCodec;
   int             m_videoStream;
   AVFrame         *m_pFrame;
-  AVFrame         *m_pFrameRGB;
   AVPacket        *m_packet;
-  uint8_t         *m_buffer;
   struct SwsContext *m_img_convert_ctx;
 
+  output_format   m_format;         //< Format we are delivering frames in
+  unsigned        m_decoder_threads; //< Threads to ask the codec to use
+  const AVFrame   *m_current;       //< Frame being reported (NULL before the first)
+  std::vector<vrpn_uint8> m_gl_buffer; //< Packed copy of padded frames for OpenGL
+
   enum {PAUSE, PLAY, SINGLE}  d_mode;		  //< What we're doing right now
 
+  // Ring of decoded frames.  The decode thread fills slots in order, waiting
+  // on m_ringFree when all of them are full; the reading thread takes them in
+  // the same order from m_ringFilled, and gives back the slot it was showing
+  // each time it moves on to a new one.  A slot marked end_of_video is
+  // the last thing the decode thread puts in before it exits.
+  typedef struct {
+    AVFrame       *frame;         //< Converted frame, or reference to decoded frame
+    uint8_t       *buffer;        //< Pixels for the converted frame (NULL for Y_PLANE)
+    bool          end_of_video;   //< No frame here; the video ended or failed
+  } Decoded_Frame;
+  std::vector<Decoded_Frame>  m_ring;
+  unsigned        m_decode_ahead;   //< Frames to decode ahead (0 means none, no thread)
+  unsigned        m_ringHead;       //< Next slot for the reader to take
+  unsigned        m_ringTail;       //< Next slot for the decode thread to fill
+  int             m_ringCurrent;    //< Slot being shown (-1 if none)
+  bool            m_atEnd;          //< Reader has reached the end of the video
+  counting_semaphore m_ringFree;    //< Counts slots that the decoder may fill
+  counting_semaphore m_ringFilled;  //< Counts slots waiting to be read
+  vrpn_Thread     *m_decodeThread;
+  volatile bool   m_decodeStop;     //< Tells the decode thread to exit
+
+  bool allocate_ring(void);
+  void free_ring(void);
+  bool start_decoding(void);
+  void stop_decoding(void);
+  bool decode_next_frame(Decoded_Frame &slot);
+  void decode_frames(void);
+  static void decode_thread_func(vrpn_ThreadData &threadData);
+
+  /// Pointer to the first element of pixel (X,Y) in the current frame.
+  const uint8_t *pixel_pointer(unsigned X, unsigned Y) const;
+
   // Routines to close and re-open the file.  These are here because
   // the av_seek_frame() function fails on some videos so we can't use
   // it to reliably rewind.
@@ -0,0 +1,335 @@
+#include  <math.h>
+#include  <stdio.h>
+#include  <map>
+#include  "fft_correlator.h"
+#include  "spot_math.h"
+#include  "thread.h"
+
+//----------------------------------------------------------------------------
+// Tables for one transform size: the bit-reversed index of each element and
+// the cosine and sine of each twiddle angle.  They are built once per size
+// and never changed afterwards, so any number of threads can use one after
+// it has been looked up.
+
+class fft_plan {
+public:
+  fft_plan(unsigned n) : d_n(n), d_reverse(n), d_cos(n/2), d_sin(n/2) {
+    unsigned bits = 0;
+    while ( (1u << bits) < n ) { bits++; }
+    unsigned i, b;
+    for (i = 0; i < n; i++) {
+      unsigned r = 0;
+      for (b = 0; b < bits; b++) {
+        if (i & (1u << b)) { r |= 1u << (bits - 1 - b); }
+      }
+      d_reverse[i] = r;
+    }
+    for (i = 0; i < n/2; i++) {
+      d_cos[i] = cos(TWOPI * i / n);
+      d_sin[i] = sin(TWOPI * i / n);
+    }
+  }
+
+  // In-place transform of n complex values.  The forward transform uses
+  // exp(-2 pi i jk/n); the inverse uses exp(+2 pi i jk/n) and does not scale.
+  void transform(double *re, double *im, bool inverse) const {
+    unsigned i, j;
+    for (i = 0; i < d_n; i++) {
+      j = d_reverse[i];
+      if (j > i) {
+        double t = re[i]; re[i] = re[j]; re[j] = t;
+        t = im[i]; im[i] = im[j]; im[j] = t;
+      }
+    }
+    double sign = inverse ? 1.0 : -1.0;
+    unsigned len;
+    for (len = 2; len <= d_n; len *= 2) {
+      unsigned half = len / 2;
+      unsigned step = d_n / len;
+      for (i = 0; i < d_n; i += len) {
+        for (j = 0; j < half; j++) {
+          double wr = d_cos[j * step];
+          double wi = sign * d_sin[j * step];
+          unsigned a = i + j;
+          unsigned b = a + half;
+          double vr = re[b] * wr - im[b] * wi;
+          double vi = re[b] * wi + im[b] * wr;
+          re[b] = re[a] - vr;
+          im[b] = im[a] - vi;
+          re[a] += vr;
+          im[a] += vi;
+        }
+      }
+    }
+  }
+
+protected:
+  unsigned              d_n;
+  std::vector<unsigned> d_reverse;
+  std::vector<double>   d_cos, d_sin;
+};
+
+// The plans are shared by all correlators.  The semaphore protects the map
+// while a plan is being looked up or added.
+class fft_plan_cache {
+public:
+  const fft_plan *plan(unsigned n) {
+    const fft_plan *ret = NULL;
+    d_sem.p();
+    std::map<unsigned, fft_plan *>::iterator i = d_plans.find(n);
+    if (i != d_plans.end()) {
+      ret = i->second;
+    } else {
+      fft_plan *p = new fft_plan(n);
+      if (p == NULL) {
+        fprintf(stderr, "fft_plan_cache::plan(): Out of memory\n");
+      } else {
+        d_plans[n] = p;
+      }
+      ret = p;
+    }
+    d_sem.v();
+    return ret;
+  }
+
+protected:
+  std::map<unsigned, fft_plan *>  d_plans;
+  Semaphore                       d_sem;
+};
+
+// The cache is made the first time it is needed and never deleted (nor are
+// its plans), so that correlators in static objects that are deleted after
+// it would be can still be used.
+static fft_plan_cache &fft_plans(void)
+{
+  static fft_plan_cache *cache = new fft_plan_cache;
+  return *cache;
+}
+
+//----------------------------------------------------------------------------
+
+fft_correlator::fft_correlator()
+{
+}
+
+fft_correlator::~fft_correlator()
+{
+}
+
+unsigned fft_correlator::transform_size(unsigned size)
+{
+  unsigned n = 1;
+  while (n < size) { n *= 2; }
+  return n;
+}
+
+bool fft_correlator::transform_2d(double *re, double *im, unsigned n, bool inverse)
+{
+  if ( (n == 0) || ((n & (n - 1)) != 0) ) {
+    fprintf(stderr, "fft_correlator::transform_2d(): Size %u is not a power of two\n", n);
+    return false;
+  }
+  const fft_plan *plan = fft_plans().plan(n);
+  if (plan == NULL) {
+    return false;
+  }
+
+  // Transform each row in place, then copy each column out, transform it,
+  // and copy it back.
+  unsigned x, y;
+  for (y = 0; y < n; y++) {
+    plan->transform(&re[y*n], &im[y*n], inverse);
+  }
+  d_col_re.resize(n);
+  d_col_im.resize(n);
+  for (x = 0; x < n; x++) {
+    for (y = 0; y < n; y++) {
+      d_col_re[y] = re[x + y*n];
+      d_col_im[y] = im[x + y*n];
+    }
+    plan->transform(&d_col_re[0], &d_col_im[0], inverse);
+    for (y = 0; y < n; y++) {
+      re[x + y*n] = d_col_re[y];
+      im[x + y*n] = d_col_im[y];
+    }
+  }
+
+  if (inverse) {
+    double scale = 1.0 / (static_cast<double>(n) * n);
+    for (x = 0; x < n*n; x++) {
+      re[x] *= scale;
+      im[x] *= scale;
+    }
+  }
+  return true;
+}
+
+// The numerator of the normalized cross-correlation is the correlation of
+// the window with the template after the template's mean has been removed;
+// it is computed for all offsets at once by multiplying the transform of the
+// window by the conjugate of the transform of the template.  The window is
+// padded out to a power of two at least as large as itself, which keeps the
+// circular correlation from wrapping at the offsets we keep.  The
+// denominator needs the sum and sum of squares of the window under the
+// template at each offset, which come from summed-area tables.
+bool fft_correlator::correlate(const double *templ, int template_rad,
+                               const image_wrapper &image, unsigned rgb,
+                               int cx, int cy, int search_rad,
+                               std::vector<double> &surface)
+{
+  if ( (templ == NULL) || (template_rad < 0) || (search_rad < 0) ) {
+    fprintf(stderr, "fft_correlator::correlate(): Invalid template or search size\n");
+    return false;
+  }
+  int tsize = 2 * template_rad + 1;
+  int ssize = 2 * search_rad + 1;
+  int wsize = tsize + 2 * search_rad;
+  unsigned n = transform_size(wsize);
+  surface.assign(ssize * ssize, -2.0);
+
+  // Remove the mean from the template.  A flat template matches nothing.
+  int i, x, y;
+  double tmean = 0;
+  for (i = 0; i < tsize * tsize; i++) {
+    tmean += templ[i];
+  }
+  tmean /= tsize * tsize;
+  double tsumsq = 0;
+  for (i = 0; i < tsize * tsize; i++) {
+    tsumsq += (templ[i] - tmean) * (templ[i] - tmean);
+  }
+  if (tsumsq <= 0) {
+    return true;
+  }
+
+  // Fill in the window, leaving zeroes where it hangs off the image.  The
+  // offsets that would use those pixels are left at -2 below.
+  int minx, maxx, miny, maxy;
+  image.read_range(minx, maxx, miny, maxy);
+  int wx0 = cx - search_rad - template_rad;
+  int wy0 = cy - search_rad - template_rad;
+  d_image_re.assign(n * n, 0.0);
+  d_image_im.assign(n * n, 0.0);
+  d_sum.assign((wsize + 1) * (wsize + 1), 0.0);
+  d_sum_sq.assign((wsize + 1) * (wsize + 1), 0.0);
+  for (y = 0; y < wsize; y++) {
+    double row_sum = 0, row_sum_sq = 0;
+    for (x = 0; x < wsize; x++) {
+      double val = 0;
+      int ix = wx0 + x, iy = wy0 + y;
+      if ( (ix >= minx) && (ix <= maxx) && (iy >= miny) && (iy <= maxy) ) {
+        val = image.read_pixel_nocheck(ix, iy, rgb);
+      }
+      d_image_re[x + y*n] = val;
+      row_sum += val;
+      row_sum_sq += val * val;
+      d_sum[(x+1) + (y+1)*(wsize+1)] = d_sum[(x+1) + y*(wsize+1)] + row_sum;
+      d_sum_sq[(x+1) + (y+1)*(wsize+1)] = d_sum_sq[(x+1) + y*(wsize+1)] + row_sum_sq;
+    }
+  }
+
+  d_templ_re.assign(n * n, 0.0);
+  d_templ_im.assign(n * n, 0.0);
+  for (y = 0; y < tsize; y++) {
+    for (x = 0; x < tsize; x++) {
+      d_templ_re[x + y*n] = templ[x + y*tsize] - tmean;
+    }
+  }
+
+  if (!transform_2d(&d_image_re[0], &d_image_im[0], n, false) ||
+      !transform_2d(&d_templ_re[0], &d_templ_im[0], n, false)) {
+    return false;
+  }
+  unsigned k;
+  for (k = 0; k < n * n; k++) {
+    double ar = d_image_re[k], ai = d_image_im[k];
+    double br = d_templ_re[k], bi = -d_templ_im[k];
+    d_image_re[k] = ar * br - ai * bi;
+    d_image_im[k] = ar * bi + ai * br;
+  }
+  if (!transform_2d(&d_image_re[0], &d_image_im[0], n, true)) {
+    return false;
+  }
+
+  // Normalize each offset whose template lies entirely inside the image.
+  double npix = tsize * tsize;
+  for (y = 0; y < ssize; y++) {
+    int top = wy0 + y;
+    if ( (top < miny) || (top + tsize - 1 > maxy) ) { continue; }
+    for (x = 0; x < ssize; x++) {
+      int left = wx0 + x;
+      if ( (left < minx) || (left + tsize - 1 > maxx) ) { continue; }
+      int stride = wsize + 1;
+      double s = d_sum[(x+tsize) + (y+tsize)*stride] - d_sum[x + (y+tsize)*stride]
+               - d_sum[(x+tsize) + y*stride] + d_sum[x + y*stride];
+      double s2 = d_sum_sq[(x+tsize) + (y+tsize)*stride] - d_sum_sq[x + (y+tsize)*stride]
+                - d_sum_sq[(x+tsize) + y*stride] + d_sum_sq[x + y*stride];
+      double var = s2 - s * s / npix;
+      if (var <= 1e-12 * (s2 + 1)) { continue; }
+      double ncc = d_image_re[x + y*n] / sqrt(tsumsq * var);
+      if (ncc > 1) { ncc = 1; }
+      if (ncc < -1) { ncc = -1; }
+      surface[x + y*ssize] = ncc;
+    }
+  }
+
+  return true;
+}
+
+// Offset of the vertex of the parabola through three equally-spaced values,
+// relative to the middle one.  Returns 0 if the values don't curve down.
+static double parabola_peak_offset(double left, double center, double right)
+{
+  double denom = left - 2 * center + right;
+  if (denom >= 0) {
+    return 0;
+  }
+  double offset = 0.5 * (left - right) / denom;
+  if (offset > 0.5) { offset = 0.5; }
+  if (offset < -0.5) { offset = -0.5; }
+  return offset;
+}
+
+bool fft_correlator::find_peak(const std::vector<double> &surface, int search_rad,
+                               double max_offset, double &dx, double &dy, double &value)
+{
+  int ssize = 2 * search_rad + 1;
+  if (surface.size() != static_cast<size_t>(ssize * ssize)) {
+    fprintf(stderr, "fft_correlator::find_peak(): Surface is the wrong size\n");
+    return false;
+  }
+
+  int x, y;
+  int best_x = 0, best_y = 0;
+  double best = -2;
+  double maxsq = max_offset * max_offset;
+  for (y = -search_rad; y <= search_rad; y++) {
+    for (x = -search_rad; x <= search_rad; x++) {
+      if (x*x + y*y > maxsq) { continue; }
+      double val = surface[(x + search_rad) + (y + search_rad) * ssize];
+      if (val > best) {
+        best = val;
+        best_x = x;
+        best_y = y;
+      }
+    }
+  }
+  if (best <= -2) {
+    return false;
+  }
+
+  // Refine along each axis where both neighbors have valid values.
+  int cx = best_x + search_rad, cy = best_y + search_rad;
+  dx = best_x;
+  dy = best_y;
+  if ( (cx > 0) && (cx < ssize - 1) ) {
+    double l = surface[(cx-1) + cy * ssize], r = surface[(cx+1) + cy * ssize];
+    if ( (l > -2) && (r > -2) ) { dx += parabola_peak_offset(l, best, r); }
+  }
+  if ( (cy > 0) && (cy < ssize - 1) ) {
+    double l = surface[cx + (cy-1) * ssize], r = surface[cx + (cy+1) * ssize];
+    if ( (l > -2) && (r > -2) ) { dy += parabola_peak_offset(l, best, r); }
+  }
+  value = best;
+  return true;
+}
@@ -0,0 +1,70 @@
+#ifndef	FFT_CORRELATOR_H
+#define	FFT_CORRELATOR_H
+
+#include <vector>
+#include "image_wrapper.h"
+
+//----------------------------------------------------------------------------
+// Normalized cross-correlation of a square template against every integer
+// offset within a square search window of an image, computed with 2D FFTs
+// rather than by summing over the template once per offset.  The cost goes
+// as N^2 log N in the padded window size N, rather than as the number of
+// offsets times the number of template pixels, so it pays off for search
+// windows more than a few pixels across.
+//
+// The transforms are done with a built-in radix-2 FFT so that the library
+// does not depend on an external package.  The tables for each transform
+// size (the "plan") are built the first time that size is used and then
+// shared by all correlators, so trackers with the same template and search
+// sizes only pay for them once.  Each correlator keeps its own work buffers,
+// so use one correlator per thread.
+
+class fft_correlator {
+public:
+  fft_correlator();
+  ~fft_correlator();
+
+  /// Correlate a template against an image.
+  // The template holds (2*template_rad+1) squared values, row by row (the
+  // layout image_spot_tracker_interp uses for its test image).  The result
+  // holds (2*search_rad+1) squared values, also row by row, where entry
+  // (dx + search_rad, dy + search_rad) is the normalized cross-correlation
+  // (between -1 and 1) with the template centered on pixel (cx+dx, cy+dy).
+  // Offsets where the template would hang off the image, or where either
+  // the template or the image under it is flat, are given -2 so that they
+  // lose to any real match.  Returns false if the sizes are invalid.
+  bool correlate(const double *templ, int template_rad,
+                 const image_wrapper &image, unsigned rgb,
+                 int cx, int cy, int search_rad,
+                 std::vector<double> &surface);
+
+  /// Find the highest value in a surface returned by correlate(), looking
+  // only at offsets within max_offset of the center.  The peak is refined to
+  // sub-pixel accuracy by fitting a parabola through it and its neighbors
+  // along each axis.  Returns false if no offset had a valid correlation.
+  static bool find_peak(const std::vector<double> &surface, int search_rad,
+                        double max_offset, double &dx, double &dy, double &value);
+
+  /// Smallest power of two that is at least as large as the value passed in.
+  static unsigned transform_size(unsigned size);
+
+  /// Do an in-place 2D FFT on an n-by-n complex array stored row by row as
+  // separate real and imaginary parts.  n must be a power of two.  The
+  // inverse transform divides by n*n, so a forward then inverse transform
+  // gives back the original values.  Each column is copied into this
+  // correlator's work buffers to be transformed.
+  bool transform_2d(double *re, double *im, unsigned n, bool inverse);
+
+protected:
+  std::vector<double> d_image_re, d_image_im;     //< Transform of the search window
+  std::vector<double> d_templ_re, d_templ_im;     //< Transform of the template
+  std::vector<double> d_sum, d_sum_sq;            //< Summed-area tables of the window
+  std::vector<double> d_col_re, d_col_im;         //< One column, for transform_2d()
+
+private:
+  // Not copyable.
+  fft_correlator(const fft_correlator &);
+  fft_correlator &operator=(const fft_correlator &);
+};
+
+#endif
@@ -28,57 +28,20 @@ using namespace std;
 // This is to ensure that we only call InitializeMagick once.
 bool file_stack_server::ds_majickInitialized = false;
 
-// This routine will open, read, and discard the image from the file
-// whose name is passed in.  Its purpose is to pull the file into the
-// operating system's memory cache so that when it is actually needed
-// it will be immediately available.
-// This routine operates in a separate thread and in a non-blocking
-// manner so that it does not slow down the main process (unless it
-// competes for disk bandwidth).
-// To make this thread prefetch a file, change the string pointed to
-// in its userdata to a new name.
-static void prefetch_thread_func(vrpn_ThreadData &threadData)
-{
-  string *fileName = static_cast<string *>(threadData.pvUD);
-
-  // Record the original file name.
-  string oldFileName = *fileName;
-
-  // Whenever the new name becomes not the same as the last name,
-  // prefetch the file.  Sleep a little between tests to avoid
-  // eating an entire CPU in busy-wait.
-  do {
-    if (oldFileName != *fileName) {
-      oldFileName = *fileName;
-#if !defined(VIDEO_NO_IMAGEMAGICK)
-      ExceptionInfo   exception;
-      Image           *image;
-      ImageInfo       *image_info;
-
-      //Initialize the image info structure and read an image.
-      GetExceptionInfo(&exception);
-      image_info=CloneImageInfo((ImageInfo *) NULL);
-      (void) strcpy(image_info->filename,oldFileName.c_str());
-
-      image=ReadImage(image_info,&exception);
-      if (image != (Image *) NULL) {
-        DestroyImageInfo(image_info);
-        DestroyImageList(image);
-      }
-
-#endif
-    } else {
-      vrpn_SleepMsecs(1);
-    }
-  } while (true);
-}
-
-file_stack_server::file_stack_server(const char *filename, const char *magickfilesdir) :
+file_stack_server::file_stack_server(const char *filename, const char *magickfilesdir,
+                                     unsigned prefetch_threads, unsigned prefetch_depth,
+                                     unsigned prefetch_megabytes) :
 d_buffer(NULL),
 d_mode(SINGLE),
 d_xFileSize(0),
 d_yFileSize(0),
-d_listOfImages(NULL)
+d_listOfImages(NULL),
+d_prefetchLock(1),
+d_prefetchWork(0),
+d_prefetchDone(0),
+d_prefetchGeneration(0),
+d_prefetchNext(0),
+d_prefetchStop(false)
 {
   // In case we fail somewhere along the way
   _status = false;
@@ -109,18 +72,33 @@ d_listOfImages(NULL)
     return;
   }
 
-  // Start the prefetch thread
-  vrpn_ThreadData td;
-  td.pvUD = &d_prefetchName;
-  d_prefetchThread = new vrpn_Thread(prefetch_thread_func, td);
-  if (d_prefetchThread == NULL) {
-    fprintf(stderr,"file_stack_server::file_stack_server(): Can't create prefetch thread\n");
-    return;
+  // Make the prefetch pool.  Keep at least one slot even if a single frame
+  // is larger than the memory limit; we can't read the files without it.
+  // The buffers themselves are allocated by the workers as they are needed.
+  double frame_megabytes = d_xFileSize * d_yFileSize * 3.0 * sizeof(vrpn_uint16) / (1024.0 * 1024.0);
+  unsigned num_slots = prefetch_depth;
+  if (num_slots * frame_megabytes > prefetch_megabytes) {
+    num_slots = static_cast<unsigned>(prefetch_megabytes / frame_megabytes);
   }
-  if (!d_prefetchThread->go()) {
-    fprintf(stderr,"file_stack_server::file_stack_server(): Can't run prefetch thread\n");
-    return;
+  if (num_slots < 1) { num_slots = 1; }
+  Prefetch_Slot empty;
+  empty.state = Prefetch_Slot::EMPTY;
+  empty.index = 0;
+  empty.generation = 0;
+  empty.buffer = NULL;
+  empty.rest_of_images = NULL;
+  d_prefetchSlots.assign(num_slots, empty);
+
+  // Start the decoding threads and have them begin on the first files.
+  if (prefetch_threads == 0) {
+    prefetch_threads = vrpn_Thread::number_of_processors();
+    if (prefetch_threads > 1) { prefetch_threads--; }
+    if (prefetch_threads < 1) { prefetch_threads = 1; }
   }
+  start_prefetch(prefetch_threads);
+  d_prefetchLock.p();
+  queue_prefetch(0);
+  d_prefetchLock.v();
 
   // Everything opened okay.
   _minX = _minY = 0;
@@ -135,9 +113,17 @@ d_listOfImages(NULL)
 
 file_stack_server::~file_stack_server(void)
 {
-  // Stop the prefetch thread, if there is one
-  if (d_prefetchThread) {
-    d_prefetchThread->kill();
+  // Stop the prefetch threads and free their buffers.
+  stop_prefetch();
+  d_prefetchLock.p();
+  discard_prefetch();
+  d_prefetchLock.v();
+  size_t i;
+  for (i = 0; i < d_prefetchSlots.size(); i++) {
+    if (d_prefetchSlots[i].buffer) {
+      delete [] d_prefetchSlots[i].buffer;
+      d_prefetchSlots[i].buffer = NULL;
+    }
   }
 
   // Free the space taken by the in-memory image copy (if allocated)
@@ -181,8 +167,13 @@ void  file_stack_server::rewind()
   }
 #endif
 
-  // Seek back to the first file
+  // Seek back to the first file.  Anything the workers have decoded or
+  // are decoding is for later files, so throw it away and start over.
   d_whichFile = d_fileNames.begin();
+  d_prefetchLock.p();
+  discard_prefetch();
+  queue_prefetch(0);
+  d_prefetchLock.v();
 
   // Read one frame when we start
   d_mode = SINGLE;
@@ -193,6 +184,25 @@ void  file_stack_server::single_step()
   d_mode = SINGLE;
 }
 
+#if !defined(VIDEO_NO_IMAGEMAGICK)
+// Copy the pixels from an image into a buffer. Flip the image over in Y
+// to match the orientation we expect.  Note that if we have an 8-bit image,
+// ImagemMagick will have shifted it left to the most-significant-byte.
+static void copy_pixels_to_buffer(const PixelPacket *pixels, vrpn_uint16 *buffer,
+                                  unsigned nx, unsigned ny)
+{
+  unsigned x, y, flip_y;
+  for (y = 0; y < ny; y++) {
+    flip_y = (ny - 1) - y;
+    for (x = 0; x < nx; x++) {
+      buffer[ (x + flip_y * nx) * 3 + 0 ] = pixels[x + nx*y].red;
+      buffer[ (x + flip_y * nx) * 3 + 1 ] = pixels[x + nx*y].green;
+      buffer[ (x + flip_y * nx) * 3 + 2 ] = pixels[x + nx*y].blue;
+    }
+  }
+}
+#endif
+
 // This routine has some side effects: It allocates the buffer and it fills in
 // the d_xFileSize and d_yFileSize data members.
 //*** Note: This routine is complicated by the fact that some images (TIFF files
@@ -271,18 +281,7 @@ bool  file_stack_server::read_image_from_file(const string filename)
       return false;
   }
 
-  // Copy the pixels from the image into the buffer. Flip the image over in Y
-  // to match the orientation we expect.  Note that if we have an 8-bit image,
-  // ImagemMagick will have shifted it left to the most-significant-byte.
-  unsigned x, y, flip_y;
-  for (y = 0; y < d_yFileSize; y++) {
-    flip_y = (d_yFileSize - 1) - y;
-    for (x = 0; x < d_xFileSize; x++) {
-      d_buffer[ (x + flip_y * d_xFileSize) * 3 + 0 ] = pixels[x + image->columns*y].red;
-      d_buffer[ (x + flip_y * d_xFileSize) * 3 + 1 ] = pixels[x + image->columns*y].green;
-      d_buffer[ (x + flip_y * d_xFileSize) * 3 + 2 ] = pixels[x + image->columns*y].blue;
-    }
-  }
+  copy_pixels_to_buffer(pixels, d_buffer, d_xFileSize, d_yFileSize);
 
   DestroyCacheView(vinfo);
   DestroyImageInfo(image_info);
@@ -304,15 +303,261 @@ bool  file_stack_server::read_image_from_file(const string filename)
 #endif
 }
 
-// Tell the prefetch thread that it is time to grab another image.
-// If told the same image twice, won't re-read.
-void  file_stack_server::prefetch_image_from_file(const string filename)
+//---------------------------------------------------------------------
+// Prefetch pipeline.  The main thread queues file indices into empty slots
+// of the pool, in order, as far ahead as there are slots.  Each worker takes
+// the lowest-numbered queued slot, decodes its file into the slot's buffer
+// without holding the lock, and marks it ready (or failed).  The main thread
+// waits for the slot holding the file it wants and swaps that slot's buffer
+// with d_buffer, which makes the old frame's buffer available for reuse.
+// Rewinding bumps the generation number; slots that are being decoded for
+// an older generation are emptied by their worker when it finishes.
+
+void file_stack_server::prefetch_thread_func(vrpn_ThreadData &threadData)
+{
+  file_stack_server *me = static_cast<file_stack_server *>(threadData.pvUD);
+  me->decode_queued_frames();
+}
+
+void file_stack_server::start_prefetch(unsigned num_threads)
+{
+  unsigned i;
+  for (i = 0; i < num_threads; i++) {
+    vrpn_ThreadData td;
+    td.pvUD = this;
+    vrpn_Thread *t = new vrpn_Thread(prefetch_thread_func, td);
+    if (t == NULL) {
+      fprintf(stderr,"file_stack_server::start_prefetch(): Can't create prefetch thread\n");
+      break;
+    }
+    if (!t->go()) {
+      fprintf(stderr,"file_stack_server::start_prefetch(): Can't run prefetch thread\n");
+      delete t;
+      break;
+    }
+    d_prefetchThreads.push_back(t);
+  }
+}
+
+void file_stack_server::stop_prefetch(void)
+{
+  // Tell each thread to exit and wake it up.  Give them a while to finish
+  // the file they are decoding before killing them.
+  d_prefetchStop = true;
+  size_t i;
+  for (i = 0; i < d_prefetchThreads.size(); i++) {
+    d_prefetchWork.v();
+  }
+  for (i = 0; i < d_prefetchThreads.size(); i++) {
+    int wait;
+    for (wait = 0; (wait < 5000) && d_prefetchThreads[i]->running(); wait++) {
+      vrpn_SleepMsecs(1);
+    }
+    if (d_prefetchThreads[i]->running()) {
+      d_prefetchThreads[i]->kill();
+    }
+    delete d_prefetchThreads[i];
+  }
+  d_prefetchThreads.clear();
+}
+
+// Queue files starting at the one specified (or where we left off, if that
+// is later) into any empty slots.
+void file_stack_server::queue_prefetch(unsigned first_index)
+{
+  if (d_prefetchNext < first_index) {
+    d_prefetchNext = first_index;
+  }
+  size_t i;
+  for (i = 0; i < d_prefetchSlots.size(); i++) {
+    if (d_prefetchNext >= d_fileNames.size()) {
+      break;
+    }
+    Prefetch_Slot &slot = d_prefetchSlots[i];
+    if (slot.state == Prefetch_Slot::EMPTY) {
+      slot.state = Prefetch_Slot::QUEUED;
+      slot.index = d_prefetchNext++;
+      slot.generation = d_prefetchGeneration;
+      d_prefetchWork.v();
+    }
+  }
+}
+
+// Throw away everything that has been queued or decoded.  Slots that are in
+// the middle of being decoded are left to their workers, which will see that
+// they are from an old generation.
+void file_stack_server::discard_prefetch(void)
+{
+  d_prefetchGeneration++;
+  d_prefetchNext = 0;
+  size_t i;
+  for (i = 0; i < d_prefetchSlots.size(); i++) {
+    Prefetch_Slot &slot = d_prefetchSlots[i];
+    if (slot.state == Prefetch_Slot::DECODING) {
+      continue;
+    }
+#if !defined(VIDEO_NO_IMAGEMAGICK)
+    if (slot.rest_of_images) {
+      DestroyImageList(static_cast<Image *>(slot.rest_of_images));
+    }
+#endif
+    slot.rest_of_images = NULL;
+    slot.state = Prefetch_Slot::EMPTY;
+  }
+}
+
+void file_stack_server::decode_queued_frames(void)
 {
+  while (true) {
+    d_prefetchWork.p();
+    if (d_prefetchStop) {
+      return;
+    }
+
+    // Find the lowest-numbered file that is waiting, so that frames come out
+    // in the order they will be asked for.  There may not be one if the work
+    // was discarded by a rewind.
+    d_prefetchLock.p();
+    Prefetch_Slot *slot = NULL;
+    size_t i;
+    for (i = 0; i < d_prefetchSlots.size(); i++) {
+      Prefetch_Slot &s = d_prefetchSlots[i];
+      if ( (s.state == Prefetch_Slot::QUEUED) && ( (slot == NULL) || (s.index < slot->index) ) ) {
+        slot = &s;
+      }
+    }
+    if (slot == NULL) {
+      d_prefetchLock.v();
+      continue;
+    }
+    slot->state = Prefetch_Slot::DECODING;
+    std::string filename = d_fileNames[slot->index];
+    d_prefetchLock.v();
+
+    // Decode the file into the slot's buffer.  Nobody else touches a slot
+    // while it is being decoded, so we don't need the lock for this part.
+    bool ok = false;
+    void *rest = NULL;
 #if !defined(VIDEO_NO_IMAGEMAGICK)
-  d_prefetchName = filename;
+    if (slot->buffer == NULL) {
+      slot->buffer = new vrpn_uint16[d_xFileSize * d_yFileSize * 3];
+    }
+    ExceptionInfo   exception;
+    GetExceptionInfo(&exception);
+    ImageInfo *image_info = CloneImageInfo((ImageInfo *) NULL);
+    (void) strcpy(image_info->filename, filename.c_str());
+    Image *image = ReadImage(image_info, &exception);
+    DestroyImageInfo(image_info);
+    if (image == NULL) {
+      fprintf(stderr, "file_stack_server::decode_queued_frames(): ReadImage() failed: %s: %s\n",
+             exception.reason,exception.description);
+    } else if ( (d_xFileSize != image->columns) || (d_yFileSize != image->rows) ) {
+      fprintf(stderr,"file_stack_server::decode_queued_frames(): Image size differs in %s\n", filename.c_str());
+      DestroyImageList(image);
+    } else if (slot->buffer == NULL) {
+      fprintf(stderr,"file_stack_server::decode_queued_frames(): Out of memory\n");
+      DestroyImageList(image);
+    } else {
+#if (MagickLibVersion <= 0x649)
+      ViewInfo	*vinfo;
 #else
-  fprintf(stderr, "file_stack_server::prefetch_image_from_file(): ImageMagick not compiled in\n");
+      CacheView	*vinfo;
+#endif
+      vinfo = AcquireCacheView(image);
+      PixelPacket *pixels = GetCacheViewPixels(vinfo, 0,0,image->columns,image->rows);
+      if (pixels) {
+        copy_pixels_to_buffer(pixels, slot->buffer, d_xFileSize, d_yFileSize);
+        ok = true;
+      } else {
+        fprintf(stderr, "file_stack_server::decode_queued_frames(): unable to get pixel cache.\n");
+      }
+      DestroyCacheView(vinfo);
+
+      // Keep any further layers in the file around for the main thread.
+      Image *next = GetNextImageInList(image);
+      if (ok && (next != NULL)) {
+        rest = next;
+      } else {
+        DestroyImageList(image);
+      }
+    }
+#endif
+
+    // Hand the result back, unless the work was discarded while we did it.
+    d_prefetchLock.p();
+    if (slot->generation != d_prefetchGeneration) {
+#if !defined(VIDEO_NO_IMAGEMAGICK)
+      if (rest) { DestroyImageList(static_cast<Image *>(rest)); }
 #endif
+      slot->state = Prefetch_Slot::EMPTY;
+    } else {
+      slot->rest_of_images = rest;
+      slot->state = ok ? Prefetch_Slot::READY : Prefetch_Slot::FAILED;
+    }
+    d_prefetchLock.v();
+    d_prefetchDone.v();
+  }
+}
+
+// Wait for the specified file to be decoded and make it the current frame.
+// Returns false if it could not be decoded.
+bool file_stack_server::take_prefetched_frame(unsigned index)
+{
+  bool restarted = false;
+  d_prefetchLock.p();
+  while (true) {
+    // Find the slot for the file we want in the current generation.
+    Prefetch_Slot *slot = NULL;
+    size_t i;
+    for (i = 0; i < d_prefetchSlots.size(); i++) {
+      Prefetch_Slot &s = d_prefetchSlots[i];
+      if ( (s.state != Prefetch_Slot::EMPTY) && (s.index == index) &&
+           (s.generation == d_prefetchGeneration) ) {
+        slot = &s;
+        break;
+      }
+    }
+
+    // If it is not there, we either failed to read it last time or the
+    // pool is holding files we don't want.  Start over from this one.  If
+    // every slot is still busy with discarded work, wait for one to free up.
+    if (slot == NULL) {
+      if (!restarted) {
+        discard_prefetch();
+        restarted = true;
+      }
+      queue_prefetch(index);
+      if (d_prefetchNext <= index) {
+        d_prefetchLock.v();
+        d_prefetchDone.p();
+        d_prefetchLock.p();
+      }
+      continue;
+    }
+
+    if (slot->state == Prefetch_Slot::READY) {
+      vrpn_uint16 *swap = d_buffer;
+      d_buffer = slot->buffer;
+      slot->buffer = swap;
+      d_listOfImages = slot->rest_of_images;
+      slot->rest_of_images = NULL;
+      slot->state = Prefetch_Slot::EMPTY;
+      queue_prefetch(index + 1);
+      d_prefetchLock.v();
+      return true;
+    }
+    if (slot->state == Prefetch_Slot::FAILED) {
+      slot->state = Prefetch_Slot::EMPTY;
+      queue_prefetch(index + 1);
+      d_prefetchLock.v();
+      return false;
+    }
+
+    // Still waiting; sleep until a worker finishes something.
+    d_prefetchLock.v();
+    d_prefetchDone.p();
+    d_prefetchLock.p();
+  }
 }
 
 //*** Note: This routine is complicated by the fact that some images (TIFF files
@@ -370,9 +615,17 @@ bool  file_stack_server::read_image_to_memory(unsigned minX, unsigned maxX,
   if (_maxX >= _num_columns) { _maxX = _num_columns - 1; };
   if (_maxY >= _num_rows) { _maxY = _num_rows - 1; };
 
-  // Try to read the current file.  If we fail in the read, set the mode to paused so we don't keep trying.
-  // If we succeed, then set up to read the next file.
-  if (!read_image_from_file(*d_whichFile)) {
+  // Try to read the current file.  If we're in the middle of a multi-layer
+  // file, the next layer is already in memory; otherwise, get the frame that
+  // the prefetch threads decoded.  If the prefetch threads could not be
+  // started, read it ourselves.
+  bool ok;
+  if ( (d_listOfImages != NULL) || d_prefetchThreads.empty() ) {
+    ok = read_image_from_file(*d_whichFile);
+  } else {
+    ok = take_prefetched_frame(static_cast<unsigned>(d_whichFile - d_fileNames.begin()));
+  }
+  if (!ok) {
     fprintf(stderr,"file_stack_server::read_image_to_memory(): Could not read file\n");
     return false;
   }
@@ -382,11 +635,6 @@ bool  file_stack_server::read_image_to_memory(unsigned minX, unsigned maxX,
     d_whichFile++;
   }
 
-  // Try and prefetch the new file
-  if (d_whichFile != d_fileNames.end()) {
-    prefetch_image_from_file(*d_whichFile);
-  }
-
   // Okay, we got a new frame!
   return true;
 }
@@ -421,6 +669,22 @@ bool  file_stack_server::get_pixel_from_memory(unsigned X, unsigned Y, vrpn_uint
   return true;
 }
 
+/// Describe the RGB 16-bit buffer that holds the current frame.
+bool  file_stack_server::get_buffer_view(image_buffer_view &view) const
+{
+  if (d_buffer == NULL) {
+    return false;
+  }
+  view.base = &d_buffer[ (_minX + _minY * d_xFileSize) * 3 ];
+  view.type = image_buffer_view::UINT16;
+  view.x_stride = 3;
+  view.y_stride = 3 * d_xFileSize;
+  view.minx = _minX; view.maxx = _maxX;
+  view.miny = _minY; view.maxy = _maxY;
+  view.num_colors = 3;
+  return true;
+}
+
 /// Store the memory image to a PPM file.
 bool  file_stack_server::write_memory_to_ppm_file(const char *filename, int gain, bool sixteen_bits) const
 {
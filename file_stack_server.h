@@ -2,13 +2,23 @@
 #define	FILE_STACK_SERVER_H
 
 #include "base_camera_server.h"
+#include "counting_semaphore.h"
 #pragma warning( disable : 4786 )
 #include <vector>
 #include <string>
 
+// Files are decoded ahead of time by a set of worker threads into a pool
+// of frame buffers, so that read_image_to_memory() usually only has to swap
+// in a buffer that is already filled.  The number of threads, how many files
+// ahead to decode, and how much memory the decoded frames may use can be set
+// in the constructor; a thread count of zero picks one fewer than the number
+// of processors (but at least one).
+
 class file_stack_server : public base_camera_server {
 public:
-  file_stack_server(const char *filename, const char *magickFilesDir = "");
+  file_stack_server(const char *filename, const char *magickFilesDir = "",
+                    unsigned prefetch_threads = 0, unsigned prefetch_depth = 8,
+                    unsigned prefetch_megabytes = 512);
   virtual ~file_stack_server(void);
 
   /// Start the stored video playing.
@@ -43,6 +53,9 @@ public:
   /// How many colors are in the image.
   virtual unsigned  get_num_colors() const { return 3; }
 
+  /// Describe the in-memory frame buffer so that trackers can read it directly.
+  virtual bool  get_buffer_view(image_buffer_view &view) const;
+
   /// Store the memory image to a PPM file.
   virtual bool  write_memory_to_ppm_file(const char *filename, int gain = 1, bool sixteen_bits = false) const;
 
@@ -68,9 +81,33 @@ protected:
   unsigned		      d_yFileSize;	  //< Number of pixels in Y in the files
 
   bool read_image_from_file(const std::string filename);
-  void prefetch_image_from_file(const std::string filename);
-  std::string                 d_prefetchName;     //< Name of the next file to prefetch
-  vrpn_Thread                 *d_prefetchThread;  //< Thread that prefetches files from disk
+
+  // One entry in the prefetch pool.  Entries are claimed by the main thread
+  // for a file index, decoded by a worker, and then handed back when the
+  // frame has been swapped into d_buffer.
+  typedef struct {
+    enum {EMPTY, QUEUED, DECODING, READY, FAILED} state;
+    unsigned      index;                          //< Which file in d_fileNames
+    unsigned      generation;                     //< d_prefetchGeneration when queued
+    vrpn_uint16   *buffer;                        //< Decoded frame (same layout as d_buffer)
+    void          *rest_of_images;                //< Remaining layers of a multi-layer file
+  } Prefetch_Slot;
+  std::vector<Prefetch_Slot>  d_prefetchSlots;    //< Pool of frames being decoded or waiting
+  std::vector<vrpn_Thread *>  d_prefetchThreads;  //< Worker threads decoding files
+  vrpn_Semaphore              d_prefetchLock;     //< Protects the slots and the values below
+  counting_semaphore          d_prefetchWork;     //< Counts queued slots for the workers
+  counting_semaphore          d_prefetchDone;     //< Raised each time a worker finishes a slot
+  unsigned                    d_prefetchGeneration; //< Bumped to invalidate queued work on rewind
+  unsigned                    d_prefetchNext;     //< Next file index not yet queued
+  volatile bool               d_prefetchStop;     //< Tells the workers to exit
+
+  void start_prefetch(unsigned num_threads);
+  void stop_prefetch(void);
+  void queue_prefetch(unsigned first_index);      //< Call with d_prefetchLock held
+  void discard_prefetch(void);                    //< Call with d_prefetchLock held
+  bool take_prefetched_frame(unsigned index);
+  void decode_queued_frames(void);
+  static void prefetch_thread_func(vrpn_ThreadData &threadData);
   
   static bool ds_majickInitialized;		  //< Has ImageMagick been initialized?
 };
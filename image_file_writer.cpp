@@ -0,0 +1,485 @@
+#include  <string.h>
+#include  "image_file_writer.h"
+
+#if !defined(_WIN32) || defined(__MINGW32__)
+  #define _fseeki64 fseek
+#endif
+
+//----------------------------------------------------------------------------
+// BigTIFF files are little-endian here ("II"), with a 16-byte header that
+// holds the offset of the first page's directory.  Each directory is an
+// 8-byte entry count, 20-byte entries sorted by tag, and the 8-byte offset
+// of the next directory (zero for the last one).  Each page's pixels are
+// written just before its directory, so adding a page only means writing
+// to the end of the file and then filling in the previous link.
+
+enum { TIFF_SHORT = 3, TIFF_LONG = 4, TIFF_LONG8 = 16 };
+
+static void put_le(std::vector<unsigned char> &bytes, vrpn_uint32 high, vrpn_uint32 low, unsigned count)
+{
+  unsigned i;
+  for (i = 0; i < count; i++) {
+    if (i < 4) {
+      bytes.push_back(static_cast<unsigned char>((low >> (8*i)) & 0xff));
+    } else {
+      bytes.push_back(static_cast<unsigned char>((high >> (8*(i-4))) & 0xff));
+    }
+  }
+}
+
+static void put_offset(std::vector<unsigned char> &bytes, tiff_file_offset value)
+{
+  vrpn_uint32 low = static_cast<vrpn_uint32>(value & 0xffffffff);
+  vrpn_uint32 high = static_cast<vrpn_uint32>((value >> 16) >> 16);
+  put_le(bytes, high, low, 8);
+}
+
+// Directory entry whose value fits into the 8-byte value field.  Shorts are
+// packed one after another into it; up to four fit.
+static void put_entry(std::vector<unsigned char> &bytes, unsigned tag, unsigned type,
+                      unsigned count, const tiff_file_offset *values)
+{
+  put_le(bytes, 0, tag, 2);
+  put_le(bytes, 0, type, 2);
+  put_le(bytes, 0, count, 8);
+  size_t start = bytes.size();
+  unsigned i;
+  if (type == TIFF_SHORT) {
+    for (i = 0; i < count; i++) {
+      put_le(bytes, 0, static_cast<vrpn_uint32>(values[i]), 2);
+    }
+  } else if (type == TIFF_LONG) {
+    put_le(bytes, 0, static_cast<vrpn_uint32>(values[0]), 4);
+  } else {
+    put_offset(bytes, values[0]);
+  }
+  while (bytes.size() < start + 8) {
+    bytes.push_back(0);
+  }
+}
+
+bigtiff_stack_writer::bigtiff_stack_writer() :
+  d_file(NULL), d_end(0), d_next_ifd_link(0), d_pages(0)
+{
+}
+
+bigtiff_stack_writer::~bigtiff_stack_writer()
+{
+  close();
+}
+
+bool bigtiff_stack_writer::open(const char *filename)
+{
+  close();
+  if ( (d_file = fopen(filename, "wb")) == NULL) {
+    fprintf(stderr, "bigtiff_stack_writer::open(): Cannot create %s\n", filename);
+    return false;
+  }
+
+  // Header: byte order, version 43, 8-byte offsets, and (for now) no pages.
+  d_bytes.clear();
+  d_bytes.push_back('I'); d_bytes.push_back('I');
+  put_le(d_bytes, 0, 43, 2);
+  put_le(d_bytes, 0, 8, 2);
+  put_le(d_bytes, 0, 0, 2);
+  put_offset(d_bytes, 0);
+  d_end = 0;
+  d_next_ifd_link = 8;
+  d_pages = 0;
+  if (!write_at(0, &d_bytes[0], d_bytes.size())) {
+    close();
+    return false;
+  }
+  d_end = d_bytes.size();
+  return true;
+}
+
+void bigtiff_stack_writer::close()
+{
+  if (d_file != NULL) {
+    fclose(d_file);
+    d_file = NULL;
+  }
+}
+
+bool bigtiff_stack_writer::write_at(tiff_file_offset offset, const unsigned char *bytes, size_t count)
+{
+  if ( (_fseeki64(d_file, offset, SEEK_SET) != 0) ||
+       (fwrite(bytes, 1, count, d_file) != count) ) {
+    fprintf(stderr, "bigtiff_stack_writer::write_at(): Write failed\n");
+    return false;
+  }
+  return true;
+}
+
+bool bigtiff_stack_writer::append_page(const vrpn_uint16 *buffer, int numcols, int numrows,
+                                       unsigned num_colors, bool sixteen_bits)
+{
+  if (d_file == NULL) {
+    fprintf(stderr, "bigtiff_stack_writer::append_page(): No file open\n");
+    return false;
+  }
+  if ( (numcols <= 0) || (numrows <= 0) || ((num_colors != 1) && (num_colors != 3)) ) {
+    fprintf(stderr, "bigtiff_stack_writer::append_page(): Invalid page size\n");
+    return false;
+  }
+
+  // The pixels, then padding to keep the directory on a word boundary.
+  size_t count = static_cast<size_t>(numcols) * numrows * num_colors;
+  tiff_file_offset pixels_at = d_end;
+  d_bytes.resize(sixteen_bits ? 2 * count : count);
+  size_t i;
+  if (sixteen_bits) {
+    for (i = 0; i < count; i++) {
+      d_bytes[2*i] = static_cast<unsigned char>(buffer[i] & 0xff);
+      d_bytes[2*i+1] = static_cast<unsigned char>(buffer[i] >> 8);
+    }
+  } else {
+    for (i = 0; i < count; i++) {
+      d_bytes[i] = static_cast<unsigned char>(buffer[i] >> 8);
+    }
+  }
+  tiff_file_offset pixel_bytes = d_bytes.size();
+  while (d_bytes.size() % 8) {
+    d_bytes.push_back(0);
+  }
+  tiff_file_offset ifd_at = pixels_at + d_bytes.size();
+
+  // The directory.
+  const unsigned num_entries = 10;
+  tiff_file_offset bits[3] = { sixteen_bits ? 16 : 8, sixteen_bits ? 16 : 8, sixteen_bits ? 16 : 8 };
+  tiff_file_offset width = numcols, height = numrows, one = 1, colors = num_colors;
+  tiff_file_offset photometric = (num_colors == 3) ? 2 : 1;
+  put_offset(d_bytes, num_entries);
+  put_entry(d_bytes, 256, TIFF_LONG, 1, &width);            // ImageWidth
+  put_entry(d_bytes, 257, TIFF_LONG, 1, &height);           // ImageLength
+  put_entry(d_bytes, 258, TIFF_SHORT, num_colors, bits);    // BitsPerSample
+  put_entry(d_bytes, 259, TIFF_SHORT, 1, &one);             // Compression: none
+  put_entry(d_bytes, 262, TIFF_SHORT, 1, &photometric);     // Photometric: black is zero, or RGB
+  put_entry(d_bytes, 273, TIFF_LONG8, 1, &pixels_at);       // StripOffsets
+  put_entry(d_bytes, 277, TIFF_SHORT, 1, &colors);          // SamplesPerPixel
+  put_entry(d_bytes, 278, TIFF_LONG, 1, &height);           // RowsPerStrip
+  put_entry(d_bytes, 279, TIFF_LONG8, 1, &pixel_bytes);     // StripByteCounts
+  put_entry(d_bytes, 284, TIFF_SHORT, 1, &one);             // PlanarConfiguration: interleaved
+  put_offset(d_bytes, 0);
+
+  if (!write_at(pixels_at, &d_bytes[0], d_bytes.size())) {
+    return false;
+  }
+  d_end = pixels_at + d_bytes.size();
+
+  // Link the new page to the end of the list, and push it to the disk so
+  // that the file can be read while it is being written.
+  std::vector<unsigned char> link;
+  put_offset(link, ifd_at);
+  if (!write_at(d_next_ifd_link, &link[0], link.size())) {
+    return false;
+  }
+  d_next_ifd_link = ifd_at + 8 + 20 * num_entries;
+  fflush(d_file);
+  d_pages++;
+  return true;
+}
+
+//----------------------------------------------------------------------------
+// The writer keeps its jobs in a queue in the order they were handed in.
+// A worker takes the first job that is waiting and fills in its pixels
+// without holding the lock.  Then, whichever worker finds the oldest
+// unwritten job ready to go writes it, along with any that follow it that
+// are ready, so that the frames reach the disk in order without any worker
+// waiting on another.  The main thread removes the jobs that are done.
+
+image_file_writer::image_file_writer(unsigned num_threads, unsigned max_queued, bool drop_when_full) :
+  d_work(0), d_done(0), d_stop(false),
+  d_max_queued(max_queued < 1 ? 1 : max_queued), d_drop_when_full(drop_when_full),
+  d_stack(NULL), d_written(0), d_failed(0), d_dropped(0), d_waits(0), d_failed_reported(0),
+  d_scratch(true)
+{
+  unsigned i;
+  for (i = 0; i < num_threads; i++) {
+    vrpn_ThreadData td;
+    td.pvUD = this;
+    vrpn_Thread *t = new vrpn_Thread(thread_func, td);
+    if (t == NULL) {
+      fprintf(stderr,"image_file_writer::image_file_writer(): Can't create writer thread\n");
+      break;
+    }
+    if (!t->go()) {
+      fprintf(stderr,"image_file_writer::image_file_writer(): Can't run writer thread\n");
+      delete t;
+      break;
+    }
+    d_threads.push_back(t);
+  }
+}
+
+image_file_writer::~image_file_writer()
+{
+  close_stack();
+
+  // Tell each thread to exit and wake it up.  They are all idle now.
+  d_stop = true;
+  size_t i;
+  for (i = 0; i < d_threads.size(); i++) {
+    d_work.v();
+  }
+  for (i = 0; i < d_threads.size(); i++) {
+    int wait;
+    for (wait = 0; (wait < 5000) && d_threads[i]->running(); wait++) {
+      vrpn_SleepMsecs(1);
+    }
+    if (d_threads[i]->running()) {
+      d_threads[i]->kill();
+    }
+    delete d_threads[i];
+  }
+  d_threads.clear();
+}
+
+void image_file_writer::thread_func(vrpn_ThreadData &threadData)
+{
+  image_file_writer *me = static_cast<image_file_writer *>(threadData.pvUD);
+  me->work();
+}
+
+// Presents three single-color images as the colors of one image.
+class color_planes_image : public image_wrapper {
+public:
+  color_planes_image(const double_image *planes) : d_planes(planes) {};
+  virtual void read_range(int &minx, int &maxx, int &miny, int &maxy) const {
+    d_planes[0].read_range(minx, maxx, miny, maxy);
+  }
+  virtual unsigned get_num_colors() const { return 3; }
+  using image_wrapper::read_pixel;
+  virtual bool read_pixel(int x, int y, double &result, unsigned rgb = 0) const {
+    return d_planes[rgb].read_pixel(x, y, result);
+  }
+  virtual double read_pixel_nocheck(int x, int y, unsigned rgb = 0) const {
+    return d_planes[rgb].read_pixel_nocheck(x, y);
+  }
+protected:
+  const double_image *d_planes;
+};
+
+bool image_file_writer::render(Job *job, Scratch &scratch)
+{
+  // Find the region to write the way cropped_image does.
+  cropped_image crop(job->source, job->minx, job->miny, job->maxx, job->maxy);
+  if (job->transform.kind == Transform::NONE) {
+    return image_wrapper_fill_tiff_buffer(crop, job->channel, job->scale, job->offset,
+                                          job->buffer, job->numcols, job->numrows);
+  }
+  int minx, maxx, miny, maxy;
+  crop.read_range(minx, maxx, miny, maxy);
+
+  // Transform each color that we are writing.
+  const Transform &t = job->transform;
+  unsigned num_colors = (job->channel < 0) ? 3 : 1;
+  unsigned c;
+  for (c = 0; c < num_colors; c++) {
+    unsigned rgb = (job->channel < 0) ? c : job->channel;
+    bool ok;
+    if (t.kind == Transform::AFFINE) {
+      ok = scratch.engine.transform(job->source, t.dx, t.dy, t.rotation, t.scale,
+                                    t.centerx, t.centery, minx, maxx, miny, maxy,
+                                    scratch.planes[c], rgb);
+    } else {
+      ok = scratch.engine.translate(job->source, t.dx, t.dy, minx, maxx, miny, maxy,
+                                    scratch.planes[c], rgb);
+    }
+    if (!ok) {
+      return false;
+    }
+  }
+  if (num_colors == 1) {
+    return image_wrapper_fill_tiff_buffer(scratch.planes[0], 0, job->scale, job->offset,
+                                          job->buffer, job->numcols, job->numrows);
+  }
+  color_planes_image planes(scratch.planes);
+  return image_wrapper_fill_tiff_buffer(planes, -1, job->scale, job->offset,
+                                        job->buffer, job->numcols, job->numrows);
+}
+
+bool image_file_writer::store(Job *job)
+{
+  unsigned num_colors = (job->channel < 0) ? 3 : 1;
+  if (job->stack) {
+    return job->stack->append_page(&job->buffer[0], job->numcols, job->numrows,
+                                   num_colors, job->sixteen_bits);
+  }
+  return image_wrapper_write_tiff_buffer(job->filename.c_str(), &job->buffer[0],
+                                         job->numcols, job->numrows, num_colors, job->sixteen_bits);
+}
+
+void image_file_writer::work()
+{
+  // The frames are already being done in parallel, so each one's rows
+  // are not.
+  Scratch scratch(false);
+  while (true) {
+    d_work.p();
+    if (d_stop) {
+      return;
+    }
+
+    // Find the oldest job that is waiting.  There is one for each time the
+    // work semaphore was raised.
+    d_lock.p();
+    Job *job = NULL;
+    size_t i;
+    for (i = 0; i < d_jobs.size(); i++) {
+      if (d_jobs[i]->state == Job::QUEUED) {
+        job = d_jobs[i];
+        job->state = Job::RENDERING;
+        break;
+      }
+    }
+    d_lock.v();
+    if (job == NULL) {
+      continue;
+    }
+
+    bool ok = render(job, scratch);
+
+    d_lock.p();
+    if (ok) {
+      job->state = Job::RENDERED;
+    } else {
+      job->state = Job::FAILED;
+      d_failed++;
+      d_done.v();
+    }
+    write_finished_jobs();
+    d_lock.v();
+  }
+}
+
+void image_file_writer::write_finished_jobs()
+{
+  while (true) {
+    // Find the oldest job that has not been written.  If it is not ready,
+    // or someone is already writing it, then there is nothing to do.
+    Job *job = NULL;
+    size_t i;
+    for (i = 0; i < d_jobs.size(); i++) {
+      if ( (d_jobs[i]->state != Job::WRITTEN) && (d_jobs[i]->state != Job::FAILED) ) {
+        job = d_jobs[i];
+        break;
+      }
+    }
+    if ( (job == NULL) || (job->state != Job::RENDERED) ) {
+      return;
+    }
+    job->state = Job::WRITING;
+    d_lock.v();
+    bool ok = store(job);
+    d_lock.p();
+    if (ok) {
+      job->state = Job::WRITTEN;
+      d_written++;
+    } else {
+      job->state = Job::FAILED;
+      d_failed++;
+    }
+    d_done.v();
+  }
+}
+
+void image_file_writer::delete_finished_jobs()
+{
+  d_lock.p();
+  while ( !d_jobs.empty() &&
+          ((d_jobs.front()->state == Job::WRITTEN) || (d_jobs.front()->state == Job::FAILED)) ) {
+    delete d_jobs.front();
+    d_jobs.pop_front();
+  }
+  d_lock.v();
+}
+
+bool image_file_writer::write(const image_wrapper &source, const Transform &transform,
+                              int minx, int miny, int maxx, int maxy, int channel,
+                              double scale, double offset, bool sixteen_bits, const char *filename)
+{
+  // Wait for room in the queue, or drop the frame if we're not supposed to.
+  delete_finished_jobs();
+  if (d_jobs.size() >= d_max_queued) {
+    if (d_drop_when_full) {
+      d_dropped++;
+      return true;
+    }
+    d_waits++;
+    while (d_jobs.size() >= d_max_queued) {
+      d_done.p();
+      delete_finished_jobs();
+    }
+  }
+
+  Job *job = new Job(source);
+  if (job == NULL) {
+    fprintf(stderr, "image_file_writer::write(): Out of memory\n");
+    return false;
+  }
+  job->transform = transform;
+  job->minx = minx; job->miny = miny; job->maxx = maxx; job->maxy = maxy;
+  job->channel = channel;
+  job->scale = scale;
+  job->offset = offset;
+  job->sixteen_bits = sixteen_bits;
+  if (filename) { job->filename = filename; }
+  job->stack = d_stack;
+
+  // With no threads, do the work right here.
+  if (d_threads.empty()) {
+    bool ok = render(job, d_scratch) && store(job);
+    delete job;
+    if (ok) {
+      d_written++;
+    } else {
+      d_failed++;
+    }
+    return ok;
+  }
+
+  d_lock.p();
+  d_jobs.push_back(job);
+  d_lock.v();
+  d_work.v();
+  return true;
+}
+
+bool image_file_writer::flush()
+{
+  delete_finished_jobs();
+  while (!d_jobs.empty()) {
+    d_done.p();
+    delete_finished_jobs();
+  }
+  bool ok = (d_failed == d_failed_reported);
+  d_failed_reported = d_failed;
+  return ok;
+}
+
+bool image_file_writer::open_stack(const char *filename)
+{
+  close_stack();
+  d_stack = new bigtiff_stack_writer();
+  if (d_stack == NULL) {
+    fprintf(stderr, "image_file_writer::open_stack(): Out of memory\n");
+    return false;
+  }
+  if (!d_stack->open(filename)) {
+    delete d_stack;
+    d_stack = NULL;
+    return false;
+  }
+  return true;
+}
+
+void image_file_writer::close_stack()
+{
+  flush();
+  if (d_stack) {
+    delete d_stack;
+    d_stack = NULL;
+  }
+}
@@ -0,0 +1,183 @@
+#ifndef	IMAGE_FILE_WRITER_H
+#define	IMAGE_FILE_WRITER_H
+
+#include  <stdio.h>
+#include  <deque>
+#include  <string>
+#include  <vector>
+#include  <vrpn_Shared.h>
+#include  "base_camera_server.h"
+#include  "counting_semaphore.h"
+#include  "image_wrapper.h"
+
+// Stacks are often longer than 4GB, so we need 64-bit file offsets.
+// As in raw_file_server, we rely on long being 64 bits off Windows.
+#if defined(_WIN32) && !defined(__MINGW32__)
+  typedef __int64 tiff_file_offset;
+#else
+  typedef long tiff_file_offset;
+#endif
+
+//----------------------------------------------------------------------------
+// Writes uncompressed pages to a multi-page BigTIFF file as they arrive, so
+// that a long run can be stored in one file rather than one file per frame.
+// BigTIFF uses 64-bit offsets, so the file can grow past 4GB.  Each page is
+// one strip of 8- or 16-bit pixels with one or three colors, taken from a
+// buffer filled in by image_wrapper_fill_tiff_buffer().  8-bit pages get the
+// high byte of each value.  The file is valid after each page is added.
+
+class bigtiff_stack_writer {
+public:
+  bigtiff_stack_writer();
+  ~bigtiff_stack_writer();
+
+  /// Create the file, replacing any that is there.  Returns false on failure.
+  bool  open(const char *filename);
+
+  /// Close the file (also done by the destructor).
+  void  close();
+
+  /// Is a file open?
+  bool  is_open() const { return d_file != NULL; }
+
+  /// Add a page to the end of the file.  Returns false on failure.
+  bool  append_page(const vrpn_uint16 *buffer, int numcols, int numrows,
+                    unsigned num_colors, bool sixteen_bits);
+
+  /// Number of pages written so far.
+  unsigned  num_pages() const { return d_pages; }
+
+protected:
+  FILE              *d_file;            //< The file being written
+  tiff_file_offset  d_end;              //< Offset of the end of the file
+  tiff_file_offset  d_next_ifd_link;    //< Where to store the offset of the next page's directory
+  unsigned          d_pages;            //< How many pages have been written
+  std::vector<unsigned char>  d_bytes;  //< Staging for one page, reused
+
+  bool  write_at(tiff_file_offset offset, const unsigned char *bytes, size_t count);
+
+private:
+  // Not copyable.
+  bigtiff_stack_writer(const bigtiff_stack_writer &);
+  bigtiff_stack_writer &operator=(const bigtiff_stack_writer &);
+};
+
+//----------------------------------------------------------------------------
+// Writes frames to TIFF files in the background, so that the program that
+// makes them does not wait on resampling and file output.  Each frame is a
+// snapshot of a source image (copy_of_image, which shares the pixels when
+// the source is itself a copy) along with an optional translation or affine
+// transform and a region to crop.  Worker threads resample and scale the
+// frames in parallel; the results are then written one at a time, in the
+// order the frames were queued, either to one file per frame or as pages of
+// one BigTIFF stack.
+//
+// At most max_queued frames are waiting or being worked on.  When the queue
+// is full, write() either waits for room (counting a backpressure wait) or
+// drops the frame (counting it), depending on how the writer was made.  With
+// zero threads, each frame is written before write() returns.  The methods
+// should all be called from one thread.
+
+class image_file_writer {
+public:
+  // How to map the output pixels back into the source image; see
+  // translated_image and affine_transformed_image.
+  class Transform {
+  public:
+    enum { NONE, TRANSLATE, AFFINE } kind;
+    double  dx, dy;             //< Translation
+    double  rotation, scale;    //< Rotation (radians) and scale, for AFFINE
+    double  centerx, centery;   //< Center of rotation and scale, for AFFINE
+
+    Transform() : kind(NONE), dx(0), dy(0), rotation(0), scale(1), centerx(0), centery(0) {};
+  };
+
+  image_file_writer(unsigned num_threads, unsigned max_queued = 8, bool drop_when_full = false);
+  ~image_file_writer();   //< Finishes writing any queued frames
+
+  /// Write the frames queued from now on as pages in the named BigTIFF file
+  // rather than to their own files.  Waits for frames already queued to be
+  // written.  Returns false if the file cannot be created.
+  bool  open_stack(const char *filename);
+
+  /// Go back to one file per frame, closing any stack file after the
+  // frames queued for it have been written.
+  void  close_stack();
+
+  /// Queue a frame to be written.  The region from (minx,miny) to
+  // (maxx,maxy) of the transformed image is written (max less than min
+  // means the whole image).  A channel less than zero writes an RGB image;
+  // otherwise that color is written as grayscale.  Pixel values are
+  // scaled and offset as in image_wrapper::write_to_tiff_file().  The
+  // filename is ignored while a stack is open.  Returns false if the frame
+  // could not be queued or (with no threads) written.
+  bool  write(const image_wrapper &source, const Transform &transform,
+              int minx, int miny, int maxx, int maxy, int channel,
+              double scale, double offset, bool sixteen_bits, const char *filename);
+
+  /// Wait until all queued frames have been written.  Returns false if any
+  // frame has failed to be written since the last call.
+  bool  flush();
+
+  /// Counters since the writer was made.
+  unsigned  frames_written() const { return d_written; }
+  unsigned  frames_failed() const { return d_failed; }
+  unsigned  frames_dropped() const { return d_dropped; }
+  unsigned  backpressure_waits() const { return d_waits; }
+
+protected:
+  class Job {
+  public:
+    Job(const image_wrapper &image) : source(image), state(QUEUED) {};
+    enum { QUEUED, RENDERING, RENDERED, WRITING, WRITTEN, FAILED };
+
+    copy_of_image   source;
+    Transform       transform;
+    int             minx, miny, maxx, maxy;
+    int             channel;
+    double          scale, offset;
+    bool            sixteen_bits;
+    std::string     filename;
+    bigtiff_stack_writer *stack;          //< Stack to append to, or NULL for a file
+    int             state;
+    std::vector<vrpn_uint16>  buffer;     //< Pixels ready to write
+    int             numcols, numrows;
+  };
+
+  // What a worker keeps from one frame to the next.
+  class Scratch {
+  public:
+    Scratch(bool parallel) : engine(parallel) {};
+    affine_warp_engine  engine;
+    double_image        planes[3];          //< Transformed colors of the frame
+  };
+
+  // Jobs are only made and deleted by the main thread.
+  std::deque<Job *>           d_jobs;     //< Queued frames, in the order they will be written
+  std::vector<vrpn_Thread *>  d_threads;  //< Workers
+  vrpn_Semaphore              d_lock;     //< Protects d_jobs, the job states, and the counters
+  counting_semaphore          d_work;     //< Counts queued frames for the workers
+  counting_semaphore          d_done;     //< Raised each time a frame is written or fails
+  volatile bool               d_stop;     //< Tells the workers to exit
+  unsigned                    d_max_queued;
+  bool                        d_drop_when_full;
+  bigtiff_stack_writer        *d_stack;   //< Stack for new frames, NULL for one file each
+  unsigned                    d_written, d_failed, d_dropped, d_waits;
+  unsigned                    d_failed_reported;  //< d_failed at the last flush()
+  Scratch                     d_scratch;  //< For frames written with no threads
+
+
+  static bool render(Job *job, Scratch &scratch);
+  static bool store(Job *job);
+  void  work();
+  void  write_finished_jobs();            //< Call with d_lock held
+  void  delete_finished_jobs();           //< Call from the main thread
+  static void thread_func(vrpn_ThreadData &threadData);
+
+private:
+  // Not copyable.
+  image_file_writer(const image_file_writer &);
+  image_file_writer &operator=(const image_file_writer &);
+};
+
+#endif
@@ -1,8 +1,10 @@
 #include  <stdlib.h>
 #include  <math.h>
 #include  <stdio.h>
+#include  <algorithm>
 
 #include  "image_wrapper.h"
+#include  "spot_tracker_simd.h"
 
 disc_image::disc_image(int minx, int maxx, int miny, int maxy,
 		       double background, double noise,
@@ -358,6 +360,91 @@ multi_cone_image::multi_cone_image(std::vector<bead>& b,
   }
 }
 
+void Gaussian_kernel_model::compute_axis(int min, int max, double center,
+	     double std_dev, double scale, sampling how, int oversample,
+	     std::vector<double> &terms)
+{
+  int n = max - min + 1;
+  if (n <= 0) {
+    terms.clear();
+    return;
+  }
+  terms.resize(n);
+  double B = -1 / (2 * std_dev * std_dev);
+  int i;
+  switch (how) {
+    case POINT_SAMPLED:
+      for (i = 0; i < n; i++) {
+        double x = (min + i) - center;
+        terms[i] = scale * exp(B * x * x);
+      }
+      break;
+
+    case OVERSAMPLED:
+      // This takes the same samples as ComputeGaussianVolume() does in
+      // each direction.
+      if (oversample < 1) { oversample = 1; }
+      for (i = 0; i < n; i++) {
+        double x0 = ((min + i) - center) - 0.5;  // The left edge of the pixel in Gaussian space
+        double x1 = x0 + 1;                      // The right edge of the pixel in Gaussian space
+        double sx = (x1 - x0) / oversample;
+        double sum = 0, count = 0, x;
+        for (x = x0 + sx/2; x < x1; x += sx) {
+          sum += exp(B * x * x);
+          count++;
+        }
+        terms[i] = scale * (sum / count) * (x1 - x0);
+      }
+      break;
+
+    case INTEGRATED:
+      // Neighboring pixels share an edge, so we find the error function at
+      // each edge once.
+      {
+        _edges.resize(n + 1);
+        double edge_scale = 1 / (std_dev * sqrt(2.0));
+        for (i = 0; i <= n; i++) {
+          _edges[i] = erf( (((min + i) - center) - 0.5) * edge_scale );
+        }
+        for (i = 0; i < n; i++) {
+          terms[i] = scale * 0.5 * (_edges[i+1] - _edges[i]);
+        }
+      }
+      break;
+  }
+}
+
+void Gaussian_kernel_model::compute(int minx, int maxx, int miny, int maxy,
+	     double centerx, double centery, double std_dev,
+	     double summedvolume, sampling how, int oversample)
+{
+  _minx = minx; _maxx = maxx; _miny = miny; _maxy = maxy;
+
+  // The sampled versions take the height of the Gaussian from its volume;
+  // the integrated one finds the fraction of the volume in each pixel.
+  double scale = summedvolume;
+  if (how != INTEGRATED) {
+    scale /= 2 * M_PI * std_dev * std_dev;
+  }
+  compute_axis(minx, maxx, centerx, std_dev, scale, how, oversample, _column);
+  compute_axis(miny, maxy, centery, std_dev, 1.0, how, oversample, _row);
+}
+
+void Gaussian_kernel_model::fill(double *buffer, int y_stride, double background) const
+{
+  int nx = static_cast<int>(_column.size());
+  int ny = static_cast<int>(_row.size());
+  const double *column = nx ? &_column[0] : NULL;
+  int x, y;
+  for (y = 0; y < ny; y++) {
+    double *out = buffer + y * y_stride;
+    double r = _row[y];
+    for (x = 0; x < nx; x++) {
+      out[x] = background + column[x] * r;
+    }
+  }
+}
+
 Integrated_Gaussian_image::Integrated_Gaussian_image(int minx, int maxx, int miny, int maxy,
 	     double background, double noise,
 	     double centerx, double centery, double std_dev,
@@ -373,52 +460,56 @@ void Integrated_Gaussian_image::recompute(double background, double noise,
 	     double centerx, double centery, double std_dev,
 	     double summedvolume, int oversample)
 {
+  new_generation();
   _oversample = oversample;
   int i,j, index;
+  if (_image == NULL) { return; }
 
     // Fill in the background intensity.
-  for (i = _minx; i <= _maxx; i++) {
-    for (j = _miny; j <= _maxy; j++) {
+  for (j = _miny; j <= _maxy; j++) {
+    for (i = _minx; i <= _maxx; i++) {
       write_pixel_nocheck(i, j, _background);
     }
   }
 
-//  XXX Verify that this centers the pixel like it should.
-  // Compute where the samples should be taken.  These need to be taken
-  // symmetrically around the pixel center and cover all samples within
-  // the pixel exactly once.  First, compute the step size between the
-  // samples, then the one with the smallest value that lies within a
-  // half-pixel-width of the center of the pixel as the starting offset.
-  // Proceeed until we exceed a half-pixel-radius on the high side of
-  // the pixel.
-
-  // Fill in the Gaussian intensity plus background plus noise (if any).
+  // Fill in the Gaussian intensity plus background plus noise (if any)
+  // within 3.5 standard deviations of the center.
   // Note that the area under the curve for the unit Gaussian is 1; we
   // multiply by the summedvolume (which needs to be the sum above or
   // below the background) to produce an overall volume matching the
-  // one requested.
+  // one requested.  We assume 1-meter pixels, which makes std dev and
+  // other be in pixel units without conversion.
 #ifdef	DEBUG
   printf("Gaussian_image::recompute(): Making Gaussian of standard deviation %lg, background %lg, volume %lg\n", std_dev, background, summedvolume);
 #endif
-  for (i = (int)floor(centerx - (3.5*std_dev)); i <= (int)ceil(centerx + (3.5*std_dev)); i++) {
-	for (j = (int)floor(centery - (3.5*std_dev)); j <= (int)ceil(centery + (3.5*std_dev)); j++) {
-      double x0 = (i - centerx) - 0.5;    // The left edge of the pixel in Gaussian space
-      double x1 = x0 + 1;                 // The right edge of the pixel in Gaussian space
-      double y0 = (j - centery) - 0.5;    // The bottom edge of the pixel in Gaussian space
-      double y1 = y0 + 1;                 // The top edge of the pixel in Gaussian space
-      if (find_index(i,j,index)) {
-        // For this call to ComputeGaussianVolume, we assume 1-meter pixels.
-        // This makes std dev and other be in pixel units without conversion.
-	_image[index] = background + ComputeGaussianVolume(summedvolume, std_dev,
-                        x0,x1, y0,y1, _oversample);
-        
-        // Add zero-mean uniform noise to the image, with the specified width
-        if (noise > 0.0) {
-	  double  unit_rand = (double)(rand()) / RAND_MAX;
-	  _image[index] += (unit_rand - 0.5) * 2 * noise;
+  int lowx = (int)floor(centerx - (3.5*std_dev));
+  int highx = (int)ceil(centerx + (3.5*std_dev));
+  int lowy = (int)floor(centery - (3.5*std_dev));
+  int highy = (int)ceil(centery + (3.5*std_dev));
+  if (lowx < _minx) { lowx = _minx; }
+  if (highx > _maxx) { highx = _maxx; }
+  if (lowy < _miny) { lowy = _miny; }
+  if (highy > _maxy) { highy = _maxy; }
+  if ( (lowx > highx) || (lowy > highy) ) { return; }
+  _model.compute(lowx, highx, lowy, highy, centerx, centery, std_dev, summedvolume,
+    _oversample > 0 ? Gaussian_kernel_model::OVERSAMPLED : Gaussian_kernel_model::INTEGRATED,
+    _oversample);
+
+  if (noise > 0.0) {
+    // Add zero-mean uniform noise to the image, with the specified width.
+    // Go through the pixels in the same order as always so that the same
+    // random numbers land on the same pixels.
+    for (i = lowx; i <= highx; i++) {
+      for (j = lowy; j <= highy; j++) {
+        if (find_index(i, j, index)) {
+          double  unit_rand = (double)(rand()) / RAND_MAX;
+          _image[index] = background + _model.value(i, j) + (unit_rand - 0.5) * 2 * noise;
         }
       }
     }
+  } else {
+    int nx = _maxx - _minx + 1;
+    _model.fill(&_image[(lowx - _minx) + (lowy - _miny) * nx], nx, background);
   }
 }
 
@@ -437,19 +528,11 @@ void Integrated_multi_Gaussian_image::multi_recompute(std::vector<bead>& b,
          double background, double noise,
 	     int oversample)
 {
+  new_generation();
   _oversample = oversample;
   int i,j, index;
   double summedvolume;
 
-//  XXX Verify that this centers the pixel like it should.
-  // Compute where the samples should be taken.  These need to be taken
-  // symmetrically around the pixel center and cover all samples within
-  // the pixel exactly once.  First, compute the step size between the
-  // samples, then the one with the smallest value that lies within a
-  // half-pixel-width of the center of the pixel as the starting offset.
-  // Proceeed until we exceed a half-pixel-radius on the high side of
-  // the pixel.
-
   // Fill in the Gaussian intensity plus background plus noise (if any).
   // Note that the area under the curve for the unit Gaussian is 1; we
   // multiply by the summedvolume (which needs to be the sum above or
@@ -457,8 +540,8 @@ void Integrated_multi_Gaussian_image::multi_recompute(std::vector<bead>& b,
   // one requested.
   
   // Fill in the background intensity.
-  for (i = _minx; i <= _maxx; i++) {
-    for (j = _miny; j <= _maxy; j++) {
+  for (j = _miny; j <= _maxy; j++) {
+    for (i = _minx; i <= _maxx; i++) {
       write_pixel_nocheck(i, j, background);
     }
   }
@@ -468,17 +551,16 @@ void Integrated_multi_Gaussian_image::multi_recompute(std::vector<bead>& b,
   printf("multi_Gaussian_image::multi_recompute(): Making Gaussian of standard deviation %lg, background %lg, volume %lg\n",
           b[bead].r, background, b[bead].intensity * b[bead].r*b[bead].r * 2 * M_PI);
 #endif
-    for (i = _minx; i <= _maxx; i++) {
-      for (j = _miny; j <= _maxy; j++) {
-        double x0 = (i - b[bead].x) - 0.5;    // The left edge of the pixel in Gaussian space
-        double x1 = x0 + 1;                   // The right edge of the pixel in Gaussian space
-        double y0 = (j - b[bead].y) - 0.5;    // The bottom edge of the pixel in Gaussian space
-        double y1 = y0 + 1;                   // The top edge of the pixel in Gaussian space
+    // We assume 1-meter pixels.  This makes std dev and other be in
+    // pixel units without conversion.
+    summedvolume = b[bead].intensity * b[bead].r*b[bead].r * 2 * M_PI;
+    _model.compute(_minx, _maxx, _miny, _maxy, b[bead].x, b[bead].y, b[bead].r, summedvolume,
+      _oversample > 0 ? Gaussian_kernel_model::OVERSAMPLED : Gaussian_kernel_model::INTEGRATED,
+      _oversample);
+    for (j = _miny; j <= _maxy; j++) {
+      for (i = _minx; i <= _maxx; i++) {
         if (find_index(i,j,index)) {
-          // For this call to ComputeGaussianVolume, we assume 1-meter pixels.
-          // This makes std dev and other be in pixel units without conversion.
-          summedvolume = b[bead].intensity * b[bead].r*b[bead].r * 2 * M_PI;
-          _image[index] += ComputeGaussianVolume(summedvolume, b[bead].r, x0,x1, y0,y1, _oversample); 
+          _image[index] += _model.value(i, j);
         }
       }
     }
@@ -626,15 +708,396 @@ rod_image::rod_image(int minx, int maxx, int miny, int maxy,
 }
 
 
-// XXX This could be made much faster if needed.
+//----------------------------------------------------------------------------
+// Gaussian blur engine.
+
+// Standard deviation at and above which AUTOMATIC uses the recursive filter.
+static const float RECURSIVE_BLUR_MIN_STD = 4.0f;
+
+// Width (in pixels) of the strips that the separable column pass works on,
+// so that the rows it is summing stay in the cache from one output row to
+// the next.
+static const int BLUR_STRIP_WIDTH = 1024;
+
+gaussian_blur_engine::blur_method gaussian_blur_engine::choose_method(
+  blur_method method, float std) const
+{
+  if (method == AUTOMATIC) {
+    method = (std >= RECURSIVE_BLUR_MIN_STD) ? RECURSIVE : SEPARABLE;
+  }
+  if ( (method == RECURSIVE) && (std < 0.5) ) {
+    method = SEPARABLE;
+  }
+  return method;
+}
+
+bool gaussian_blur_engine::check_output(const float_image &output) const
+{
+  int minx, maxx, miny, maxy;
+  output.read_range(minx, maxx, miny, maxy);
+  if ( (minx != 0) || (miny != 0) || (maxx != d_nx-1) || (maxy != d_ny-1) ) {
+    fprintf(stderr,"gaussian_blur_engine: Output image does not match input size\n");
+    return false;
+  }
+  return true;
+}
+
+template <class T>
+static void copy_view_row(const image_buffer_view &view, int y, unsigned rgb,
+                          int nx, float *row)
+{
+  const T *p = view.pixel<T>(0, y, rgb);
+  int x;
+  for (x = 0; x < nx; x++) {
+    row[x] = static_cast<float>(p[x * view.x_stride]);
+  }
+}
+
+// Copy the input into d_input one row at a time, with pad zeroes on each
+// side of each row.  Read the input's buffer directly if it will hand it
+// out.
+bool gaussian_blur_engine::load_input(const image_wrapper &input, unsigned pad, unsigned rgb)
+{
+  d_nx = input.get_num_columns();
+  d_ny = input.get_num_rows();
+  if ( (d_nx <= 0) || (d_ny <= 0) ) {
+    fprintf(stderr,"gaussian_blur_engine::load_input(): Empty input image\n");
+    return false;
+  }
+  d_pad = pad;
+  int width = d_nx + 2*d_pad;
+  d_input.resize(width * d_ny);
+
+  image_buffer_view view;
+  bool direct = input.get_buffer_view(view) &&
+    (view.minx <= 0) && (view.maxx >= d_nx-1) &&
+    (view.miny <= 0) && (view.maxy >= d_ny-1) && (rgb < view.num_colors);
+  int y;  // Needs to be int for OpenMP
+  #pragma omp parallel for
+  for (y = 0; y < d_ny; y++) {
+    float *row = &d_input[y * width];
+    int x;
+    for (x = 0; x < d_pad; x++) {
+      row[x] = 0;
+      row[d_pad + d_nx + x] = 0;
+    }
+    row += d_pad;
+    if (direct) {
+      switch (view.type) {
+        case image_buffer_view::UINT8: copy_view_row<vrpn_uint8>(view, y, rgb, d_nx, row); continue;
+        case image_buffer_view::UINT16: copy_view_row<vrpn_uint16>(view, y, rgb, d_nx, row); continue;
+        case image_buffer_view::FLOAT: copy_view_row<float>(view, y, rgb, d_nx, row); continue;
+        case image_buffer_view::DOUBLE: copy_view_row<double>(view, y, rgb, d_nx, row); continue;
+        default: break;
+      }
+    }
+    for (x = 0; x < d_nx; x++) {
+      row[x] = static_cast<float>(input.read_pixel_nocheck(x, y, rgb));
+    }
+  }
+  return true;
+}
+
+// Fill in the 1D kernel whose outer product with itself is the
+// Integrated_Gaussian_image that the 2D convolution used: each entry is the
+// mean of four point samples across its pixel, and entries whose pixels
+// are more than 3.5 standard deviations from the center are zero.  The
+// scale factors of the Gaussian cancel out in the normalization, so they
+// are left out.
+static void make_blur_kernel(unsigned aperture, float std, std::vector<float> &kernel)
+{
+  int size = 2 * aperture + 1;
+  kernel.assign(size, 0.0f);
+  double center = aperture;
+  int lo = static_cast<int>(floor(center - 3.5*std));
+  int hi = static_cast<int>(ceil(center + 3.5*std));
+  if (lo < 0) { lo = 0; }
+  if (hi > size - 1) { hi = size - 1; }
+  double B = -1 / (2.0 * std * std);
+  int i;
+  for (i = lo; i <= hi; i++) {
+    double x0 = (i - center) - 0.5;
+    double x1 = x0 + 1;
+    double sx = (x1 - x0) / 4;
+    double sum = 0, count = 0, x;
+    for (x = x0 + sx/2; x < x1; x += sx) {
+      sum += exp(B * x * x);
+      count++;
+    }
+    kernel[i] = static_cast<float>(sum / count);
+  }
+}
+
+// For each of n positions, one over the sum of the kernel entries that
+// land inside [0,n), so that dividing by it keeps the average brightness
+// constant near the borders.
+static void make_edge_scale(const std::vector<float> &kernel, int n,
+                            std::vector<float> &scale)
+{
+  int a = static_cast<int>(kernel.size() - 1) / 2;
+  scale.resize(n);
+  int x, i;
+  for (x = 0; x < n; x++) {
+    double weight = 0;
+    for (i = -a; i <= a; i++) {
+      if ( (x+i >= 0) && (x+i < n) ) { weight += kernel[i+a]; }
+    }
+    scale[x] = (weight > 0) ? static_cast<float>(1 / weight) : 0.0f;
+  }
+}
+
+void gaussian_blur_engine::blur_separable(unsigned aperture, float std,
+  float_image &output, const float_image *subtract_from, double offset)
+{
+  int a = aperture;
+  make_blur_kernel(aperture, std, d_kernel);
+  make_edge_scale(d_kernel, d_nx, d_x_scale);
+  make_edge_scale(d_kernel, d_ny, d_y_scale);
+
+  // Row pass, into d_rows with a zero rows above and below so that the
+  // column pass can run off the ends.
+  int width = d_nx + 2*d_pad;
+  d_rows.resize((d_ny + 2*a) * d_nx);
+  std::fill(d_rows.begin(), d_rows.begin() + a*d_nx, 0.0f);
+  std::fill(d_rows.end() - a*d_nx, d_rows.end(), 0.0f);
+  int y;  // Needs to be int for OpenMP
+  #pragma omp parallel for
+  for (y = 0; y < d_ny; y++) {
+    float *out = &d_rows[(y + a) * d_nx];
+    const float *in = &d_input[y * width + d_pad - a];
+    int x, i;
+    for (x = 0; x < d_nx; x++) { out[x] = 0; }
+    for (i = 0; i <= 2*a; i++) {
+      if (d_kernel[i] != 0) {
+        VST_simd_multiply_add(out, in + i, d_kernel[i], d_nx);
+      }
+    }
+    for (x = 0; x < d_nx; x++) { out[x] *= d_x_scale[x]; }
+  }
+
+  // Column pass, one strip of columns at a time.
+  int start;
+  for (start = 0; start < d_nx; start += BLUR_STRIP_WIDTH) {
+    int count = d_nx - start;
+    if (count > BLUR_STRIP_WIDTH) { count = BLUR_STRIP_WIDTH; }
+    #pragma omp parallel for
+    for (y = 0; y < d_ny; y++) {
+      float sum[BLUR_STRIP_WIDTH];
+      int x, j;
+      for (x = 0; x < count; x++) { sum[x] = 0; }
+      for (j = 0; j <= 2*a; j++) {
+        if (d_kernel[j] != 0) {
+          VST_simd_multiply_add(sum, &d_rows[(y + j) * d_nx + start], d_kernel[j], count);
+        }
+      }
+      float scale = d_y_scale[y];
+      if (subtract_from) {
+        for (x = 0; x < count; x++) {
+          output.write_pixel_nocheck(start + x, y,
+            subtract_from->read_pixel_nocheck(start + x, y) - sum[x] * scale + offset);
+        }
+      } else {
+        for (x = 0; x < count; x++) {
+          output.write_pixel_nocheck(start + x, y, sum[x] * scale);
+        }
+      }
+    }
+  }
+}
+
+// Coefficients for the recursive Gaussian filter from I. T. Young and
+// L. J. van Vliet, "Recursive implementation of the Gaussian filter",
+// Signal Processing 44 (1995), pp. 139-151.  Each output is B times the
+// input plus c[0..2] times the previous three outputs.
+static void recursive_blur_coefficients(double std, double &B, double c[3])
+{
+  double q;
+  if (std >= 2.5) {
+    q = 0.98711 * std - 0.96330;
+  } else {
+    q = 3.97156 - 4.14554 * sqrt(1 - 0.26891 * std);
+  }
+  double q2 = q*q, q3 = q2*q;
+  double b0 = 1.57825 + 2.44413*q + 1.4281*q2 + 0.422205*q3;
+  double b1 = 2.44413*q + 2.85619*q2 + 1.26661*q3;
+  double b2 = -(1.4281*q2 + 1.26661*q3);
+  double b3 = 0.422205*q3;
+  c[0] = b1 / b0;
+  c[1] = b2 / b0;
+  c[2] = b3 / b0;
+  B = 1 - (c[0] + c[1] + c[2]);
+}
+
+// Run the forward then the backward filter over a line in place.  The
+// line should end with enough zeroes for the forward response to die out.
+static void recursive_blur_line(double *line, int n, double B, const double c[3])
+{
+  double w1 = 0, w2 = 0, w3 = 0;
+  int i;
+  for (i = 0; i < n; i++) {
+    double w = B * line[i] + c[0]*w1 + c[1]*w2 + c[2]*w3;
+    line[i] = w; w3 = w2; w2 = w1; w1 = w;
+  }
+  w1 = w2 = w3 = 0;
+  for (i = n-1; i >= 0; i--) {
+    double w = B * line[i] + c[0]*w1 + c[1]*w2 + c[2]*w3;
+    line[i] = w; w3 = w2; w2 = w1; w1 = w;
+  }
+}
+
+// Filtering a line of n ones followed by zeroes tells how much of the
+// kernel lands inside the image at each position.
+static void make_recursive_edge_scale(int n, int tail, double B, const double c[3],
+                                      std::vector<double> &line, std::vector<float> &scale)
+{
+  line.assign(n + tail, 0.0);
+  int i;
+  for (i = 0; i < n; i++) { line[i] = 1; }
+  recursive_blur_line(&line[0], n + tail, B, c);
+  scale.resize(n);
+  for (i = 0; i < n; i++) {
+    scale[i] = (line[i] > 0) ? static_cast<float>(1 / line[i]) : 0.0f;
+  }
+}
+
+void gaussian_blur_engine::blur_recursive(float std,
+  float_image &output, const float_image *subtract_from, double offset)
+{
+  double B, c[3];
+  recursive_blur_coefficients(std, B, c);
+  int tail = static_cast<int>(ceil(5 * std));
+  make_recursive_edge_scale(d_nx, tail, B, c, d_iir_line, d_x_scale);
+  make_recursive_edge_scale(d_ny, tail, B, c, d_iir_line, d_y_scale);
+
+  // Filter each row in place in d_iir, which has tail extra zeroes at the
+  // end of each row and tail extra rows of zeroes at the bottom.
+  int width = d_nx + tail;
+  int height = d_ny + tail;
+  d_iir.resize(width * height);
+  std::fill(d_iir.begin() + d_ny * width, d_iir.end(), 0.0);
+  int y;  // Needs to be int for OpenMP
+  #pragma omp parallel for
+  for (y = 0; y < d_ny; y++) {
+    double *line = &d_iir[y * width];
+    const float *in = &d_input[y * (d_nx + 2*d_pad) + d_pad];
+    int x;
+    for (x = 0; x < d_nx; x++) { line[x] = in[x]; }
+    for (x = d_nx; x < width; x++) { line[x] = 0; }
+    recursive_blur_line(line, width, B, c);
+  }
+
+  // Filter the columns by running the recursion down whole rows at a time,
+  // so that memory is read in order.  Split the columns into strips to run
+  // in parallel.
+  int strip;
+  int num_strips = (d_nx + BLUR_STRIP_WIDTH - 1) / BLUR_STRIP_WIDTH;
+  #pragma omp parallel for
+  for (strip = 0; strip < num_strips; strip++) {
+    int start = strip * BLUR_STRIP_WIDTH;
+    int end = start + BLUR_STRIP_WIDTH;
+    if (end > d_nx) { end = d_nx; }
+    int row, x;
+    for (row = 0; row < height; row++) {
+      double *w0 = &d_iir[row * width];
+      const double *w1 = (row >= 1) ? w0 - width : NULL;
+      const double *w2 = (row >= 2) ? w0 - 2*width : NULL;
+      const double *w3 = (row >= 3) ? w0 - 3*width : NULL;
+      for (x = start; x < end; x++) {
+        w0[x] = B * w0[x] + c[0] * (w1 ? w1[x] : 0) + c[1] * (w2 ? w2[x] : 0) + c[2] * (w3 ? w3[x] : 0);
+      }
+    }
+    for (row = height-1; row >= 0; row--) {
+      double *w0 = &d_iir[row * width];
+      const double *w1 = (row+1 < height) ? w0 + width : NULL;
+      const double *w2 = (row+2 < height) ? w0 + 2*width : NULL;
+      const double *w3 = (row+3 < height) ? w0 + 3*width : NULL;
+      for (x = start; x < end; x++) {
+        w0[x] = B * w0[x] + c[0] * (w1 ? w1[x] : 0) + c[1] * (w2 ? w2[x] : 0) + c[2] * (w3 ? w3[x] : 0);
+      }
+    }
+  }
+
+  #pragma omp parallel for
+  for (y = 0; y < d_ny; y++) {
+    const double *line = &d_iir[y * width];
+    double yscale = d_y_scale[y];
+    int x;
+    if (subtract_from) {
+      for (x = 0; x < d_nx; x++) {
+        output.write_pixel_nocheck(x, y,
+          subtract_from->read_pixel_nocheck(x, y) - line[x] * d_x_scale[x] * yscale + offset);
+      }
+    } else {
+      for (x = 0; x < d_nx; x++) {
+        output.write_pixel_nocheck(x, y, line[x] * d_x_scale[x] * yscale);
+      }
+    }
+  }
+}
+
+bool gaussian_blur_engine::blur(const image_wrapper &input,
+  unsigned aperture, float std, float_image &output,
+  blur_method method, unsigned rgb)
+{
+  method = choose_method(method, std);
+  if (!load_input(input, method == SEPARABLE ? aperture : 0, rgb)) { return false; }
+  if (!check_output(output)) { return false; }
+  output.new_generation();
+  if (method == SEPARABLE) {
+    blur_separable(aperture, std, output, NULL, 0);
+  } else {
+    blur_recursive(std, output, NULL, 0);
+  }
+  return true;
+}
+
+bool gaussian_blur_engine::difference_of_gaussians(const image_wrapper &input,
+  unsigned aperture, float std,
+  unsigned surround_aperture, float surround_std,
+  double offset,
+  float_image &blurred, float_image &surround,
+  blur_method method, unsigned rgb)
+{
+  blur_method center_method = choose_method(method, std);
+  blur_method surround_method = choose_method(method, surround_std);
+  unsigned pad = 0;
+  if ( (center_method == SEPARABLE) && (aperture > pad) ) { pad = aperture; }
+  if ( (surround_method == SEPARABLE) && (surround_aperture > pad) ) { pad = surround_aperture; }
+  if (!load_input(input, pad, rgb)) { return false; }
+  if (!check_output(blurred) || !check_output(surround)) { return false; }
+  blurred.new_generation();
+  surround.new_generation();
+
+  if (center_method == SEPARABLE) {
+    blur_separable(aperture, std, blurred, NULL, 0);
+  } else {
+    blur_recursive(std, blurred, NULL, 0);
+  }
+  if (surround_method == SEPARABLE) {
+    blur_separable(surround_aperture, surround_std, surround, &blurred, offset);
+  } else {
+    blur_recursive(surround_std, surround, &blurred, offset);
+  }
+  return true;
+}
+
 gaussian_blurred_image::gaussian_blurred_image(const image_wrapper &input
     , const unsigned aperture
-    , const float std)
+    , const float std
+    , gaussian_blur_engine::blur_method method)
     : float_image(0, input.get_num_columns()-1,
                    0, input.get_num_rows()-1)
+{
+  recompute(input, aperture, std, method);
+}
+
+bool gaussian_blurred_image::recompute(const image_wrapper &input
+    , const unsigned aperture
+    , const float std
+    , gaussian_blur_engine::blur_method method)
 {
   // If we have no buffer, we're hopeless.
-  if (_image == NULL) { return; }
+  if (!resize(0, input.get_num_columns()-1, 0, input.get_num_rows()-1)) { return false; }
 
   //printf("dbg: Aperture = %u\n", aperture);
   //printf("dbg: Std = %f\n", std);
@@ -714,110 +1177,366 @@ gaussian_blurred_image::gaussian_blurred_image(const image_wrapper &input
       }
     }
   #else
-    // Faster version of convolution that avoids checking for boundary
-    // conditions on the images.  We first create a Gaussian kernel image
-    // and copy it into a buffer that is fast for reading.  We then copy
-    // the input image into a buffer that has a border around it so we can
-    // run past during convolution.  Inside the original image, we place
-    // the values; outside, zero.  We then make a second weighting image
-    // that has weights of 1 inside the image an 0 in the border.  That way,
-    // we can run the same algorithm at every pixel and not have to check
-    // whether we're going outside the image.  We write the results directly
-    // into our floating-point image values.
+    // Separable (or recursive) version that makes a pass along the rows and
+    // then one along the columns; see gaussian_blur_engine.
+    if (!d_engine.blur(input, aperture, std, *this, method)) { return false; }
+  #endif
+  }
+  return true;
+}
 
-    // Construct a temporary Gaussian image with a size that is twice
-    // the aperture plus one to store the Gaussian with which we will
-    // convolve the input image.  Fill it with the subset of a unit
-    // Gaussian whose standard deviation is the one passed in.
-    unsigned kernel_size = 2 * aperture + 1;
-    Integrated_Gaussian_image kernel(0, kernel_size - 1, 0, kernel_size - 1,
-      0, 0, aperture, aperture, std, 1, 4);
+template <class T>
+static void copy_view_row_to_image(const image_buffer_view &view, int x0, int y, unsigned rgb,
+                                   int nx, float_image &out)
+{
+  const T *p = view.pixel<T>(x0, y, rgb);
+  int x;
+  for (x = 0; x < nx; x++) {
+    out.write_pixel_nocheck(x0 + x, y, p[x * view.x_stride]);
+  }
+}
 
-    // Construct a temporary floating-point image to store the padded
-    // version of the input image.  Fill the boundaries with zeroes and
-    // then fill the image with values.
-    float_image copy(0, input.get_num_columns() + 2*aperture -1,
-                     0, input.get_num_rows() + 2*aperture -1);
-    int x;  // Needs to be int for OpenMP
-    // We parallelize the inner loop here because aperture will be small.
-    for (x = 0; x < (int)(aperture); x++) {
-      int y;  // Needs to be int for OpenMP
-      #pragma omp parallel for
-      for (y = 0; y < (int)(input.get_num_rows() + 2 * aperture); y++) {
-        copy.write_pixel_nocheck(x, y, 0);
-        copy.write_pixel_nocheck(input.get_num_columns() + 2*aperture - 1 - x, y, 0);
-      }
+image_pyramid::~image_pyramid()
+{
+  unsigned i;
+  for (i = 0; i < _levels.size(); i++) {
+    delete _levels[i];
+  }
+}
+
+bool image_pyramid::build(const image_wrapper &image, unsigned max_levels, unsigned rgb)
+{
+  _num_levels = 0;
+  int minx, maxx, miny, maxy;
+  image.read_range(minx, maxx, miny, maxy);
+  if ( (max_levels == 0) || (maxx <= minx) || (maxy <= miny) ) {
+    fprintf(stderr,"image_pyramid::build(): Empty image or no levels\n");
+    return false;
+  }
+
+  // Get the level-0 image and copy the input into it, reading the input's
+  // buffer directly if it will hand it out.
+  if (_levels.size() == 0) {
+    float_image *level0 = new float_image(minx, maxx, miny, maxy);
+    if (level0 == NULL) {
+      fprintf(stderr,"image_pyramid::build(): Out of memory\n");
+      return false;
     }
-    #pragma omp parallel for
-    for (x = 0; x < (int)(input.get_num_columns() + 2 * aperture); x++) {
-      int y;  // Needs to be int for OpenMP
-      for (y = 0; y < (int)(aperture); y++) {
-        copy.write_pixel_nocheck(x, y, 0);
-        copy.write_pixel_nocheck(x, input.get_num_rows() + 2*aperture - 1 - y, 0);
+    _levels.push_back(level0);
+  }
+  float_image &base = *_levels[0];
+  if (!base.resize(minx, maxx, miny, maxy)) { return false; }
+  base.new_generation();
+  int nx = maxx - minx + 1;
+  image_buffer_view view;
+  bool direct = image.get_buffer_view(view) &&
+    (view.minx <= minx) && (view.maxx >= maxx) &&
+    (view.miny <= miny) && (view.maxy >= maxy) && (rgb < view.num_colors);
+  int y;  // Needs to be int for OpenMP
+  #pragma omp parallel for
+  for (y = miny; y <= maxy; y++) {
+    if (direct) {
+      switch (view.type) {
+        case image_buffer_view::UINT8: copy_view_row_to_image<vrpn_uint8>(view, minx, y, rgb, nx, base); continue;
+        case image_buffer_view::UINT16: copy_view_row_to_image<vrpn_uint16>(view, minx, y, rgb, nx, base); continue;
+        case image_buffer_view::FLOAT: copy_view_row_to_image<float>(view, minx, y, rgb, nx, base); continue;
+        case image_buffer_view::DOUBLE: copy_view_row_to_image<double>(view, minx, y, rgb, nx, base); continue;
+        default: break;
       }
     }
-    #pragma omp parallel for
-    for (x = 0; x < (int)(input.get_num_columns()); x++) {
-      int y;  // Needs to be int for OpenMP
-      for (y = 0; y < (int)(input.get_num_rows()); y++) {
-        copy.write_pixel_nocheck(x+aperture, y+aperture,
-          input.read_pixel_nocheck(x,y));
-      }
+    int x;
+    for (x = minx; x <= maxx; x++) {
+      base.write_pixel_nocheck(x, y, image.read_pixel_nocheck(x, y, rgb));
     }
+  }
+  _num_levels = 1;
 
-    // Construct a temporary floating-point mask image to store the weights
-    // which are 1 within the copied image and 0 around the border.
-    float_image mask(0, input.get_num_columns() + 2*aperture -1,
-                     0, input.get_num_rows() + 2*aperture -1);
-    #pragma omp parallel for
-    for (x = 0; x < (int)(aperture); x++) {
-      int y;  // Needs to be int for OpenMP
-      for (y = 0; y < (int)(input.get_num_rows() + 2 * aperture); y++) {
-        mask.write_pixel_nocheck(x, y, 0);
-        mask.write_pixel_nocheck(input.get_num_columns() + 2*aperture - 1 - x, y, 0);
+  // Each level averages 2x2 blocks of the one below it.  Blocks that hang
+  // off the edge of the level below average the pixels that are there.
+  while (_num_levels < max_levels) {
+    const float_image &below = *_levels[_num_levels - 1];
+    int bminx, bmaxx, bminy, bmaxy;
+    below.read_range(bminx, bmaxx, bminy, bmaxy);
+    int lminx = static_cast<int>(floor(bminx / 2.0));
+    int lmaxx = static_cast<int>(floor(bmaxx / 2.0));
+    int lminy = static_cast<int>(floor(bminy / 2.0));
+    int lmaxy = static_cast<int>(floor(bmaxy / 2.0));
+    if ( (lmaxx <= lminx) || (lmaxy <= lminy) ) { break; }
+
+    if (_levels.size() <= _num_levels) {
+      float_image *level = new float_image(lminx, lmaxx, lminy, lmaxy);
+      if (level == NULL) {
+        fprintf(stderr,"image_pyramid::build(): Out of memory\n");
+        return false;
       }
+      _levels.push_back(level);
     }
+    float_image &current = *_levels[_num_levels];
+    if (!current.resize(lminx, lmaxx, lminy, lmaxy)) { return false; }
+    current.new_generation();
+
     #pragma omp parallel for
-    for (x = 0; x < (int)(input.get_num_columns() + 2 * aperture); x++) {
-      int y;  // Needs to be int for OpenMP
-      for (y = 0; y < (int)(aperture); y++) {
-        mask.write_pixel_nocheck(x, y, 0);
-        mask.write_pixel_nocheck(x, input.get_num_rows() + 2*aperture - 1 - y, 0);
+    for (y = lminy; y <= lmaxy; y++) {
+      int x;
+      for (x = lminx; x <= lmaxx; x++) {
+        double sum = 0;
+        int count = 0;
+        int i, j;
+        for (j = 2*y; j <= 2*y + 1; j++) {
+          if ( (j < bminy) || (j > bmaxy) ) { continue; }
+          for (i = 2*x; i <= 2*x + 1; i++) {
+            if ( (i < bminx) || (i > bmaxx) ) { continue; }
+            sum += below.read_pixel_nocheck(i, j);
+            count++;
+          }
+        }
+        current.write_pixel_nocheck(x, y, sum / count);
       }
     }
-    #pragma omp parallel for
-    for (x = 0; x < (int)(input.get_num_columns()); x++) {
-      int y;  // Needs to be int for OpenMP
-      for (y = 0; y < (int)(input.get_num_rows()); y++) {
-        mask.write_pixel_nocheck(x+aperture, y+aperture, 1);
+    _num_levels++;
+  }
+  return true;
+}
+
+
+
+//----------------------------------------------------------------------------
+// Rows are resampled in strips this wide, so that each thread can keep its
+// results on the stack before storing them into the output image.
+static const int WARP_STRIP_WIDTH = 1024;
+
+// Find the samples i in [0, count) for which lo <= a + i * b < hi, which
+// for a sample coordinate means that it and its interpolation neighbors are
+// inside the image.  The range is pulled in by one sample at each end so
+// that rounding cannot put a sample just inside it outside of the image;
+// the samples it leaves out are checked one at a time.  Returns last <
+// first if there are none.
+static void warp_inside_range(double a, double b, double lo, double hi, int count,
+                              int &first, int &last)
+{
+  first = 0; last = -1;
+  if (b == 0) {
+    if ( (a >= lo) && (a < hi) ) { last = count - 1; }
+    return;
+  }
+  double i0 = (lo - a) / b;
+  double i1 = (hi - a) / b;
+  if (i0 > i1) { std::swap(i0, i1); }
+  i0 = ceil(i0) + 1;
+  i1 = floor(i1) - 1;
+  if (i0 < 0) { i0 = 0; }
+  if (i1 > count - 1) { i1 = count - 1; }
+  if (i0 <= i1) {
+    first = static_cast<int>(i0);
+    last = static_cast<int>(i1);
+  }
+}
+
+// Fill out[i] with the interpolated value at (x0 + i * xstep, y0 + i * ystep).
+template <class T>
+static void warp_strip(const image_buffer_view &view, unsigned rgb,
+                       double x0, double y0, double xstep, double ystep,
+                       int count, double *out)
+{
+  int first, last, yfirst, ylast;
+  warp_inside_range(x0, xstep, view.minx, view.maxx, count, first, last);
+  warp_inside_range(y0, ystep, view.miny, view.maxy, count, yfirst, ylast);
+  if (yfirst > first) { first = yfirst; }
+  if (ylast < last) { last = ylast; }
+  if (last < first) { first = count; last = count - 1; }
+
+  int i;
+  for (i = 0; i < first; i++) {
+    image_buffer_bilerp<T>(view, x0 + i * xstep, y0 + i * ystep, out[i], rgb);
+  }
+  int n = last - first + 1;
+  if (n > 0) {
+    double xs0 = x0 + first * xstep;
+    double ys0 = y0 + first * ystep;
+    if (!VST_simd_bilerp_line(view, rgb, xs0, ys0, xstep, ystep, n, out + first)) {
+      for (i = 0; i < n; i++) {
+        image_buffer_bilerp<T>(view, xs0 + i * xstep, ys0 + i * ystep, out[first + i], rgb);
       }
     }
+  }
+  for (i = last + 1; i < count; i++) {
+    image_buffer_bilerp<T>(view, x0 + i * xstep, y0 + i * ystep, out[i], rgb);
+  }
+}
 
-    // Convolve the image with the Gaussian kernel.  At each pixel, we
-    // sum up the amount of the kernel that is on the inside of time image
-    // and rescale by this so that we get equal energy at all locations,
-    // even near the edges.
-    unsigned center = aperture; // Index of the center pixel in the kernel
-    int aperture_int = aperture;
-    #pragma omp parallel for
-    for (x = 0; x < (int)(get_num_columns()); x++) {
-      int y;  // Needs to be int for OpenMP
-      for (y = 0; y < (int)(get_num_rows()); y++) {
-        int i, j;
-        double sum = 0;
-        double weight = 0;
-        for (i = -aperture_int; i <= aperture_int; i++) {
-          for (j = -aperture_int; j <= aperture_int; j++) {
-            double kval = kernel.read_pixel_nocheck(center+i,center+j);
-            weight += kval * mask.read_pixel_nocheck(x+aperture+i, y+aperture+j);
-            sum += kval * copy.read_pixel_nocheck(x+aperture+i, y+aperture+j);
-          }
-        }
-        write_pixel(x, y, sum/weight);
+// Fill out[i] with the value interpolated between pixels (ix0 + i, iy) and
+// (ix0 + i + 1, iy + 1) with the given fractions toward the higher ones.
+// First blend each column of the two rows, then blend neighboring columns,
+// in place in the output.
+template <class T>
+static void translate_strip(const image_buffer_view &view, unsigned rgb,
+                            int ix0, int iy, double xhighfrac, double yhighfrac,
+                            int count, double *out)
+{
+  int first = view.minx - ix0;
+  int last = view.maxx - 1 - ix0;
+  if (first < 0) { first = 0; }
+  if (last > count - 1) { last = count - 1; }
+  if ( (iy < view.miny) || (iy + 1 > view.maxy) || (last < first) ) {
+    first = count; last = count - 1;
+  }
+
+  int i;
+  for (i = 0; i < first; i++) { out[i] = 0; }
+  for (i = last + 1; i < count; i++) { out[i] = 0; }
+  int n = last - first + 1;
+  if (n <= 0) {
+    return;
+  }
+
+  double xlowfrac = 1.0 - xhighfrac;
+  double ylowfrac = 1.0 - yhighfrac;
+  const int xs = view.x_stride;
+  const T *low = view.pixel<T>(ix0 + first, iy, rgb);
+  const T *high = low + view.y_stride;
+  double *o = out + first;
+  for (i = 0; i < n; i++) {
+    o[i] = low[i * xs] * ylowfrac + high[i * xs] * yhighfrac;
+  }
+  double beyond = low[n * xs] * ylowfrac + high[n * xs] * yhighfrac;
+  for (i = 0; i < n - 1; i++) {
+    o[i] = o[i] * xlowfrac + o[i + 1] * xhighfrac;
+  }
+  o[n - 1] = o[n - 1] * xlowfrac + beyond * xhighfrac;
+}
+
+bool affine_warp_engine::get_view(const image_wrapper &input, unsigned rgb,
+                                  image_buffer_view &view, unsigned &view_rgb)
+{
+  int minx, maxx, miny, maxy;
+  input.read_range(minx, maxx, miny, maxy);
+  if ( (maxx < minx) || (maxy < miny) ) {
+    fprintf(stderr,"affine_warp_engine::get_view(): Empty input image\n");
+    return false;
+  }
+  if (input.get_buffer_view(view) &&
+      (view.minx == minx) && (view.maxx == maxx) &&
+      (view.miny == miny) && (view.maxy == maxy) && (rgb < view.num_colors)) {
+    view_rgb = rgb;
+    return true;
+  }
+
+  // Copy the color we want into our own image.
+  if (!d_input.resize(minx, maxx, miny, maxy)) {
+    return false;
+  }
+  int y;  // Needs to be int for OpenMP
+  #pragma omp parallel for if(d_parallel)
+  for (y = miny; y <= maxy; y++) {
+    int x;
+    for (x = minx; x <= maxx; x++) {
+      d_input.write_pixel_nocheck(x, y, input.read_pixel_nocheck(x, y, rgb));
+    }
+  }
+  view_rgb = 0;
+  return d_input.get_buffer_view(view);
+}
+
+bool affine_warp_engine::translate(const image_wrapper &input, double dx, double dy,
+    int minx, int maxx, int miny, int maxy,
+    double_image &output, unsigned rgb)
+{
+  image_buffer_view view;
+  unsigned view_rgb;
+  if (!get_view(input, rgb, view, view_rgb) ||
+      !output.resize(minx, maxx, miny, maxy)) {
+    return false;
+  }
+
+  // Every output pixel (x,y) reads from (x + dx, y + dy), so they all
+  // have the same fractional offset.
+  double xlow = floor(dx);
+  double ylow = floor(dy);
+  int ixoff = static_cast<int>(xlow);
+  int iyoff = static_cast<int>(ylow);
+  double xhighfrac = dx - xlow;
+  double yhighfrac = dy - ylow;
+
+  int y;  // Needs to be int for OpenMP
+  #pragma omp parallel for if(d_parallel)
+  for (y = miny; y <= maxy; y++) {
+    double line[WARP_STRIP_WIDTH];
+    int start;
+    for (start = minx; start <= maxx; start += WARP_STRIP_WIDTH) {
+      int count = maxx - start + 1;
+      if (count > WARP_STRIP_WIDTH) { count = WARP_STRIP_WIDTH; }
+      int ix0 = start + ixoff, iy = y + iyoff;
+      switch (view.type) {
+        case image_buffer_view::UINT8:
+          translate_strip<vrpn_uint8>(view, view_rgb, ix0, iy, xhighfrac, yhighfrac, count, line); break;
+        case image_buffer_view::UINT16:
+          translate_strip<vrpn_uint16>(view, view_rgb, ix0, iy, xhighfrac, yhighfrac, count, line); break;
+        case image_buffer_view::FLOAT:
+          translate_strip<float>(view, view_rgb, ix0, iy, xhighfrac, yhighfrac, count, line); break;
+        default:
+          translate_strip<double>(view, view_rgb, ix0, iy, xhighfrac, yhighfrac, count, line); break;
+      }
+      int x;
+      for (x = 0; x < count; x++) {
+        output.write_pixel_nocheck(start + x, y, line[x]);
       }
     }
-  #endif
   }
+  output.new_generation();
+  return true;
 }
 
+bool affine_warp_engine::transform(const image_wrapper &input, double dx, double dy,
+    double rotradians, double scale, double centerx, double centery,
+    int minx, int maxx, int miny, int maxy,
+    double_image &output, unsigned rgb)
+{
+  if ( (rotradians == 0) && (scale == 1) ) {
+    return translate(input, dx, dy, minx, maxx, miny, maxy, output, rgb);
+  }
+  image_buffer_view view;
+  unsigned view_rgb;
+  if (!get_view(input, rgb, view, view_rgb) ||
+      !output.resize(minx, maxx, miny, maxy)) {
+    return false;
+  }
+
+  // Each step along an output row is a step of (xstep, ystep) in the input.
+  // The start of each strip is found the way affine_transformed_image does
+  // for that pixel.
+  double sinrot = sin(rotradians);
+  double cosrot = cos(rotradians);
+  double xstep = scale * cosrot;
+  double ystep = scale * sinrot;
 
+  int y;  // Needs to be int for OpenMP
+  #pragma omp parallel for if(d_parallel)
+  for (y = miny; y <= maxy; y++) {
+    double line[WARP_STRIP_WIDTH];
+    int start;
+    for (start = minx; start <= maxx; start += WARP_STRIP_WIDTH) {
+      int count = maxx - start + 1;
+      if (count > WARP_STRIP_WIDTH) { count = WARP_STRIP_WIDTH; }
+      double xc = start - centerx + dx;
+      double yc = y - centery + dy;
+      double x0 = scale * (cosrot*xc - sinrot*yc) + centerx;
+      double y0 = scale * (sinrot*xc + cosrot*yc) + centery;
+      switch (view.type) {
+        case image_buffer_view::UINT8:
+          warp_strip<vrpn_uint8>(view, view_rgb, x0, y0, xstep, ystep, count, line); break;
+        case image_buffer_view::UINT16:
+          warp_strip<vrpn_uint16>(view, view_rgb, x0, y0, xstep, ystep, count, line); break;
+        case image_buffer_view::FLOAT:
+          warp_strip<float>(view, view_rgb, x0, y0, xstep, ystep, count, line); break;
+        default:
+          warp_strip<double>(view, view_rgb, x0, y0, xstep, ystep, count, line); break;
+      }
+      int x;
+      for (x = 0; x < count; x++) {
+        output.write_pixel_nocheck(start + x, y, line[x]);
+      }
+    }
+  }
+  output.new_generation();
+  return true;
+}
@@ -105,12 +105,55 @@ protected:
   int	  _oversample;
 };
 
+//----------------------------------------------------------------------------
+// Computes the pixel values of a 2D Gaussian over a range of pixels.  The
+// Gaussian is separable, so the value at each pixel is the product of a
+// term for its column and a term for its row, whether it is point-sampled
+// at the pixel center, averaged over oversample x oversample points within
+// the pixel (as ComputeGaussianVolume() does) or integrated exactly over
+// the pixel (with error functions).  compute() fills in the column and row
+// terms once for a given center and standard deviation, after which each
+// pixel is one multiply.  The center is in the same coordinates as the
+// pixels, and the Gaussian has the specified total volume.
+
+class Gaussian_kernel_model {
+public:
+  typedef enum { POINT_SAMPLED, OVERSAMPLED, INTEGRATED } sampling;
+
+  Gaussian_kernel_model() : _minx(0), _maxx(-1), _miny(0), _maxy(-1) {};
+
+  void compute(int minx, int maxx, int miny, int maxy,
+	       double centerx, double centery, double std_dev,
+	       double summedvolume, sampling how, int oversample = 1);
+
+  // Value of the Gaussian at a pixel, which must be in the range.
+  inline double value(int x, int y) const {
+    return _column[x - _minx] * _row[y - _miny];
+  }
+
+  // Fill in a row-major buffer with the background plus the Gaussian for
+  // the whole range.  The first entry is pixel (minx,miny) and rows are
+  // y_stride entries apart.
+  void fill(double *buffer, int y_stride, double background) const;
+
+protected:
+  int     _minx, _maxx, _miny, _maxy;
+  std::vector<double> _column;   //< Term for each column, including the volume scale
+  std::vector<double> _row;      //< Term for each row
+  std::vector<double> _edges;    //< Scratch space for the error function at pixel edges
+
+  void  compute_axis(int min, int max, double center, double std_dev, double scale,
+		     sampling how, int oversample, std::vector<double> &terms);
+};
+
 class Integrated_Gaussian_image: public double_image {
 public:
   // Create an image of the specified size and background intensity with a
   // Gaussian in the specified location (may be subpixel) with the specified
   // standard deviation and total volume (in height-pixels, if integrated to infinity).
   // The Gaussian is brighter than the background for positive volumes.
+  // Each pixel is averaged over oversample x oversample samples; an
+  // oversample of 0 integrates each pixel exactly.
   Integrated_Gaussian_image(int minx = 0, int maxx = 255, int miny = 0, int maxy = 255,
 	     double background = 127.0, double noise = 0.0,
 	     double centerx = 127.25, double centery = 127.75, double std_dev = 2.5,
@@ -124,6 +167,7 @@ public:
 protected:
   int	 _oversample;
   double _background;
+  Gaussian_kernel_model _model;
 };
 
 class Integrated_multi_Gaussian_image: public double_image {
@@ -145,6 +189,7 @@ public:
 protected:
   int	 _oversample;
   double _background;
+  Gaussian_kernel_model _model;
 };
 
 class Point_sampled_Gaussian_image: public image_wrapper {
@@ -162,6 +207,7 @@ public:
   void set_new_parameters(double background = 127.0, double noise = 0.0,
 	     double centerx = 127.25, double centery = 127.75, double std_dev = 2.5,
          double summedvolume = 250) {
+    new_generation();
     _background = background;
     _noise = noise;
     _centerx = centerx;
@@ -206,6 +252,75 @@ protected:
   int	 _oversample;
 };
 
+//----------------------------------------------------------------------------
+// Blurs images with a Gaussian kernel.  The kernel is separable, so it is
+// applied as a pass along each row followed by a pass along each column,
+// each of which walks the image in memory order.  The engine keeps its
+// working buffers between calls, so an application that blurs every frame
+// of a video should keep one around rather than making a new one each time.
+// As with gaussian_blurred_image, the weighting at the borders is adjusted
+// so that there is no average intensity increase or decrease there, and
+// the output images are indexed from 0 in X and Y.
+
+class gaussian_blur_engine {
+public:
+  // SEPARABLE convolves with the same pixel-integrated kernel that
+  // gaussian_blurred_image always has, and gives the same results to within
+  // floating-point rounding.  Its cost grows with the aperture.
+  // RECURSIVE uses the Young/van Vliet recursive filter, whose cost per
+  // pixel does not depend on the standard deviation.  It ignores the
+  // aperture and is a close approximation to an untruncated Gaussian.  It
+  // needs a standard deviation of at least 0.5 pixels, and falls back to
+  // SEPARABLE for smaller ones.
+  // AUTOMATIC uses RECURSIVE for standard deviations of 4 pixels or more,
+  // where it is faster, and SEPARABLE otherwise.
+  typedef enum { SEPARABLE, RECURSIVE, AUTOMATIC } blur_method;
+
+  gaussian_blur_engine() : d_nx(0), d_ny(0), d_pad(0) {};
+
+  // Blur color rgb of the input into the output image, which must be the
+  // same size as the input.  Returns false if it is not.
+  bool blur(const image_wrapper &input,
+    unsigned aperture, float std,
+    float_image &output,
+    blur_method method = SEPARABLE, unsigned rgb = 0);
+
+  // Fill in both the blurred image and the difference-of-Gaussians
+  // surround image: blurred minus the input blurred by surround_std, plus
+  // offset.  This is what making a subtracted_image from two
+  // gaussian_blurred_images produces, but the input is read once and
+  // there are no intermediate images.  Returns false if the output images
+  // are not the same size as the input.
+  bool difference_of_gaussians(const image_wrapper &input,
+    unsigned aperture, float std,
+    unsigned surround_aperture, float surround_std,
+    double offset,
+    float_image &blurred, float_image &surround,
+    blur_method method = SEPARABLE, unsigned rgb = 0);
+
+protected:
+  int                 d_nx, d_ny;         //< Size of the image being blurred
+  int                 d_pad;              //< Zero columns on each side of d_input
+  std::vector<float>  d_input;            //< Input, padded with zeroes on the left and right
+  std::vector<float>  d_rows;             //< Row pass results, padded with zero rows above and below
+  std::vector<float>  d_kernel;           //< 1D kernel for the separable passes
+  std::vector<float>  d_x_scale;          //< 1 / the kernel weight inside the image at each X
+  std::vector<float>  d_y_scale;          //< 1 / the kernel weight inside the image at each Y
+  std::vector<double> d_iir;              //< Working image for the recursive passes
+  std::vector<double> d_iir_line;         //< One row or column for the recursive passes
+
+  bool  load_input(const image_wrapper &input, unsigned pad, unsigned rgb);
+  bool  check_output(const float_image &output) const;
+  blur_method choose_method(blur_method method, float std) const;
+
+  // Blur the loaded input.  If subtract_from is not NULL, write
+  // subtract_from - blurred + offset instead of the blurred value.
+  void  blur_separable(unsigned aperture, float std, float_image &output,
+                       const float_image *subtract_from, double offset);
+  void  blur_recursive(float std, float_image &output,
+                       const float_image *subtract_from, double offset);
+};
+
 //----------------------------------------------------------------------------
 // Concrete version of virtual base class that creates itself by convolving
 // the input image with a Gaussian kernel whose parameters are specified in
@@ -218,11 +333,105 @@ public:
   // half distance (how far gone from the origin in each direction).  The
   // standard deviation is also in pixels.  At the borders, the weighting is
   // adjusted so that there is no average intentity increase or descrease.
+  // See gaussian_blur_engine for the methods.
   gaussian_blurred_image(const image_wrapper &input,
     const unsigned aperture,  // Aperture of the convolution kernel
-    const float std);         // Standard deviation of the kernel
+    const float std,          // Standard deviation of the kernel
+    gaussian_blur_engine::blur_method method = gaussian_blur_engine::SEPARABLE);
+
+  // Blur a new input image, resizing to match it.  The image buffer and
+  // the engine's working buffers are reused when the size does not change,
+  // so an image that is recomputed every frame does not allocate memory.
+  bool recompute(const image_wrapper &input,
+    const unsigned aperture,
+    const float std,
+    gaussian_blur_engine::blur_method method = gaussian_blur_engine::SEPARABLE);
+
+protected:
+  gaussian_blur_engine  d_engine;   //< Does the blurring, keeping its buffers
+};
+
+//----------------------------------------------------------------------------
+// A stack of images, each half the size of the one below it in X and Y, for
+// coarse-to-fine searches.  Level 0 is a copy of one color of the image the
+// pyramid is built from; each pixel on level L+1 is the average of the (up
+// to) four pixels on level L that it covers.  The levels are kept from one
+// build() to the next, so a pyramid that is rebuilt for every frame of a
+// video reuses its memory.  Pixel centers are at integer coordinates on
+// every level, so the level-L pixel x covers level-0 pixels 2^L x through
+// 2^L x + 2^L - 1; to_level() and from_level() convert coordinates.
+
+class image_pyramid {
+public:
+  image_pyramid() : _num_levels(0) {};
+  ~image_pyramid();
+
+  // Build the pyramid from one color of the image, with at most max_levels
+  // levels (counting level 0).  It stops early when a level would be less
+  // than two pixels across.  Returns false on error.
+  bool  build(const image_wrapper &image, unsigned max_levels, unsigned rgb = 0);
+
+  unsigned  num_levels(void) const { return _num_levels; }
+  const float_image &level(unsigned which) const { return *_levels[which]; }
+
+  // Convert a coordinate on level 0 to one on the specified level, and back.
+  static double to_level(double x, unsigned which)
+    { double scale = static_cast<double>(1 << which); return (x - (scale - 1) / 2) / scale; }
+  static double from_level(double x, unsigned which)
+    { double scale = static_cast<double>(1 << which); return x * scale + (scale - 1) / 2; }
 
 protected:
+  std::vector<float_image *>  _levels;      //< Allocated levels (may be more than are in use)
+  unsigned                    _num_levels;  //< Levels filled by the last build()
+
+private:
+  image_pyramid(const image_pyramid &);
+  image_pyramid &operator=(const image_pyramid &);
+};
+
+//----------------------------------------------------------------------------
+// Resamples a whole region of an image through the same coordinate mappings
+// that translated_image and affine_transformed_image use, giving the same
+// values (to within floating-point rounding) as reading each pixel of them
+// with read_pixel(): bilinear interpolation inside the image and zero where
+// the sample or any of its interpolation neighbors falls outside.  Rather
+// than doing the transform and four virtual pixel reads per output pixel,
+// it steps the source coordinates along each row and interpolates straight
+// from the input's buffer, with the vector kernels for rotated and scaled
+// rows and a separable (column then row) blend for translations, where every
+// pixel has the same fractional offset.  Rows are done in parallel unless
+// the engine is told not to be, which makes sense when the caller is already
+// running several engines at once.  Inputs that do not hand out a buffer
+// view are first copied into one that does, which the engine keeps.
+
+class affine_warp_engine {
+public:
+  affine_warp_engine(bool parallel = true) : d_parallel(parallel), d_input(0, 1, 0, 1) {};
+
+  // Fill output with color rgb of the pixels (minx..maxx, miny..maxy) of
+  // translated_image(input, dx, dy).  The output is resized to cover
+  // exactly that region, with the same coordinates.  Returns false on an
+  // empty region or out of memory.
+  bool translate(const image_wrapper &input, double dx, double dy,
+    int minx, int maxx, int miny, int maxy,
+    double_image &output, unsigned rgb = 0);
+
+  // The same for affine_transformed_image(input, dx, dy, rotradians, scale,
+  // centerx, centery).  With no rotation and unit scale, this is a
+  // translation and uses the translation code.
+  bool transform(const image_wrapper &input, double dx, double dy,
+    double rotradians, double scale, double centerx, double centery,
+    int minx, int maxx, int miny, int maxy,
+    double_image &output, unsigned rgb = 0);
+
+protected:
+  bool          d_parallel;   //< Do rows on several threads?
+  double_image  d_input;      //< Copy of an input that has no buffer view
+
+  // Find a buffer view and the color within it to read from, copying the
+  // input if needed.  Returns false if the input is empty.
+  bool  get_view(const image_wrapper &input, unsigned rgb,
+                 image_buffer_view &view, unsigned &view_rgb);
 };
 
 //----------------------------------------------------------------------------------
@@ -1,17 +1,45 @@
 #include "raw_file_server.h"
 
+#ifdef	_WIN32
+  #include <io.h>
+#else
+  #include <sys/mman.h>
+  #include <unistd.h>
+#endif
+
 #ifndef min
 #define min(a,b) ( (a)<(b)?(a):(b) )
 #endif
 
+#if !defined(_WIN32) || defined(__MINGW32__)
+  #define _fseeki64 fseek
+  #define _ftelli64 ftell
+#endif
+
 raw_file_server::raw_file_server(const char *filename, unsigned numX, unsigned numY, unsigned bitdepth,
-                  unsigned channels, unsigned headersize, unsigned frameheadersize) :
+                  unsigned channels, unsigned headersize, unsigned frameheadersize,
+                  bool map_file, unsigned readahead_frames) :
 d_buffer(NULL),
+d_read_buffer(NULL),
 d_bits(bitdepth),
 d_header_size(headersize),
 d_frame_header_size(frameheadersize),
 d_channels(channels),
-d_infile(NULL)
+d_infile(NULL),
+d_reverse(false),
+d_next_frame(0),
+d_file_frame(-1),
+d_num_frames(0),
+d_mapped(false),
+d_readahead_frames(readahead_frames),
+d_map_base(NULL),
+d_map_offset(0),
+d_map_length(0),
+d_map_window(0),
+d_map_granularity(1)
+#ifdef _WIN32
+, d_map_handle(NULL)
+#endif
 {
   // In case we fail somewhere along the way
   _status = false;
@@ -50,10 +78,41 @@ d_infile(NULL)
   }
 
   // Allocate space to read a frame from the file
-  if ( (d_buffer = new vrpn_uint8[get_num_columns() * get_num_rows()]) == NULL) {
+  if ( (d_read_buffer = new vrpn_uint8[get_num_columns() * get_num_rows()]) == NULL) {
     fprintf(stderr,"raw_file_server::raw_file_server: Out of memory\n");
     return;
   }
+  d_buffer = d_read_buffer;
+
+  // If we can seek in the file, find out how many frames it holds.  Pipes
+  // and other streams can't seek, so we read them in order without knowing.
+  count_frames();
+
+  // Try to map the file if we've been asked to.  The window we map holds the
+  // read-ahead frames and is at least 64MB, to keep from moving it often.
+  if (map_file && (d_num_frames > 0)) {
+#ifdef	_WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    d_map_granularity = info.dwAllocationGranularity;
+    HANDLE file = reinterpret_cast<HANDLE>(_get_osfhandle(_fileno(d_infile)));
+    d_map_handle = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    d_mapped = (d_map_handle != NULL);
+#else
+    d_map_granularity = sysconf(_SC_PAGESIZE);
+    d_mapped = true;
+#endif
+    size_t stride = d_frame_header_size + get_num_columns() * get_num_rows();
+    d_map_window = (d_readahead_frames + 2) * stride;
+    if (d_map_window < 64 * 1024 * 1024) {
+      d_map_window = 64 * 1024 * 1024;
+    }
+    if (d_mapped && !map_window_for(0)) {
+      fprintf(stderr,"raw_file_server::raw_file_server: Could not map file, reading it instead\n");
+      unmap_window();
+      d_mapped = false;
+    }
+  }
 
   // Get us to the beginning of the file.
   rewind();
@@ -71,17 +130,163 @@ d_infile(NULL)
 
 raw_file_server::~raw_file_server(void)
 {
+  // Release the mapping, if we have one.
+  unmap_window();
+#ifdef	_WIN32
+  if (d_map_handle != NULL) {
+    CloseHandle(d_map_handle);
+  }
+#endif
+
   // Close the file
   if (d_infile != NULL) {
     fclose(d_infile);
   }
 
   // Free the space taken by the in-memory image (if allocated)
-  if (d_buffer) {
-    delete [] d_buffer;
+  if (d_read_buffer) {
+    delete [] d_read_buffer;
+  }
+}
+
+raw_file_offset raw_file_server::frame_offset(int frame) const
+{
+  raw_file_offset stride = d_frame_header_size + get_num_columns() * get_num_rows();
+  return d_header_size + frame * stride + d_frame_header_size;
+}
+
+bool raw_file_server::seek_file(raw_file_offset offset)
+{
+  return _fseeki64(d_infile, offset, SEEK_SET) == 0;
+}
+
+// Find how many complete frames the file holds.  The file may still be being
+// written, so this is checked again whenever we reach the end we knew about.
+// Measuring moves the file pointer, so the next read will seek.  Does nothing
+// for files we can't seek in.
+void raw_file_server::count_frames(void)
+{
+  if (_fseeki64(d_infile, 0, SEEK_END) != 0) {
+    return;
+  }
+  raw_file_offset length = _ftelli64(d_infile);
+  raw_file_offset stride = d_frame_header_size + get_num_columns() * get_num_rows();
+  if (length > static_cast<raw_file_offset>(d_header_size)) {
+    unsigned frames = static_cast<unsigned>( (length - d_header_size) / stride );
+    if (frames > d_num_frames) {
+#ifdef	_WIN32
+      // A Windows file mapping can't see past the length the file had when
+      // it was made, so make a new one that covers the added frames.
+      if (d_mapped) {
+        unmap_window();
+        CloseHandle(d_map_handle);
+        HANDLE file = reinterpret_cast<HANDLE>(_get_osfhandle(_fileno(d_infile)));
+        d_map_handle = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        d_mapped = (d_map_handle != NULL);
+      }
+#endif
+      d_num_frames = frames;
+    }
+  }
+  d_file_frame = -1;
+}
+
+// Make sure the image data for the specified frame is inside the mapped
+// window, moving the window if it is not.  The window is placed so that
+// there is room for reading ahead in the direction we're playing.
+bool raw_file_server::map_window_for(int frame)
+{
+  raw_file_offset start = frame_offset(frame);
+  size_t frame_size = get_num_columns() * get_num_rows();
+  if ( (d_map_base != NULL) && (start >= d_map_offset) &&
+       (start + static_cast<raw_file_offset>(frame_size) <= d_map_offset + static_cast<raw_file_offset>(d_map_length)) ) {
+    return true;
+  }
+  unmap_window();
+
+  raw_file_offset file_end = frame_offset(d_num_frames - 1) + frame_size;
+  raw_file_offset window_start;
+  if (d_reverse) {
+    window_start = start + frame_size - d_map_window;
+  } else {
+    window_start = start;
+  }
+  if (window_start < 0) { window_start = 0; }
+  window_start -= window_start % d_map_granularity;
+  raw_file_offset window_end = window_start + d_map_window;
+  if (window_end > file_end) { window_end = file_end; }
+  if (window_end < start + static_cast<raw_file_offset>(frame_size)) {
+    window_end = start + frame_size;
+  }
+  size_t length = static_cast<size_t>(window_end - window_start);
+
+#ifdef	_WIN32
+  d_map_base = static_cast<vrpn_uint8 *>(MapViewOfFile(d_map_handle, FILE_MAP_READ,
+    static_cast<DWORD>(window_start >> 32), static_cast<DWORD>(window_start & 0xffffffff), length));
+  if (d_map_base == NULL) {
+    return false;
+  }
+#else
+  void *base = mmap(NULL, length, PROT_READ, MAP_SHARED, fileno(d_infile), window_start);
+  if (base == MAP_FAILED) {
+    perror("raw_file_server::map_window_for: mmap() failed");
+    return false;
+  }
+  d_map_base = static_cast<vrpn_uint8 *>(base);
+  madvise(d_map_base, length, d_reverse ? MADV_RANDOM : MADV_SEQUENTIAL);
+#endif
+  d_map_offset = window_start;
+  d_map_length = length;
+  return true;
+}
+
+void raw_file_server::unmap_window(void)
+{
+  if (d_map_base != NULL) {
+#ifdef	_WIN32
+    UnmapViewOfFile(d_map_base);
+#else
+    munmap(d_map_base, d_map_length);
+#endif
+    d_map_base = NULL;
+    d_map_length = 0;
   }
 }
 
+// Ask the operating system to start loading the frames after this one
+// (in the direction we are playing) that lie inside the mapped window.
+// There is no portable equivalent on Windows, where the file cache's own
+// read-ahead has to do.
+void raw_file_server::advise_readahead(int frame)
+{
+#ifndef	_WIN32
+  if ( (d_map_base == NULL) || (d_readahead_frames == 0) ) {
+    return;
+  }
+  int first, last;
+  if (d_reverse) {
+    first = frame - static_cast<int>(d_readahead_frames);
+    last = frame - 1;
+  } else {
+    first = frame + 1;
+    last = frame + static_cast<int>(d_readahead_frames);
+  }
+  if (first < 0) { first = 0; }
+  if (last >= static_cast<int>(d_num_frames)) { last = d_num_frames - 1; }
+  if (first > last) {
+    return;
+  }
+  raw_file_offset start = frame_offset(first) - d_map_offset;
+  raw_file_offset end = frame_offset(last) + get_num_columns() * get_num_rows() - d_map_offset;
+  if (start < 0) { start = 0; }
+  if (end > static_cast<raw_file_offset>(d_map_length)) { end = d_map_length; }
+  start -= start % d_map_granularity;
+  if (start < end) {
+    madvise(d_map_base + start, static_cast<size_t>(end - start), MADV_WILLNEED);
+  }
+#endif
+}
+
 void  raw_file_server::play()
 {
   d_mode = PLAY;
@@ -94,18 +299,26 @@ void  raw_file_server::pause()
 
 void  raw_file_server::rewind()
 {
-  // Seek to the beginning of the file.
-  if (d_infile != NULL) {
-    fseek(d_infile, 0, SEEK_SET);
-  }
-
-  // If we've been asked to skip a header, do so now.
-  if (d_header_size> 0) {
-    if (fread(d_buffer, d_header_size, 1, d_infile) != 1) {
-      char  msg[1024];
-      sprintf(msg, "raw_file_server::rewind: Could not skip file header");
-      perror(msg);
-      return;
+  d_next_frame = 0;
+
+  // Seek to the beginning of the file and skip any header.  If we can't
+  // seek (a pipe), then we can only skip it by reading, and only once.
+  if ( (d_infile != NULL) && !d_mapped ) {
+    if (seek_file(d_header_size)) {
+      d_file_frame = 0;
+    } else if (d_file_frame < 0) {
+      unsigned left = d_header_size;
+      while (left > 0) {
+        unsigned chunk = min(left, get_num_columns() * get_num_rows());
+        if (fread(d_read_buffer, chunk, 1, d_infile) != 1) {
+          char  msg[1024];
+          sprintf(msg, "raw_file_server::rewind: Could not skip file header");
+          perror(msg);
+          return;
+        }
+        left -= chunk;
+      }
+      d_file_frame = 0;
     }
   }
 
@@ -118,6 +331,23 @@ void  raw_file_server::single_step()
   d_mode = SINGLE;
 }
 
+bool  raw_file_server::seek_to_frame(unsigned frame)
+{
+  // We can only jump around in files whose length we know; in a stream we
+  // can only "seek" to the frame we're about to read anyway.
+  if (d_num_frames == 0) {
+    return static_cast<int>(frame) == d_next_frame;
+  }
+  if (frame >= d_num_frames) {
+    count_frames();
+    if (frame >= d_num_frames) {
+      return false;
+    }
+  }
+  d_next_frame = frame;
+  return true;
+}
+
 bool  raw_file_server::read_image_to_memory(unsigned minX, unsigned maxX,
 					    unsigned minY, unsigned maxY,
 					    double exposure_time_millisecs)
@@ -135,23 +365,57 @@ bool  raw_file_server::read_image_to_memory(unsigned minX, unsigned maxX,
   }
 
   // Make sure we have both a file and a buffer pointer that are valid.
-  if ( (d_infile == NULL) || (d_buffer == NULL)) {
+  if ( (d_infile == NULL) || (d_read_buffer == NULL)) {
     return false;
   }
 
-  // Try to read one frame from the current location in the file.  If we fail in the read,
-  // set the mode to paused so we don't keep trying.
-  if (d_frame_header_size > 0) { // Skip any extra padding before images
-    if (fread(d_buffer, d_frame_header_size, 1, d_infile) != 1) {
-      d_mode = PAUSE;
-      return false;
-    }
+  // Stop when we run off either end of the file (if we know where the end is).
+  // A file that is still being written may have grown since we measured it.
+  if ( (d_num_frames > 0) && (d_next_frame >= static_cast<int>(d_num_frames)) ) {
+    count_frames();
   }
-  if (fread(d_buffer, get_num_columns() * get_num_rows(), 1, d_infile) != 1) {
+  if ( (d_next_frame < 0) ||
+       ( (d_num_frames > 0) && (d_next_frame >= static_cast<int>(d_num_frames)) ) ) {
     d_mode = PAUSE;
     return false;
   }
 
+  if (d_mapped) {
+    // Point at the frame where it sits in the file.
+    if (!map_window_for(d_next_frame)) {
+      d_mode = PAUSE;
+      return false;
+    }
+    d_buffer = d_map_base + (frame_offset(d_next_frame) - d_map_offset);
+    advise_readahead(d_next_frame);
+  } else {
+    // Seek if we're not already at the frame we want, which happens when
+    // playing backwards or after seek_to_frame().
+    if (d_file_frame != d_next_frame) {
+      if (!seek_file(frame_offset(d_next_frame) - d_frame_header_size)) {
+        d_mode = PAUSE;
+        return false;
+      }
+    }
+
+    // Try to read one frame from the current location in the file.  If we fail in the read,
+    // set the mode to paused so we don't keep trying.
+    d_file_frame = -1;
+    if (d_frame_header_size > 0) { // Skip any extra padding before images
+      if (fread(d_read_buffer, d_frame_header_size, 1, d_infile) != 1) {
+        d_mode = PAUSE;
+        return false;
+      }
+    }
+    if (fread(d_read_buffer, get_num_columns() * get_num_rows(), 1, d_infile) != 1) {
+      d_mode = PAUSE;
+      return false;
+    }
+    d_file_frame = d_next_frame + 1;
+    d_buffer = d_read_buffer;
+  }
+  d_next_frame += d_reverse ? -1 : 1;
+
   // Okay, we got a new frame!
   return true;
 }
@@ -183,6 +447,24 @@ bool  raw_file_server::get_pixel_from_memory(unsigned X, unsigned Y, vrpn_uint16
   return true;
 }
 
+// The buffer is stored flipped in Y (see get_pixel_from_memory() above), so
+// the view starts at the row for _minY and steps backwards through memory.
+bool  raw_file_server::get_buffer_view(image_buffer_view &view) const
+{
+  if (d_buffer == NULL) {
+    return false;
+  }
+  int cols = get_num_columns();
+  view.base = d_buffer + _minX + (_maxY - _minY) * cols;
+  view.type = image_buffer_view::UINT8;
+  view.x_stride = 1;
+  view.y_stride = -cols;
+  view.minx = _minX; view.maxx = _maxX;
+  view.miny = _minY; view.maxy = _maxY;
+  view.num_colors = 1;
+  return true;
+}
+
 /// Store the memory image to a PPM file.
 bool  raw_file_server::write_memory_to_ppm_file(const char *filename, int gain, bool sixteen_bits) const
 {
@@ -3,6 +3,14 @@
 
 #include "base_camera_server.h"
 
+// Raw files are often longer than 2GB, so we need 64-bit file offsets.
+// As in cismm_video_optimizer, we rely on long being 64 bits off Windows.
+#if defined(_WIN32) && !defined(__MINGW32__)
+  typedef __int64 raw_file_offset;
+#else
+  typedef long raw_file_offset;
+#endif
+
 class raw_file_server : public base_camera_server {
 public:
   // (numX, numY) = image size in pixels.
@@ -13,9 +21,15 @@ public:
   // EDT/Pulnix has numX = 648, numY = 484, bitdepth = 8, headersize = 0, frameheadersize = 0;
   // New Pulnix camera as numX = 640, numY = 480, bitdepth = 8, headersize = 0, frameheadersize = 0;
   // Point Grey raw format has numX = 1024, numY = 768, bitdepth = 8, headersize = 0, frameheadersize = 112;
+  // map_file = map the file into memory and use each frame in place, rather than
+  //   reading it into a buffer.  Falls back to reading if the file cannot be
+  //   mapped (for example, if it is a pipe).
+  // readahead_frames = how many frames past the current one to ask the operating
+  //   system to start loading when the file is mapped.
   raw_file_server(const char *filename, unsigned numX = 648, unsigned numY = 484,
                   unsigned bitdepth = 8, unsigned channels = 1,
-                  unsigned headersize = 0, unsigned frameheadersize = 0);
+                  unsigned headersize = 0, unsigned frameheadersize = 0,
+                  bool map_file = true, unsigned readahead_frames = 16);
   virtual ~raw_file_server(void);
 
   /// Start the stored video playing.
@@ -30,6 +44,18 @@ public:
   /// Single-step the stored video for one frame.
   virtual void single_step();
 
+  /// Make the specified frame (counting from 0) be the next one read.
+  // This is constant-time when the file is mapped or can be seeked in; it
+  // returns false for pipes or if the frame is past the end of the file.
+  bool seek_to_frame(unsigned frame);
+
+  /// Play (and single-step) towards the start of the file rather than the end.
+  void set_reverse(bool reverse) { d_reverse = reverse; }
+
+  /// Number of complete frames in the file, or 0 if it can't be told (pipes).
+  // This grows if the file is still being written when we reach its end.
+  unsigned get_num_frames(void) const { return d_num_frames; }
+
   /// Read an image to a memory buffer.  Exposure time is in milliseconds
   virtual bool	read_image_to_memory(unsigned minX = 0, unsigned maxX = 0,
 			     unsigned minY = 0, unsigned maxY = 0,
@@ -42,6 +68,9 @@ public:
   /// How many colors are in the image.
   virtual unsigned  get_num_colors() const { return 1; }
 
+  /// Describe the in-memory frame buffer so that trackers can read it directly.
+  virtual bool  get_buffer_view(image_buffer_view &view) const;
+
   /// Store the memory image to a PPM file.
   virtual bool  write_memory_to_ppm_file(const char *filename, int gain = 1, bool sixteen_bits = false) const;
 
@@ -69,7 +98,33 @@ protected:
   unsigned  d_frame_header_size;  //< Number of bytes to skip at the start of each frame
   unsigned  d_bits;               //< Number of bits per pixel
   unsigned  d_channels;           //< Number of channels
-  vrpn_uint8  *d_buffer;	  //< Holds one frame of data from the file
+  vrpn_uint8  *d_buffer;	  //< Points at the current frame (in d_read_buffer or in the mapping)
+  vrpn_uint8  *d_read_buffer;     //< Holds one frame of data read from the file
   enum {PAUSE, PLAY, SINGLE} d_mode;	  //< What we're doing right now
+  bool      d_reverse;            //< Play towards the start of the file?
+  int       d_next_frame;         //< Frame to read next (-1 or d_num_frames when past either end)
+  int       d_file_frame;         //< Frame whose header the file pointer is at (-1 if unknown)
+  unsigned  d_num_frames;         //< Complete frames in the file (0 if unknown)
+
+  // Memory-mapping state.  Only a window of the file is mapped at a time so
+  // that files larger than the address space still work; it is moved when a
+  // frame outside of it is requested.
+  bool        d_mapped;           //< Are we reading frames from a mapping?
+  unsigned    d_readahead_frames; //< How many frames ahead to ask the OS to load
+  vrpn_uint8  *d_map_base;        //< Start of the mapped window (NULL if none)
+  raw_file_offset d_map_offset;   //< File offset of the start of the window
+  size_t      d_map_length;       //< Length of the window in bytes
+  size_t      d_map_window;       //< How large a window to map
+  size_t      d_map_granularity;  //< Window offsets must be a multiple of this
+#ifdef _WIN32
+  void        *d_map_handle;      //< File-mapping object handle
+#endif
+
+  raw_file_offset frame_offset(int frame) const;  //< File offset of the image data for a frame
+  bool    map_window_for(int frame);
+  void    unmap_window(void);
+  void    advise_readahead(int frame);
+  bool    seek_file(raw_file_offset offset);
+  void    count_frames(void);
 };
 #endif
@@ -168,5 +168,30 @@ inline double	ComputeGaussianVolume(
   return A * (sum / count) * (x1-x0) * (y1-y0);
 }
 
+// Compute the volume under part of the Gaussian described above exactly,
+// rather than by sampling.  The 2D Gaussian is the product of a Gaussian
+// in X and one in Y, so its integral over a rectangle is the product of
+// the 1D integrals, each of which is a difference of error functions.
+
+inline double	ComputeGaussianIntegral1D(
+  double s,             //< standard deviation
+  double x0,		//< Low end of integration range in Gaussian-centered coordinates
+  double x1)		//< High end of integration range
+{
+  const double scale = 1 / (s * sqrt(2.0));
+  return 0.5 * ( erf(x1 * scale) - erf(x0 * scale) );
+}
+
+inline double	ComputeGaussianVolumeExact(
+  double m,             //< Magnitude (summed volume under curve over all space)
+  double s_meters,      //< standard deviation (square root of variance)
+  double x0,		//< Low end of X integration range in Gaussian-centered coordinates
+  double x1,		//< High end of X integration range
+  double y0,		//< Low end of Y integration range
+  double y1)		//< High end of Y integration range
+{
+  return m * ComputeGaussianIntegral1D(s_meters, x0, x1) * ComputeGaussianIntegral1D(s_meters, y0, y1);
+}
+
 
 #endif
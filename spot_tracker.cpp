@@ -1,12 +1,20 @@
 #include  <math.h>
 #include  <stdio.h>
+#include  <algorithm>
 #include  "spot_tracker.h"
+#include  "spot_tracker_simd.h"
+#include  "fft_correlator.h"
 
 // For PlaySound()
 #ifdef _WIN32
 #include <MMSystem.h>
 #endif
 
+// For omp_get_thread_num(), to pick per-thread work space in parallel loops
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 //#define DEBUG
 #ifndef	M_PI
 #ifndef M_PI_DEFINED
@@ -28,6 +36,218 @@ double max3(double v0, double v1, double v2, unsigned &index) {
   return max;
 }
 
+// Pixel samplers used to instantiate the templated fitness functions of the
+// interpolating trackers.  The buffer sampler reads directly from the memory
+// of an image that can describe its buffer, which lets the compiler inline
+// the whole bilinear interpolation.  The virtual sampler is the fallback for
+// images that compute their pixels (affine_transformed_image, for example).
+template <class T>
+class buffer_bilerp_sampler {
+public:
+  buffer_bilerp_sampler(const image_buffer_view &view) : d_view(view) {};
+  inline bool operator()(double x, double y, double &result, unsigned rgb) const {
+    return image_buffer_bilerp<T>(d_view, x, y, result, rgb);
+  }
+
+  // Sum a whole ring of samples (and their squares) at once using the vector
+  // kernels.  This only happens when every sample within radius of the center
+  // is inside the image; otherwise returns false and the caller goes sample by
+  // sample.
+  inline bool ring_sums(double cx, double cy, double radius,
+                        const float *xoff, const float *yoff, int count, unsigned rgb,
+                        double &sum, double &square_sum) const {
+    if ( (cx - radius < d_view.minx) || (cx + radius + 1 > d_view.maxx) ||
+         (cy - radius < d_view.miny) || (cy + radius + 1 > d_view.maxy) ) {
+      return false;
+    }
+    return VST_simd_ring_sums(d_view, rgb, cx, cy, xoff, yoff, count, sum, square_sum);
+  }
+protected:
+  image_buffer_view d_view;
+};
+
+class virtual_bilerp_sampler {
+public:
+  virtual_bilerp_sampler(const image_wrapper &image) : d_image(image) {};
+  inline bool operator()(double x, double y, double &result, unsigned rgb) const {
+    return d_image.read_pixel_bilerp(x, y, result, rgb);
+  }
+  inline bool ring_sums(double, double, double, const float *, const float *, int, unsigned,
+                        double &, double &) const { return false; }
+protected:
+  const image_wrapper &d_image;
+};
+
+// Pick the sampler that matches the image's buffer (if any) once per call,
+// then run the tracker's fitness function using it.  Requests for a color
+// the buffer does not hold go through the virtual path, which lets each
+// image decide how to handle them as it always has.
+template <class TRACKER>
+static double check_fitness_with_best_sampler(TRACKER &tracker, const image_wrapper &image, unsigned rgb)
+{
+  image_buffer_view view;
+  if (image.get_buffer_view(view) && (rgb < view.num_colors)) {
+    switch (view.type) {
+      case image_buffer_view::UINT8:
+        return tracker.check_fitness_sampled(buffer_bilerp_sampler<vrpn_uint8>(view), rgb);
+      case image_buffer_view::UINT16:
+        return tracker.check_fitness_sampled(buffer_bilerp_sampler<vrpn_uint16>(view), rgb);
+      case image_buffer_view::FLOAT:
+        return tracker.check_fitness_sampled(buffer_bilerp_sampler<float>(view), rgb);
+      case image_buffer_view::DOUBLE:
+        return tracker.check_fitness_sampled(buffer_bilerp_sampler<double>(view), rgb);
+      default:
+        break;
+    }
+  }
+  return tracker.check_fitness_sampled(virtual_bilerp_sampler(image), rgb);
+}
+
+//----------------------------------------------------------------------------
+// Shared sampling tables.
+
+spot_sampling_table::spot_sampling_table(KIND kind, double sample_separation, double max_radius) :
+  d_kind(kind), d_samplesep(sample_separation), d_max_radius(max_radius), d_users(0)
+{
+  double  r;
+  int     ring;
+  switch (kind) {
+    case SYMMETRIC_RINGS:
+      add_ring(0, 0, 1);
+      for (ring = 1; ring <= d_max_radius / d_samplesep; ring++) {
+        double scaled_r = ring * d_samplesep;
+        double rads_per_step = d_samplesep / scaled_r;
+        add_ring(scaled_r, ring*rads_per_step*0.5, rads_per_step);
+      }
+      break;
+
+    case DISK_RINGS:
+    case CONE_RINGS:
+      // These kernels step the radius by adding the spacing each time, so
+      // the table does too.
+      for (r = (kind == DISK_RINGS) ? d_samplesep : 1; r <= d_max_radius; r += d_samplesep) {
+        double rads_per_step = 1 / r * d_samplesep;
+        add_ring(r, r*rads_per_step*0.5, rads_per_step);
+      }
+      break;
+  }
+}
+
+// Add a ring of the specified radius, or an empty one if the radius is zero.
+void  spot_sampling_table::add_ring(double r, double first_theta, double rads_per_step)
+{
+  d_ring_radius.push_back(r);
+  d_ring_start.push_back(static_cast<int>(d_x.size()));
+  if (r > 0) {
+    double theta;
+    for (theta = first_theta; theta <= 2*M_PI + first_theta; theta += rads_per_step) {
+      d_x.push_back(r*cos(theta));
+      d_y.push_back(r*sin(theta));
+      d_xf.push_back(static_cast<float>(d_x.back()));
+      d_yf.push_back(static_cast<float>(d_y.back()));
+    }
+  }
+  d_ring_count.push_back(static_cast<int>(d_x.size()) - d_ring_start.back());
+}
+
+// The tables in use, protected by a semaphore so that trackers can be made
+// and deleted from any thread.  A table is built while the semaphore is
+// held, so two threads asking for the same new table wait for one copy.
+class spot_sampling_table_cache {
+public:
+  const spot_sampling_table *acquire(spot_sampling_table::KIND kind, double sample_separation, double radius) {
+    double max_radius = 16;
+    while (max_radius < radius) { max_radius *= 2; }
+
+    spot_sampling_table *ret = NULL;
+    d_sem.p();
+    size_t i;
+    for (i = 0; i < d_tables.size(); i++) {
+      spot_sampling_table *t = d_tables[i];
+      if ( (t->d_kind == kind) && (t->d_samplesep == sample_separation) && (t->d_max_radius >= radius) ) {
+        ret = t;
+        break;
+      }
+    }
+    if (ret == NULL) {
+      ret = new spot_sampling_table(kind, sample_separation, max_radius);
+      if (ret == NULL) {
+        fprintf(stderr, "spot_sampling_table::acquire(): Out of memory\n");
+      } else {
+        d_tables.push_back(ret);
+      }
+    }
+    if (ret) { ret->d_users++; }
+    d_sem.v();
+    return ret;
+  }
+
+  void release(const spot_sampling_table *table) {
+    d_sem.p();
+    size_t i;
+    for (i = 0; i < d_tables.size(); i++) {
+      if (d_tables[i] == table) {
+        if (--d_tables[i]->d_users == 0) {
+          delete d_tables[i];
+          d_tables.erase(d_tables.begin() + i);
+        }
+        break;
+      }
+    }
+    d_sem.v();
+  }
+
+  unsigned num_tables(void) {
+    d_sem.p();
+    unsigned ret = static_cast<unsigned>(d_tables.size());
+    d_sem.v();
+    return ret;
+  }
+
+protected:
+  std::vector<spot_sampling_table *>  d_tables;
+  Semaphore                           d_sem;
+};
+
+// The cache is made the first time it is needed and never deleted, so that
+// trackers in static objects (which may be made before it and deleted after
+// it would be) can still get and release their tables.  Each table is
+// deleted when its last user lets go of it.
+static spot_sampling_table_cache &sampling_tables(void)
+{
+  static spot_sampling_table_cache *cache = new spot_sampling_table_cache;
+  return *cache;
+}
+
+const spot_sampling_table *spot_sampling_table::acquire(KIND kind, double sample_separation, double radius)
+{
+  return sampling_tables().acquire(kind, sample_separation, radius);
+}
+
+void  spot_sampling_table::release(const spot_sampling_table *table)
+{
+  if (table != NULL) {
+    sampling_tables().release(table);
+  }
+}
+
+const spot_sampling_table *spot_sampling_table::update(const spot_sampling_table *table,
+                                                       KIND kind, double sample_separation, double radius)
+{
+  if ( table && (table->d_kind == kind) && (table->d_samplesep == sample_separation) &&
+       (table->d_max_radius >= radius) ) {
+    return table;
+  }
+  const spot_sampling_table *ret = acquire(kind, sample_separation, radius);
+  release(table);
+  return ret;
+}
+
+unsigned spot_sampling_table::num_cached_tables(void)
+{
+  return sampling_tables().num_tables();
+}
+
 spot_tracker_XY::spot_tracker_XY(double radius, bool inverted, double pixelaccuracy, double radiusaccuracy,
 			   double sample_separation_in_pixels) :
     _rad(radius),	      // Initial radius of the disk
@@ -37,10 +257,49 @@ spot_tracker_XY::spot_tracker_XY(double radius, bool inverted, double pixelaccur
     _fitness(-1e10),	      // No good position found yet!
     _pixelstep(2),	      // Starting pixel step size
     _radstep(2),	      // Starting radius step size
-    _samplesep(sample_separation_in_pixels) // Spacing between samples taken by the kernel
+    _samplesep(sample_separation_in_pixels), // Spacing between samples taken by the kernel
+    _optimizer(NULL),	      // Use the pattern search
+    _cache_count(0), _cache_next(0), _cache_active(false),
+    _cache_image(NULL), _cache_generation(0), _cache_rgb(0),
+    _cache_hits(0), _cache_misses(0)
 {
 }
 
+// Return the fitness at the current position and radius, from the cache if
+// the pattern search has already been here on this version of this image.
+// Positions are compared exactly, so the answers are the same as without the
+// cache.
+double  spot_tracker_XY::cached_fitness(const image_wrapper &image, unsigned rgb)
+{
+  if (!_cache_active) {
+    return check_fitness(image, rgb);
+  }
+  if ( (&image != _cache_image) || (image.get_generation() != _cache_generation) ||
+       (rgb != _cache_rgb) ) {
+    _cache_image = &image;
+    _cache_generation = image.get_generation();
+    _cache_rgb = rgb;
+    invalidate_fitness_cache();
+  }
+
+  unsigned i;
+  for (i = 0; i < _cache_count; i++) {
+    const fitness_cache_entry &e = _cache[i];
+    if ( (e.x == _x) && (e.y == _y) && (e.r == _rad) ) {
+      _cache_hits++;
+      return e.fitness;
+    }
+  }
+
+  _cache_misses++;
+  double fitness = check_fitness(image, rgb);
+  fitness_cache_entry &e = _cache[_cache_next];
+  e.x = _x; e.y = _y; e.r = _rad; e.fitness = fitness;
+  _cache_next = (_cache_next + 1) % FITNESS_CACHE_SIZE;
+  if (_cache_count < FITNESS_CACHE_SIZE) { _cache_count++; }
+  return fitness;
+}
+
 // Optimize starting at the specified location to find the best-fit location.
 // Take only one optimization step.  Return whether we ended up finding a
 // better location or not.  Return new location in any case.  One step means
@@ -61,9 +320,9 @@ bool  spot_tracker_XY::take_single_optimization_step(const image_wrapper &image,
     double starting_x = get_x();
     v0 = _fitness;                                      // Value at starting location
     set_location(starting_x + _pixelstep, get_y());	// Try going a step in +X
-    vplus = check_fitness(image, rgb);
+    vplus = cached_fitness(image, rgb);
     set_location(starting_x - _pixelstep, get_y());	// Try going a step in -X
-    vminus = check_fitness(image, rgb);
+    vminus = cached_fitness(image, rgb);
     unsigned which;
     new_fitness = max3(v0, vplus, vminus, which);
     switch (which) {
@@ -87,9 +346,9 @@ bool  spot_tracker_XY::take_single_optimization_step(const image_wrapper &image,
     double starting_y = get_y();
     v0 = _fitness;                                      // Value at starting location
     set_location(get_x(), starting_y + _pixelstep);	// Try going a step in +Y
-    vplus = check_fitness(image, rgb);
+    vplus = cached_fitness(image, rgb);
     set_location(get_x(), starting_y - _pixelstep);	// Try going a step in -Y
-    vminus = check_fitness(image, rgb);
+    vminus = cached_fitness(image, rgb);
     unsigned which;
     new_fitness = max3(v0, vplus, vminus, which);
     switch (which) {
@@ -114,10 +373,10 @@ bool  spot_tracker_XY::take_single_optimization_step(const image_wrapper &image,
     double starting_rad = get_radius();
     v0 = _fitness;                                      // Value at starting radius
     set_radius(starting_rad + _radstep);	// Try going a step in +radius
-    vplus = check_fitness(image, rgb);
+    vplus = cached_fitness(image, rgb);
     if (_rad - _radstep >= 1) {  // Don't let it get less than 1
       set_radius(starting_rad - _radstep);	// Try going a step in -radius
-      vminus = check_fitness(image, rgb);
+      vminus = cached_fitness(image, rgb);
     } else {
       vminus = v0 - 1;  // Don't make it want to step in this direction
     }
@@ -179,12 +438,20 @@ void  spot_tracker_XY::locate_good_fit_in_image(const image_wrapper &image, unsi
 // the minimum.
 void  spot_tracker_XY::optimize(const image_wrapper &image, unsigned rgb, double &x, double &y)
 {
+  // If we have another optimizer, try it first.
+  if (_optimizer && _optimizer->optimize(*this, image, rgb, true, _optstatus)) {
+    x = get_x(); y = get_y();
+    return;
+  }
+
   // Set the step sizes to a large value to start with
   _pixelstep = 2;
   _radstep = 2;
 
   // Find out what our current value is (presumably this is a new image)
-  _fitness = check_fitness(image, rgb);
+  _cache_active = true;
+  invalidate_fitness_cache();
+  _fitness = cached_fitness(image, rgb);
 
   // Try with ever-smaller steps until we reach the smallest size and
   // can't do any better.
@@ -201,6 +468,7 @@ void  spot_tracker_XY::optimize(const image_wrapper &image, unsigned rgb, double
       break;
     }
   } while (true);
+  _cache_active = false;
 }
 
 // Continue to optimize until we can't do any better (the step size drops below
@@ -209,11 +477,19 @@ void  spot_tracker_XY::optimize_xy(const image_wrapper &image, unsigned rgb, dou
 {
   int optsteps_tried = 0;
 
+  // If we have another optimizer, try it first.
+  if (_optimizer && _optimizer->optimize(*this, image, rgb, false, _optstatus)) {
+    x = get_x(); y = get_y();
+    return;
+  }
+
   // Set the step sizes to a large value to start with
   _pixelstep = 2;
   
   // Find out what our current value is (presumably this is a new image)
-  _fitness = check_fitness(image, rgb);
+  _cache_active = true;
+  invalidate_fitness_cache();
+  _fitness = cached_fitness(image, rgb);
   
   // Try with ever-smaller steps until we reach the smallest size and
   // can't do any better.
@@ -228,6 +504,7 @@ void  spot_tracker_XY::optimize_xy(const image_wrapper &image, unsigned rgb, dou
     }
     _pixelstep /= 2;
   } while (true);
+  _cache_active = false;
 #ifdef	DEBUG
   printf("%d optimization steps tried\n", optsteps_tried);
 #endif
@@ -589,10 +866,19 @@ double	disk_spot_tracker::check_fitness(const image_wrapper &image, unsigned rgb
   return fitness;
 }
 
+// How much larger the off-surround is than the on-center disk.
+static const double disk_surround_factor = 1.3;
+
 disk_spot_tracker_interp::disk_spot_tracker_interp(double radius, bool inverted, double pixelaccuracy,
 				     double radiusaccuracy, double sample_separation_in_pixels) :
   spot_tracker_XY(radius, inverted, pixelaccuracy, radiusaccuracy, sample_separation_in_pixels)
 {
+  _table = spot_sampling_table::acquire(spot_sampling_table::DISK_RINGS, _samplesep, _rad * disk_surround_factor);
+}
+
+disk_spot_tracker_interp::~disk_spot_tracker_interp()
+{
+  spot_sampling_table::release(_table);
 }
 
 // Check the fitness of the disk against an image, at the current parameter settings.
@@ -612,33 +898,34 @@ disk_spot_tracker_interp::disk_spot_tracker_interp(double radius, bool inverted,
 // interpolation and sample within the space of the disk kernel, rather than
 // point-sampling the nearest pixel.
 
-// XXX This function should keep track of the last radius it computed the list
-// of points for and rebuild an "inside" and "outside" list when it changes.
-// Then the list can be re-used and the math avoided if the radius does not
-// change, making this run a lot faster.
+// The sample points come from the shared table, whose rings step out by the
+// sample spacing and have their first sample shifted by 1/2 step on each
+// outgoing ring, to keep them from lining up with each other.  The rings
+// within the radius count positively and the ones beyond it (out to the
+// surround) negatively.
 
-double	disk_spot_tracker_interp::check_fitness(const image_wrapper &image, unsigned rgb)
+template <class SAMPLER>
+double	disk_spot_tracker_interp::check_fitness_sampled(const SAMPLER &sample, unsigned rgb)
 {
-  double  r,theta;			//< Coordinates in disk space
   int	  pixels = 0;			//< How many pixels we ended up using
   double  fitness = 0.0;		//< Accumulates the fitness values
   double  val;				//< Pixel value read from the image
-  double  surroundfac = 1.3;		//< How much larger the surround is
-  double  surroundr = _rad*surroundfac;  //< The surround "off" disk radius
+  double  surroundr = _rad*disk_surround_factor;  //< The surround "off" disk radius
+  int	  ring, pix;
 
   // Start with the pixel in the middle.
-  if (image.read_pixel_bilerp(get_x(),get_y(),val, rgb)) {
+  if (sample(get_x(),get_y(),val, rgb)) {
     pixels++;
     fitness += val;
   }
 
   // Pixels within the radius have positive weights
-  // Shift the start location by 1/2 step on each outgoing ring, to
-  // keep them from lining up with each other.
-  for (r = _samplesep; r <= _rad; r += _samplesep) {
-    double rads_per_step = 1 / r * _samplesep;
-    for (theta = r*rads_per_step*0.5; theta <= 2*M_PI + r*rads_per_step*0.5; theta += rads_per_step) {
-      if (image.read_pixel_bilerp(get_x()+r*cos(theta),get_y()+r*sin(theta),val, rgb)) {
+  int num_rings = _table->num_rings();
+  for (ring = 0; (ring < num_rings) && (_table->ring_radius(ring) <= _rad); ring++) {
+    const double *xs = _table->ring_x(ring), *ys = _table->ring_y(ring);
+    int count = _table->ring_count(ring);
+    for (pix = 0; pix < count; pix++) {
+      if (sample(get_x()+xs[pix],get_y()+ys[pix],val, rgb)) {
 	pixels++;
 	fitness += val;
       }
@@ -646,12 +933,11 @@ double	disk_spot_tracker_interp::check_fitness(const image_wrapper &image, unsig
   }
 
   // Pixels outside the radius have negative weights
-  // Shift the start location by 1/2 step on each outgoing ring, to
-  // keep them from lining up with each other.
-  for (r = r /* Keep going */; r <= surroundr; r += _samplesep) {
-    double rads_per_step = 1 / r * _samplesep;
-    for (theta = r*rads_per_step*0.5; theta <= 2*M_PI + r*rads_per_step*0.5; theta += rads_per_step) {
-      if (image.read_pixel_bilerp(get_x()+r*cos(theta),get_y()+r*sin(theta),val, rgb)) {
+  for (/* Keep going */; (ring < num_rings) && (_table->ring_radius(ring) <= surroundr); ring++) {
+    const double *xs = _table->ring_x(ring), *ys = _table->ring_y(ring);
+    int count = _table->ring_count(ring);
+    for (pix = 0; pix < count; pix++) {
+      if (sample(get_x()+xs[pix],get_y()+ys[pix],val, rgb)) {
 	pixels++;
 	fitness -= val;
       }
@@ -668,10 +954,27 @@ double	disk_spot_tracker_interp::check_fitness(const image_wrapper &image, unsig
   return fitness;
 }
 
+double	disk_spot_tracker_interp::check_fitness(const image_wrapper &image, unsigned rgb)
+{
+  // The radius or spacing may have changed since the table was chosen.
+  _table = spot_sampling_table::update(_table, spot_sampling_table::DISK_RINGS,
+                                       _samplesep, _rad * disk_surround_factor);
+  if (_table == NULL) {
+    return 0;
+  }
+  return check_fitness_with_best_sampler(*this, image, rgb);
+}
+
 cone_spot_tracker_interp::cone_spot_tracker_interp(double radius, bool inverted, double pixelaccuracy,
 				     double radiusaccuracy, double sample_separation_in_pixels) :
   spot_tracker_XY(radius, inverted, pixelaccuracy, radiusaccuracy, sample_separation_in_pixels)
 {
+  _table = spot_sampling_table::acquire(spot_sampling_table::CONE_RINGS, _samplesep, _rad);
+}
+
+cone_spot_tracker_interp::~cone_spot_tracker_interp()
+{
+  spot_sampling_table::release(_table);
 }
 
 // Check the fitness of the disk against an image, at the current parameter settings.
@@ -683,36 +986,34 @@ cone_spot_tracker_interp::cone_spot_tracker_interp(double radius, bool inverted,
 
 // We assume that we are looking at a smooth function, so we do linear
 // interpolation and sample within the space of the kernel, rather than
-// point-sampling the nearest pixel.
+// point-sampling the nearest pixel.  The sample points come from the shared
+// table.
 
-// XXX This function should keep track of the last radius it computed the list
-// of points for and rebuild an "inside" and "outside" list when it changes.
-// Then the list can be re-used and the math avoided if the radius does not
-// change, making this run a lot faster.  It could also keep track of the
-// multiplier at each pixel.
-
-double	cone_spot_tracker_interp::check_fitness(const image_wrapper &image, unsigned rgb)
+template <class SAMPLER>
+double	cone_spot_tracker_interp::check_fitness_sampled(const SAMPLER &sample, unsigned rgb)
 {
-  double  r,theta;			//< Coordinates in disk space
   int	  pixels = 0;			//< How many pixels we ended up using
   double  fitness = 0.0;		//< Accumulates the fitness values
   double  val;				//< Pixel value read from the image
+  int	  ring, pix;
 
   // Start with the pixel in the middle.
-  if (image.read_pixel_bilerp(get_x(),get_y(),val, rgb)) {
+  if (sample(get_x(),get_y(),val, rgb)) {
     pixels++;
     fitness += val;
   }
 
   // Pixels within the radius have positive weights that fall off from 1
   // in the center to 0 at the radius.
-  // Shift the start location by 1/2 pixel on each outgoing ring, to
+  // The first sample is shifted by 1/2 pixel on each outgoing ring, to
   // keep them from lining up with each other.
-  for (r = 1; r <= _rad; r += _samplesep) {
-    double rads_per_step  = 1 / r * _samplesep;
-    double weight = 1 - (r / _rad);
-    for (theta = r*rads_per_step*0.5; theta <= 2*M_PI + r*rads_per_step*0.5; theta += rads_per_step) {
-      if (image.read_pixel_bilerp(get_x()+r*cos(theta),get_y()+r*sin(theta),val, rgb)) {
+  int num_rings = _table->num_rings();
+  for (ring = 0; (ring < num_rings) && (_table->ring_radius(ring) <= _rad); ring++) {
+    const double *xs = _table->ring_x(ring), *ys = _table->ring_y(ring);
+    int count = _table->ring_count(ring);
+    double weight = 1 - (_table->ring_radius(ring) / _rad);
+    for (pix = 0; pix < count; pix++) {
+      if (sample(get_x()+xs[pix],get_y()+ys[pix],val, rgb)) {
 	pixels++;
 	fitness += val * weight;
       }
@@ -729,81 +1030,39 @@ double	cone_spot_tracker_interp::check_fitness(const image_wrapper &image, unsig
   return fitness;
 }
 
+double	cone_spot_tracker_interp::check_fitness(const image_wrapper &image, unsigned rgb)
+{
+  // The radius or spacing may have changed since the table was chosen.
+  _table = spot_sampling_table::update(_table, spot_sampling_table::CONE_RINGS, _samplesep, _rad);
+  if (_table == NULL) {
+    return 0;
+  }
+  return check_fitness_with_best_sampler(*this, image, rgb);
+}
+
 symmetric_spot_tracker_interp::symmetric_spot_tracker_interp(double radius, bool inverted, double pixelaccuracy,
 				     double radiusaccuracy, double sample_separation_in_pixels) :
   spot_tracker_XY(radius, inverted, pixelaccuracy, radiusaccuracy, sample_separation_in_pixels),
-  _MAX_RADIUS(100), _radius_lists(NULL)
+  _MAX_RADIUS(100), _table(NULL)
 {
   // Check the radius here so we don't need to check it in the fitness routine.
   if (_rad < 1) { _rad = 1; }
   if (_rad > _MAX_RADIUS) { _rad = _MAX_RADIUS; }
   if (_samplesep < 0.1) { _samplesep = 0.1; }
 
-  // Allocate the space for the counts of pixel in each radius
-  if ( (_radius_counts = new int[(int)(_MAX_RADIUS/_samplesep+1)]) == NULL) {
-    fprintf(stderr,"symmetric_spot_tracker_interp::symmetric_spot_tracker_interp(): Out of memory!\n");
-    _MAX_RADIUS = 0;
-    return;
-  }
-
-  // Allocate the space for each list and fill it in.
-  int	  r;				//< Coordinates in disk space
-  double  theta;			//< Coordinates in disk space
-  int	  pixels = 0;			//< How many pixels we ended up using
-  int pixel;				//< Loop variable
-
-  // Allocate the list that holds the lists of pixels
-  if ( (_radius_lists = new offset*[(int)(_MAX_RADIUS/_samplesep+1)]) == NULL) {
+  // Get the lists of offsets for each ring.  Don't sample the pixel in the
+  // middle; it makes no difference to circular symmetry.
+  if ( (_table = spot_sampling_table::acquire(spot_sampling_table::SYMMETRIC_RINGS, _samplesep, _MAX_RADIUS)) == NULL) {
     fprintf(stderr,"symmetric_spot_tracker_interp::symmetric_spot_tracker_interp(): Out of memory!\n");
     _MAX_RADIUS = 0;
     return;
   }
-
-  // Don't make one for the pixel in the middle; it makes no difference to circular
-  // symmetry.
-  // Shift the start location by 1/2 pixel on each outgoing ring, to
-  // keep them from lining up with each other.
-  _radius_lists[0] = NULL;
-  for (r = 1; r <= _MAX_RADIUS / _samplesep; r++) {
-
-    // The floating-point value of how far we've come from the center of
-    // the circle; the integer count of steps times the step size.
-    double scaled_r = r * _samplesep;
-
-    // How many radians are in a step of one _samplesep at the given
-    // radius.  There are 2pi radians at a distance of 1 from the
-    // center, and 2pi*scaled_r at the scaled_r distance.  So the
-    // radians/2pi = _samplestep/(2pi*scaled_r), so
-    // radians = _samplesep / scaled_r;
-    double rads_per_step = _samplesep / scaled_r;
-
-    pixels = (int)(1 + 2*M_PI / rads_per_step);
-    if ( (_radius_lists[r] = new offset[pixels]) == NULL) {
-      fprintf(stderr,"symmetric_spot_tracker_interp::symmetric_spot_tracker_interp(): Out of memory!\n");
-      _MAX_RADIUS = 0;
-      return;
-    }
-    pixel = 0;
-    for (theta = r*rads_per_step*0.5; theta <= 2*M_PI + r*rads_per_step*0.5; theta += rads_per_step) {
-      _radius_lists[r][pixel].x = scaled_r*cos(theta);
-      _radius_lists[r][pixel].y = scaled_r*sin(theta);
-      pixel++;
-    }
-    _radius_counts[r] = pixel;
-  }
 }
 
 symmetric_spot_tracker_interp::~symmetric_spot_tracker_interp()
 {
-  int i;
-  if (_radius_lists != NULL) {
-    for (i = 0; i <= _MAX_RADIUS / _samplesep; i++) {
-      if (_radius_lists[i] != NULL) { delete [] _radius_lists[i]; _radius_lists[i] = NULL; }
-    }
-    delete [] _radius_lists;
-    _radius_lists = NULL;
-  }
-  if (_radius_counts) { delete [] _radius_counts; _radius_counts = NULL; }
+  spot_sampling_table::release(_table);
+  _table = NULL;
 }
 
 // Check the fitness of the tracker against an image, at the current parameter settings.
@@ -816,12 +1075,12 @@ symmetric_spot_tracker_interp::~symmetric_spot_tracker_interp()
 // interpolation and sample within the space of the kernel, rather than
 // point-sampling the nearest pixel.
 
-double	symmetric_spot_tracker_interp::check_fitness(const image_wrapper &image, unsigned rgb)
+template <class SAMPLER>
+double	symmetric_spot_tracker_interp::check_fitness_sampled(const SAMPLER &sample, unsigned rgb)
 {
   double  val;				//< Pixel value read from the image
   double  pixels;			//< How many pixels we ended up using (used in floating-point calculations only)
   double  ring_variance_sum = 0.0;	//< Accumulates the variance around the rings
-  offset  **which_list = &_radius_lists[1];  //< Point at the first list, use increment later to advance
   int	  r;				//< Loops over radii from 1 up
   int	  count;			//< How many entries in a particular list
 
@@ -831,28 +1090,29 @@ double	symmetric_spot_tracker_interp::check_fitness(const image_wrapper &image,
     double squareValSum = 0.0;		//< Accumulates the variance around a ring
     double valSum = 0.0;		//< Accumulates the mean around a ring
     int	pix;
-    offset *list = *(which_list++);	//< Makes a speed difference to do this with increment vs. index
+    const double *xs = _table->ring_x(r);
+    const double *ys = _table->ring_y(r);
 
     pixels = 0.0;	// No pixels in this circle yet.
-    count = _radius_counts[r];
-    for (pix = 0; pix < count; pix++) {
-// Switching to the version that does not check boundaries didn't make it faster by much at all...
+    count = _table->ring_count(r);
+
+    // If the whole ring is inside the image, let the vector code sum it.
+    // The radius is padded a bit to cover rounding of the float offsets.
+    if (sample.ring_sums(get_x(), get_y(), r * _samplesep + 0.01,
+                         _table->ring_xf(r), _table->ring_yf(r), count, rgb, valSum, squareValSum)) {
+      pixels = count;
+    } else {
+      for (pix = 0; pix < count; pix++) {
+// Switching to a version that does not check boundaries didn't make it faster by much at all...
 // Using it would mean somehow clipping the boundaries before calling these functions, which would
 // surely slow things down.
-#if 1
-      if (image.read_pixel_bilerp(get_x()+list->x,get_y()+list->y,val, rgb)) {
-	    valSum += val;
-	    squareValSum += val*val;
-	    pixels++;
-	    list++;	  //< Makes big speed difference to do this with increment vs. index
+        if (sample(get_x()+*xs,get_y()+*ys,val, rgb)) {
+	      valSum += val;
+	      squareValSum += val*val;
+	      pixels++;
+	      xs++; ys++;	  //< Makes big speed difference to do this with increment vs. index
+        }
       }
-#else
-      val = image.read_pixel_bilerp_nocheck(get_x()+list->x, get_y()+list->y, rgb);
-      valSum += val;
-      squareValSum += val*val;
-      pixels++;
-      list++;
-#endif
     }
 
     // Calculate the variance around the ring using the formulation
@@ -867,6 +1127,139 @@ double	symmetric_spot_tracker_interp::check_fitness(const image_wrapper &image,
   return -ring_variance_sum;
 }
 
+double	symmetric_spot_tracker_interp::check_fitness(const image_wrapper &image, unsigned rgb)
+{
+  if (_table == NULL) {
+    return 0;
+  }
+  return check_fitness_with_best_sampler(*this, image, rgb);
+}
+
+// Bilinear interpolation as in image_wrapper::read_pixel_bilerp(), also
+// returning the slope of the interpolated surface in X and Y (deriv) and
+// its curvature in XX, XY and YY (curv).  The bilinear surface has no
+// curvature in XX or YY except at the pixel boundaries, so those are
+// interpolated from the second differences of the pixels around the four
+// that are blended; they are zero if some of those pixels can't be read.
+// Returns false if the four pixels can't be read.
+static inline bool read_pixel_bilerp_derivatives(const image_wrapper &image, double x, double y,
+						 double &result, double deriv[2], double curv[3], unsigned rgb)
+{
+  result = 0;
+  double xlow = floor(x); int ixlow = (int)xlow;
+  double ylow = floor(y); int iylow = (int)ylow;
+  double xhighfrac = x - xlow;
+  double yhighfrac = y - ylow;
+  double xlowfrac = 1.0 - xhighfrac;
+  double ylowfrac = 1.0 - yhighfrac;
+  double ll, lh, hl, hh;
+  if (!image.read_pixel(ixlow, iylow, ll, rgb)) { return false; }
+  if (!image.read_pixel(ixlow, iylow+1, lh, rgb)) { return false; }
+  if (!image.read_pixel(ixlow+1, iylow, hl, rgb)) { return false; }
+  if (!image.read_pixel(ixlow+1, iylow+1, hh, rgb)) { return false; }
+  result = ll * xlowfrac * ylowfrac +
+	   lh * xlowfrac * yhighfrac +
+	   hl * xhighfrac * ylowfrac +
+	   hh * xhighfrac * yhighfrac;
+  deriv[0] = (hl - ll) * ylowfrac + (hh - lh) * yhighfrac;
+  deriv[1] = (lh - ll) * xlowfrac + (hh - hl) * xhighfrac;
+  curv[1] = hh - hl - lh + ll;
+
+  // The pixels beyond the four, to the left and right of each row (xl, xh)
+  // and below and above each column (yl, yh).
+  double xll, xlh, xhl, xhh, yll, ylh, yhl, yhh;
+  if ( image.read_pixel(ixlow-1, iylow, xll, rgb) && image.read_pixel(ixlow-1, iylow+1, xlh, rgb) &&
+       image.read_pixel(ixlow+2, iylow, xhl, rgb) && image.read_pixel(ixlow+2, iylow+1, xhh, rgb) &&
+       image.read_pixel(ixlow, iylow-1, yll, rgb) && image.read_pixel(ixlow+1, iylow-1, yhl, rgb) &&
+       image.read_pixel(ixlow, iylow+2, ylh, rgb) && image.read_pixel(ixlow+1, iylow+2, yhh, rgb) ) {
+    curv[0] = (xll - 2*ll + hl) * xlowfrac * ylowfrac +
+	      (xlh - 2*lh + hh) * xlowfrac * yhighfrac +
+	      (ll - 2*hl + xhl) * xhighfrac * ylowfrac +
+	      (lh - 2*hh + xhh) * xhighfrac * yhighfrac;
+    curv[2] = (yll - 2*ll + lh) * xlowfrac * ylowfrac +
+	      (ll - 2*lh + ylh) * xlowfrac * yhighfrac +
+	      (yhl - 2*hl + hh) * xhighfrac * ylowfrac +
+	      (hl - 2*hh + yhh) * xhighfrac * yhighfrac;
+  } else {
+    curv[0] = curv[2] = 0;
+  }
+  return true;
+}
+
+// For each ring, with v the interpolated values and n how many there are,
+// the variance V = sum(v^2) - sum(v)^2/n has derivatives
+//   dV/da = 2 * (sum(v * dv/da) - sum(v) * sum(dv/da) / n)
+//   d2V/dadb = 2 * (sum(dv/da * dv/db) - sum(dv/da) * sum(dv/db) / n)
+//            + 2 * (sum(v * d2v/dadb) - sum(v) * sum(d2v/dadb) / n)
+// for a and b each X or Y.  The fitness is minus the sum of these.  The
+// first term of the second derivative (the Gauss-Newton one) makes the
+// fitness look more curved than it is away from the peak, so the steps fall
+// short; the second term corrects for that.  If the sum of the two has no
+// peak, the first term is returned alone.  The samples are read the same
+// way as check_fitness_sampled() reads them when it goes one at a time.
+bool	symmetric_spot_tracker_interp::check_fitness_derivatives(const image_wrapper &image, unsigned rgb,
+						double &fitness, double gradient[2], double hessian[2][2])
+{
+  if (_table == NULL) {
+    return false;
+  }
+  double  ring_variance_sum = 0.0;
+  double  grad[2] = { 0, 0 };
+  double  gn[3] = { 0, 0, 0 };      //< Gauss-Newton term of the XX, XY and YY second derivatives
+  double  full[3] = { 0, 0, 0 };    //< Gauss-Newton term plus curvature term
+  int	  r, k;
+  for (r = 1; r <= _rad / _samplesep; r++) {
+    const double *xs = _table->ring_x(r);
+    const double *ys = _table->ring_y(r);
+    int	    count = _table->ring_count(r);
+    double  pixels = 0, val, deriv[2], curv[3];
+    double  valSum = 0, squareValSum = 0;
+    double  derivSum[2] = { 0, 0 }, valDerivSum[2] = { 0, 0 };
+    double  curvSum[3] = { 0, 0, 0 }, valCurvSum[3] = { 0, 0, 0 }, derivDerivSum[3] = { 0, 0, 0 };
+    int	    pix;
+    for (pix = 0; pix < count; pix++) {
+      if (read_pixel_bilerp_derivatives(image, get_x()+*xs, get_y()+*ys, val, deriv, curv, rgb)) {
+	valSum += val;
+	squareValSum += val*val;
+	for (k = 0; k < 2; k++) {
+	  derivSum[k] += deriv[k];
+	  valDerivSum[k] += val * deriv[k];
+	}
+	for (k = 0; k < 3; k++) {
+	  curvSum[k] += curv[k];
+	  valCurvSum[k] += val * curv[k];
+	}
+	derivDerivSum[0] += deriv[0] * deriv[0];
+	derivDerivSum[1] += deriv[0] * deriv[1];
+	derivDerivSum[2] += deriv[1] * deriv[1];
+	pixels++;
+	xs++; ys++;
+      }
+    }
+    if (pixels) {
+      ring_variance_sum += squareValSum - valSum*valSum / pixels;
+      for (k = 0; k < 2; k++) {
+	grad[k] += valDerivSum[k] - valSum * derivSum[k] / pixels;
+      }
+      const int a[3] = { 0, 0, 1 }, b[3] = { 0, 1, 1 };
+      for (k = 0; k < 3; k++) {
+	double term = derivDerivSum[k] - derivSum[a[k]] * derivSum[b[k]] / pixels;
+	gn[k] += term;
+	full[k] += term + valCurvSum[k] - valSum * curvSum[k] / pixels;
+      }
+    }
+  }
+
+  const double *h = ( (full[0] > 0) && (full[0] * full[2] - full[1] * full[1] > 0) ) ? full : gn;
+  fitness = -ring_variance_sum;
+  gradient[0] = -2 * grad[0];
+  gradient[1] = -2 * grad[1];
+  hessian[0][0] = -2 * h[0];
+  hessian[0][1] = hessian[1][0] = -2 * h[1];
+  hessian[1][1] = -2 * h[2];
+  return true;
+}
+
 image_spot_tracker_interp::image_spot_tracker_interp(double radius, bool inverted, double pixelaccuracy,
 				     double radiusaccuracy, double sample_separation_in_pixels, int frames_to_average) :
     spot_tracker_XY(radius, inverted, pixelaccuracy, radiusaccuracy, sample_separation_in_pixels)
@@ -1005,37 +1398,20 @@ bool	image_spot_tracker_interp::set_image(const image_wrapper &image, unsigned r
 
 // We assume that we are looking at a smooth function, so we do linear
 // interpolation and sample within the space of the kernel, rather than
-// point-sampling the nearest pixel.
-
-double	image_spot_tracker_interp::check_fitness(const image_wrapper &image, unsigned rgb)
+// point-sampling the nearest pixel.  The caller has made sure that the test
+// image exists.
+template <class SAMPLER>
+double	image_spot_tracker_interp::check_fitness_sampled(const SAMPLER &sample, unsigned rgb)
 {
   double  val;				//< Pixel value read from the image
   double  pixels = 0;			//< How many pixels we ended up using (used in floating-point calculations only)
   double  fitness = 0.0;		//< Accumulates the fitness values
   double  x, y;				//< Loops over coordinates, distance from the center.
 
-  // If we haven't ever gotten the original image, go ahead and grab it now from
-  // the image we've been asked to optimize from.
-  if (_testimage == NULL) {
-    fprintf(stderr,"image_spot_tracker_interp::check_fitness(): Called before set_image() succeeded (grabbing from image)\n");
-    set_image(image, rgb, get_x(), get_y(), get_radius());
-    if (_testimage == NULL) {
-      return 0;
-    }
-  }
-
-  // If our center is outside of the image, return a very low fitness value.
-  int minx, miny, maxx, maxy;
-  image.read_range(minx, maxx, miny, maxy);
-  if ( (get_x() < minx) || (get_x() > maxx) || (get_y() < miny) || (get_y() > maxy) ) {
-    fitness = -1e10;
-    return fitness;
-  }
-
   // Find the fitness.
   for (x = -_testrad; x <= _testrad; x++) {
     for (y = -_testrad; y <= _testrad; y++) {
-      if (image.read_pixel_bilerp(get_x()+x,get_y()+y,val, rgb)) {
+      if (sample(get_x()+x,get_y()+y,val, rgb)) {
 	double myval = _testimage[(int)(_testx+x) + _testsize * (int)(_testy+y)];
 	double squarediff = (val-myval) * (val-myval);
 	fitness -= squarediff;
@@ -1057,6 +1433,30 @@ double	image_spot_tracker_interp::check_fitness(const image_wrapper &image, unsi
   return fitness;
 }
 
+// Make sure we have a test image and that we're inside the image, then
+// compare against it using the fastest sampler the image supports.
+double	image_spot_tracker_interp::check_fitness(const image_wrapper &image, unsigned rgb)
+{
+  // If we haven't ever gotten the original image, go ahead and grab it now from
+  // the image we've been asked to optimize from.
+  if (_testimage == NULL) {
+    fprintf(stderr,"image_spot_tracker_interp::check_fitness(): Called before set_image() succeeded (grabbing from image)\n");
+    set_image(image, rgb, get_x(), get_y(), get_radius());
+    if (_testimage == NULL) {
+      return 0;
+    }
+  }
+
+  // If our center is outside of the image, return a very low fitness value.
+  int minx, miny, maxx, maxy;
+  image.read_range(minx, maxx, miny, maxy);
+  if ( (get_x() < minx) || (get_x() > maxx) || (get_y() < miny) || (get_y() > maxy) ) {
+    return -1e10;
+  }
+
+  return check_fitness_with_best_sampler(*this, image, rgb);
+}
+
 // Check the fitness of the stored image against another image, at the current parameter settings.
 // Return the fitness value there.
 
@@ -1070,6 +1470,16 @@ void  image_spot_tracker_interp::optimize_xy(const image_wrapper &image, unsigne
 	set_image(image, rgb, get_x(), get_y(), get_radius());
 }
 
+bool  image_spot_tracker_interp::get_correlation_template(std::vector<double> &templ, int &template_rad) const
+{
+  if (_testimage == NULL) {
+    return false;
+  }
+  template_rad = _testrad;
+  templ.assign(_testimage, _testimage + _testsize * _testsize);
+  return true;
+}
+
 double	twolines_image_spot_tracker_interp::check_fitness(const image_wrapper &image, unsigned rgb)
 {
   double  val;				//< Pixel value read from the image
@@ -1376,6 +1786,7 @@ bool  image_oriented_spot_tracker_interp::take_single_optimization_step(const im
     }
     _fitness = new_fitness;
   }
+  if (betterorient) { invalidate_fitness_cache(); }
 
   // Return the new location and whether we found a better one.
   x = get_x(); y = get_y();
@@ -1388,6 +1799,41 @@ void  image_oriented_spot_tracker_interp::optimize_xy(const image_wrapper &image
 	set_image(image, rgb, get_x(), get_y(), get_radius(), get_orientation());
 }
 
+// The test image is stored in the tracker's own frame and compared against
+// the image rotated by the orientation, so each template pixel is found by
+// rotating back into the test image and interpolating there.  Corners that
+// rotate outside the test image use the nearest edge value.
+bool  image_oriented_spot_tracker_interp::get_correlation_template(std::vector<double> &templ, int &template_rad) const
+{
+  if (_testimage == NULL) {
+    return false;
+  }
+  template_rad = _testrad;
+  templ.resize(_testsize * _testsize);
+  double c = cos(-d_orientation * (M_PI/180));
+  double s = sin(-d_orientation * (M_PI/180));
+  int u, v;
+  for (v = -_testrad; v <= _testrad; v++) {
+    for (u = -_testrad; u <= _testrad; u++) {
+      double tx = _testx + u * c - v * s;
+      double ty = _testy + u * s + v * c;
+      if (tx < 0) { tx = 0; }
+      if (ty < 0) { ty = 0; }
+      if (tx > _testsize - 1) { tx = _testsize - 1; }
+      if (ty > _testsize - 1) { ty = _testsize - 1; }
+      int ix = (int)floor(tx), iy = (int)floor(ty);
+      int ix1 = min(ix + 1, _testsize - 1), iy1 = min(iy + 1, _testsize - 1);
+      double fx = tx - ix, fy = ty - iy;
+      templ[(_testx + u) + _testsize * (_testy + v)] =
+        _testimage[ix + _testsize * iy] * (1-fx) * (1-fy) +
+        _testimage[ix1 + _testsize * iy] * fx * (1-fy) +
+        _testimage[ix + _testsize * iy1] * (1-fx) * fy +
+        _testimage[ix1 + _testsize * iy1] * fx * fy;
+    }
+  }
+  return true;
+}
+
 Gaussian_spot_tracker::Gaussian_spot_tracker(double radius, bool inverted, double pixelaccuracy,
 				     double radiusaccuracy, double sample_separation_in_pixels,
                                      double background, double summedvalue) :
@@ -1442,13 +1888,6 @@ double	Gaussian_spot_tracker::check_fitness(const image_wrapper &image, unsigned
   double summed_value = _summedvalue;
   if (_invert) { summed_value *= -1; }
 
-  // Make sure that the sample separation in pixels is at most 1 so we get a
-  // sample per pixel at least, and also make sure that it is nonzero to avoid
-  // divide-by-zero problems.
-  double sample_separation_in_pixels = _samplesep;
-  if (sample_separation_in_pixels > 1) { sample_separation_in_pixels = 1; }
-  if (sample_separation_in_pixels < 0.01) { sample_separation_in_pixels = 0.01; }
-
   // Figure out the offset for the Gaussian image we want to compute.  This is
   // the floor of the translation, so it will always be between 0 and 1 in X and Y.
   // We will translate the center pixel (0,0) of the Gaussian image so that
@@ -1469,16 +1908,16 @@ double	Gaussian_spot_tracker::check_fitness(const image_wrapper &image, unsigned
 
   // If we don't have an image allocated, then create a new one with the appropriate
   // parameters.  Otherwise, just fill in the existing image with new values.  Allocate
-  // out to twice the radius on each side (two standard deviations).
+  // out to twice the radius on each side (two standard deviations).  An oversample
+  // of zero has the image integrate each pixel exactly.
   if (!_testimage) {
     _testimage = new Integrated_Gaussian_image(static_cast<int>(-2*get_radius()),
       static_cast<int>(2*get_radius()),
       static_cast<int>(-2*get_radius()),
       static_cast<int>(2*get_radius()),
-      _background, 0.0, x_frac,y_frac, get_radius(), summed_value,
-      static_cast<int>(1/sample_separation_in_pixels));
+      _background, 0.0, x_frac,y_frac, get_radius(), summed_value, 0);
   } else {
-    _testimage->recompute(_background, 0.0, x_frac,y_frac, get_radius(), summed_value, static_cast<int>(1/sample_separation_in_pixels));
+    _testimage->recompute(_background, 0.0, x_frac,y_frac, get_radius(), summed_value, 0);
   }
 
   // Compute the sum of the squared errors between the test image and the image
@@ -1581,6 +2020,11 @@ double	FIONA_spot_tracker::check_fitness(const image_wrapper &image, unsigned rg
   int halfwidth = static_cast<int>(4*_rad);
   //if (halfwidth < 15) { halfwidth = 15; }
 
+  // Compute the same point-sampled Gaussian as _testimage, but one row and
+  // column at a time rather than calling exp() for every pixel.
+  _model.compute(-halfwidth, halfwidth, -halfwidth, halfwidth,
+    x_frac, y_frac, get_radius(), summed_value, Gaussian_kernel_model::POINT_SAMPLED);
+
   // Compute the sum of the squared errors between the test image and the image
   // we're optimizing against.  The Gaussian image will have been shifted by
   // the fractional part of the offset between the Gaussian and the test image, so
@@ -1604,7 +2048,7 @@ double	FIONA_spot_tracker::check_fitness(const image_wrapper &image, unsigned rg
   for (x = -halfwidth+1; x < halfwidth; x++) {
     for (y = -halfwidth+1; y < halfwidth; y++) {
       if (image.read_pixel(x_int+x,y_int+y,val, rgb)) {
-        _testimage.read_pixel(x, y, myval, 0);
+        myval = _background + _model.value(x, y);
 	double squarediff = (val-myval) * (val-myval);
 	fitness -= squarediff;
 	pixels++;
@@ -1618,13 +2062,13 @@ double	FIONA_spot_tracker::check_fitness(const image_wrapper &image, unsigned rg
   double xmaxweight = x_frac;
   for (y = -halfwidth+1; y < halfwidth; y++) {
     if (image.read_pixel(xmin,y_int+y,val, rgb)) {
-      _testimage.read_pixel(-halfwidth, y, myval, 0);
+      myval = _background + _model.value(-halfwidth, y);
 	double squarediff = (val-myval) * (val-myval);
 	fitness -= squarediff * xminweight;
 	pixels++;
     }
     if (image.read_pixel(xmax,y_int+y,val, rgb)) {
-      _testimage.read_pixel(+halfwidth, y, myval, 0);
+      myval = _background + _model.value(+halfwidth, y);
 	double squarediff = (val-myval) * (val-myval);
 	fitness -= squarediff * xmaxweight;
 	pixels++;
@@ -1637,13 +2081,13 @@ double	FIONA_spot_tracker::check_fitness(const image_wrapper &image, unsigned rg
   // Boundaries at the top and bottom
   for (x = -halfwidth+1; x < halfwidth; x++) {
     if (image.read_pixel(x_int+x,ymin,val, rgb)) {
-      _testimage.read_pixel(x, -halfwidth, myval, 0);
+      myval = _background + _model.value(x, -halfwidth);
 	double squarediff = (val-myval) * (val-myval);
 	fitness -= squarediff * yminweight;
 	pixels++;
     }
     if (image.read_pixel(x_int+x,ymax,val, rgb)) {
-      _testimage.read_pixel(x, +halfwidth, myval, 0);
+      myval = _background + _model.value(x, +halfwidth);
 	double squarediff = (val-myval) * (val-myval);
 	fitness -= squarediff * ymaxweight;
 	pixels++;
@@ -1651,25 +2095,25 @@ double	FIONA_spot_tracker::check_fitness(const image_wrapper &image, unsigned rg
   }
   // Four corners
   if (image.read_pixel(xmin,ymin,val, rgb)) {
-    _testimage.read_pixel(-halfwidth, -halfwidth, myval, 0);
+    myval = _background + _model.value(-halfwidth, -halfwidth);
 	double squarediff = (val-myval) * (val-myval);
 	fitness -= squarediff * xminweight * yminweight;
 	pixels++;
   }
   if (image.read_pixel(xmax,ymin,val, rgb)) {
-    _testimage.read_pixel(+halfwidth, -halfwidth, myval, 0);
+    myval = _background + _model.value(+halfwidth, -halfwidth);
 	double squarediff = (val-myval) * (val-myval);
 	fitness -= squarediff * xmaxweight * yminweight;
 	pixels++;
   }
   if (image.read_pixel(xmin,ymax,val, rgb)) {
-    _testimage.read_pixel(-halfwidth, +halfwidth, myval, 0);
+    myval = _background + _model.value(-halfwidth, +halfwidth);
 	double squarediff = (val-myval) * (val-myval);
 	fitness -= squarediff * xminweight * ymaxweight;
 	pixels++;
   }
   if (image.read_pixel(xmax,ymax,val, rgb)) {
-    _testimage.read_pixel(+halfwidth, +halfwidth, myval, 0);
+    myval = _background + _model.value(+halfwidth, +halfwidth);
 	double squarediff = (val-myval) * (val-myval);
 	fitness -= squarediff * xmaxweight * ymaxweight;
 	pixels++;
@@ -1761,23 +2205,439 @@ bool  FIONA_spot_tracker::take_single_optimization_step(const image_wrapper &ima
   }
   _fitness = new_fitness;
 
+  if (betterbackground || bettersummedvalue) { invalidate_fitness_cache(); }
+
   // Return the new location and whether we found a better one.
   x = get_x(); y = get_y();
   return betterbase || betterbackground || bettersummedvalue;
 }
 
 
-rod3_spot_tracker_interp::rod3_spot_tracker_interp(const disk_spot_tracker *,
-			    double radius, bool inverted,
-			    double pixelaccuracy, double radiusaccuracy,
-			    double sample_separation_in_pixels,
-			    double length, double orientation) :
-    spot_tracker_XY(radius, inverted, pixelaccuracy, radiusaccuracy, sample_separation_in_pixels),
-    d_length(length),
-    d_orientation(orientation),
-    d_center(NULL),
-    d_beginning(NULL),
-    d_end(NULL)
+//----------------------------------------------------------------------------
+// Least-squares fit of a Gaussian model to an image.  The model is
+//    background + S * X(px) * Y(py)
+// where X and Y are the per-column and per-row Gaussian terms and S scales
+// the signed volume.  For the point-sampled Gaussian, X(px) = exp(-dx^2/2s^2)
+// and S = volume / (2 pi s^2); for the integrated Gaussian, X(px) is the
+// fraction of the Gaussian that lands in column px and S = volume.
+
+enum { LM_X = 0, LM_Y, LM_S, LM_B, LM_V, LM_PARAMS };
+
+class Gaussian_LM_model {
+public:
+  Gaussian_LM_model(const image_wrapper &image, unsigned rgb, bool integrated, double halfwidth_per_radius)
+    : _image(image), _rgb(rgb), _integrated(integrated), _hwscale(halfwidth_per_radius) {};
+
+  /// Find the sum of squared errors, J^T J and J^T r at the parameters,
+  // for the parameters listed in which[].  Returns false if no pixels are
+  // inside the image.
+  bool evaluate(const double p[LM_PARAMS], const unsigned *which, unsigned n,
+		double &cost, double JtJ[LM_PARAMS][LM_PARAMS], double Jtr[LM_PARAMS]);
+
+protected:
+  void  axis(int min, int n, double center, double s);
+
+  const image_wrapper	&_image;
+  unsigned		_rgb;
+  bool			_integrated;
+  double		_hwscale;
+  std::vector<double>	_v, _dv, _ds;	  // Term, d/dcenter and d/ds for one axis
+  std::vector<double>	_X, _dX, _dXs;	  // Copies for the X axis
+};
+
+void Gaussian_LM_model::axis(int min, int n, double center, double s)
+{
+  _v.resize(n); _dv.resize(n); _ds.resize(n);
+  int i;
+  if (_integrated) {
+    const double edge_scale = 1 / (s * sqrt(2.0));
+    const double phi_scale = 1 / (s * sqrt(2*M_PI));
+    for (i = 0; i < n; i++) {
+      double u0 = (min + i) - center - 0.5;
+      double u1 = u0 + 1;
+      double phi0 = phi_scale * exp(-u0*u0 / (2*s*s));
+      double phi1 = phi_scale * exp(-u1*u1 / (2*s*s));
+      _v[i] = 0.5 * ( erf(u1 * edge_scale) - erf(u0 * edge_scale) );
+      _dv[i] = phi0 - phi1;
+      _ds[i] = (u0*phi0 - u1*phi1) / s;
+    }
+  } else {
+    for (i = 0; i < n; i++) {
+      double d = (min + i) - center;
+      double g = exp(-d*d / (2*s*s));
+      _v[i] = g;
+      _dv[i] = g * d / (s*s);
+      _ds[i] = g * d*d / (s*s*s);
+    }
+  }
+}
+
+bool Gaussian_LM_model::evaluate(const double p[LM_PARAMS], const unsigned *which, unsigned n,
+				 double &cost, double JtJ[LM_PARAMS][LM_PARAMS], double Jtr[LM_PARAMS])
+{
+  const double s = p[LM_S];
+  int halfwidth = static_cast<int>(_hwscale * s);
+  int minx = static_cast<int>(floor(p[LM_X])) - halfwidth;
+  int miny = static_cast<int>(floor(p[LM_Y])) - halfwidth;
+  int count = 2*halfwidth + 1;
+
+  // The scale and its derivatives with respect to the radius and volume.
+  double S, dS_ds, dS_dV;
+  if (_integrated) {
+    S = p[LM_V]; dS_ds = 0; dS_dV = 1;
+  } else {
+    dS_dV = 1 / (2 * M_PI * s * s);
+    S = p[LM_V] * dS_dV;
+    dS_ds = -2 * S / s;
+  }
+
+  axis(minx, count, p[LM_X], s);
+  _X.swap(_v); _dX.swap(_dv); _dXs.swap(_ds);
+  axis(miny, count, p[LM_Y], s);
+
+  unsigned i, j;
+  for (i = 0; i < n; i++) {
+    Jtr[i] = 0;
+    for (j = 0; j < n; j++) { JtJ[i][j] = 0; }
+  }
+  cost = 0;
+
+  unsigned pixels = 0;
+  double d[LM_PARAMS];
+  double all[LM_PARAMS];
+  int x, y;
+  for (y = 0; y < count; y++) {
+    for (x = 0; x < count; x++) {
+      double val;
+      if (!_image.read_pixel(minx + x, miny + y, val, _rgb)) { continue; }
+      double XY = _X[x] * _v[y];
+      double r = val - (p[LM_B] + S * XY);
+      all[LM_X] = S * _dX[x] * _v[y];
+      all[LM_Y] = S * _X[x] * _dv[y];
+      all[LM_S] = S * (_dXs[x] * _v[y] + _X[x] * _ds[y]) + dS_ds * XY;
+      all[LM_B] = 1;
+      all[LM_V] = dS_dV * XY;
+      for (i = 0; i < n; i++) { d[i] = all[which[i]]; }
+      for (i = 0; i < n; i++) {
+	Jtr[i] += d[i] * r;
+	for (j = 0; j <= i; j++) { JtJ[i][j] += d[i] * d[j]; }
+      }
+      cost += r * r;
+      pixels++;
+    }
+  }
+  for (i = 0; i < n; i++) {
+    for (j = i+1; j < n; j++) { JtJ[i][j] = JtJ[j][i]; }
+  }
+  return pixels > 0;
+}
+
+// Solve A x = b for the n x n system using Gaussian elimination with
+// partial pivoting.  A and b are destroyed.  Returns false if singular.
+static bool solve_linear_system(double A[LM_PARAMS][LM_PARAMS], double b[LM_PARAMS], unsigned n, double x[LM_PARAMS])
+{
+  unsigned i, j, k;
+  for (k = 0; k < n; k++) {
+    unsigned pivot = k;
+    for (i = k+1; i < n; i++) {
+      if (fabs(A[i][k]) > fabs(A[pivot][k])) { pivot = i; }
+    }
+    if (A[pivot][k] == 0) { return false; }
+    if (pivot != k) {
+      for (j = 0; j < n; j++) { std::swap(A[k][j], A[pivot][j]); }
+      std::swap(b[k], b[pivot]);
+    }
+    for (i = k+1; i < n; i++) {
+      double f = A[i][k] / A[k][k];
+      for (j = k; j < n; j++) { A[i][j] -= f * A[k][j]; }
+      b[i] -= f * b[k];
+    }
+  }
+  for (k = n; k-- > 0; ) {
+    double sum = b[k];
+    for (j = k+1; j < n; j++) { sum -= A[k][j] * x[j]; }
+    x[k] = sum / A[k][k];
+  }
+  return true;
+}
+
+bool Gaussian_LM_optimizer::optimize(spot_tracker_XY &tracker, const image_wrapper &image, unsigned rgb,
+				     bool do_r, spot_optimizer_status &status) const
+{
+  status = spot_optimizer_status();
+
+  // Figure out which model the tracker uses and which parameters we fit.
+  // The FIONA tracker always fits all of them, the Gaussian tracker only the
+  // position and (maybe) the radius.  The window sizes match check_fitness().
+  FIONA_spot_tracker *fiona = dynamic_cast<FIONA_spot_tracker *>(&tracker);
+  Gaussian_spot_tracker *gauss = dynamic_cast<Gaussian_spot_tracker *>(&tracker);
+  double sign = tracker.get_invert() ? -1 : 1;
+  double p[LM_PARAMS];
+  unsigned which[LM_PARAMS];
+  unsigned n = 0;
+  which[n++] = LM_X;
+  which[n++] = LM_Y;
+  bool integrated;
+  double hwscale;
+  if (fiona) {
+    integrated = false; hwscale = 4;
+    p[LM_B] = fiona->get_background();
+    p[LM_V] = sign * fiona->get_summedvalue();
+    which[n++] = LM_S; which[n++] = LM_B; which[n++] = LM_V;
+  } else if (gauss) {
+    integrated = true; hwscale = 2;
+    p[LM_B] = gauss->get_background();
+    p[LM_V] = sign * gauss->get_summedvalue();
+    if (do_r) { which[n++] = LM_S; }
+  } else {
+    return false;
+  }
+  const double startx = tracker.get_x();
+  const double starty = tracker.get_y();
+  p[LM_X] = startx;
+  p[LM_Y] = starty;
+  p[LM_S] = tracker.get_radius();
+  const double maxmove = 2 * p[LM_S] > 3 ? 2 * p[LM_S] : 3;
+  const double xyacc = tracker.get_pixel_accuracy() / 10;
+  const double racc = tracker.get_radius_accuracy() / 10;
+
+  Gaussian_LM_model model(image, rgb, integrated, hwscale);
+  double cost, JtJ[LM_PARAMS][LM_PARAMS], Jtr[LM_PARAMS];
+  if (!model.evaluate(p, which, n, cost, JtJ, Jtr)) { return false; }
+  status.evaluations++;
+
+  // Levenberg-Marquardt: solve (J^T J + lambda diag(J^T J)) delta = J^T r,
+  // making lambda larger when a step makes things worse and smaller when it
+  // makes them better.
+  double lambda = 1e-3;
+  unsigned i, j;
+  while (!status.converged && (status.iterations < _max_iterations)) {
+    status.iterations++;
+
+    double A[LM_PARAMS][LM_PARAMS], b[LM_PARAMS], delta[LM_PARAMS];
+    for (i = 0; i < n; i++) {
+      for (j = 0; j < n; j++) { A[i][j] = JtJ[i][j]; }
+      A[i][i] += lambda * JtJ[i][i];
+      b[i] = Jtr[i];
+    }
+    if (!solve_linear_system(A, b, n, delta)) {
+      lambda *= 10;
+      continue;
+    }
+
+    double trial[LM_PARAMS];
+    for (i = 0; i < LM_PARAMS; i++) { trial[i] = p[i]; }
+    for (i = 0; i < n; i++) { trial[which[i]] += delta[i]; }
+    bool small = (fabs(trial[LM_X] - p[LM_X]) < xyacc) && (fabs(trial[LM_Y] - p[LM_Y]) < xyacc)
+      && (fabs(trial[LM_S] - p[LM_S]) < racc);
+
+    // Radii below one can't be set on the tracker.
+    double tcost, tJtJ[LM_PARAMS][LM_PARAMS], tJtr[LM_PARAMS];
+    bool better = false;
+    if (trial[LM_S] >= 1) {
+      better = model.evaluate(trial, which, n, tcost, tJtJ, tJtr) && (tcost <= cost);
+      status.evaluations++;
+    }
+    if (better) {
+      for (i = 0; i < LM_PARAMS; i++) { p[i] = trial[i]; }
+      for (i = 0; i < n; i++) {
+	Jtr[i] = tJtr[i];
+	for (j = 0; j < n; j++) { JtJ[i][j] = tJtJ[i][j]; }
+      }
+      cost = tcost;
+      lambda /= 10;
+      if (lambda < 1e-7) { lambda = 1e-7; }
+    } else {
+      lambda *= 10;
+    }
+
+    // Once the step is below the accuracy we are done, whether or not it
+    // was taken.
+    if (small) { status.converged = true; }
+  }
+
+  // Make sure we ended up with a sensible fit near where we started.
+  if ( !status.converged ||
+       (fabs(p[LM_X] - startx) > maxmove) || (fabs(p[LM_Y] - starty) > maxmove) ||
+       (sign * p[LM_V] < 0) ) {
+    status.converged = false;
+    return false;
+  }
+
+  tracker.set_location(p[LM_X], p[LM_Y]);
+  tracker.set_radius(p[LM_S]);
+  if (fiona) {
+    fiona->set_background(p[LM_B]);
+    fiona->set_summedvalue(sign * p[LM_V]);
+  }
+  tracker.set_fitness(tracker.check_fitness(image, rgb));
+  status.evaluations++;
+  return true;
+}
+
+bool Newton_spot_optimizer::optimize(spot_tracker_XY &tracker, const image_wrapper &image, unsigned rgb,
+				     bool do_r, spot_optimizer_status &status) const
+{
+  status = spot_optimizer_status();
+  if (do_r) { return false; }
+
+  const double acc = tracker.get_pixel_accuracy();
+  const double startx = tracker.get_x();
+  const double starty = tracker.get_y();
+  const double maxmove = 2 * tracker.get_radius() > 3 ? 2 * tracker.get_radius() : 3;
+  double x = startx, y = starty;
+  double f0, g[2], H[2][2];
+  tracker.set_location(x, y);
+  if (!tracker.check_fitness_derivatives(image, rgb, f0, g, H)) {
+    return optimize_by_sampling(tracker, image, rgb, status);
+  }
+  status.evaluations++;
+
+  // Jump to the peak of the quadratic, by at most maxstep.  A jump that
+  // makes things worse is not taken; maxstep is cut to half of it and we
+  // try again from the same place.  A jump that works lets maxstep grow.
+  double maxstep = 2;
+  while (!status.converged && (status.iterations < _max_iterations)) {
+    status.iterations++;
+    double det = H[0][0] * H[1][1] - H[0][1] * H[1][0];
+    if ( (H[0][0] >= 0) || (det <= 0) ) {
+      break;    // No peak
+    }
+    double dx = -( H[1][1] * g[0] - H[0][1] * g[1]) / det;
+    double dy = -(-H[1][0] * g[0] + H[0][0] * g[1]) / det;
+    double len = sqrt(dx*dx + dy*dy);
+    if (len > maxstep) { dx *= maxstep / len; dy *= maxstep / len; len = maxstep; }
+    if (len < acc) {
+      status.converged = true;
+      break;
+    }
+
+    double f, tg[2], tH[2][2];
+    tracker.set_location(x + dx, y + dy);
+    tracker.check_fitness_derivatives(image, rgb, f, tg, tH);
+    status.evaluations++;
+    if (f >= f0) {
+      x += dx; y += dy; f0 = f;
+      g[0] = tg[0]; g[1] = tg[1];
+      H[0][0] = tH[0][0]; H[0][1] = tH[0][1]; H[1][0] = tH[1][0]; H[1][1] = tH[1][1];
+      if (maxstep < 2 * len) { maxstep = 2 * len; }
+    } else {
+      maxstep = len / 2;
+    }
+  }
+
+  tracker.set_location(x, y);
+  if ( !status.converged || (fabs(x - startx) > maxmove) || (fabs(y - starty) > maxmove) ) {
+    status.converged = false;
+    tracker.set_location(startx, starty);
+    return false;
+  }
+  tracker.set_fitness(f0);
+  return true;
+}
+
+bool Newton_spot_optimizer::optimize_by_sampling(spot_tracker_XY &tracker, const image_wrapper &image,
+						 unsigned rgb, spot_optimizer_status &status) const
+{
+  const double acc = tracker.get_pixel_accuracy();
+  const double startx = tracker.get_x();
+  const double starty = tracker.get_y();
+  const double maxmove = 2 * tracker.get_radius() > 3 ? 2 * tracker.get_radius() : 3;
+  double x = startx, y = starty;
+  double h = 0.5;   // Sample spacing for the quadratic fit
+  if (h < acc) { h = acc; }
+  tracker.set_location(x, y);
+  double f0 = tracker.check_fitness(image, rgb);
+  status.evaluations++;
+
+  while (!status.converged && (status.iterations < _max_iterations)) {
+    status.iterations++;
+
+    // Sample around the current point and fit a quadratic to the samples.
+    double fs[5];
+    const double sx[5] = { h, -h, 0, 0, h };
+    const double sy[5] = { 0, 0, h, -h, h };
+    unsigned i, best = 5;
+    double fbest = f0;
+    for (i = 0; i < 5; i++) {
+      tracker.set_location(x + sx[i], y + sy[i]);
+      fs[i] = tracker.check_fitness(image, rgb);
+      status.evaluations++;
+      if (fs[i] > fbest) { fbest = fs[i]; best = i; }
+    }
+    double gx = (fs[0] - fs[1]) / (2*h);
+    double gy = (fs[2] - fs[3]) / (2*h);
+    double hxx = (fs[0] - 2*f0 + fs[1]) / (h*h);
+    double hyy = (fs[2] - 2*f0 + fs[3]) / (h*h);
+    double hxy = (fs[4] - fs[0] - fs[2] + f0) / (h*h);
+    double det = hxx * hyy - hxy * hxy;
+
+    // If the quadratic has a peak, step towards it (by at most a pixel),
+    // halving the step until it does at least as well as the best sample.
+    // If not, or if the step never does as well, move to the best sample.
+    bool stepped = false;
+    double len = 2*h;
+    if ( (hxx < 0) && (det > 0) ) {
+      double dx = -( hyy * gx - hxy * gy) / det;
+      double dy = -(-hxy * gx + hxx * gy) / det;
+      len = sqrt(dx*dx + dy*dy);
+      if (len > 1) { dx /= len; dy /= len; len = 1; }
+      if ( (len < acc) && (best == 5) ) {
+	status.converged = true;
+	break;
+      }
+      for (i = 0; (i < 3) && !stepped; i++) {
+	tracker.set_location(x + dx, y + dy);
+	double f = tracker.check_fitness(image, rgb);
+	status.evaluations++;
+	if (f >= fbest) {
+	  x += dx; y += dy; f0 = f;
+	  stepped = true;
+	}
+	dx /= 2; dy /= 2;
+      }
+    }
+    if (!stepped && (best < 5)) {
+      x += sx[best]; y += sy[best]; f0 = fbest;
+      continue;
+    }
+
+    // Peaks that are sharper than a quadratic (the symmetric kernel on a
+    // disc has one) make the fit wander within the sample spacing, so we
+    // sample more closely once we are that near.  When the samples are as
+    // close as the accuracy and none of them is better, we're done.
+    if (!stepped || (len < h)) {
+      if (h <= acc) {
+	if (!stepped) { status.converged = true; }
+      } else {
+	h /= 2;
+	if (h < acc) { h = acc; }
+      }
+    }
+  }
+
+  tracker.set_location(x, y);
+  if ( !status.converged || (fabs(x - startx) > maxmove) || (fabs(y - starty) > maxmove) ) {
+    status.converged = false;
+    tracker.set_location(startx, starty);
+    return false;
+  }
+  tracker.set_fitness(f0);
+  return true;
+}
+
+
+rod3_spot_tracker_interp::rod3_spot_tracker_interp(const disk_spot_tracker *,
+			    double radius, bool inverted,
+			    double pixelaccuracy, double radiusaccuracy,
+			    double sample_separation_in_pixels,
+			    double length, double orientation) :
+    spot_tracker_XY(radius, inverted, pixelaccuracy, radiusaccuracy, sample_separation_in_pixels),
+    d_length(length),
+    d_orientation(orientation),
+    d_center(NULL),
+    d_beginning(NULL),
+    d_end(NULL)
 {
   // Create three subordinate trackers of type cone_spot_tracker_interp
   if ( NULL == (d_center = new disk_spot_tracker(radius, inverted, pixelaccuracy, radiusaccuracy, sample_separation_in_pixels)) ) {
@@ -1954,6 +2814,7 @@ bool  rod3_spot_tracker_interp::take_single_optimization_step(const image_wrappe
     }
     _fitness = new_fitness;
   }
+  if (betterorient) { invalidate_fitness_cache(); }
 
   // Return the new location and whether we found a better one.
   x = get_x(); y = get_y();
@@ -1964,7 +2825,9 @@ bool  rod3_spot_tracker_interp::take_single_optimization_step(const image_wrappe
 
 radial_average_tracker_Z::radial_average_tracker_Z(const char *in_filename, double depth_accuracy) :
   spot_tracker_Z(0.0, 0.0, 0.0, depth_accuracy),	  // Fill in the min and max z and radius from the file later
-  d_radial_image(NULL)
+  d_radial_image(NULL),
+  d_scatter(0), d_pixels(0),
+  d_profile_active(false), d_profile_image(NULL), d_profile_rgb(0), d_profile_x(0), d_profile_y(0)
 {
     // Read in the radially-averaged point-spread function from the file whose
     // name is given.
@@ -1978,19 +2841,156 @@ radial_average_tracker_Z::radial_average_tracker_Z(const char *in_filename, doub
       fprintf(stderr,"radial_average_tracker_Z::radial_average_tracker_Z(): file_stack_server not compiled in\n");
       return;
 #endif
+    use_radial_image();
+}
+
+radial_average_tracker_Z::radial_average_tracker_Z(const image_wrapper &radial_image, double depth_accuracy) :
+  spot_tracker_Z(0.0, 0.0, 0.0, depth_accuracy),	  // Fill in the min and max z and radius from the image
+  d_radial_image(NULL),
+  d_scatter(0), d_pixels(0),
+  d_profile_active(false), d_profile_image(NULL), d_profile_rgb(0), d_profile_x(0), d_profile_y(0)
+{
+    d_radial_image = new copy_of_image(radial_image);
+    if (d_radial_image == NULL) {
+      fprintf(stderr,"radial_average_tracker_Z::radial_average_tracker_Z(): Out of memory\n");
+      return;
+    }
+    use_radial_image();
+}
 
+bool radial_average_tracker_Z::use_radial_image(void)
+{
     // Set the minimum and maximum Z and the radius based on the file information.
     // X size in the file maps to radius (reduced by one for the zero element)
     // Y size in the file maps to Z (reduced by one for the zero element)
     int	minx, miny, maxx, maxy;
     d_radial_image->read_range(minx, maxx, miny, maxy);
     if ( (minx != 0) || (miny != 0) || (maxx <= 0) || (maxy <= 0) ) {
-      fprintf(stderr,"radial_average_tracker_Z::radial_average_tracker_Z(): Bogus radial image\n");
-      return;
+      fprintf(stderr,"radial_average_tracker_Z::use_radial_image(): Bogus radial image\n");
+      return false;
     }
     _minz = 0;
     _maxz = maxy - 1;
     _radius = maxx - 1;
+
+    // Find the pixels within the radius.  They are a whole number of pixels
+    // from the center in X and Y, so the squared distance of each is a whole
+    // number; each squared distance that occurs is a ring.  Number the rings
+    // from the inside out.
+    double rad_sq = _radius * _radius;
+    std::vector<int> ring_of_dist_sq(static_cast<size_t>(rad_sq) + 1, -1);
+    double  lx, ly;
+    for (lx = -_radius; lx <= _radius; lx++) {
+      for (ly = -_radius; ly <= _radius; ly++) {
+        double dist_sq = lx*lx + ly*ly;
+        if (dist_sq <= rad_sq) {
+          d_offset_x.push_back(lx);
+          d_offset_y.push_back(ly);
+          ring_of_dist_sq[static_cast<size_t>(dist_sq)] = 0;
+        }
+      }
+    }
+    size_t d;
+    for (d = 0; d < ring_of_dist_sq.size(); d++) {
+      if (ring_of_dist_sq[d] == 0) {
+        ring_of_dist_sq[d] = static_cast<int>(d_ring_dist.size());
+        d_ring_dist.push_back(sqrt(static_cast<double>(d)));
+      }
+    }
+    size_t i;
+    d_pixel_ring.resize(d_offset_x.size());
+    for (i = 0; i < d_offset_x.size(); i++) {
+      size_t dist_sq = static_cast<size_t>(d_offset_x[i]*d_offset_x[i] + d_offset_y[i]*d_offset_y[i]);
+      d_pixel_ring[i] = ring_of_dist_sq[dist_sq];
+    }
+
+    // Sample the spread function at each ring's distance for each Z.  Its
+    // distances are no more than the radius, so the next pixel out is
+    // always in the image.
+    size_t num_rings = d_ring_dist.size();
+    d_table.resize((maxy + 1) * num_rings);
+    int z;
+    for (z = 0; z <= maxy; z++) {
+      size_t r;
+      for (r = 0; r < num_rings; r++) {
+        double xlow = floor(d_ring_dist[r]); int ixlow = (int)xlow;
+        double xhighfrac = d_ring_dist[r] - xlow;
+        d_table[z * num_rings + r] = d_radial_image->read_pixel_nocheck(ixlow, z) * (1.0 - xhighfrac) +
+                                     d_radial_image->read_pixel_nocheck(ixlow+1, z) * xhighfrac;
+      }
+    }
+    return true;
+}
+
+// Read the pixels within the radius of (x,y) and reduce them to the mean,
+// count, and scatter of each ring.  Pixels whose interpolation neighbors
+// are not all inside the image are left out, as the pixel-by-pixel
+// comparison always has.
+template <class SAMPLER>
+void radial_average_tracker_Z::load_profile_sampled(const SAMPLER &sample, unsigned rgb, double x, double y)
+{
+  size_t num_pixels = d_pixel_ring.size();
+  size_t num_rings = d_ring_dist.size();
+  d_values.resize(num_pixels);
+  d_in_image.resize(num_pixels);
+  d_ring_mean.assign(num_rings, 0.0);
+  d_ring_count.assign(num_rings, 0.0);
+  d_pixels = 0;
+
+  size_t i;
+  for (i = 0; i < num_pixels; i++) {
+    double val;
+    if (sample(x + d_offset_x[i], y + d_offset_y[i], val, rgb)) {
+      d_values[i] = val;
+      d_in_image[i] = 1;
+      d_ring_mean[d_pixel_ring[i]] += val;
+      d_ring_count[d_pixel_ring[i]]++;
+      d_pixels++;
+    } else {
+      d_in_image[i] = 0;
+    }
+  }
+  size_t r;
+  for (r = 0; r < num_rings; r++) {
+    if (d_ring_count[r]) {
+      d_ring_mean[r] /= d_ring_count[r];
+    }
+  }
+
+  // Summing squared differences from the means, rather than squared values,
+  // keeps the fitness from being the small difference of large numbers.
+  d_scatter = 0;
+  for (i = 0; i < num_pixels; i++) {
+    if (d_in_image[i]) {
+      double diff = d_values[i] - d_ring_mean[d_pixel_ring[i]];
+      d_scatter += diff * diff;
+    }
+  }
+}
+
+void radial_average_tracker_Z::load_profile(const image_wrapper &image, unsigned rgb, double x, double y)
+{
+  d_profile_image = &image;
+  d_profile_rgb = rgb;
+  d_profile_x = x;
+  d_profile_y = y;
+
+  image_buffer_view view;
+  if (image.get_buffer_view(view) && (rgb < view.num_colors)) {
+    switch (view.type) {
+      case image_buffer_view::UINT8:
+        load_profile_sampled(buffer_bilerp_sampler<vrpn_uint8>(view), rgb, x, y); return;
+      case image_buffer_view::UINT16:
+        load_profile_sampled(buffer_bilerp_sampler<vrpn_uint16>(view), rgb, x, y); return;
+      case image_buffer_view::FLOAT:
+        load_profile_sampled(buffer_bilerp_sampler<float>(view), rgb, x, y); return;
+      case image_buffer_view::DOUBLE:
+        load_profile_sampled(buffer_bilerp_sampler<double>(view), rgb, x, y); return;
+      default:
+        break;
+    }
+  }
+  load_profile_sampled(virtual_bilerp_sampler(image), rgb, x, y);
 }
 
 // Check the fitness of the radially-symmetric image against the given image, at the current parameter settings.
@@ -2000,47 +3000,74 @@ radial_average_tracker_Z::radial_average_tracker_Z(const char *in_filename, doub
 // interpolation and sample within the space of the kernel, rather than
 // point-sampling the nearest pixel.
 
+// The sum of the squared differences over the pixels in a ring is the sum
+// of their squared differences from the ring's mean, plus the number of
+// them times the squared difference between the ring's mean and the spread
+// function, so only the second part changes with Z.
+
 double	radial_average_tracker_Z::check_fitness(const image_wrapper &image, unsigned rgb, double x, double y)
 {
-  double  val;				//< Pixel value read from the image
-  double  pixels = 0;			//< How many pixels we ended up using (used in floating-point calculations only)
-  double  fitness = 0.0;		//< Accumulates the fitness values
-  double  lx, ly;			//< Loops over coordinates, distance from the center.
-
-  // If we're outside the z range, return a large negative fitness.
-  if ( (_z < _minz) || (_z > _maxz) ) {
+  // If we're outside the z range (or have no spread function), return a
+  // large negative fitness.
+  if ( (_z < _minz) || (_z > _maxz) || d_table.empty() ) {
     return -1e100;
   }
 
-  double rad_sq = _radius * _radius;
-  for (lx = -_radius; lx <= _radius; lx++) {
-    for (ly = -_radius; ly <= _radius; ly++) {
-      // Only count pixels inside of our radial distance
-      double dist_sq = lx*lx + ly*ly;
-      if ( dist_sq <= rad_sq) {
-	// Only count pixels inside the other image's boundaries
-	if (image.read_pixel_bilerp(x+lx,y+ly,val, rgb)) {
-	  double dist = sqrt(dist_sq);
-	  double myval = d_radial_image->read_pixel_bilerp_nocheck(dist, _z);
-
-	  double squarediff = (val-myval) * (val-myval);
-	  fitness -= squarediff;
+  if ( !d_profile_active || (&image != d_profile_image) || (rgb != d_profile_rgb) ||
+       (x != d_profile_x) || (y != d_profile_y) ) {
+    load_profile(image, rgb, x, y);
+  }
 
-	  pixels++;
-	}
-      }
-    }
+  // Leave the fitness at zero if we never found any pixels.
+  if (d_pixels == 0) {
+    return 0.0;
   }
 
-  // Normalize the fitness value by the number of pixels we have chosen,
-  // or leave it at zero if we never found any.
-  if (pixels) {
-    fitness /= pixels;
+  // Interpolate the spread function between the depths on either side.
+  size_t num_rings = d_ring_dist.size();
+  double zlow = floor(_z); int izlow = (int)zlow;
+  double zhighfrac = _z - zlow;
+  double zlowfrac = 1.0 - zhighfrac;
+  const double *low = &d_table[izlow * num_rings];
+  const double *high = low + num_rings;
+  double fitness = -d_scatter;
+  size_t r;
+  for (r = 0; r < num_rings; r++) {
+    double diff = d_ring_mean[r] - (low[r] * zlowfrac + high[r] * zhighfrac);
+    fitness -= d_ring_count[r] * diff * diff;
   }
 
+  // Normalize the fitness value by the number of pixels we have chosen.
   // We never invert the fitness: we don't care whether it is a dark
   // or bright spot.
-  return fitness;
+  return fitness / d_pixels;
+}
+
+// The searches all look at one location in one image, so read the pixels
+// around it once and keep them until the search is done.
+
+void  radial_average_tracker_Z::optimize(const image_wrapper &image, unsigned rgb, double x, double y, double &z)
+{
+  load_profile(image, rgb, x, y);
+  d_profile_active = true;
+  spot_tracker_Z::optimize(image, rgb, x, y, z);
+  d_profile_active = false;
+}
+
+void  radial_average_tracker_Z::locate_best_fit_in_depth(const image_wrapper &image, unsigned rgb, double x, double y, double &z)
+{
+  load_profile(image, rgb, x, y);
+  d_profile_active = true;
+  spot_tracker_Z::locate_best_fit_in_depth(image, rgb, x, y, z);
+  d_profile_active = false;
+}
+
+void  radial_average_tracker_Z::locate_close_fit_in_depth(const image_wrapper &image, unsigned rgb, double x, double y, double &z)
+{
+  load_profile(image, rgb, x, y);
+  d_profile_active = true;
+  spot_tracker_Z::locate_close_fit_in_depth(image, rgb, x, y, z);
+  d_profile_active = false;
 }
 
 Semaphore Spot_Information::d_index_sem;
@@ -2052,21 +3079,273 @@ unsigned Spot_Information::get_static_index() {
   return val;
 };
 
+//----------------------------------------------------------------------------------
+// Tracker_Proximity_Grid class implementation
+
+void Tracker_Proximity_Grid::reset(double minx, double miny, double maxx, double maxy,
+                                   double cell_size, unsigned max_cells)
+{
+  if (cell_size < 1) { cell_size = 1; }
+  if (max_cells < 1) { max_cells = 1; }
+  if (maxx < minx) { maxx = minx; }
+  if (maxy < miny) { maxy = miny; }
+
+  // Grow the cells until there are not too many of them.  This keeps a
+  // small separation over a large image from making a huge grid.
+  double nx = floor((maxx - minx) / cell_size) + 1;
+  double ny = floor((maxy - miny) / cell_size) + 1;
+  if (nx * ny > max_cells) {
+    cell_size *= sqrt(nx * ny / max_cells);
+    nx = floor((maxx - minx) / cell_size) + 1;
+    ny = floor((maxy - miny) / cell_size) + 1;
+  }
+
+  d_minx = minx;
+  d_miny = miny;
+  d_cell_size = cell_size;
+  d_nx = static_cast<int>(nx);
+  d_ny = static_cast<int>(ny);
+
+  // Empty the cells we're going to use, keeping their storage.
+  size_t num = static_cast<size_t>(d_nx) * d_ny;
+  if (d_cells.size() < num) {
+    d_cells.resize(num);
+  }
+  size_t i;
+  for (i = 0; i < num; i++) {
+    d_cells[i].clear();
+  }
+}
+
+int Tracker_Proximity_Grid::cell_x(double x) const
+{
+  double c = floor((x - d_minx) / d_cell_size);
+  if (c < 0) { return 0; }
+  if (c >= d_nx) { return d_nx - 1; }
+  return static_cast<int>(c);
+}
+
+int Tracker_Proximity_Grid::cell_y(double y) const
+{
+  double c = floor((y - d_miny) / d_cell_size);
+  if (c < 0) { return 0; }
+  if (c >= d_ny) { return d_ny - 1; }
+  return static_cast<int>(c);
+}
+
+void Tracker_Proximity_Grid::insert(unsigned index, double x, double y)
+{
+  Entry e;
+  e.index = index;
+  e.x = x;
+  e.y = y;
+  d_cells[cell_x(x) + d_nx * cell_y(y)].push_back(e);
+}
+
+void Tracker_Proximity_Grid::candidates(double x, double y, double half_width,
+                                        std::vector<unsigned> &indices) const
+{
+  int minx = cell_x(x - half_width), maxx = cell_x(x + half_width);
+  int miny = cell_y(y - half_width), maxy = cell_y(y + half_width);
+  int cx, cy;
+  for (cy = miny; cy <= maxy; cy++) {
+    for (cx = minx; cx <= maxx; cx++) {
+      const std::vector<Entry> &cell = d_cells[cx + d_nx * cy];
+      size_t i;
+      for (i = 0; i < cell.size(); i++) {
+        indices.push_back(cell[i].index);
+      }
+    }
+  }
+}
+
+int Tracker_Proximity_Grid::nearest(double x, double y) const
+{
+  int best = -1;
+  double best_dist2 = 0;
+
+  // Look at rings of cells around the one containing the point, working
+  // outwards, until the closest point found so far is closer than anything
+  // that could be in a cell outside the rings we've checked.
+  int cx = cell_x(x), cy = cell_y(y);
+  int ring;
+  for (ring = 0; ; ring++) {
+    int minx = cx - ring, maxx = cx + ring;
+    int miny = cy - ring, maxy = cy + ring;
+    if ( (minx < 0) && (miny < 0) && (maxx >= d_nx) && (maxy >= d_ny) ) {
+      break;
+    }
+
+    int i, j;
+    for (j = miny; j <= maxy; j++) {
+      if ( (j < 0) || (j >= d_ny) ) { continue; }
+      for (i = minx; i <= maxx; i++) {
+        if ( (i < 0) || (i >= d_nx) ) { continue; }
+        // Only the cells on the outside of this ring are new.
+        if ( (j != miny) && (j != maxy) && (i != minx) && (i != maxx) ) { continue; }
+        const std::vector<Entry> &cell = d_cells[i + d_nx * j];
+        size_t k;
+        for (k = 0; k < cell.size(); k++) {
+          double dx = cell[k].x - x;
+          double dy = cell[k].y - y;
+          double dist2 = dx*dx + dy*dy;
+          if ( (best < 0) || (dist2 < best_dist2) ||
+               ( (dist2 == best_dist2) && (cell[k].index < static_cast<unsigned>(best)) ) ) {
+            best = cell[k].index;
+            best_dist2 = dist2;
+          }
+        }
+      }
+    }
+
+    // Find how far the point is from the nearest side of the checked
+    // region that has unchecked cells beyond it.  Anything not yet seen
+    // is at least this far away.
+    if (best >= 0) {
+      double outside = 1e100;
+      if (minx > 0) { outside = min(outside, x - (d_minx + minx * d_cell_size)); }
+      if (maxx < d_nx - 1) { outside = min(outside, (d_minx + (maxx + 1) * d_cell_size) - x); }
+      if (miny > 0) { outside = min(outside, y - (d_miny + miny * d_cell_size)); }
+      if (maxy < d_ny - 1) { outside = min(outside, (d_miny + (maxy + 1) * d_cell_size) - y); }
+      if ( (outside > 0) && (best_dist2 < outside * outside) ) {
+        break;
+      }
+    }
+  }
+
+  return best;
+}
+
+//----------------------------------------------------------------------------------
+// VST_Region_Union class implementation
+
+void VST_Region_Union::add(int minx, int miny, int maxx, int maxy)
+{
+  if ( (maxx < minx) || (maxy < miny) ) {
+    return;
+  }
+  Rect r;
+  r.minx = minx; r.miny = miny;
+  r.maxx = maxx; r.maxy = maxy;
+  d_rects.push_back(r);
+  d_requested += static_cast<double>(maxx - minx + 1) * (maxy - miny + 1);
+}
+
+static bool rect_starts_higher(const VST_Region_Union::Rect &a, const VST_Region_Union::Rect &b)
+{
+  return a.miny < b.miny;
+}
+
+double VST_Region_Union::disjoint_cover(std::vector<Rect> &out)
+{
+  out.clear();
+  double pixels = 0;
+  if (d_rects.empty()) {
+    return pixels;
+  }
+
+  // Every top edge and every row just past a bottom edge starts a new band.
+  // Within a band, each rectangle either covers all of its rows or none.
+  std::sort(d_rects.begin(), d_rects.end(), rect_starts_higher);
+  d_edges.clear();
+  size_t i;
+  for (i = 0; i < d_rects.size(); i++) {
+    d_edges.push_back(d_rects[i].miny);
+    d_edges.push_back(d_rects[i].maxy + 1);
+  }
+  std::sort(d_edges.begin(), d_edges.end());
+  d_edges.erase(std::unique(d_edges.begin(), d_edges.end()), d_edges.end());
+
+  // d_open holds the indices in out of the rectangles that reach down to
+  // the band before this one, in order of their left edges.  A span in this
+  // band that matches one of them exactly grows it down; any other span
+  // starts a new rectangle.
+  d_open.clear();
+  size_t next = 0;
+  std::vector<size_t> &active = d_active;
+  active.clear();
+  size_t band;
+  for (band = 0; band + 1 < d_edges.size(); band++) {
+    int top = d_edges[band];
+    int bottom = d_edges[band + 1] - 1;
+
+    // Update the list of rectangles that cover this band.
+    while ( (next < d_rects.size()) && (d_rects[next].miny <= top) ) {
+      active.push_back(next++);
+    }
+    size_t a, kept = 0;
+    for (a = 0; a < active.size(); a++) {
+      if (d_rects[active[a]].maxy >= top) {
+        active[kept++] = active[a];
+      }
+    }
+    active.resize(kept);
+
+    // Merge the spans of the covering rectangles, joining ones that touch.
+    d_spans.clear();
+    for (a = 0; a < active.size(); a++) {
+      d_spans.push_back(std::pair<int,int>(d_rects[active[a]].minx, d_rects[active[a]].maxx));
+    }
+    std::sort(d_spans.begin(), d_spans.end());
+    size_t s, merged = 0;
+    for (s = 0; s < d_spans.size(); s++) {
+      if ( (merged > 0) && (d_spans[s].first <= d_spans[merged-1].second + 1) ) {
+        if (d_spans[s].second > d_spans[merged-1].second) {
+          d_spans[merged-1].second = d_spans[s].second;
+        }
+      } else {
+        d_spans[merged++] = d_spans[s];
+      }
+    }
+    d_spans.resize(merged);
+
+    d_still_open.clear();
+    size_t o = 0;
+    for (s = 0; s < d_spans.size(); s++) {
+      while ( (o < d_open.size()) && (out[d_open[o]].minx < d_spans[s].first) ) {
+        o++;
+      }
+      if ( (o < d_open.size()) && (out[d_open[o]].maxy == top - 1) &&
+           (out[d_open[o]].minx == d_spans[s].first) && (out[d_open[o]].maxx == d_spans[s].second) ) {
+        out[d_open[o]].maxy = bottom;
+        d_still_open.push_back(d_open[o]);
+      } else {
+        Rect r;
+        r.minx = d_spans[s].first; r.maxx = d_spans[s].second;
+        r.miny = top; r.maxy = bottom;
+        d_still_open.push_back(out.size());
+        out.push_back(r);
+      }
+    }
+    d_open.swap(d_still_open);
+    for (s = 0; s < d_spans.size(); s++) {
+      pixels += static_cast<double>(d_spans[s].second - d_spans[s].first + 1) * (bottom - top + 1);
+    }
+  }
+
+  return pixels;
+}
+
 //----------------------------------------------------------------------------------
 // Tracker_Collection_Manager class implementation
 
 Tracker_Collection_Manager::~Tracker_Collection_Manager()
 {
     delete_trackers();
+    size_t i;
+    for (i = 0; i < d_fft_correlators.size(); i++) {
+      delete d_fft_correlators[i];
+    }
 }
 
 void Tracker_Collection_Manager::delete_trackers()
 {
   // Delete all of the tracker objects we had created.
-  while (!d_trackers.empty()) {
-    delete d_trackers.front();
-    d_trackers.pop_front();
+  size_t i;
+  for (i = 0; i < d_trackers.size(); i++) {
+    delete d_trackers[i];
   }
+  d_trackers.clear();
 
   // No active tracker.
   d_active_tracker = -1;
@@ -2079,37 +3358,22 @@ bool Tracker_Collection_Manager::delete_tracker(unsigned which)
     return false;
   }
 
-  // Locate the tracker and then delete it.
-  unsigned i;
-  std::list<Spot_Information *>::iterator loop;
-  loop = d_trackers.begin();
-  for (i = 0; i < which; i++) {
-      loop++;
-      if (loop == d_trackers.end()) {
-          return false;
-      }
-  }
-  if (loop == d_trackers.end()) {
-      return false;
-  } else {
-      // Delete the xytracker pointed to by our list pointer.
-      delete *loop;
-      // Remove this element from the list.
-      d_trackers.erase(loop);
-
-      // If this was the active tracker, set the active tracker
-      // to be the last tracker (or to none if there are no more
-      // trackers).
-      if (which == d_active_tracker) {
-        if (d_trackers.size() == 0) {
-          d_active_tracker = -1;
-        } else {
-          d_active_tracker = d_trackers.size() - 1;
-        }
-      }
+  // Delete the tracker and remove its entry, sliding the later ones down.
+  delete d_trackers[which];
+  d_trackers.erase(d_trackers.begin() + which);
 
-      return true;
+  // If this was the active tracker, set the active tracker
+  // to be the last tracker (or to none if there are no more
+  // trackers).
+  if (static_cast<int>(which) == d_active_tracker) {
+    if (d_trackers.size() == 0) {
+      d_active_tracker = -1;
+    } else {
+      d_active_tracker = d_trackers.size() - 1;
+    }
   }
+
+  return true;
 }
 
 bool Tracker_Collection_Manager::delete_active_tracker(void)
@@ -2150,7 +3414,7 @@ void Tracker_Collection_Manager::add_tracker(double x, double y, double radius)
 // creation functions.
 void Tracker_Collection_Manager::rebuild_trackers(void)
 {
-  std::list<Spot_Information *>::iterator  loop;
+  std::vector<Spot_Information *>::iterator  loop;
 
   for (loop = d_trackers.begin(); loop != d_trackers.end(); loop++) {
     double x = (*loop)->xytracker()->get_x();
@@ -2170,23 +3434,14 @@ void Tracker_Collection_Manager::rebuild_trackers(void)
   }
 }
 
-// XXX Replace the list with a vector to make this faster?
+// Constant-time lookup, so it is safe to call from inside the
+// per-tracker loops.
 Spot_Information *Tracker_Collection_Manager::tracker(unsigned which) const
 {
-    unsigned i;
-    std::list<Spot_Information *>::const_iterator loop;
-    loop = d_trackers.begin();
-    for (i = 0; i < which; i++) {
-        loop++;
-        if (loop == d_trackers.end()) {
-            return NULL;
-        }
-    }
-    if (loop == d_trackers.end()) {
+    if (which >= d_trackers.size()) {
         return NULL;
-    } else {
-        return *loop;
     }
+    return d_trackers[which];
 }
 
 // Returns a pointer to the active tracker, or NULL if there is not one.
@@ -2208,93 +3463,171 @@ void Tracker_Collection_Manager::set_lost_all_if_collide(bool value)
     d_lost_all_if_collide = value;
 }
 
-//----------------------------------------------------------------------------
-// Class to deal with storing a list of locations on the image
-
-class Flood_Position {
-public:
-  Flood_Position(int x, int y) { d_x = x; d_y = y; };
-  int x(void) const { return d_x; };
-  int y(void) const { return d_y; };
-  void set_x(int x) { d_x = x; };
-  void set_y(int y) { d_y = y; };
-
-protected:
-  int   d_x;
-  int   d_y;
-};
-
 //--------------------------------------------------------------------------
-// Helper routine that fills all pixels that are connected to
-// the indicated pixel and which have a value of -1 with the new value that
-// is specified.  Recursion failed due to stack overflow when
-// the whole image was one region, so the new algorithm keeps a list of
-// "border positions" and repeatedly goes through that list until it is
-// empty.
+// Helper routines for the union-find labeling in
+// VST_find_connected_components().  Each entry in the label array is -1
+// for pixels below threshold; otherwise it is the index of a pixel in the
+// same component.  A pixel whose entry is its own index is the root of its
+// component.  Roots are always joined so that the smaller index wins,
+// which means that each entry is never larger than its own index.
+
+static int find_component_root(int *labels, int p)
+{
+  int root = p;
+  while (labels[root] != root) {
+    root = labels[root];
+  }
+  // Point everything along the path straight at the root.
+  while (labels[p] != root) {
+    int next = labels[p];
+    labels[p] = root;
+    p = next;
+  }
+  return root;
+}
+
+static void join_components(int *labels, int a, int b)
+{
+  a = find_component_root(labels, a);
+  b = find_component_root(labels, b);
+  if (a < b) {
+    labels[b] = a;
+  } else if (b < a) {
+    labels[a] = b;
+  }
+}
 
-static void flood_connected_component(double_image *img, int x, int y, double value)
+bool VST_find_connected_components(const image_wrapper &image, unsigned rgb,
+                                   double threshold,
+                                   std::vector<VST_Connected_Component> &components)
 {
+  components.clear();
   int minx, maxx, miny, maxy;
-  img->read_range(minx, maxx, miny, maxy);
-
-  //------------------------------------------------------------
-  // Fill in the first pixel as requested, and add it to the
-  // boundary list.
-  std::list<Flood_Position>  boundary;
-  img->write_pixel_nocheck(x,y, value);
-  boundary.push_front(Flood_Position(x,y));
-
-  //------------------------------------------------------------
-  // Go looking for ways to expand the boundary so long as the
-  // boundary is not empty.  Once each boundary pixel has been
-  // completely handled, delete it from the boundary list.
-  while (!boundary.empty()) {
-    std::list<Flood_Position>::iterator  i;
-
-    // We add new boundary pixels to the beginning of the list so that
-    // we won't see them while traversing the list: each time through,
-    // we only consider the positions that were on the boundary when
-    // we started through that time.
-    i = boundary.begin();
-    while (i != boundary.end()) {
-
-      // Move to the location of the pixel and check around it.
-      x = i->x();
-      y = i->y();
-
-      // If any of the four neighbors are valid new boundary elements,
-      // mark them and insert them into the boundary list.
-      if ( x-1 >= minx ) {
-        if (img->read_pixel_nocheck(x-1,y) == -1) {
-          img->write_pixel_nocheck(x-1,y, value);
-          boundary.push_front(Flood_Position(x-1,y));
+  image.read_range(minx, maxx, miny, maxy);
+  if ( (maxx < minx) || (maxy < miny) ) { return true; }
+  int nx = maxx - minx + 1;
+  int ny = maxy - miny + 1;
+
+  int *labels = new int[nx * ny];
+  if (labels == NULL) {
+    fprintf(stderr,"VST_find_connected_components(): Out of memory\n");
+    return false;
+  }
+
+  // Threshold and label each strip of rows on its own.  Only pixels inside
+  // the strip are touched, so the strips can be done in parallel.
+  const int strip_height = 64;
+  int num_strips = (ny + strip_height - 1) / strip_height;
+  int strip;
+#pragma omp parallel for
+  for (strip = 0; strip < num_strips; strip++) {
+    int y0 = strip * strip_height;
+    int y1 = y0 + strip_height;
+    if (y1 > ny) { y1 = ny; }
+    int x, y;
+    for (y = y0; y < y1; y++) {
+      int row = y * nx;
+      for (x = 0; x < nx; x++) {
+        int p = row + x;
+        if (image.read_pixel_nocheck(x + minx, y + miny, rgb) < threshold) {
+          labels[p] = -1;
+          continue;
         }
-      }
-      if ( x+1 <= maxx ) {
-        if (img->read_pixel_nocheck(x+1,y) == -1) {
-          img->write_pixel_nocheck(x+1,y, value);
-          boundary.push_front(Flood_Position(x+1,y));
+        labels[p] = p;
+        if ( (x > 0) && (labels[p-1] >= 0) ) {
+          join_components(labels, p-1, p);
         }
-      }
-      if ( y-1 >= miny ) {
-        if (img->read_pixel_nocheck(x,y-1) == -1) {
-          img->write_pixel_nocheck(x,y-1, value);
-          boundary.push_front(Flood_Position(x,y-1));
+        if ( (y > y0) && (labels[p-nx] >= 0) ) {
+          join_components(labels, p-nx, p);
         }
       }
-      if ( y+1 <= maxy ) {
-        if (img->read_pixel_nocheck(x,y+1) == -1) {
-          img->write_pixel_nocheck(x,y+1, value);
-          boundary.push_front(Flood_Position(x,y+1));
-        }
+    }
+  }
+
+  // Join components that cross the boundaries between strips.
+  for (strip = 1; strip < num_strips; strip++) {
+    int row = strip * strip_height * nx;
+    int x;
+    for (x = 0; x < nx; x++) {
+      if ( (labels[row + x] >= 0) && (labels[row + x - nx] >= 0) ) {
+        join_components(labels, row + x - nx, row + x);
       }
+    }
+  }
 
-      // Get rid of this entry, stepping to the next one before doing so.
-      std::list<Flood_Position>::iterator j = i;
-      ++i;
-      boundary.erase(j);
+  // Walk the pixels in order.  Each entry points at an earlier pixel, which
+  // has already been pointed at its root, so one step finds the root.  Roots
+  // are given component numbers as they are found; we keep the number in
+  // place of the root's own index, negated and offset to keep it apart from
+  // the -1 background marker.
+  std::vector<VST_Connected_Component> found;
+  int p, npix = nx * ny;
+  for (p = 0; p < npix; p++) {
+    int l = labels[p];
+    if (l == -1) { continue; }
+    int comp;
+    if (l == p) {
+      comp = static_cast<int>(found.size());
+      labels[p] = -2 - comp;
+      VST_Connected_Component c;
+      c.area = 0;
+      c.cx = c.cy = 0;
+      c.intensity = 0;
+      c.weighted_cx = c.weighted_cy = 0;
+      c.minx = c.maxx = c.firstx = (p % nx) + minx;
+      c.miny = c.maxy = c.firsty = (p / nx) + miny;
+      found.push_back(c);
+    } else {
+      comp = -2 - labels[l];
+      labels[p] = labels[l];
+    }
+
+    int x = (p % nx) + minx;
+    int y = (p / nx) + miny;
+    double val = image.read_pixel_nocheck(x, y, rgb);
+    VST_Connected_Component &c = found[comp];
+    c.area++;
+    c.cx += x;
+    c.cy += y;
+    c.intensity += val;
+    c.weighted_cx += x * val;
+    c.weighted_cy += y * val;
+    if (x < c.minx) { c.minx = x; }
+    if (x > c.maxx) { c.maxx = x; }
+    if (y > c.maxy) { c.maxy = y; }
+    if ( (x < c.firstx) || ( (x == c.firstx) && (y < c.firsty) ) ) {
+      c.firstx = x;
+      c.firsty = y;
+    }
+  }
+
+  // Turn the sums into means and put the components in column-scan order.
+  size_t i;
+  for (i = 0; i < found.size(); i++) {
+    VST_Connected_Component &c = found[i];
+    c.cx /= c.area;
+    c.cy /= c.area;
+    if (c.intensity != 0) {
+      c.weighted_cx /= c.intensity;
+      c.weighted_cy /= c.intensity;
+    } else {
+      c.weighted_cx = c.cx;
+      c.weighted_cy = c.cy;
     }
   }
+  std::vector< std::pair<long long, int> > order(found.size());
+  for (i = 0; i < found.size(); i++) {
+    order[i].first = static_cast<long long>(found[i].firstx - minx) * ny + (found[i].firsty - miny);
+    order[i].second = static_cast<int>(i);
+  }
+  std::sort(order.begin(), order.end());
+  components.resize(found.size());
+  for (i = 0; i < found.size(); i++) {
+    components[i] = found[order[i].second];
+  }
+
+  delete [] labels;
+  return true;
 }
 
 // Helper function for find_more_brightfield_beads_in.
@@ -2478,9 +3811,12 @@ bool Tracker_Collection_Manager::find_more_brightfield_beads_in(
 	double tooClose = 5;
 	double curX, curY;
 	bool safe = false;
-        std::list <Spot_Information *>::iterator loop;
+        std::vector<Spot_Information *>::iterator loop;
 	int cx, cy;
 	spot_tracker_XY* curTracker;
+	std::vector<unsigned> neighbors;
+	size_t n;
+	rebuild_proximity_grid(tooClose, &s_image);
 	for (y = 0; y < static_cast<int>(horiCandidates.size()); ++y) {
 		cy = horiCandidates[y];
 		for (x = 0; x < static_cast<int>(vertCandidates.size()); ++x) {
@@ -2488,8 +3824,10 @@ bool Tracker_Collection_Manager::find_more_brightfield_beads_in(
 			safe = true;
 
 			// check to make sure we don't already have a tracker too close
-			for (loop = d_trackers.begin(); loop != d_trackers.end(); loop++)  {
-				curTracker = (*loop)->xytracker();
+			neighbors.clear();
+			d_grid.candidates(cx, cy, tooClose, neighbors);
+			for (n = 0; n < neighbors.size(); n++)  {
+				curTracker = d_trackers[neighbors[n]]->xytracker();
 				curX = curTracker->get_x();
 				curY = curTracker->get_y();
 				if (cx >= curX - tooClose && cx <= curX + tooClose &&
@@ -2527,7 +3865,7 @@ bool Tracker_Collection_Manager::find_more_brightfield_beads_in(
 
 	double SMDthresh = avgSMD * candidate_spot_threshold;
 
-        std::list<Spot_Information*> potentialTrackers;
+        std::vector<Spot_Information*> potentialTrackers;
 
 	int newTrackers = 0;
 	for (i = 0; i < static_cast<int>(candidateSpotsSMD.size()); ++i) {
@@ -2563,10 +3901,10 @@ bool Tracker_Collection_Manager::find_more_brightfield_beads_in(
 	//printf("%i candidates were not lost.\n", numnotlost);
 	
 	// clean up candidate spots memory
-        while (!potentialTrackers.empty()) {
-          delete potentialTrackers.front();
-          potentialTrackers.pop_front();
+        for (loop = potentialTrackers.begin(); loop != potentialTrackers.end(); loop++) {
+          delete *loop;
         }
+        potentialTrackers.clear();
 
 	// clear up our SMD memory in reverse order from allocation to make it
         // easier for the memory manager
@@ -2611,39 +3949,15 @@ bool Tracker_Collection_Manager::autofind_fluorescent_beads_in(const image_wrapp
     }
     double threshold = mini + (maxi-mini)*thresh;
 
-    // Make a threshold image that has 0 everywhere our original image was
-    // below threshold and -1 everywhere it was at or above threshold.  The
-    // -1 value means "no label yet selected".
-    double_image *threshold_image = new double_image(minx, maxx, miny, maxy);
-    if (threshold_image == NULL) {
-        fprintf(stderr,"Tracker_Collection_Manager::autofind_fluorescent_beads_in(): Out of memory\n");
-        return false;
-    }
-#pragma omp parallel for private(x)
-    for (y = miny; y <= maxy; ++y) {
-        for (x = minx; x <= maxx; ++x) {
-            if (s_image.read_pixel_nocheck(x,y) >= threshold) {
-                threshold_image->write_pixel_nocheck(x, y, -1.0);
-            } else {
-                threshold_image->write_pixel_nocheck(x, y, 0.0);
-            }
-        }
-    }
-
-    // Go through the threshold image and label each component with a number
-    // greater than zero (starting with 1).  This replaces the "-1" values from
-    // above along the way.  This leaves us with a set of labeled components
-    // embedded in the image.
-    int index = 0;
+    // Find the connected components of pixels that are at or above threshold,
+    // along with the size and center of each.
+    std::vector<VST_Connected_Component> components;
     //printf("Looking for components.\n"); fflush(stdout);
-    for (x =  minx; x <= maxx; x++) {
-        for (y = miny; y <= maxy; y++) {
-            if (threshold_image->read_pixel_nocheck(x,y) == -1) {
-                index++;
-                flood_connected_component(threshold_image, x,y, index);
-            }
-        }
+    if (!VST_find_connected_components(s_image, 0, threshold, components)) {
+        fprintf(stderr,"Tracker_Collection_Manager::autofind_fluorescent_beads_in(): Can't find components\n");
+        return false;
     }
+    int index = static_cast<int>(components.size());
     //printf("Found %d components.\n", index); fflush(stdout);
 
     // If we have too many components, then only use some of them.
@@ -2659,27 +3973,18 @@ bool Tracker_Collection_Manager::autofind_fluorescent_beads_in(const image_wrapp
     // and see if it is immediately lost.  If not, then we add it to the list of
     // trackers.
 
-    std::list<Spot_Information *>::iterator loop;
     double tooClose = d_min_bead_separation;
+    rebuild_proximity_grid(tooClose, &s_image);
+    std::vector<unsigned> neighbors;
 
     int comp;
-    for (comp = 1; comp <= index; comp++) {
+    for (comp = 0; comp < index; comp++) {
 
-        // Compute the center of mass for this component.  All components exist
+        // Get the center of mass for this component.  All components exist
         // and have at least one pixel in them.
-        double cx = 0, cy = 0;
-        unsigned count = 0;
-        for (x = minx; x <= maxx; x++) {
-            for (y = miny; y <= maxy; y++) {
-                if (threshold_image->read_pixel_nocheck(x,y) == comp) {
-                    count++;
-                    cx += x;
-                    cy += y;
-                }
-            }
-        }
-        cx /= count;
-        cy /= count;
+        double cx = components[comp].cx;
+        double cy = components[comp].cy;
+        unsigned count = components[comp].area;
 
         // check to make sure we don't already have a tracker too close to where
         // we want to put the new one.
@@ -2689,9 +3994,12 @@ bool Tracker_Collection_Manager::autofind_fluorescent_beads_in(const image_wrapp
             safe = false;
         }
 
-        for (loop = d_trackers.begin(); loop != d_trackers.end(); loop++)  {
+        neighbors.clear();
+        d_grid.candidates(cx, cy, tooClose, neighbors);
+        size_t n;
+        for (n = 0; n < neighbors.size(); n++)  {
             double curX, curY;
-            spot_tracker_XY *curTracker = (*loop)->xytracker();
+            spot_tracker_XY *curTracker = d_trackers[neighbors[n]]->xytracker();
             curX = curTracker->get_x();
             curY = curTracker->get_y();
             //if ( (cx >= curX - tooClose) && (cx <= curX + tooClose) &&
@@ -2699,7 +4007,7 @@ bool Tracker_Collection_Manager::autofind_fluorescent_beads_in(const image_wrapp
             if ((cx - curX)*(cx-curX) + (cy - curY)*(cy - curY) < tooClose * tooClose) {
                 safe = false;
                 if (d_lost_all_if_collide) {
-                    (*loop)->lost(true);
+                    d_trackers[neighbors[n]]->lost(true);
                 }
             }
         }
@@ -2728,14 +4036,13 @@ bool Tracker_Collection_Manager::autofind_fluorescent_beads_in(const image_wrapp
                 // Deleting the SpotInformation also deletes its trackers.
                 delete si;
             } else {
+                d_grid.insert(static_cast<unsigned>(d_trackers.size()),
+                              si->xytracker()->get_x(), si->xytracker()->get_y());
                 d_trackers.push_back(si);
             }
         }
     }
 
-    // Clean up our temporary image.
-    delete threshold_image;
-
     return true;
 }
 
@@ -2775,6 +4082,19 @@ bool Tracker_Collection_Manager::perform_local_image_search(int max_tracker_to_o
       double search_radius,
       const image_wrapper &previous_image, const image_wrapper &new_image)
 {
+    // Each thread gets its own correlator, which keeps its work buffers
+    // from one tracker (and one frame) to the next.
+    if (d_fft_search) {
+#ifdef _OPENMP
+      size_t threads = omp_get_max_threads();
+#else
+      size_t threads = 1;
+#endif
+      while (d_fft_correlators.size() < threads) {
+        d_fft_correlators.push_back(new fft_correlator);
+      }
+    }
+
     int i;
     #pragma omp parallel for
     for (i = 0; i < (int)(d_trackers.size()); i++) {
@@ -2787,6 +4107,16 @@ bool Tracker_Collection_Manager::perform_local_image_search(int max_tracker_to_o
         double y_base = tkr->get_y();
         double rad = tkr->get_radius();
 
+        if (d_fft_search) {
+#ifdef _OPENMP
+          fft_correlator &correlator = *d_fft_correlators[omp_get_thread_num()];
+#else
+          fft_correlator &correlator = *d_fft_correlators[0];
+#endif
+          fft_image_search(correlator, tkr, last_pos, search_radius, previous_image, new_image);
+          continue;
+        }
+
         // Create an image spot tracker and initialize it at the location where the current
         // tracker started this frame (before prediction), but in the last image.  Grab enough
         // of the image that we will be able to check over the used_search_radius for a match.
@@ -2827,6 +4157,145 @@ bool Tracker_Collection_Manager::perform_local_image_search(int max_tracker_to_o
     return true;
 }
 
+// The template is centered on the tracker's last position in the previous
+// image, and the search window on the nearest pixel to where the tracker is
+// now in the new one; the tracker is moved to the sub-pixel peak of the
+// correlation.  If the template can't be made or nothing in the window
+// matches, the tracker is left where it is.
+bool Tracker_Collection_Manager::fft_image_search(fft_correlator &correlator,
+      spot_tracker_XY *tkr, const double last_pos[2],
+      double search_radius,
+      const image_wrapper &previous_image, const image_wrapper &new_image)
+{
+  std::vector<double> templ;
+  int template_rad;
+  if (!tkr->get_correlation_template(templ, template_rad)) {
+    // Snapshot the previous image, trimming the template to fit inside it
+    // as image_spot_tracker_interp::set_image() does.
+    int minx, maxx, miny, maxy;
+    previous_image.read_range(minx, maxx, miny, maxy);
+    template_rad = (int)ceil(tkr->get_radius());
+    template_rad = (int)min(template_rad, last_pos[0] - minx - 1);
+    template_rad = (int)min(template_rad, last_pos[1] - miny - 1);
+    template_rad = (int)min(template_rad, maxx - last_pos[0] - 1);
+    template_rad = (int)min(template_rad, maxy - last_pos[1] - 1);
+    if (template_rad <= 0) {
+      return false;
+    }
+    int tsize = 2 * template_rad + 1;
+    templ.resize(tsize * tsize);
+    int x, y;
+    for (y = -template_rad; y <= template_rad; y++) {
+      for (x = -template_rad; x <= template_rad; x++) {
+        templ[(x + template_rad) + tsize * (y + template_rad)] =
+          previous_image.read_pixel_bilerp_nocheck(last_pos[0] + x, last_pos[1] + y, d_color_index);
+      }
+    }
+  }
+
+  std::vector<double> surface;
+  int cx = (int)floor(tkr->get_x() + 0.5);
+  int cy = (int)floor(tkr->get_y() + 0.5);
+  int search_rad = (int)ceil(search_radius);
+  double dx, dy, value;
+  if (!correlator.correlate(&templ[0], template_rad, new_image, d_color_index,
+                            cx, cy, search_rad, surface) ||
+      !fft_correlator::find_peak(surface, search_rad, search_radius, dx, dy, value)) {
+    return false;
+  }
+  tkr->set_location(cx + dx, cy + dy);
+  return true;
+}
+
+bool Tracker_Collection_Manager::perform_local_image_search(int max_tracker_to_optimize,
+      double search_radius,
+      const image_pyramid &previous_pyramid, const image_pyramid &new_pyramid)
+{
+    unsigned levels = min(previous_pyramid.num_levels(), new_pyramid.num_levels());
+    if (levels == 0) {
+      fprintf(stderr, "Tracker_Collection_Manager::perform_local_image_search(): Empty pyramid\n");
+      return false;
+    }
+
+    int i;
+    #pragma omp parallel for
+    for (i = 0; i < (int)(d_trackers.size()); i++) {
+      if ( (max_tracker_to_optimize < 0) || (i <= max_tracker_to_optimize) ) {
+        Spot_Information  *tracker = Tracker_Collection_Manager::tracker(i);
+        double last_pos[2];
+        tracker->get_last_position(last_pos);
+        spot_tracker_XY *tkr = tracker->xytracker();
+        double x_base = tkr->get_x();
+        double y_base = tkr->get_y();
+        double rad = tkr->get_radius();
+
+        // Find the coarsest level where both the kernel and the search radius
+        // are still at least two pixels.
+        unsigned top = 0;
+        while ( (top + 1 < levels) && (rad / (2 << top) >= 2) && (search_radius / (2 << top) >= 2) ) {
+          top++;
+        }
+
+        // The best offset is kept in pixels of the level being searched, which
+        // is twice what it was on the level above.
+        int best_x_offset = 0;
+        int best_y_offset = 0;
+        int level;
+        for (level = top; level >= 0; level--) {
+          double scale = static_cast<double>(1 << level);
+          int reach = 2;
+          if (level == (int)top) {
+            reach = static_cast<int>(floor(search_radius / scale));
+          } else {
+            best_x_offset *= 2;
+            best_y_offset *= 2;
+          }
+          const float_image &previous_image = previous_pyramid.level(level);
+          const float_image &new_image = new_pyramid.level(level);
+          double level_rad = rad / scale;
+          double last_x = image_pyramid::to_level(last_pos[0], level);
+          double last_y = image_pyramid::to_level(last_pos[1], level);
+          double base_x = image_pyramid::to_level(x_base, level);
+          double base_y = image_pyramid::to_level(y_base, level);
+
+          // Take the snapshot where the tracker was on the previous frame, as
+          // the full-resolution search does.
+          twolines_image_spot_tracker_interp max_find(level_rad, d_invert, 1.0, 1.0, 1.0);
+          max_find.set_location(last_x, last_y);
+          if (!max_find.set_image(previous_image, 0, last_x, last_y, level_rad + reach)) {
+            continue;
+          }
+
+          double radsq = (search_radius / scale) * (search_radius / scale);
+          int center_x = best_x_offset;
+          int center_y = best_y_offset;
+          max_find.set_location(base_x + center_x, base_y + center_y);
+          double best_value = max_find.check_fitness(new_image, 0);
+          int x_offset, y_offset;
+          for (x_offset = center_x - reach; x_offset <= center_x + reach; x_offset++) {
+            for (y_offset = center_y - reach; y_offset <= center_y + reach; y_offset++) {
+              if ( (x_offset * x_offset) + (y_offset * y_offset) <= radsq) {
+                max_find.set_location(base_x + x_offset, base_y + y_offset);
+                double val = max_find.check_fitness(new_image, 0);
+                if (val > best_value) {
+                  best_x_offset = x_offset;
+                  best_y_offset = y_offset;
+                  best_value = val;
+                }
+              }
+            }
+          }
+        }
+
+        // Put the tracker at the location of the maximum, so that it will find the
+        // total maximum when it finds the local maximum.
+        tracker->xytracker()->set_location(x_base + best_x_offset, y_base + best_y_offset);
+      }
+    }
+
+    return true;
+}
+
 // Update the positions of the trackers we are managing based on a new image.
 // For kymograph applications, we only want to optimize the first two trackers,
 // so we have the ability to tell how many to optimize; by default, they
@@ -3364,30 +4833,79 @@ unsigned Tracker_Collection_Manager::delete_edge_beads_in(const image_wrapper &s
 // tracks from earlier trackers.
 void Tracker_Collection_Manager::mark_colliding_beads_in(const image_wrapper &s_image)
 {
-    std::list<Spot_Information *>::iterator  loop;
-    for (loop = d_trackers.begin(); loop != d_trackers.end(); loop++) {
-        double x = (*loop)->xytracker()->get_x();
-        double y = (*loop)->xytracker()->get_y();
-
-        std::list<Spot_Information *>::iterator loop2;
-        double zone2 = d_min_bead_separation * d_min_bead_separation;
-        for (loop2 = d_trackers.begin(); loop2 != loop; loop2++) {
-            double x2 = (*loop2)->xytracker()->get_x();
-            double y2 = (*loop2)->xytracker()->get_y();
+    // Only trackers in grid cells near each one need to be checked.  The
+    // neighbors are sorted so that they are visited in the same order as
+    // when each tracker was compared against all of the earlier ones.
+    rebuild_proximity_grid(d_min_bead_separation);
+    double zone2 = d_min_bead_separation * d_min_bead_separation;
+    std::vector<unsigned> neighbors;
+    size_t i, n;
+    for (i = 0; i < d_trackers.size(); i++) {
+        double x = d_trackers[i]->xytracker()->get_x();
+        double y = d_trackers[i]->xytracker()->get_y();
+
+        neighbors.clear();
+        d_grid.candidates(x, y, d_min_bead_separation, neighbors);
+        std::sort(neighbors.begin(), neighbors.end());
+        for (n = 0; (n < neighbors.size()) && (neighbors[n] < i); n++) {
+            Spot_Information *other = d_trackers[neighbors[n]];
+            double x2 = other->xytracker()->get_x();
+            double y2 = other->xytracker()->get_y();
             double dist2 = ( (x-x2)*(x-x2) + (y-y2)*(y-y2) );
             if (dist2 < zone2) {
-                (*loop)->lost(true);
-                printf("id %d is lost\n", (*loop)->index());
+                d_trackers[i]->lost(true);
+                printf("id %d is lost\n", d_trackers[i]->index());
 
                 if (d_lost_all_if_collide) {
-                    (*loop2)->lost(true);
-                    printf("id %d is also lost\n", (*loop2)->index());
+                    other->lost(true);
+                    printf("id %d is also lost\n", other->index());
                 }
             }
         }
     }
 }
 
+int Tracker_Collection_Manager::nearest_tracker_index(double x, double y)
+{
+    rebuild_proximity_grid(d_min_bead_separation);
+    return d_grid.nearest(x, y);
+}
+
+void Tracker_Collection_Manager::rebuild_proximity_grid(double cell_size,
+                                                        const image_wrapper *image)
+{
+    // Find the area covered by the trackers and the image.
+    double minx = 1e100, maxx = -1e100, miny = 1e100, maxy = -1e100;
+    size_t i;
+    for (i = 0; i < d_trackers.size(); i++) {
+        double x = d_trackers[i]->xytracker()->get_x();
+        double y = d_trackers[i]->xytracker()->get_y();
+        if (x < minx) { minx = x; }
+        if (x > maxx) { maxx = x; }
+        if (y < miny) { miny = y; }
+        if (y > maxy) { maxy = y; }
+    }
+    if (image) {
+        int iminx, imaxx, iminy, imaxy;
+        image->read_range(iminx, imaxx, iminy, imaxy);
+        if (iminx < minx) { minx = iminx; }
+        if (imaxx > maxx) { maxx = imaxx; }
+        if (iminy < miny) { miny = iminy; }
+        if (imaxy > maxy) { maxy = imaxy; }
+    }
+    if (minx > maxx) { minx = maxx = miny = maxy = 0; }
+
+    // Allow a few cells per tracker, with a floor so that a grid that is
+    // having trackers added to it is not squeezed down to a few cells.
+    unsigned max_cells = 4 * static_cast<unsigned>(d_trackers.size()) + 4096;
+    d_grid.reset(minx, miny, maxx, maxy, cell_size, max_cells);
+    for (i = 0; i < d_trackers.size(); i++) {
+        d_grid.insert(static_cast<unsigned>(i),
+                      d_trackers[i]->xytracker()->get_x(),
+                      d_trackers[i]->xytracker()->get_y());
+    }
+}
+
 // Auto-deletes trackers that have gotten too close to another tracker.
 // Uses the specified distance threshold to determine if they are too close.
 // Returns the number of remaining trackers after any have
@@ -3411,16 +4929,17 @@ unsigned Tracker_Collection_Manager::delete_beads_marked_as_lost(void)
       active_lost = tracker(d_active_tracker)->lost();
     }
 
-    // Remove all lost beads.
-    std::list<Spot_Information *>::iterator it = d_trackers.begin();
-    while (it != d_trackers.end()) {
-      if((*it)->lost()) {
-        delete *it;
-        it = d_trackers.erase(it);
+    // Remove all lost beads in one pass, sliding each survivor down
+    // over the holes so the order of the remaining trackers is kept.
+    size_t from, to = 0;
+    for (from = 0; from < d_trackers.size(); from++) {
+      if (d_trackers[from]->lost()) {
+        delete d_trackers[from];
       } else {
-        ++it;
+        d_trackers[to++] = d_trackers[from];
       }
     }
+    d_trackers.resize(to);
  
     // If the active tracker was lost, set the active tracker to the first one.
     if (active_lost) {
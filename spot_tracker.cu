@@ -632,7 +632,7 @@ static __global__ void VST_cuda_symmetric_opt_kernel(const float *img, int nx, i
 // Optimize the passed-in list of symmetric XY trackers based on the
 // image buffer passed in.
 bool VST_cuda_optimize_symmetric_trackers(const VST_cuda_image_buffer &buf,
-                                                 std::list<Spot_Information *> &tkrs,
+                                                 std::vector<Spot_Information *> &tkrs,
                                                  unsigned num_to_optimize)
 {
 	// Make sure we can initialize CUDA.  This also allocates the global
@@ -680,7 +680,7 @@ bool VST_cuda_optimize_symmetric_trackers(const VST_cuda_image_buffer &buf,
 		return false;
 	}
 	int i;
-	std::list<Spot_Information *>::iterator  loop;
+	std::vector<Spot_Information *>::iterator  loop;
 	for (loop = tkrs.begin(), i = 0; i < (int)(num_to_optimize); loop++, i++) {
 		const spot_tracker_XY *t = (*loop)->xytracker();
 		ti[i].radius = static_cast<float>(t->get_radius());
@@ -832,7 +832,7 @@ static __global__ void VST_cuda_symmetric_bright_lost_kernel(const float *img, i
 // Optimize the passed-in list of symmetric XY trackers based on the
 // image buffer passed in.
 bool VST_cuda_check_bright_lost_symmetric_trackers(const VST_cuda_image_buffer &buf,
-                                                 std::list<Spot_Information *> &tkrs,
+                                                 std::vector<Spot_Information *> &tkrs,
                                                  unsigned num_to_optimize,
                                                  float var_thresh)
 {
@@ -877,7 +877,7 @@ bool VST_cuda_check_bright_lost_symmetric_trackers(const VST_cuda_image_buffer &
 		return false;
 	}
 	int i;
-	std::list<Spot_Information *>::iterator  loop;
+	std::vector<Spot_Information *>::iterator  loop;
 	for (loop = tkrs.begin(), i = 0; i < (int)(num_to_optimize); loop++, i++) {
 		spot_tracker_XY *t = (*loop)->xytracker();
 		ti[i].radius = static_cast<float>(t->get_radius());
@@ -1039,6 +1039,27 @@ bool VST_cuda_check_bright_lost_symmetric_trackers(const VST_cuda_image_buffer &
 	return true;
 }
 
+// Versions of the above that take a list of trackers, for applications
+// that keep their own lists.  They copy the pointers into a vector and
+// call the vector versions; the trackers themselves are shared, so the
+// results end up in the same place.
+bool VST_cuda_optimize_symmetric_trackers(const VST_cuda_image_buffer &buf,
+                                                 std::list<Spot_Information *> &tkrs,
+                                                 unsigned num_to_optimize)
+{
+	std::vector<Spot_Information *> v(tkrs.begin(), tkrs.end());
+	return VST_cuda_optimize_symmetric_trackers(buf, v, num_to_optimize);
+}
+
+bool VST_cuda_check_bright_lost_symmetric_trackers(const VST_cuda_image_buffer &buf,
+                                                 std::list<Spot_Information *> &tkrs,
+                                                 unsigned num_to_optimize,
+                                                 float var_thresh)
+{
+	std::vector<Spot_Information *> v(tkrs.begin(), tkrs.end());
+	return VST_cuda_check_bright_lost_symmetric_trackers(buf, v, num_to_optimize, var_thresh);
+}
+
 
 //----------------------------------------------------------------------
 // Notes on speedup attempts for tracking are below here
@@ -6,6 +6,39 @@
 #include <list>
 #include <vector>
 
+class spot_tracker_XY;
+class fft_correlator;
+
+//----------------------------------------------------------------------------
+// What happened the last time an optimizer ran on a tracker.
+
+class spot_optimizer_status {
+public:
+  spot_optimizer_status() : iterations(0), evaluations(0), converged(false) {};
+
+  unsigned  iterations;   //< Steps the optimizer took
+  unsigned  evaluations;  //< Fitness (or model) evaluations over the whole kernel
+  bool      converged;    //< Did it reach the tracker's accuracy?
+};
+
+//----------------------------------------------------------------------------
+// Virtual base class for optimizers that can stand in for the pattern search
+// that spot_tracker_XY::optimize() and optimize_xy() do.  optimize() starts
+// from the tracker's current location and radius, leaves the tracker at the
+// best fit with its fitness set, and returns true.  If it can't handle the
+// tracker or does not converge, it puts the tracker back where it started
+// and returns false; the tracker then does its pattern search.  The radius
+// is optimized only if do_r is true.  Trackers are optimized in parallel,
+// so an optimizer must be usable on several trackers at once.
+
+class spot_tracker_optimizer {
+public:
+  virtual ~spot_tracker_optimizer() {};
+
+  virtual bool  optimize(spot_tracker_XY &tracker, const image_wrapper &image, unsigned rgb,
+                         bool do_r, spot_optimizer_status &status) const = 0;
+};
+
 //----------------------------------------------------------------------------
 // Virtual base class for spot trackers that track in X and Y.
 
@@ -57,11 +90,19 @@ public:
   // Return the fitness value there.
   virtual double  check_fitness(const image_wrapper &image, unsigned rgb) = 0;
 
+  /// Check the fitness along with its gradient and (an approximation to) its
+  // Hessian with respect to X and Y, all from one pass over the kernel.  Used
+  // by Newton_spot_optimizer.  Returns false if the kernel can't do this.
+  virtual bool    check_fitness_derivatives(const image_wrapper &image, unsigned rgb,
+                                            double &fitness, double gradient[2], double hessian[2][2])
+            { return false; };
+
   /// Get at internal information
   inline double  get_radius(void) const { return _rad; };
   inline double  get_fitness(void) const { return _fitness; };
   inline double  get_sample_separation(void) const { return _samplesep; };
   inline double  get_pixel_accuracy(void) const { return _pixelacc; };
+  inline double  get_radius_accuracy(void) const { return _radacc; };
   inline double  get_x(void) const { return _x; };
   inline double  get_y(void) const { return _y; };
   
@@ -87,6 +128,31 @@ public:
   // fitness outside the object itself; it should be used with caution.
   virtual void set_fitness(const double fitness) { _fitness = fitness; };
 
+  /// Use a different optimizer than the pattern search in optimize() and
+  // optimize_xy().  NULL goes back to the pattern search.  The tracker does
+  // not take ownership of the optimizer.
+  void set_optimizer(const spot_tracker_optimizer *optimizer) { _optimizer = optimizer; };
+  const spot_tracker_optimizer *get_optimizer(void) const { return _optimizer; };
+
+  /// What happened the last time the optimizer ran.
+  const spot_optimizer_status &get_optimizer_status(void) const { return _optstatus; };
+
+  inline bool  get_invert(void) const { return _invert; };
+
+  /// How many times the pattern search in optimize() and optimize_xy() found
+  // the fitness at a position it had already checked during the same call,
+  // and how many times it had to check it.
+  unsigned long get_fitness_cache_hits(void) const { return _cache_hits; };
+  unsigned long get_fitness_cache_misses(void) const { return _cache_misses; };
+
+  /// Trackers that match against a stored image fill in that image, as it
+  // would look in the image being tracked, for the FFT correlation search
+  // (see fft_correlator.h).  The template holds (2*template_rad+1) squared
+  // values, row by row, centered on the tracker.  Returns false for trackers
+  // that don't have one.
+  virtual bool	get_correlation_template(std::vector<double> &templ, int &template_rad) const
+            { return false; };
+
 protected:
   double  _samplesep; //< Spacing between samples in pixels
   double  _rad;	      //< Current radius of the disk
@@ -97,6 +163,28 @@ protected:
   double  _pixelstep; //< Current X,Y pixel step size
   double  _fitness;   //< Current value of match for the disk
   bool	  _invert;    //< Do we look for a dark spot on a black background?
+  const spot_tracker_optimizer *_optimizer;  //< Optimizer to use instead of the pattern search (if any)
+  spot_optimizer_status _optstatus;           //< What happened the last time it ran
+
+  // The pattern search steps back and forth over the same positions, so
+  // during each optimize() and optimize_xy() call we remember the last few
+  // fitness values it found, along with which image (and which version of
+  // it) they came from.  Derived classes that change other parameters of
+  // the fit during the search must call invalidate_fitness_cache() when they
+  // do.
+  enum { FITNESS_CACHE_SIZE = 16 };
+  struct fitness_cache_entry { double x, y, r, fitness; };
+  fitness_cache_entry _cache[FITNESS_CACHE_SIZE];
+  unsigned  _cache_count;   //< How many entries are valid
+  unsigned  _cache_next;    //< Where the next one goes
+  bool      _cache_active;  //< Only used within optimize() and optimize_xy()
+  const image_wrapper *_cache_image;  //< Image the entries came from
+  unsigned long _cache_generation;    //< Its generation stamp
+  unsigned  _cache_rgb;               //< Color they came from
+  unsigned long _cache_hits, _cache_misses;
+
+  double  cached_fitness(const image_wrapper &image, unsigned rgb);
+  void    invalidate_fitness_cache(void) { _cache_count = 0; _cache_next = 0; };
 
   spot_tracker_XY(double radius, bool inverted = false, double pixelacurracy = 0.25, double radiusaccuracy = 0.25, double sample_separation_in_pixels = 1.0);
 };
@@ -217,6 +305,69 @@ public:
 protected:
 };
 
+//----------------------------------------------------------------------------
+// The offsets at which the interpolating kernels sample the image, stored as
+// rings around the center.  Every tracker with the same kind of kernel and
+// sample spacing samples in the same places, so rather than each tracker
+// computing its own, they share one read-only table from a process-wide
+// cache.  The cache counts the trackers using each table and deletes it when
+// the last one releases it.  Each kind of table is built with the same
+// arithmetic its kernel used to do inline, so the samples land in exactly
+// the same places:
+//   SYMMETRIC_RINGS: ring r (from 1) has radius r * spacing; ring 0 is empty.
+//   DISK_RINGS: rings start at one spacing and step by it.
+//   CONE_RINGS: rings start at one pixel and step by the spacing.
+// Tables cover radii up to a power of two that is at least the radius asked
+// for; update() swaps in a larger one when a tracker's radius outgrows it.
+
+class spot_sampling_table {
+public:
+  enum KIND { SYMMETRIC_RINGS, DISK_RINGS, CONE_RINGS };
+
+  /// Get a table that covers at least the radius passed in, building it if
+  // no other tracker is using one.  Returns NULL if out of memory.
+  static const spot_sampling_table *acquire(KIND kind, double sample_separation, double radius);
+
+  /// Stop using a table (NULL is ignored).
+  static void release(const spot_sampling_table *table);
+
+  /// Return the table passed in if it matches the kind and spacing and
+  // covers the radius; otherwise release it and acquire one that does.
+  static const spot_sampling_table *update(const spot_sampling_table *table,
+                                           KIND kind, double sample_separation, double radius);
+
+  /// How many tables are in the cache (for testing).
+  static unsigned num_cached_tables(void);
+
+  KIND    kind(void) const { return d_kind; };
+  double  sample_separation(void) const { return d_samplesep; };
+  double  max_radius(void) const { return d_max_radius; };
+  int     num_rings(void) const { return static_cast<int>(d_ring_radius.size()); };
+  double  ring_radius(int ring) const { return d_ring_radius[ring]; };
+  int     ring_count(int ring) const { return d_ring_count[ring]; };
+
+  /// Offsets for a ring, as doubles and as floats for the vector code.
+  const double *ring_x(int ring) const { return &d_x[0] + d_ring_start[ring]; };
+  const double *ring_y(int ring) const { return &d_y[0] + d_ring_start[ring]; };
+  const float *ring_xf(int ring) const { return &d_xf[0] + d_ring_start[ring]; };
+  const float *ring_yf(int ring) const { return &d_yf[0] + d_ring_start[ring]; };
+
+protected:
+  spot_sampling_table(KIND kind, double sample_separation, double max_radius);
+  void    add_ring(double r, double first_theta, double rads_per_step);
+
+  KIND    d_kind;
+  double  d_samplesep;
+  double  d_max_radius;
+  int     d_users;                      //< How many trackers are using it
+  std::vector<double> d_ring_radius;
+  std::vector<int>    d_ring_start, d_ring_count;
+  std::vector<double> d_x, d_y;
+  std::vector<float>  d_xf, d_yf;
+
+  friend class spot_sampling_table_cache;
+};
+
 //----------------------------------------------------------------------------
 // This class will optimize the response of a disk-shaped kernel on an image.
 // It does bilinear interpolation on the four neighboring pixels when computing
@@ -237,12 +388,19 @@ public:
 		    double pixelaccuracy = 0.25,
 		    double radiusaccuracy = 0.25,
 		    double sample_separation_in_pixels = 1.0);
+  virtual ~disk_spot_tracker_interp();
 
   /// Check the fitness of the disk against an image, at the current parameter settings.
   // Return the fitness value there.
   virtual double  check_fitness(const image_wrapper &image, unsigned rgb);
 
+  // The fitness calculation, templated on how pixels are sampled from the
+  // image so that reads can be inlined for images that expose their buffer.
+  // Called by check_fitness(), which picks the sampler.
+  template <class SAMPLER> double check_fitness_sampled(const SAMPLER &sample, unsigned rgb);
+
 protected:
+  const spot_sampling_table *_table;  //< Shared sample offsets
 };
 
 //----------------------------------------------------------------------------
@@ -264,12 +422,17 @@ public:
 		    double pixelaccuracy = 0.25,
 		    double radiusaccuracy = 0.25,
 		    double sample_separation_in_pixels = 1.0);
+  virtual ~cone_spot_tracker_interp();
 
   /// Check the fitness against an image, at the current parameter settings.
   // Return the fitness value there.
   virtual double  check_fitness(const image_wrapper &image, unsigned rgb);
 
+  // Sampler-templated fitness calculation called by check_fitness().
+  template <class SAMPLER> double check_fitness_sampled(const SAMPLER &sample, unsigned rgb);
+
 protected:
+  const spot_sampling_table *_table;  //< Shared sample offsets
 };
 
 //----------------------------------------------------------------------------
@@ -285,6 +448,11 @@ protected:
 // area of the image that has circular symmetry.
 // The class is given an image to search in, and whether to search for a bright
 // spot on a dark background (the default) or a dark spot on a bright background.
+// When the image exposes its buffer and a ring lies entirely inside it, the
+// ring is summed by the SSE2/AVX2 code in spot_tracker_simd.cpp.  That code
+// stores the offsets as floats, so fitness values differ from the scalar code
+// by about one part in 10^7; tracked positions have matched the scalar code
+// exactly in testing and should agree to well within the pixel accuracy.
 
 class symmetric_spot_tracker_interp : public spot_tracker_XY {
 public:
@@ -300,20 +468,25 @@ public:
   // Return the fitness value there.
   virtual double  check_fitness(const image_wrapper &image, unsigned rgb);
 
+  // Sampler-templated fitness calculation called by check_fitness().
+  template <class SAMPLER> double check_fitness_sampled(const SAMPLER &sample, unsigned rgb);
+
+  /// The fitness is minus the sum of the variances around the rings, so its
+  // derivatives come from sums of the interpolated values and their slopes
+  // and curvatures over the same rings.
+  virtual bool    check_fitness_derivatives(const image_wrapper &image, unsigned rgb,
+                                            double &fitness, double gradient[2], double hessian[2][2]);
+
 protected:
-  // These structures and functions support pre-filling the coordinate offsets
-  // for the circles.  This avoids having to call all of the sin() and cos()
-  // functions, as well as a lot of other math, each time through the routine
-  // that determines fitness.  Because the pixels are always even integer
-  // distances from the center, we can precompute them for all radii in the
-  // constructor and then just loop through each list that is within the
-  // current radius value at run-time.
+  // The coordinate offsets for the circles are pre-filled for all radii up
+  // to the maximum, so the fitness routine doesn't need to call all of the
+  // sin() and cos() functions, as well as a lot of other math.  Because the
+  // pixels are always even integer distances from the center, the fitness
+  // routine just loops through each ring that is within the current radius.
+  // The table is shared with every other symmetric tracker that has the
+  // same sample spacing.
   int _MAX_RADIUS;	//< Can't have larger radius than this
-  int *_radius_counts;	//< How many values in each radius, stored in an array
-  typedef struct {
-    double x, y;
-  } offset;
-  offset  **_radius_lists;  //< List of offset values, stored in an array
+  const spot_sampling_table *_table;  //< Shared sample offsets
 };
 
 //----------------------------------------------------------------------------
@@ -343,6 +516,9 @@ public:
   // Return the fitness value there.
   virtual double  check_fitness(const image_wrapper &image, unsigned rgb);
 
+  // Sampler-templated fitness calculation called by check_fitness().
+  template <class SAMPLER> double check_fitness_sampled(const SAMPLER &sample, unsigned rgb);
+
   using spot_tracker_XY::optimize_xy;
   virtual void  optimize_xy(const image_wrapper &image, unsigned rgb, double &x, double &y);
 
@@ -351,6 +527,9 @@ public:
 	return true;
   }
 
+  // The stored test image.
+  virtual bool	get_correlation_template(std::vector<double> &templ, int &template_rad) const;
+
 protected:
   std::list<double *> trackedimages;
   int max_images;
@@ -446,6 +625,9 @@ public:
 
   int get_testsize(void) const { return _testsize; };
 
+  // The stored test image, turned to the current orientation.
+  virtual bool	get_correlation_template(std::vector<double> &templ, int &template_rad) const;
+
 protected:
   std::list<double *> trackedimages;
   int max_images;
@@ -461,9 +643,9 @@ protected:
 // This class is initialized with a description of a Gaussian profile that it
 // should track, and then it will optimize against this initial image by shifting
 // over a specified range to find the image whose pixel-wise least-squares
-// difference is minimized.  It approximates integration of the volume of the
-// Gaussian within each pixel by sampling a number of times within each pixel
-// and averaging.
+// difference is minimized.  It integrates the volume of the Gaussian within
+// each pixel exactly.
+// The "sample_separation_in_pixels" parameter does nothing for this tracker.
 
 class Gaussian_spot_tracker : public spot_tracker_XY {
 public:
@@ -481,6 +663,9 @@ public:
   // Return the fitness value there.
   virtual double  check_fitness(const image_wrapper &image, unsigned rgb);
 
+  double get_background(void) const { return _background; };
+  double get_summedvalue(void) const { return _summedvalue; };
+
   // Debugging method.  Remember that the check_fitness() function has to
   // be called before it can be used, so that an image is created.
   bool read_pixel(double x, double y, double &result) const {
@@ -542,6 +727,8 @@ public:
 
   double get_background(void) const { return _background; };
   double get_summedvalue(void) const { return _summedvalue; };
+  void set_background(double background) { _background = background; };
+  void set_summedvalue(double summedvalue) { _summedvalue = summedvalue < 0 ? 0 : summedvalue; };
 
   //------------------------------------------------
 
@@ -554,10 +741,61 @@ public:
 
 protected:
   Point_sampled_Gaussian_image  _testimage;  //< The image to test for fitness against
+  Gaussian_kernel_model         _model;      //< Row and column terms of _testimage, for check_fitness()
   double          _background;  //< The background value to use in the image (added to the Gaussian)
   double          _summedvalue; //< The summed value under the entire Gaussian (will be negative for a dark spot)
 };
 
+//----------------------------------------------------------------------------
+// Levenberg-Marquardt least-squares fit of the Gaussian model that a
+// FIONA_spot_tracker or Gaussian_spot_tracker matches against the image,
+// using the analytic derivatives of the model with respect to its
+// parameters.  For FIONA, the point-sampled Gaussian's position, radius,
+// background and summed value are fit (as its pattern search does, whatever
+// do_r says).  For Gaussian_spot_tracker, the pixel-integrated Gaussian's
+// position and (if do_r) radius are fit.  Each iteration evaluates the model
+// once over the pixels that check_fitness() uses, so it takes many fewer
+// evaluations than the pattern search to reach a given accuracy.  It does
+// not handle other kinds of trackers.
+
+class Gaussian_LM_optimizer : public spot_tracker_optimizer {
+public:
+  Gaussian_LM_optimizer(unsigned max_iterations = 50) : _max_iterations(max_iterations) {};
+
+  virtual bool  optimize(spot_tracker_XY &tracker, const image_wrapper &image, unsigned rgb,
+                         bool do_r, spot_optimizer_status &status) const;
+
+protected:
+  unsigned  _max_iterations;
+};
+
+//----------------------------------------------------------------------------
+// Newton's method applied to a tracker's fitness function, for kernels whose
+// fitness is smooth around its peak (symmetric_spot_tracker_interp is the
+// one it is meant for).  Each step gets the fitness, gradient and Hessian
+// from one check_fitness_derivatives() call and jumps to the peak of the
+// quadratic they describe, shrinking the largest step it will take when a
+// jump makes the fitness worse.  It stops when the step is smaller than the
+// pixel accuracy.  Kernels that can't find their derivatives fall back to
+// fitting a quadratic to check_fitness() at +/- half a pixel in X and Y and
+// on one diagonal, which takes several times as many evaluations.  It only
+// optimizes X and Y, so it returns false when asked for the radius.
+
+class Newton_spot_optimizer : public spot_tracker_optimizer {
+public:
+  Newton_spot_optimizer(unsigned max_iterations = 20) : _max_iterations(max_iterations) {};
+
+  virtual bool  optimize(spot_tracker_XY &tracker, const image_wrapper &image, unsigned rgb,
+                         bool do_r, spot_optimizer_status &status) const;
+
+protected:
+  unsigned  _max_iterations;
+
+  // The fallback that samples check_fitness() around each point.
+  bool  optimize_by_sampling(spot_tracker_XY &tracker, const image_wrapper &image, unsigned rgb,
+                             spot_optimizer_status &status) const;
+};
+
 
 //----------------------------------------------------------------------------
 // This class will optimize the response of three collinear kernels on an image.
@@ -695,19 +933,70 @@ protected:
 // passed in around the specified location
 // over the specified range to find the image whose pixel-wise least-squares
 // difference is minimized.
+//
+// The pixels within the radius fall into rings of equal distance from the
+// center, and every pixel in a ring is compared against the same value from
+// the spread function.  So the tracker keeps the distance of each ring (found
+// once, when it is made) and the spread function sampled at those distances
+// for each Z (a Z by ring table).  When the fitness is checked, the image
+// around the bead is reduced to the mean, count, and spread about the mean of
+// each ring, and each Z then costs one pass over the rings rather than over
+// the pixels.  The fitness is the same as comparing pixel by pixel, to within
+// floating-point rounding.  The ring values are kept while optimize() and the
+// locate_*_in_depth() methods search in Z at one location in one image.
 
 class radial_average_tracker_Z : public spot_tracker_Z {
 public:
   // Set initial parameters of the search routine
   radial_average_tracker_Z(const char *in_filename, double depth_accuracy = 0.25);
+
+  // Same, but with the radially-averaged image already in memory.  It is
+  // copied, so it need not stay around.
+  radial_average_tracker_Z(const image_wrapper &radial_image, double depth_accuracy = 0.25);
   virtual ~radial_average_tracker_Z() { if (d_radial_image) { delete d_radial_image; }; }
 
   /// Check the fitness against an image, at the current parameter settings.
   // Return the fitness value there.
   virtual double  check_fitness(const image_wrapper &image, unsigned rgb, double x, double y);
 
+  // The searches, which measure the image around the bead once for all of
+  // the depths they try.
+  using spot_tracker_Z::optimize;
+  virtual void	optimize(const image_wrapper &image, unsigned rgb, double x, double y, double &z);
+  virtual void	locate_best_fit_in_depth(const image_wrapper &image, unsigned rgb, double x, double y, double &z);
+  virtual void	locate_close_fit_in_depth(const image_wrapper &image, unsigned rgb, double x, double y, double &z);
+
+  /// Number of distinct ring distances within the radius.
+  unsigned  num_rings(void) const { return static_cast<unsigned>(d_ring_dist.size()); }
+
 protected:
   image_wrapper	*d_radial_image;	    //< Radial image read from file.
+
+  // Filled in once by use_radial_image().
+  std::vector<double>   d_offset_x, d_offset_y; //< Offset of each pixel within the radius
+  std::vector<unsigned> d_pixel_ring;           //< Which ring each pixel is in
+  std::vector<double>   d_ring_dist;            //< Distance of each ring from the center
+  std::vector<double>   d_table;                //< Spread function at [z * num_rings + ring]
+
+  // The image around the bead, filled in by load_profile().
+  std::vector<double>   d_values;               //< Value at each pixel (if it was in the image)
+  std::vector<char>     d_in_image;             //< Was the pixel in the image?
+  std::vector<double>   d_ring_mean;            //< Mean of the pixels in each ring
+  std::vector<double>   d_ring_count;           //< Number of pixels in each ring
+  double                d_scatter;              //< Sum of squared differences from the ring means
+  double                d_pixels;               //< Number of pixels in the image
+
+  // Which image and location the ring values came from, while they are kept.
+  bool                  d_profile_active;
+  const image_wrapper   *d_profile_image;
+  unsigned              d_profile_rgb;
+  double                d_profile_x, d_profile_y;
+
+  // Check the radial image, take the Z range and radius from it, and fill
+  // in the tables.  Returns false if the image is bogus.
+  bool  use_radial_image(void);
+  void  load_profile(const image_wrapper &image, unsigned rgb, double x, double y);
+  template <class SAMPLER> void load_profile_sampled(const SAMPLER &sample, unsigned rgb, double x, double y);
 };
 
 //----------------------------------------------------------------------------------
@@ -817,6 +1106,118 @@ typedef spot_tracker_Z *(*TCM_ZTRACKER_CREATOR)(void);
 
 #endif
 
+//----------------------------------------------------------------------------------
+// Description of one 4-connected region of pixels at or above a threshold,
+// as found by VST_find_connected_components() below.
+
+class VST_Connected_Component {
+public:
+  unsigned  area;                       //< Number of pixels in the region
+  double    cx, cy;                     //< Mean location of the pixels
+  double    intensity;                  //< Sum of the pixel values
+  double    weighted_cx, weighted_cy;   //< Mean location weighted by pixel value
+  int       minx, maxx, miny, maxy;     //< Bounding box (inclusive)
+  int       firstx, firsty;             //< First pixel found scanning columns from the left
+};
+
+// Label all of the 4-connected regions of pixels in the specified color
+// that are at or above the threshold and return their statistics.  Works
+// on horizontal strips of the image in parallel, then joins regions that
+// cross the strip boundaries.  The components are returned in order of
+// their first pixel when scanning each column from the top, starting at the
+// leftmost column.  Returns false on error (out of memory).
+bool VST_find_connected_components(const image_wrapper &image, unsigned rgb,
+                                   double threshold,
+                                   std::vector<VST_Connected_Component> &components);
+
+//----------------------------------------------------------------------------------
+// Collects possibly-overlapping pixel rectangles (such as the areas of video
+// logged around each tracker) and breaks their union into rectangles that do
+// not overlap, so that each pixel is sent once no matter how many of the
+// original rectangles held it.  The union is cut into horizontal bands at
+// the top and bottom edges of the rectangles; the spans in each band are
+// merged, and a span that matches one in the band above extends it down.
+// Storage is kept between clears so that reuse each frame does not allocate.
+
+class VST_Region_Union {
+public:
+  class Rect {
+  public:
+    int minx, miny, maxx, maxy;           //< Inclusive pixel bounds
+  };
+
+  VST_Region_Union() : d_requested(0) {};
+
+  // Forget all rectangles.
+  void clear() { d_rects.clear(); d_requested = 0; }
+
+  // Add a rectangle.  Empty rectangles (max less than min) are ignored.
+  void add(int minx, int miny, int maxx, int maxy);
+
+  // Number of pixels in all rectangles added since the last clear(),
+  // counting overlapping pixels once for each rectangle that holds them.
+  double requested_pixels() const { return d_requested; }
+
+  // Fill in non-overlapping rectangles that exactly cover the union of
+  // the ones added.  Returns the number of pixels they hold.
+  double disjoint_cover(std::vector<Rect> &out);
+
+protected:
+  std::vector<Rect> d_rects;              //< Rectangles added so far
+  double            d_requested;          //< Total area of the rectangles added
+  std::vector<int>  d_edges;              //< Band edges, reused by disjoint_cover()
+  std::vector<size_t> d_active;           //< Rectangles covering the current band, reused
+  std::vector< std::pair<int,int> > d_spans;  //< Spans in one band, reused
+  std::vector<size_t> d_open, d_still_open;  //< Rectangles that may grow into the next band, reused
+};
+
+//----------------------------------------------------------------------------------
+// Uniform grid of points, used by the collection manager below to find the
+// trackers that are near a location without checking all of them.  Each
+// entry holds the index of a tracker and its position when it was inserted.
+// Points that fall outside the bounds passed to reset() are stored in the
+// nearest edge cell, so candidates() still finds them.  The storage for the
+// cells is kept between resets so that rebuilding each frame does not
+// allocate once the grid has reached its working size.
+
+class Tracker_Proximity_Grid {
+public:
+    Tracker_Proximity_Grid() : d_minx(0), d_miny(0), d_cell_size(1), d_nx(1), d_ny(1), d_cells(1) {};
+
+    // Empty the grid and set it to cover the specified area using cells
+    // of at least the specified size.  The cells are made larger if needed
+    // to keep their count near max_cells.
+    void reset(double minx, double miny, double maxx, double maxy,
+               double cell_size, unsigned max_cells);
+
+    // Add a point to the grid.
+    void insert(unsigned index, double x, double y);
+
+    // Append to the vector the indices of all points in cells that overlap
+    // the square of the specified half-width around (x,y).  This is a superset
+    // of the points within that distance; the caller does its own exact test.
+    void candidates(double x, double y, double half_width,
+                    std::vector<unsigned> &indices) const;
+
+    // Return the index of the point nearest to (x,y), or -1 if the grid is
+    // empty.  Ties go to the lowest index.  Assumes that all points were
+    // inside the bounds passed to reset().
+    int nearest(double x, double y) const;
+
+protected:
+    struct Entry {
+      unsigned  index;
+      double    x, y;
+    };
+    double  d_minx, d_miny;     //< Lower corner of the area covered
+    double  d_cell_size;        //< Width and height of each cell
+    int     d_nx, d_ny;         //< Number of cells in X and Y
+    std::vector< std::vector<Entry> > d_cells;  //< Points in each cell, X varying fastest
+
+    int cell_x(double x) const;
+    int cell_y(double y) const;
+};
+
 //----------------------------------------------------------------------------------
 // Application-level object that manages a list of trackers and keeps track of autofinding,
 // deleting, and causing them to track across images.  This is an OpenMP-threaded
@@ -848,6 +1249,7 @@ public:
         , d_z_tracker_creator(zcreator)
     {
         d_lost_all_if_collide = false;  
+        d_fft_search = false;
     };
 
     // Clean up (delete trackers in our vector, etc.)
@@ -875,6 +1277,8 @@ public:
     void color_index(unsigned index) { d_color_index = index; }
     bool invert(void) const { return d_invert; }
     void invert(bool invert) { d_invert = invert; }
+    bool fft_search(void) const { return d_fft_search; }
+    void fft_search(bool fft) { d_fft_search = fft; }
 
     // Lets the user change the default tracker-creation function to be
     // used to make XY trackers or to make Z trackers.  The default is to
@@ -931,9 +1335,23 @@ public:
     // the previous image (to take the snapshot in) and the current image (to
     // maximize the fit to).  It is also given the radius around the initial
     // position to search.
+    // If fft_search() is set, the whole search window is matched at once by
+    // normalized cross-correlation (see fft_correlator.h) rather than by
+    // checking each offset in turn, and the match is refined to sub-pixel
+    // accuracy.  Trackers that match against a stored image use it as the
+    // template; the others use a snapshot of the previous image.
     bool perform_local_image_search(int max_tracker_to_optimize, double search_radius,
       const image_wrapper &previous_image, const image_wrapper &new_image);
 
+    // Same search, but coarse-to-fine over image pyramids built from the
+    // previous and new images (from the color the trackers use).  The whole
+    // search radius is checked on the coarsest level where the kernel is
+    // still at least two pixels in radius; each finer level then checks
+    // within two of its pixels of the best match from the level above.
+    // This makes search radii of tens of pixels practical.
+    bool perform_local_image_search(int max_tracker_to_optimize, double search_radius,
+      const image_pyramid &previous_pyramid, const image_pyramid &new_pyramid);
+
     //---------------------------------------------------------------------
     // Autofind fluorescence beads within the image whose pointer is passed in.
     // Avoids adding trackers that are too close to other existing trackers.
@@ -1012,6 +1430,10 @@ public:
     // of beads left after the deletion.
     unsigned delete_beads_marked_as_lost(void);
 
+    // Returns the index of the tracker whose center is nearest to the
+    // specified location, or -1 if there are no trackers.
+    int nearest_tracker_index(double x, double y);
+
 protected:
     float                           d_default_radius;       // Radius for new trackers
     float                           d_min_bead_separation;  // How close is too close to beads
@@ -1020,10 +1442,26 @@ protected:
     unsigned                        d_color_index;          // Color index from the image.
     bool                            d_invert;               // Look for dark bead on bright background?
     bool                            d_lost_all_if_collide;  // Mark all beads colliding to each other lost  
-    std::list<Spot_Information *>   d_trackers;             // Trackers we're managing
+    bool                            d_fft_search;           // Local image search by FFT correlation?
+    std::vector<Spot_Information *> d_trackers;             // Trackers we're managing, indexed by tracker number
     int                             d_active_tracker;       // Index of the active tracker, -1 if none.
     TCM_XYTRACKER_CREATOR           d_xy_tracker_creator;   // Used to make new trackers
     TCM_ZTRACKER_CREATOR            d_z_tracker_creator;    // Used to make new trackers
+    Tracker_Proximity_Grid          d_grid;                 // Tracker locations, for proximity checks
+    std::vector<fft_correlator *>   d_fft_correlators;      // One per OpenMP thread, for fft_image_search()
+
+    // Fill the proximity grid with the current tracker locations.  The
+    // trackers move every frame, so this is called at the start of each
+    // method that asks about neighbors.  If an image is passed in, the grid
+    // is made to cover it as well so that trackers added within the image
+    // spread across cells.
+    void rebuild_proximity_grid(double cell_size, const image_wrapper *image = NULL);
+
+    // Local image search for one tracker using FFT correlation; used by
+    // perform_local_image_search() when fft_search() is set.  The
+    // correlator passed in belongs to the calling thread.
+    bool fft_image_search(fft_correlator &correlator, spot_tracker_XY *tkr, const double last_pos[2],
+      double search_radius, const image_wrapper &previous_image, const image_wrapper &new_image);
 
     // Helper function for find_more_brightfield_beads_in.
     // Computes a local SMD measure (cross) at the location (x,y) with
@@ -1078,6 +1516,14 @@ protected:
 // functions definitions for info on the parameters.
 #ifdef  VST_USE_CUDA
 
+extern bool VST_cuda_optimize_symmetric_trackers(const VST_cuda_image_buffer &buf,
+                                                 std::vector<Spot_Information *> &tkrs,
+                                                 unsigned num_to_optimize);
+
+extern bool VST_cuda_check_bright_lost_symmetric_trackers(const VST_cuda_image_buffer &buf,
+                                                 std::vector<Spot_Information *> &tkrs,
+                                                 unsigned num_to_optimize, float var_thresh);
+
 extern bool VST_cuda_optimize_symmetric_trackers(const VST_cuda_image_buffer &buf,
                                                  std::list<Spot_Information *> &tkrs,
                                                  unsigned num_to_optimize);
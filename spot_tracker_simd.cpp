@@ -0,0 +1,472 @@
+#include "spot_tracker_simd.h"
+
+// The vector code is only compiled for x86 processors.  Each kernel is marked
+// with the instruction set it uses so that GCC and Clang will compile it
+// without the whole file (or project) needing -mavx2; the code that chooses
+// among them makes sure it is only called on processors that support it.
+// Visual Studio compiles the intrinsics without needing any flags.
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+  #define VST_SIMD_X86
+  #include <immintrin.h>
+  #ifdef _MSC_VER
+    #include <intrin.h>
+    #define VST_TARGET_SSE2
+    #define VST_TARGET_AVX2
+  #else
+    #define VST_TARGET_SSE2 __attribute__((target("sse2")))
+    #define VST_TARGET_AVX2 __attribute__((target("avx2")))
+  #endif
+#endif
+
+//----------------------------------------------------------------------------
+// Run-time selection of the instruction set.
+
+static int  g_simd_limit = VST_SIMD_AVX2;   //< Set by the application
+static int  g_simd_supported = -1;          //< What the CPU can do; -1 until checked
+
+static int  find_supported_simd_level(void)
+{
+#ifdef  VST_SIMD_X86
+#ifdef  _MSC_VER
+  int info[4];
+  __cpuid(info, 0);
+  int max_leaf = info[0];
+  __cpuid(info, 1);
+  bool sse2 = (info[3] & (1 << 26)) != 0;
+  bool osxsave = (info[2] & (1 << 27)) != 0;
+  bool avx = (info[2] & (1 << 28)) != 0;
+  bool avx2 = false;
+  // AVX2 also needs the operating system to save the wide registers.
+  if (avx && osxsave && ((_xgetbv(0) & 6) == 6) && (max_leaf >= 7)) {
+    __cpuidex(info, 7, 0);
+    avx2 = (info[1] & (1 << 5)) != 0;
+  }
+#else
+  __builtin_cpu_init();
+  bool sse2 = __builtin_cpu_supports("sse2") != 0;
+  bool avx2 = __builtin_cpu_supports("avx2") != 0;
+#endif
+  if (avx2 && sse2) { return VST_SIMD_AVX2; }
+  if (sse2) { return VST_SIMD_SSE2; }
+#endif
+  return VST_SIMD_SCALAR;
+}
+
+int VST_simd_level(void)
+{
+  if (g_simd_supported < 0) {
+    g_simd_supported = find_supported_simd_level();
+  }
+  return g_simd_supported < g_simd_limit ? g_simd_supported : g_simd_limit;
+}
+
+void VST_set_simd_level_limit(int max_level)
+{
+  g_simd_limit = max_level;
+}
+
+//----------------------------------------------------------------------------
+// Ring-sum kernels.  All of them work relative to the pixel that holds the
+// center (cx, cy), so that the sample coordinates stay small and the float
+// offsets do not lose precision when they are added to it.  The per-sample
+// math is done in double precision, in the same order as image_buffer_bilerp().
+
+// Handles the samples left over after the last full vector.
+template <class T>
+static inline void ring_sums_scalar(const T *p, int xs, int ys, double fx, double fy,
+                                    const float *xoff, const float *yoff, int count,
+                                    double &sum, double &square_sum)
+{
+  for (int i = 0; i < count; i++) {
+    double x = fx + xoff[i];
+    double y = fy + yoff[i];
+    double xlow = floor(x); int ixlow = (int)xlow;
+    double ylow = floor(y); int iylow = (int)ylow;
+    double xhighfrac = x - xlow;
+    double yhighfrac = y - ylow;
+    double xlowfrac = 1.0 - xhighfrac;
+    double ylowfrac = 1.0 - yhighfrac;
+    const T *c = p + ixlow * xs + iylow * ys;
+    double val = c[0] * xlowfrac * ylowfrac +
+                 c[ys] * xlowfrac * yhighfrac +
+                 c[xs] * xhighfrac * ylowfrac +
+                 c[xs + ys] * xhighfrac * yhighfrac;
+    sum += val;
+    square_sum += val * val;
+  }
+}
+
+#ifdef  VST_SIMD_X86
+
+// SSE2 has no floor instruction, so truncate and then step down for the
+// negative values that truncation rounded up.
+VST_TARGET_SSE2 static inline __m128d floor_sse2(__m128d v, __m128i &as_int)
+{
+  __m128i t = _mm_cvttpd_epi32(v);
+  __m128d tf = _mm_cvtepi32_pd(t);
+  __m128d too_big = _mm_cmpgt_pd(tf, v);
+  tf = _mm_sub_pd(tf, _mm_and_pd(too_big, _mm_set1_pd(1.0)));
+  as_int = _mm_cvttpd_epi32(tf);
+  return tf;
+}
+
+template <class T>
+VST_TARGET_SSE2 static void ring_sums_sse2(const T *p, int xs, int ys, double fx, double fy,
+                                           const float *xoff, const float *yoff, int count,
+                                           double &sum, double &square_sum)
+{
+  const __m128d one = _mm_set1_pd(1.0);
+  const __m128d vfx = _mm_set1_pd(fx);
+  const __m128d vfy = _mm_set1_pd(fy);
+  __m128d vsum = _mm_setzero_pd();
+  __m128d vsquare = _mm_setzero_pd();
+  int i;
+  for (i = 0; i + 2 <= count; i += 2) {
+    __m128d x = _mm_add_pd(vfx, _mm_cvtps_pd(_mm_castsi128_ps(_mm_loadl_epi64((const __m128i *)&xoff[i]))));
+    __m128d y = _mm_add_pd(vfy, _mm_cvtps_pd(_mm_castsi128_ps(_mm_loadl_epi64((const __m128i *)&yoff[i]))));
+    __m128i ix, iy;
+    __m128d xlow = floor_sse2(x, ix);
+    __m128d ylow = floor_sse2(y, iy);
+    __m128d xhighfrac = _mm_sub_pd(x, xlow);
+    __m128d yhighfrac = _mm_sub_pd(y, ylow);
+    __m128d xlowfrac = _mm_sub_pd(one, xhighfrac);
+    __m128d ylowfrac = _mm_sub_pd(one, yhighfrac);
+
+    // There is no gather in SSE2, so fetch the corners one sample at a time.
+    int ixs[4], iys[4];
+    _mm_storeu_si128((__m128i *)ixs, ix);
+    _mm_storeu_si128((__m128i *)iys, iy);
+    const T *c0 = p + ixs[0] * xs + iys[0] * ys;
+    const T *c1 = p + ixs[1] * xs + iys[1] * ys;
+    __m128d ll = _mm_set_pd(c1[0], c0[0]);
+    __m128d lh = _mm_set_pd(c1[ys], c0[ys]);
+    __m128d hl = _mm_set_pd(c1[xs], c0[xs]);
+    __m128d hh = _mm_set_pd(c1[xs + ys], c0[xs + ys]);
+
+    __m128d val = _mm_mul_pd(_mm_mul_pd(ll, xlowfrac), ylowfrac);
+    val = _mm_add_pd(val, _mm_mul_pd(_mm_mul_pd(lh, xlowfrac), yhighfrac));
+    val = _mm_add_pd(val, _mm_mul_pd(_mm_mul_pd(hl, xhighfrac), ylowfrac));
+    val = _mm_add_pd(val, _mm_mul_pd(_mm_mul_pd(hh, xhighfrac), yhighfrac));
+    vsum = _mm_add_pd(vsum, val);
+    vsquare = _mm_add_pd(vsquare, _mm_mul_pd(val, val));
+  }
+  double lanes[2];
+  _mm_storeu_pd(lanes, vsum);
+  sum += lanes[0] + lanes[1];
+  _mm_storeu_pd(lanes, vsquare);
+  square_sum += lanes[0] + lanes[1];
+  ring_sums_scalar(p, xs, ys, fx, fy, xoff + i, yoff + i, count - i, sum, square_sum);
+}
+
+// Fetch one corner for four samples.  The floating-point buffers can use the
+// hardware gather; the integer ones are too narrow for it and are read one
+// element at a time.  The masked gathers are used, with every lane enabled,
+// because GCC warns that the unmasked ones read an uninitialized register.
+VST_TARGET_AVX2 static inline __m256d gather4(const double *p, __m128i index)
+{
+  const __m256d all = _mm256_castsi256_pd(_mm256_set1_epi64x(-1));
+  return _mm256_mask_i32gather_pd(_mm256_setzero_pd(), p, index, all, 8);
+}
+
+VST_TARGET_AVX2 static inline __m256d gather4(const float *p, __m128i index)
+{
+  const __m128 all = _mm_castsi128_ps(_mm_set1_epi32(-1));
+  return _mm256_cvtps_pd(_mm_mask_i32gather_ps(_mm_setzero_ps(), p, index, all, 4));
+}
+
+template <class T>
+VST_TARGET_AVX2 static inline __m256d gather4(const T *p, __m128i index)
+{
+  int i[4];
+  _mm_storeu_si128((__m128i *)i, index);
+  return _mm256_set_pd(p[i[3]], p[i[2]], p[i[1]], p[i[0]]);
+}
+
+template <class T>
+VST_TARGET_AVX2 static void ring_sums_avx2(const T *p, int xs, int ys, double fx, double fy,
+                                           const float *xoff, const float *yoff, int count,
+                                           double &sum, double &square_sum)
+{
+  const __m256d one = _mm256_set1_pd(1.0);
+  const __m256d vfx = _mm256_set1_pd(fx);
+  const __m256d vfy = _mm256_set1_pd(fy);
+  const __m128i vxs = _mm_set1_epi32(xs);
+  const __m128i vys = _mm_set1_epi32(ys);
+  __m256d vsum = _mm256_setzero_pd();
+  __m256d vsquare = _mm256_setzero_pd();
+  int i;
+  for (i = 0; i + 4 <= count; i += 4) {
+    __m256d x = _mm256_add_pd(vfx, _mm256_cvtps_pd(_mm_loadu_ps(&xoff[i])));
+    __m256d y = _mm256_add_pd(vfy, _mm256_cvtps_pd(_mm_loadu_ps(&yoff[i])));
+    __m256d xlow = _mm256_floor_pd(x);
+    __m256d ylow = _mm256_floor_pd(y);
+    __m256d xhighfrac = _mm256_sub_pd(x, xlow);
+    __m256d yhighfrac = _mm256_sub_pd(y, ylow);
+    __m256d xlowfrac = _mm256_sub_pd(one, xhighfrac);
+    __m256d ylowfrac = _mm256_sub_pd(one, yhighfrac);
+
+    __m128i index = _mm_add_epi32(_mm_mullo_epi32(_mm256_cvttpd_epi32(xlow), vxs),
+                                  _mm_mullo_epi32(_mm256_cvttpd_epi32(ylow), vys));
+    __m256d ll = gather4(p, index);
+    __m256d lh = gather4(p + ys, index);
+    __m256d hl = gather4(p + xs, index);
+    __m256d hh = gather4(p + xs + ys, index);
+
+    __m256d val = _mm256_mul_pd(_mm256_mul_pd(ll, xlowfrac), ylowfrac);
+    val = _mm256_add_pd(val, _mm256_mul_pd(_mm256_mul_pd(lh, xlowfrac), yhighfrac));
+    val = _mm256_add_pd(val, _mm256_mul_pd(_mm256_mul_pd(hl, xhighfrac), ylowfrac));
+    val = _mm256_add_pd(val, _mm256_mul_pd(_mm256_mul_pd(hh, xhighfrac), yhighfrac));
+    vsum = _mm256_add_pd(vsum, val);
+    vsquare = _mm256_add_pd(vsquare, _mm256_mul_pd(val, val));
+  }
+  double lanes[4];
+  _mm256_storeu_pd(lanes, vsum);
+  sum += (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+  _mm256_storeu_pd(lanes, vsquare);
+  square_sum += (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+  ring_sums_scalar(p, xs, ys, fx, fy, xoff + i, yoff + i, count - i, sum, square_sum);
+}
+
+#endif
+
+template <class T>
+static bool ring_sums_typed(int level, const image_buffer_view &view, unsigned rgb,
+                            double cx, double cy, const float *xoff, const float *yoff,
+                            int count, double &sum, double &square_sum)
+{
+  double icx = floor(cx);
+  double icy = floor(cy);
+  const T *p = view.pixel<T>((int)icx, (int)icy, rgb);
+#ifdef  VST_SIMD_X86
+  if (level >= VST_SIMD_AVX2) {
+    ring_sums_avx2(p, view.x_stride, view.y_stride, cx - icx, cy - icy, xoff, yoff, count, sum, square_sum);
+    return true;
+  }
+  if (level >= VST_SIMD_SSE2) {
+    ring_sums_sse2(p, view.x_stride, view.y_stride, cx - icx, cy - icy, xoff, yoff, count, sum, square_sum);
+    return true;
+  }
+#endif
+  return false;
+}
+
+bool VST_simd_ring_sums(const image_buffer_view &view, unsigned rgb,
+                        double cx, double cy,
+                        const float *xoff, const float *yoff, int count,
+                        double &sum, double &square_sum)
+{
+  int level = VST_simd_level();
+  if (level == VST_SIMD_SCALAR) {
+    return false;
+  }
+  switch (view.type) {
+    case image_buffer_view::UINT8:
+      return ring_sums_typed<vrpn_uint8>(level, view, rgb, cx, cy, xoff, yoff, count, sum, square_sum);
+    case image_buffer_view::UINT16:
+      return ring_sums_typed<vrpn_uint16>(level, view, rgb, cx, cy, xoff, yoff, count, sum, square_sum);
+    case image_buffer_view::FLOAT:
+      return ring_sums_typed<float>(level, view, rgb, cx, cy, xoff, yoff, count, sum, square_sum);
+    case image_buffer_view::DOUBLE:
+      return ring_sums_typed<double>(level, view, rgb, cx, cy, xoff, yoff, count, sum, square_sum);
+    default:
+      return false;
+  }
+}
+
+//----------------------------------------------------------------------------
+// Bilinear line kernels for warping whole images.  Each sample's coordinate
+// is computed from its index (rather than by adding the step over and over)
+// and the pixels are found by integer offsets from the view's first pixel,
+// so the math is the same as image_buffer_bilerp() at every level.
+
+#ifdef  VST_SIMD_X86
+
+template <class T>
+VST_TARGET_SSE2 static void bilerp_line_sse2(const image_buffer_view &view, unsigned rgb, const T *p,
+                                             double x0, double y0, double xstep, double ystep,
+                                             int count, double *out)
+{
+  const __m128d one = _mm_set1_pd(1.0);
+  const __m128d two = _mm_set1_pd(2.0);
+  const __m128d vx0 = _mm_set1_pd(x0), vy0 = _mm_set1_pd(y0);
+  const __m128d vxstep = _mm_set1_pd(xstep), vystep = _mm_set1_pd(ystep);
+  const int xs = view.x_stride, ys = view.y_stride;
+  __m128d vi = _mm_set_pd(1.0, 0.0);
+  int i;
+  for (i = 0; i + 2 <= count; i += 2) {
+    __m128d x = _mm_add_pd(vx0, _mm_mul_pd(vi, vxstep));
+    __m128d y = _mm_add_pd(vy0, _mm_mul_pd(vi, vystep));
+    vi = _mm_add_pd(vi, two);
+    __m128i ix, iy;
+    __m128d xlow = floor_sse2(x, ix);
+    __m128d ylow = floor_sse2(y, iy);
+    __m128d xhighfrac = _mm_sub_pd(x, xlow);
+    __m128d yhighfrac = _mm_sub_pd(y, ylow);
+    __m128d xlowfrac = _mm_sub_pd(one, xhighfrac);
+    __m128d ylowfrac = _mm_sub_pd(one, yhighfrac);
+
+    int ixs[4], iys[4];
+    _mm_storeu_si128((__m128i *)ixs, ix);
+    _mm_storeu_si128((__m128i *)iys, iy);
+    const T *c0 = p + (ixs[0] - view.minx) * xs + (iys[0] - view.miny) * ys;
+    const T *c1 = p + (ixs[1] - view.minx) * xs + (iys[1] - view.miny) * ys;
+    __m128d ll = _mm_set_pd(c1[0], c0[0]);
+    __m128d lh = _mm_set_pd(c1[ys], c0[ys]);
+    __m128d hl = _mm_set_pd(c1[xs], c0[xs]);
+    __m128d hh = _mm_set_pd(c1[xs + ys], c0[xs + ys]);
+
+    __m128d val = _mm_mul_pd(_mm_mul_pd(ll, xlowfrac), ylowfrac);
+    val = _mm_add_pd(val, _mm_mul_pd(_mm_mul_pd(lh, xlowfrac), yhighfrac));
+    val = _mm_add_pd(val, _mm_mul_pd(_mm_mul_pd(hl, xhighfrac), ylowfrac));
+    val = _mm_add_pd(val, _mm_mul_pd(_mm_mul_pd(hh, xhighfrac), yhighfrac));
+    _mm_storeu_pd(out + i, val);
+  }
+  for (; i < count; i++) {
+    image_buffer_bilerp<T>(view, x0 + i * xstep, y0 + i * ystep, out[i], rgb);
+  }
+}
+
+template <class T>
+VST_TARGET_AVX2 static void bilerp_line_avx2(const image_buffer_view &view, unsigned rgb, const T *p,
+                                             double x0, double y0, double xstep, double ystep,
+                                             int count, double *out)
+{
+  const __m256d one = _mm256_set1_pd(1.0);
+  const __m256d four = _mm256_set1_pd(4.0);
+  const __m256d vx0 = _mm256_set1_pd(x0), vy0 = _mm256_set1_pd(y0);
+  const __m256d vxstep = _mm256_set1_pd(xstep), vystep = _mm256_set1_pd(ystep);
+  const __m128i vxs = _mm_set1_epi32(view.x_stride);
+  const __m128i vys = _mm_set1_epi32(view.y_stride);
+  const __m128i vminx = _mm_set1_epi32(view.minx);
+  const __m128i vminy = _mm_set1_epi32(view.miny);
+  const int xs = view.x_stride, ys = view.y_stride;
+  __m256d vi = _mm256_set_pd(3.0, 2.0, 1.0, 0.0);
+  int i;
+  for (i = 0; i + 4 <= count; i += 4) {
+    __m256d x = _mm256_add_pd(vx0, _mm256_mul_pd(vi, vxstep));
+    __m256d y = _mm256_add_pd(vy0, _mm256_mul_pd(vi, vystep));
+    vi = _mm256_add_pd(vi, four);
+    __m256d xlow = _mm256_floor_pd(x);
+    __m256d ylow = _mm256_floor_pd(y);
+    __m256d xhighfrac = _mm256_sub_pd(x, xlow);
+    __m256d yhighfrac = _mm256_sub_pd(y, ylow);
+    __m256d xlowfrac = _mm256_sub_pd(one, xhighfrac);
+    __m256d ylowfrac = _mm256_sub_pd(one, yhighfrac);
+
+    __m128i ix = _mm_sub_epi32(_mm256_cvttpd_epi32(xlow), vminx);
+    __m128i iy = _mm_sub_epi32(_mm256_cvttpd_epi32(ylow), vminy);
+    __m128i index = _mm_add_epi32(_mm_mullo_epi32(ix, vxs), _mm_mullo_epi32(iy, vys));
+    __m256d ll = gather4(p, index);
+    __m256d lh = gather4(p + ys, index);
+    __m256d hl = gather4(p + xs, index);
+    __m256d hh = gather4(p + xs + ys, index);
+
+    __m256d val = _mm256_mul_pd(_mm256_mul_pd(ll, xlowfrac), ylowfrac);
+    val = _mm256_add_pd(val, _mm256_mul_pd(_mm256_mul_pd(lh, xlowfrac), yhighfrac));
+    val = _mm256_add_pd(val, _mm256_mul_pd(_mm256_mul_pd(hl, xhighfrac), ylowfrac));
+    val = _mm256_add_pd(val, _mm256_mul_pd(_mm256_mul_pd(hh, xhighfrac), yhighfrac));
+    _mm256_storeu_pd(out + i, val);
+  }
+  for (; i < count; i++) {
+    image_buffer_bilerp<T>(view, x0 + i * xstep, y0 + i * ystep, out[i], rgb);
+  }
+}
+
+#endif
+
+template <class T>
+static bool bilerp_line_typed(int level, const image_buffer_view &view, unsigned rgb,
+                              double x0, double y0, double xstep, double ystep,
+                              int count, double *out)
+{
+  const T *p = view.pixel<T>(view.minx, view.miny, rgb);
+#ifdef  VST_SIMD_X86
+  if (level >= VST_SIMD_AVX2) {
+    bilerp_line_avx2(view, rgb, p, x0, y0, xstep, ystep, count, out);
+    return true;
+  }
+  if (level >= VST_SIMD_SSE2) {
+    bilerp_line_sse2(view, rgb, p, x0, y0, xstep, ystep, count, out);
+    return true;
+  }
+#endif
+  return false;
+}
+
+bool VST_simd_bilerp_line(const image_buffer_view &view, unsigned rgb,
+                          double x0, double y0, double xstep, double ystep,
+                          int count, double *out)
+{
+  int level = VST_simd_level();
+  if (level == VST_SIMD_SCALAR) {
+    return false;
+  }
+  switch (view.type) {
+    case image_buffer_view::UINT8:
+      return bilerp_line_typed<vrpn_uint8>(level, view, rgb, x0, y0, xstep, ystep, count, out);
+    case image_buffer_view::UINT16:
+      return bilerp_line_typed<vrpn_uint16>(level, view, rgb, x0, y0, xstep, ystep, count, out);
+    case image_buffer_view::FLOAT:
+      return bilerp_line_typed<float>(level, view, rgb, x0, y0, xstep, ystep, count, out);
+    case image_buffer_view::DOUBLE:
+      return bilerp_line_typed<double>(level, view, rgb, x0, y0, xstep, ystep, count, out);
+    default:
+      return false;
+  }
+}
+
+//----------------------------------------------------------------------------
+// Multiply-add kernels for the blur passes.  These keep the multiply and the
+// add separate (no fused multiply-add) so that they round the same way as
+// the scalar loop.
+
+static inline void multiply_add_scalar(float *dst, const float *src, float k, int count)
+{
+  for (int i = 0; i < count; i++) {
+    dst[i] += k * src[i];
+  }
+}
+
+#ifdef  VST_SIMD_X86
+
+VST_TARGET_SSE2 static void multiply_add_sse2(float *dst, const float *src, float k, int count)
+{
+  const __m128 vk = _mm_set1_ps(k);
+  int i;
+  for (i = 0; i + 4 <= count; i += 4) {
+    __m128 d = _mm_loadu_ps(dst + i);
+    d = _mm_add_ps(d, _mm_mul_ps(vk, _mm_loadu_ps(src + i)));
+    _mm_storeu_ps(dst + i, d);
+  }
+  multiply_add_scalar(dst + i, src + i, k, count - i);
+}
+
+VST_TARGET_AVX2 static void multiply_add_avx2(float *dst, const float *src, float k, int count)
+{
+  const __m256 vk = _mm256_set1_ps(k);
+  int i;
+  for (i = 0; i + 8 <= count; i += 8) {
+    __m256 d = _mm256_loadu_ps(dst + i);
+    d = _mm256_add_ps(d, _mm256_mul_ps(vk, _mm256_loadu_ps(src + i)));
+    _mm256_storeu_ps(dst + i, d);
+  }
+  multiply_add_scalar(dst + i, src + i, k, count - i);
+}
+
+#endif
+
+void VST_simd_multiply_add(float *dst, const float *src, float k, int count)
+{
+#ifdef  VST_SIMD_X86
+  int level = VST_simd_level();
+  if (level >= VST_SIMD_AVX2) {
+    multiply_add_avx2(dst, src, k, count);
+    return;
+  }
+  if (level >= VST_SIMD_SSE2) {
+    multiply_add_sse2(dst, src, k, count);
+    return;
+  }
+#endif
+  multiply_add_scalar(dst, src, k, count);
+}
@@ -0,0 +1,59 @@
+#ifndef	SPOT_TRACKER_SIMD_H
+#define	SPOT_TRACKER_SIMD_H
+
+#include "base_camera_server.h"
+
+//----------------------------------------------------------------------------
+// Vectorized kernels used by the spot trackers.  The instruction set is
+// selected at run time based on what the processor supports, so the same
+// binary runs (more slowly) on machines without the newer instructions.
+// On processors other than x86 only the scalar code is available, and the
+// trackers fall back to their original per-sample code.
+
+enum {
+  VST_SIMD_SCALAR = 0,    //< No vector instructions used
+  VST_SIMD_SSE2 = 1,      //< Two doubles per instruction
+  VST_SIMD_AVX2 = 2       //< Four doubles per instruction, hardware gather
+};
+
+/// Highest instruction set that both the processor supports and the
+// application has allowed (see below).
+int VST_simd_level(void);
+
+/// Keep the kernels from using instruction sets above the level passed in.
+// Pass VST_SIMD_SCALAR to force the original scalar code paths, which is
+// useful for checking the vector code against them.
+void VST_set_simd_level_limit(int max_level);
+
+/// Sum the bilinearly-interpolated image values, and the squares of those
+// values, at the points (cx + xoff[i], cy + yoff[i]) for i in [0, count).
+// The caller must make sure that every one of the points, along with its
+// interpolation neighbors, lies inside the view; no boundary checking is
+// done.  The interpolation math matches image_buffer_bilerp(), but the
+// offsets are stored as floats, which moves sample points by at most about
+// 1e-5 pixel for rings of radius 100 pixels.  Returns false (and touches
+// nothing) if the level is scalar or the view type is not handled.
+bool VST_simd_ring_sums(const image_buffer_view &view, unsigned rgb,
+                        double cx, double cy,
+                        const float *xoff, const float *yoff, int count,
+                        double &sum, double &square_sum);
+
+/// Fill out[i] with the bilinearly-interpolated image value at the point
+// (x0 + i * xstep, y0 + i * ystep), for i in [0, count).  This walks a row
+// of an image that has been rotated, scaled, and translated.  The caller
+// must make sure that every one of the points, along with its
+// interpolation neighbors, lies inside the view; no boundary checking is
+// done.  The results are identical to calling image_buffer_bilerp() at
+// each of the points.  Returns false (and touches nothing) if the level is
+// scalar or the view type is not handled.
+bool VST_simd_bilerp_line(const image_buffer_view &view, unsigned rgb,
+                          double x0, double y0, double xstep, double ystep,
+                          int count, double *out);
+
+/// Add k times each element of src to the matching element of dst, for
+// count elements.  The arithmetic is done in single precision one element
+// at a time, so the result is the same at every level.  Used by the row and
+// column passes of the Gaussian blur.
+void VST_simd_multiply_add(float *dst, const float *src, float k, int count);
+
+#endif
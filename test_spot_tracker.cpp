@@ -3,18 +3,327 @@
 #include  <math.h>
 #include  <stdlib.h>
 #include  <stdio.h>
+#include  <string.h>
+#include  <new>
+#include  <algorithm>
 #include  "spot_tracker.h"
+#include  "spot_tracker_simd.h"
+#include  "fft_correlator.h"
+#include  "tracking_engine.h"
+#include  "image_file_writer.h"
+#include  "raw_file_server.h"
+#if defined(VST_USE_IMAGEMAGICK)
+#include  "file_stack_server.h"
+#endif
+#if defined(VST_USE_FFMPEG)
+#include  "ffmpeg_video_server.h"
+#endif
 
 #ifdef _WIN32
 #define unlink(s) _unlink(s)
 #endif
 
+// Count heap allocations while g_count_allocations is set, so that we can
+// check that images which are recomputed every frame don't allocate.  The
+// code being checked may be threaded, so the count is changed atomically.
+static volatile bool g_count_allocations = false;
+static volatile long g_allocations = 0;
+static void *counted_malloc(size_t size)
+{
+  if (g_count_allocations) {
+#ifdef	_WIN32
+    InterlockedIncrement(&g_allocations);
+#else
+    __sync_add_and_fetch(&g_allocations, 1);
+#endif
+  }
+  void *p = malloc(size ? size : 1);
+  if (p == NULL) { throw std::bad_alloc(); }
+  return p;
+}
+void *operator new(size_t size) { return counted_malloc(size); }
+void *operator new[](size_t size) { return counted_malloc(size); }
+void operator delete(void *p) throw() { free(p); }
+void operator delete[](void *p) throw() { free(p); }
+void operator delete(void *p, size_t) throw() { free(p); }
+void operator delete[](void *p, size_t) throw() { free(p); }
+
+// Versions of the images and blur engine that are recomputed every frame,
+// which tell where their buffers are, so that we can check that they are
+// reused.  A vector's buffer is described by its address and capacity.
+class probed_subtracted_image: public subtracted_image {
+public:
+  probed_subtracted_image(const image_wrapper &first, const image_wrapper &second, double offset) :
+    subtracted_image(first, second, offset) {};
+  const void *buffer(void) const { return _image; }
+};
+
+class probed_averaged_image: public averaged_image {
+public:
+  probed_averaged_image(const image_wrapper &first, const image_wrapper &second) :
+    averaged_image(first, second) {};
+  const void *buffer(void) const { return _image; }
+};
+
+class probed_blur_engine: public gaussian_blur_engine {
+public:
+  void buffers(std::vector<const void *> &where) const {
+    where.clear();
+    add(where, d_input); add(where, d_rows); add(where, d_kernel);
+    add(where, d_x_scale); add(where, d_y_scale);
+    add(where, d_iir); add(where, d_iir_line);
+  }
+protected:
+  template <class T> static void add(std::vector<const void *> &where, const std::vector<T> &v) {
+    where.push_back(v.empty() ? NULL : &v[0]);
+    where.push_back(reinterpret_cast<const void *>(v.capacity()));
+  }
+};
+
+// A raw file server that tells whether it is mapped, where its window is,
+// and where the bytes of the current frame are.
+class probed_raw_file_server: public raw_file_server {
+public:
+  probed_raw_file_server(const char *name, unsigned nx, unsigned ny, unsigned header,
+                         unsigned frame_header, bool map_file) :
+    raw_file_server(name, nx, ny, 8, 1, header, frame_header, map_file) {};
+  bool mapped(void) const { return d_mapped; }
+  raw_file_offset window_start(void) const { return d_map_offset; }
+  const vrpn_uint8 *frame(void) const { return d_buffer; }
+};
+
+// Where the pixels of an image with a buffer view are.
+static const void *view_base(const image_wrapper &image)
+{
+  image_buffer_view view;
+  return image.get_buffer_view(view) ? view.base : NULL;
+}
+
 static	double	duration(struct timeval t1, struct timeval t2)
 {
     return (t1.tv_usec - t2.tv_usec) / 1000000.0 +
 	   (t1.tv_sec - t2.tv_sec);
 }
 
+// Read an n-byte little-endian value from a file's bytes.
+static double le_value(const std::vector<unsigned char> &bytes, size_t at, unsigned n)
+{
+  double value = 0;
+  unsigned i;
+  for (i = n; i > 0; i--) {
+    value = value * 256 + ((at+i-1 < bytes.size()) ? bytes[at+i-1] : 0);
+  }
+  return value;
+}
+
+#if defined(VST_USE_FFMPEG)
+// Append an n-byte little-endian value, or a four-character code, to bytes.
+static void le_append(std::vector<unsigned char> &bytes, unsigned value, unsigned n)
+{
+  unsigned i;
+  for (i = 0; i < n; i++) {
+    bytes.push_back(static_cast<unsigned char>(value >> (8*i)));
+  }
+}
+static void fourcc_append(std::vector<unsigned char> &bytes, const char *code)
+{
+  bytes.insert(bytes.end(), code, code + 4);
+}
+
+// Write an uncompressed 24-bit AVI file in which the red value of each pixel
+// is five times its frame number and the green value is ten times its column.
+// The width times three must be a multiple of four, so the rows are not padded.
+static bool write_test_avi(const char *name, unsigned nx, unsigned ny, unsigned frames)
+{
+  unsigned frame_bytes = 3 * nx * ny;
+  std::vector<unsigned char> avi;
+  fourcc_append(avi, "RIFF"); le_append(avi, 0, 4); fourcc_append(avi, "AVI ");
+
+  // Main header, then the header and format of the one video stream.
+  fourcc_append(avi, "LIST"); le_append(avi, 192, 4); fourcc_append(avi, "hdrl");
+  fourcc_append(avi, "avih"); le_append(avi, 56, 4);
+  le_append(avi, 40000, 4);                   // Microseconds per frame
+  le_append(avi, 25 * frame_bytes, 4);        // Maximum bytes per second
+  le_append(avi, 0, 4);                       // Padding granularity
+  le_append(avi, 0x10, 4);                    // Has an index
+  le_append(avi, frames, 4);
+  le_append(avi, 0, 4);                       // Initial frames
+  le_append(avi, 1, 4);                       // Streams
+  le_append(avi, frame_bytes, 4);             // Suggested buffer size
+  le_append(avi, nx, 4); le_append(avi, ny, 4);
+  le_append(avi, 0, 4); le_append(avi, 0, 4); le_append(avi, 0, 4); le_append(avi, 0, 4);
+  fourcc_append(avi, "LIST"); le_append(avi, 116, 4); fourcc_append(avi, "strl");
+  fourcc_append(avi, "strh"); le_append(avi, 56, 4);
+  fourcc_append(avi, "vids"); fourcc_append(avi, "DIB ");
+  le_append(avi, 0, 4);                       // Flags
+  le_append(avi, 0, 4);                       // Priority and language
+  le_append(avi, 0, 4);                       // Initial frames
+  le_append(avi, 1, 4); le_append(avi, 25, 4);  // Scale and rate: 25 frames/second
+  le_append(avi, 0, 4);                       // Start
+  le_append(avi, frames, 4);
+  le_append(avi, frame_bytes, 4);             // Suggested buffer size
+  le_append(avi, 0, 4);                       // Quality
+  le_append(avi, 0, 4);                       // Sample size
+  le_append(avi, 0, 2); le_append(avi, 0, 2); le_append(avi, nx, 2); le_append(avi, ny, 2);
+  fourcc_append(avi, "strf"); le_append(avi, 40, 4);
+  le_append(avi, 40, 4);                      // Size of the bitmap header
+  le_append(avi, nx, 4); le_append(avi, ny, 4);
+  le_append(avi, 1, 2); le_append(avi, 24, 2);  // Planes and bits per pixel
+  le_append(avi, 0, 4);                       // Uncompressed
+  le_append(avi, frame_bytes, 4);
+  le_append(avi, 0, 4); le_append(avi, 0, 4); le_append(avi, 0, 4); le_append(avi, 0, 4);
+
+  // The frames, stored as blue, green, red for each pixel.
+  fourcc_append(avi, "LIST"); le_append(avi, 4 + frames * (8 + frame_bytes), 4);
+  fourcc_append(avi, "movi");
+  unsigned frame, x, y;
+  for (frame = 0; frame < frames; frame++) {
+    fourcc_append(avi, "00db"); le_append(avi, frame_bytes, 4);
+    for (y = 0; y < ny; y++) {
+      for (x = 0; x < nx; x++) {
+        avi.push_back(100);
+        avi.push_back(static_cast<unsigned char>(10 * x));
+        avi.push_back(static_cast<unsigned char>(5 * frame));
+      }
+    }
+  }
+
+  // The index, with offsets from the start of the "movi" code.
+  fourcc_append(avi, "idx1"); le_append(avi, 16 * frames, 4);
+  for (frame = 0; frame < frames; frame++) {
+    fourcc_append(avi, "00db"); le_append(avi, 0x10, 4);
+    le_append(avi, 4 + frame * (8 + frame_bytes), 4); le_append(avi, frame_bytes, 4);
+  }
+
+  unsigned riff_size = static_cast<unsigned>(avi.size()) - 8;
+  avi[4] = static_cast<unsigned char>(riff_size);
+  avi[5] = static_cast<unsigned char>(riff_size >> 8);
+  avi[6] = static_cast<unsigned char>(riff_size >> 16);
+  avi[7] = static_cast<unsigned char>(riff_size >> 24);
+  FILE *f = fopen(name, "wb");
+  if (f == NULL) { return false; }
+  bool ok = (fwrite(&avi[0], 1, avi.size(), f) == avi.size());
+  fclose(f);
+  return ok;
+}
+#endif
+
+// Fill in the pixels of one frame of the test raw file.  Each frame differs,
+// and no frame repeats its row pattern, so reading the wrong frame or from
+// the wrong offset in the file shows up.
+static void fill_test_raw_frame(std::vector<vrpn_uint8> &pixels, unsigned nx, unsigned ny, unsigned frame)
+{
+  pixels.resize(nx * ny);
+  unsigned i;
+  for (i = 0; i < nx * ny; i++) {
+    pixels[i] = static_cast<vrpn_uint8>(frame*7 + i + 3*(i/nx));
+  }
+}
+
+// Add frames to the end of a test raw file, starting a new file (with its
+// file header) if the first frame is 0.  Headers are filled with 0xAB for
+// the file and 0xEE for the frames.
+static bool append_test_raw_frames(const char *name, unsigned nx, unsigned ny, unsigned header,
+                                   unsigned frame_header, unsigned first, unsigned count)
+{
+  FILE *f = fopen(name, first == 0 ? "wb" : "ab");
+  if (f == NULL) { return false; }
+  bool ok = true;
+  if (first == 0) {
+    std::vector<vrpn_uint8> head(header, 0xAB);
+    ok = (header == 0) || (fwrite(&head[0], header, 1, f) == 1);
+  }
+  std::vector<vrpn_uint8> frame_head(frame_header, 0xEE), pixels;
+  unsigned frame;
+  for (frame = first; ok && (frame < first + count); frame++) {
+    fill_test_raw_frame(pixels, nx, ny, frame);
+    if ( (frame_header > 0) && (fwrite(&frame_head[0], frame_header, 1, f) != 1) ) { ok = false; }
+    if (fwrite(&pixels[0], pixels.size(), 1, f) != 1) { ok = false; }
+  }
+  fclose(f);
+  return ok;
+}
+
+// Single-step a raw file server and check that it reads the expected frame,
+// or that it reads nothing if expected is negative.
+static bool step_test_raw_file(probed_raw_file_server &server, unsigned nx, unsigned ny, int expected)
+{
+  server.single_step();
+  bool read = server.read_image_to_memory();
+  if (expected < 0) {
+    return !read;
+  }
+  std::vector<vrpn_uint8> pixels;
+  fill_test_raw_frame(pixels, nx, ny, expected);
+  return read && (memcmp(server.frame(), &pixels[0], pixels.size()) == 0);
+}
+
+// Tracker creator for the collection-manager checks; disk trackers are
+// cheap to make, which matters when making thousands of them.
+static spot_tracker_XY *make_disk_tracker(double x, double y, double r)
+{
+  spot_tracker_XY *tracker = new disk_spot_tracker_interp(r);
+  tracker->set_location(x, y);
+  return tracker;
+}
+
+// Tracker that counts how often its fitness is checked, so the optimizer
+// checks can compare how much work each optimizer does.
+template <class TRACKER> class Counting_tracker : public TRACKER {
+public:
+  Counting_tracker(double radius, double pixelaccuracy)
+    : TRACKER(radius, false, pixelaccuracy), d_checks(0) {};
+  virtual double check_fitness(const image_wrapper &image, unsigned rgb) {
+    d_checks++;
+    return TRACKER::check_fitness(image, rgb);
+  }
+  virtual bool check_fitness_derivatives(const image_wrapper &image, unsigned rgb,
+                                         double &fitness, double gradient[2], double hessian[2][2]) {
+    d_checks++;
+    return TRACKER::check_fitness_derivatives(image, rgb, fitness, gradient, hessian);
+  }
+  unsigned long d_checks;
+};
+
+// Frame source and sink for the tracking-engine check: a disc that moves
+// half a pixel per frame, and a record of where the first tracker was.
+class Moving_Disc_Source : public Tracking_Frame_Source {
+public:
+  Moving_Disc_Source(int frames) : d_frames(frames), d_next(0), d_image(NULL) {};
+  ~Moving_Disc_Source() { if (d_image) { delete d_image; } };
+  double disc_x(int frame) const { return 60.25 + 0.5*frame; }
+  virtual const image_wrapper *next_frame(void) {
+    if (d_next >= d_frames) { return NULL; }
+    if (d_image) { delete d_image; }
+    d_image = new disc_image(0,127, 0,127, 127, 0, disc_x(d_next), 63.75, 8, 250);
+    d_next++;
+    return d_image;
+  }
+protected:
+  int         d_frames;
+  int         d_next;
+  disc_image  *d_image;
+};
+
+class Position_Record_Sink : public Tracking_Output_Sink {
+public:
+  Position_Record_Sink() : d_finished(false) {};
+  virtual bool frame_done(int frame_number, const image_wrapper &,
+                          const std::vector<Tracked_Spot> &spots) {
+    d_frames.push_back(frame_number);
+    d_counts.push_back(static_cast<unsigned>(spots.size()));
+    d_x.push_back(spots.size() ? spots[0].x : -1);
+    d_y.push_back(spots.size() ? spots[0].y : -1);
+    return true;
+  }
+  virtual bool finish(void) { d_finished = true; return true; }
+
+  std::vector<int>      d_frames;
+  std::vector<unsigned> d_counts;
+  std::vector<double>   d_x, d_y;
+  bool                  d_finished;
+};
+
 void  compute_disk_chase_statistics(spot_tracker_XY &tracker, double radius, double posaccuracy,
 			       int count, double &minerr, double &maxerr, double &sumerr,
 			       double &biasx, double &biasy, double &x, double &y)
@@ -424,6 +733,33 @@ int main(int, char *[])
   vrpn_gettimeofday(&end, NULL);
   printf("  Time: %lg seconds per optimization\n", duration(end, start)/avgcount);
 
+  // A zero translation hides the buffer of the image behind it, so the tracker
+  // has to use virtual pixel reads there; both paths must give the same answer
+  // when the vector code (checked below) is turned off.
+  {
+    translated_image  unbuffered(image, 0, 0);
+    VST_set_simd_level_limit(VST_SIMD_SCALAR);
+    symmetrictracker.set_location(seedx + 0.3, seedy - 0.2);
+    double  direct = symmetrictracker.check_fitness(image, 0);
+    double  through_virtual = symmetrictracker.check_fitness(unbuffered, 0);
+    VST_set_simd_level_limit(VST_SIMD_AVX2);
+    printf("Buffer-view fitness %lg, virtual-read fitness %lg (%s)\n", direct, through_virtual,
+      direct == through_virtual ? "match" : "MISMATCH");
+  }
+
+  // The vector ring code should track to the same place as the scalar code,
+  // to well within the requested accuracy.
+  {
+    double  sx, sy, vx, vy;
+    symmetric_spot_tracker_interp simdtracker(testrad, false, 0.01);
+    VST_set_simd_level_limit(VST_SIMD_SCALAR);
+    simdtracker.optimize_xy(image, 0, sx, sy, seedx, seedy);
+    VST_set_simd_level_limit(VST_SIMD_AVX2);
+    simdtracker.optimize_xy(image, 0, vx, vy, seedx, seedy);
+    printf("Vector level %d found %g,%g; scalar found %g,%g (%s)\n", VST_simd_level(), vx, vy, sx, sy,
+      (fabs(vx-sx) <= 0.01) && (fabs(vy-sy) <= 0.01) ? "match" : "MISMATCH");
+  }
+
   printf("-----------------------------------------------------------------\n");
   printf("Generating Gaussian spot tracker\n");
 
@@ -554,6 +890,1038 @@ int main(int, char *[])
   // Delete the PSF file
   unlink("deleteme.tif");
 #endif
+
+  printf("-----------------------------------------------------------------\n");
+  printf("Checking tracker proximity grid against an exhaustive search\n");
+  {
+    Tracker_Collection_Manager  mgr(5.0, 3.0, 20.0, 0, 0, false, make_disk_tracker);
+    const int count = 1000;
+    for (i = 0; i < count; i++) {
+      mgr.add_tracker(1000 * (rand()/(double)(RAND_MAX)), 1000 * (rand()/(double)(RAND_MAX)), 5.0);
+    }
+    unsigned  mismatches = 0;
+    int p;
+    for (p = 0; p < 200; p++) {
+      double px = 1200 * (rand()/(double)(RAND_MAX)) - 100;
+      double py = 1200 * (rand()/(double)(RAND_MAX)) - 100;
+      int best = -1;
+      double best_dist2 = 0;
+      for (i = 0; i < count; i++) {
+        double dx = mgr.tracker(i)->xytracker()->get_x() - px;
+        double dy = mgr.tracker(i)->xytracker()->get_y() - py;
+        if ( (best < 0) || (dx*dx + dy*dy < best_dist2) ) {
+          best = i;
+          best_dist2 = dx*dx + dy*dy;
+        }
+      }
+      if (mgr.nearest_tracker_index(px, py) != best) { mismatches++; }
+    }
+
+    // Any tracker with an earlier one closer than the minimum separation
+    // should get marked as lost.
+    std::vector<bool> should_be_lost(count, false);
+    int j;
+    for (i = 0; i < count; i++) {
+      for (j = 0; j < i; j++) {
+        double dx = mgr.tracker(i)->xytracker()->get_x() - mgr.tracker(j)->xytracker()->get_x();
+        double dy = mgr.tracker(i)->xytracker()->get_y() - mgr.tracker(j)->xytracker()->get_y();
+        if (dx*dx + dy*dy < 3.0*3.0) { should_be_lost[i] = true; }
+      }
+    }
+    double_image  dummy(0, 1000, 0, 1000);
+    mgr.mark_colliding_beads_in(dummy);
+    for (i = 0; i < count; i++) {
+      if (mgr.tracker(i)->lost() != should_be_lost[i]) { mismatches++; }
+    }
+    printf("  %u mismatches (%s)\n", mismatches, mismatches == 0 ? "match" : "MISMATCH");
+  }
+
+#if defined(VST_USE_IMAGEMAGICK)
+  printf("Checking the file stack's prefetch threads against the files they read\n");
+  {
+    // Write more files than the prefetch pool holds, read them all back in
+    // order, and then rewind and read the first few again.
+    const int nx = 16, ny = 12, frames = 40, depth = 4;
+    double_image  image(0, nx-1, 0, ny-1);
+    char  name[256];
+    int frame, x, y;
+    bool ok = true;
+    for (frame = 0; frame < frames; frame++) {
+      for (y = 0; y < ny; y++) {
+        for (x = 0; x < nx; x++) {
+          image.write_pixel_nocheck(x, y, frame*1000 + x + nx*y);
+        }
+      }
+      sprintf(name, "test_spot_tracker_stack_%03d.tif", frame);
+      ok = ok && image.write_to_grayscale_tiff_file(name, 0, 1.0, 0.0, true, "", frame > 0);
+    }
+
+    int frames_read = 0;
+    {
+      file_stack_server  stack("test_spot_tracker_stack_000.tif", "", 2, depth);
+      ok = ok && stack.working();
+      stack.play();
+      int pass;
+      for (pass = 0; ok && (pass < 2); pass++) {
+        int last = (pass == 0) ? frames : 3;
+        for (frame = 0; ok && (frame < last); frame++) {
+          ok = stack.read_image_to_memory(1, 0, 1, 0, 0);
+          for (y = 0; ok && (y < ny); y++) {
+            for (x = 0; x < nx; x++) {
+              double value;
+              if (!stack.read_pixel(x, y, value, 0) || (value != frame*1000 + x + nx*y)) {
+                ok = false;
+              }
+            }
+          }
+          if (ok) { frames_read++; }
+        }
+        stack.rewind();
+        stack.play();
+      }
+    }
+    for (frame = 0; frame < frames; frame++) {
+      sprintf(name, "test_spot_tracker_stack_%03d.tif", frame);
+      unlink(name);
+    }
+    printf("  %d frames read through a pool of %d (%s)\n", frames_read, depth, ok ? "match" : "MISMATCH");
+  }
+#endif
+
+#if defined(VST_USE_FFMPEG)
+  printf("Checking the video decode thread against more frames than its ring holds\n");
+  {
+    // Read past the end of a video much longer than the ring, then rewind
+    // and read the first few frames again.
+    const unsigned nx = 16, ny = 12, frames = 40, decode_ahead = 3;
+    const char *videoname = "test_spot_tracker_video.avi";
+    bool ok = write_test_avi(videoname, nx, ny, frames);
+    unsigned frames_read = 0;
+    {
+      ffmpeg_video_server  video(videoname, ffmpeg_video_server::RGB24, decode_ahead);
+      ok = ok && video.working();
+      int pass;
+      for (pass = 0; ok && (pass < 2); pass++) {
+        unsigned last = (pass == 0) ? frames : 3;
+        unsigned frame, x, y;
+        video.play();
+        for (frame = 0; ok && (frame < last); frame++) {
+          ok = video.read_image_to_memory(1, 0, 1, 0, 0);
+          for (y = 0; ok && (y < ny); y++) {
+            for (x = 0; x < nx; x++) {
+              vrpn_uint8 red, green;
+              if ( !video.get_pixel_from_memory(x, y, red, 0) || !video.get_pixel_from_memory(x, y, green, 1) ||
+                   (red != 5 * frame) || (green != 10 * x) ) {
+                ok = false;
+              }
+            }
+          }
+          if (ok) { frames_read++; }
+        }
+        if (pass == 0) {
+          ok = ok && !video.read_image_to_memory(1, 0, 1, 0, 0);
+        }
+        video.rewind();
+      }
+    }
+    unlink(videoname);
+    printf("  %u frames read through a ring of %u (%s)\n", frames_read, decode_ahead, ok ? "match" : "MISMATCH");
+  }
+#endif
+
+  printf("Checking connected-component labeling against a flood fill\n");
+  {
+    // Random pixels make lots of oddly-shaped regions, many of which cross
+    // the boundaries between the strips that are labeled in parallel.
+    const int nx = 300, ny = 300;
+    double_image  noise(0, nx-1, 0, ny-1);
+    int x, y;
+    for (y = 0; y < ny; y++) {
+      for (x = 0; x < nx; x++) {
+        noise.write_pixel_nocheck(x, y, rand()/(double)(RAND_MAX));
+      }
+    }
+    std::vector<VST_Connected_Component> comps;
+    VST_find_connected_components(noise, 0, 0.45, comps);
+
+    // Flood-fill from each unlabeled pixel, scanning columns from the left,
+    // and compare each region with the next component found above.
+    std::vector<int> label(nx*ny, 0);
+    std::vector<int> stack;
+    unsigned  found = 0, mismatches = 0;
+    for (x = 0; x < nx; x++) {
+      for (y = 0; y < ny; y++) {
+        if ( (label[x + nx*y] != 0) || (noise.read_pixel_nocheck(x,y) < 0.45) ) { continue; }
+        unsigned  area = 0;
+        double    sx = 0, sy = 0;
+        label[x + nx*y] = 1;
+        stack.push_back(x + nx*y);
+        while (!stack.empty()) {
+          int p = stack.back(); stack.pop_back();
+          int px = p % nx, py = p / nx;
+          area++; sx += px; sy += py;
+          int n[4] = { px > 0 ? p-1 : -1, px < nx-1 ? p+1 : -1, py > 0 ? p-nx : -1, py < ny-1 ? p+nx : -1 };
+          int k;
+          for (k = 0; k < 4; k++) {
+            if ( (n[k] >= 0) && (label[n[k]] == 0) &&
+                 (noise.read_pixel_nocheck(n[k] % nx, n[k] / nx) >= 0.45) ) {
+              label[n[k]] = 1;
+              stack.push_back(n[k]);
+            }
+          }
+        }
+        if ( (found >= comps.size()) || (comps[found].area != area) ||
+             (comps[found].cx != sx/area) || (comps[found].cy != sy/area) ||
+             (comps[found].firstx != x) || (comps[found].firsty != y) ) {
+          mismatches++;
+        }
+        found++;
+      }
+    }
+    if (found != comps.size()) { mismatches++; }
+    printf("  %u components, %u mismatches (%s)\n", found, mismatches, mismatches == 0 ? "match" : "MISMATCH");
+  }
+
+  printf("Checking the tracking engine on a moving disc\n");
+  {
+    // The second tracker starts in the border dead zone, so it should be
+    // deleted on the first frame; the first should follow the disc.
+    Tracker_Collection_Manager  mgr(8, 30, 20, 0, 0, false, make_disk_tracker);
+    mgr.add_tracker(60, 64, 8);
+    mgr.add_tracker(4, 4, 8);
+    Tracking_Engine_Settings  settings;
+    settings.kernel_type = KT_DISK;
+    settings.lost_behavior = Tracking_Engine_Settings::LOST_DELETE;
+    settings.border_dead_zone = 10;
+    Tracking_Engine engine(mgr, settings);
+    Position_Record_Sink sink;
+    engine.add_sink(&sink);
+    Moving_Disc_Source source(20);
+    bool ok = engine.run(source, 15);
+    unsigned  mismatches = 0;
+    if (!ok || !sink.d_finished || (sink.d_frames.size() != 15) || (engine.frame_number() != 14)) {
+      mismatches++;
+    }
+    // The disc maker has a known bias, so check that the tracker follows
+    // the motion from where it settled on the first frame.
+    double maxerr = 0;
+    size_t f;
+    for (f = 0; f < sink.d_frames.size(); f++) {
+      if ( (sink.d_frames[f] != static_cast<int>(f)) || (sink.d_counts[f] != 1) ) { mismatches++; }
+      double dx = (sink.d_x[f] - sink.d_x[0]) - (source.disc_x(static_cast<int>(f)) - source.disc_x(0));
+      double dy = sink.d_y[f] - sink.d_y[0];
+      double err = sqrt(dx*dx + dy*dy);
+      if (err > maxerr) { maxerr = err; }
+    }
+    if ( (maxerr > 0.1) || (fabs(sink.d_x[0] - source.disc_x(0)) > 1) || (fabs(sink.d_y[0] - 63.75) > 1) ) {
+      mismatches++;
+    }
+    printf("  max error %lg, %u mismatches (%s)\n", maxerr, mismatches, mismatches == 0 ? "match" : "MISMATCH");
+  }
+
+  printf("Checking that the pipelined tracking engine matches the serial one\n");
+  {
+    // Use a queue shorter than the run and stop partway through, so that
+    // the ring wraps and the reader has frames in flight at the stop.
+    Position_Record_Sink  serial_sink, pipe_sink;
+    Tracker_Collection_Manager  serial_mgr(8, 30, 20, 0, 0, false, make_disk_tracker);
+    Tracker_Collection_Manager  pipe_mgr(8, 30, 20, 0, 0, false, make_disk_tracker);
+    serial_mgr.add_tracker(60, 64, 8);
+    pipe_mgr.add_tracker(60, 64, 8);
+    Tracking_Engine_Settings  settings;
+    settings.kernel_type = KT_DISK;
+    settings.predict = true;
+    Tracking_Engine serial_engine(serial_mgr, settings);
+    Tracking_Engine pipe_engine(pipe_mgr, settings);
+    serial_engine.add_sink(&serial_sink);
+    pipe_engine.add_sink(&pipe_sink);
+    Moving_Disc_Source  serial_source(40), pipe_source(40);
+    serial_engine.run(serial_source, 30);
+    bool ok = pipe_engine.run_pipelined(pipe_source, 30, 4);
+
+    unsigned  mismatches = 0;
+    if (!ok || !pipe_sink.d_finished || (pipe_sink.d_frames.size() != serial_sink.d_frames.size()) ||
+        (pipe_engine.pipeline_statistics().frames != 30)) {
+      mismatches++;
+    }
+    size_t f;
+    for (f = 0; (f < pipe_sink.d_frames.size()) && (f < serial_sink.d_frames.size()); f++) {
+      if ( (pipe_sink.d_frames[f] != serial_sink.d_frames[f]) ||
+           (pipe_sink.d_x[f] != serial_sink.d_x[f]) || (pipe_sink.d_y[f] != serial_sink.d_y[f]) ) {
+        mismatches++;
+      }
+    }
+    pipe_engine.pipeline_statistics().print(stdout);
+    printf("  %u mismatches (%s)\n", mismatches, mismatches == 0 ? "match" : "MISMATCH");
+  }
   
+  printf("Checking the separable and recursive Gaussian blurs\n");
+  {
+    // Compare the separable engine against a direct 2D convolution with the
+    // same pixel-integrated kernel, the recursive filter against the
+    // separable one for a large blur, and the one-call difference of
+    // Gaussians against subtracting two blurred images.
+    const int nx = 101, ny = 77;
+    double_image  noise(0, nx-1, 0, ny-1);
+    int x, y;
+    for (y = 0; y < ny; y++) {
+      for (x = 0; x < nx; x++) {
+        noise.write_pixel_nocheck(x, y, 255 * rand()/(double)(RAND_MAX));
+      }
+    }
+    unsigned  mismatches = 0;
+    const int aperture = 5;
+    const float std = 2;
+    Integrated_Gaussian_image kernel(0, 2*aperture, 0, 2*aperture, 0, 0, aperture, aperture, std, 1, 4);
+    gaussian_blurred_image  blurred(noise, aperture, std);
+    double  maxdiff = 0;
+    for (y = 0; y < ny; y++) {
+      for (x = 0; x < nx; x++) {
+        double sum = 0, weight = 0, value;
+        int i, j;
+        for (i = -aperture; i <= aperture; i++) {
+          for (j = -aperture; j <= aperture; j++) {
+            if (noise.read_pixel(x+i, y+j, value)) {
+              double kval = kernel.read_pixel_nocheck(aperture+i, aperture+j);
+              weight += kval;
+              sum += kval * value;
+            }
+          }
+        }
+        double diff = fabs(sum/weight - blurred.read_pixel_nocheck(x, y));
+        if (diff > maxdiff) { maxdiff = diff; }
+      }
+    }
+    if (maxdiff > 1e-3) { mismatches++; }
+    printf("  separable vs. 2D convolution: max difference %lg\n", maxdiff);
+
+    gaussian_blurred_image  sep(noise, 40, 10, gaussian_blur_engine::SEPARABLE);
+    gaussian_blurred_image  rec(noise, 40, 10, gaussian_blur_engine::RECURSIVE);
+    maxdiff = 0;
+    for (y = 0; y < ny; y++) {
+      for (x = 0; x < nx; x++) {
+        double diff = fabs(sep.read_pixel_nocheck(x, y) - rec.read_pixel_nocheck(x, y));
+        if (diff > maxdiff) { maxdiff = diff; }
+      }
+    }
+    if (maxdiff > 2.55) { mismatches++; }
+    printf("  recursive vs. separable: max difference %lg\n", maxdiff);
+
+    gaussian_blurred_image  large(noise, 2*aperture + 4, std + 2);
+    subtracted_image  dog(blurred, large, 0.5);
+    float_image center(0, nx-1, 0, ny-1), surround(0, nx-1, 0, ny-1);
+    gaussian_blur_engine  engine;
+    if (!engine.difference_of_gaussians(noise, aperture, std, 2*aperture + 4, std + 2,
+                                        0.5, center, surround)) {
+      mismatches++;
+    }
+    maxdiff = 0;
+    for (y = 0; y < ny; y++) {
+      for (x = 0; x < nx; x++) {
+        double diff = fabs(dog.read_pixel_nocheck(x, y) - surround.read_pixel_nocheck(x, y));
+        if (diff > maxdiff) { maxdiff = diff; }
+        diff = fabs(blurred.read_pixel_nocheck(x, y) - center.read_pixel_nocheck(x, y));
+        if (diff > maxdiff) { maxdiff = diff; }
+      }
+    }
+    if (maxdiff > 1e-3) { mismatches++; }
+    printf("  difference of Gaussians vs. subtracted images: max difference %lg\n", maxdiff);
+    printf("  %u mismatches (%s)\n", mismatches, mismatches == 0 ? "match" : "MISMATCH");
+  }
+
+  printf("Checking that recomputing per-frame images reuses their buffers without allocating\n");
+  {
+    const int nx = 160, ny = 120;
+    double_image  frame(0, nx-1, 0, ny-1);
+    int x, y;
+    for (y = 0; y < ny; y++) {
+      for (x = 0; x < nx; x++) {
+        frame.write_pixel_nocheck(x, y, 255 * rand()/(double)(RAND_MAX));
+      }
+    }
+    gaussian_blurred_image  blurred(frame, 5, 2);
+    gaussian_blurred_image  large(frame, 13, 6, gaussian_blur_engine::AUTOMATIC);
+    probed_subtracted_image  surround(blurred, large, 0.5);
+    probed_averaged_image  averaged(blurred, large);
+    float_image center(0, nx-1, 0, ny-1), dog(0, nx-1, 0, ny-1);
+    probed_blur_engine  engine;
+    engine.difference_of_gaussians(frame, 5, 2, 13, 6, 0.5, center, dog,
+                                   gaussian_blur_engine::AUTOMATIC);
+
+    unsigned  mismatches = 0;
+    std::vector<const void *> before, after;
+    before.push_back(view_base(blurred)); before.push_back(view_base(large));
+    before.push_back(surround.buffer()); before.push_back(averaged.buffer());
+    before.push_back(view_base(center)); before.push_back(view_base(dog));
+    std::vector<const void *> engine_before, engine_after;
+    engine.buffers(engine_before);
+    int i;
+    g_allocations = 0;
+    g_count_allocations = true;
+    for (i = 0; i < 5; i++) {
+      frame.write_pixel_nocheck(i, i, 0);
+      if (!blurred.recompute(frame, 5, 2) ||
+          !large.recompute(frame, 13, 6, gaussian_blur_engine::AUTOMATIC) ||
+          !surround.recompute(blurred, large, 0.5) ||
+          !averaged.recompute(blurred, large) ||
+          !engine.difference_of_gaussians(frame, 5, 2, 13, 6, 0.5, center, dog,
+                                          gaussian_blur_engine::AUTOMATIC) ) {
+        mismatches++;
+      }
+    }
+    g_count_allocations = false;
+    long allocations = g_allocations;
+    if (allocations != 0) { mismatches++; }
+    after.push_back(view_base(blurred)); after.push_back(view_base(large));
+    after.push_back(surround.buffer()); after.push_back(averaged.buffer());
+    after.push_back(view_base(center)); after.push_back(view_base(dog));
+    engine.buffers(engine_after);
+    unsigned moved = 0;
+    for (i = 0; i < static_cast<int>(before.size()); i++) {
+      if ( (before[i] == NULL) || (before[i] != after[i]) ) { moved++; }
+    }
+    for (i = 0; i < static_cast<int>(engine_before.size()); i++) {
+      if (engine_before[i] != engine_after[i]) { moved++; }
+    }
+    if (moved != 0) { mismatches++; }
+
+    // The recomputed images should match ones made from scratch.
+    gaussian_blurred_image  fresh_blurred(frame, 5, 2);
+    subtracted_image  fresh_surround(fresh_blurred, large, 0.5);
+    for (y = 0; y < ny; y++) {
+      for (x = 0; x < nx; x++) {
+        if ( (fresh_blurred.read_pixel_nocheck(x, y) != blurred.read_pixel_nocheck(x, y)) ||
+             (fresh_surround.read_pixel_nocheck(x, y) != surround.read_pixel_nocheck(x, y)) ||
+             (fabs(surround.read_pixel_nocheck(x, y) - dog.read_pixel_nocheck(x, y)) > 1e-3) ) {
+          mismatches++;
+        }
+      }
+    }
+    printf("  %ld allocations and %u buffers moved in 5 frames, %u mismatches (%s)\n", allocations, moved, mismatches,
+      mismatches == 0 ? "match" : "MISMATCH");
+  }
+
+  printf("Checking separable Gaussian kernel images against per-pixel integration\n");
+  {
+    // The oversampled image should match ComputeGaussianVolume() at each
+    // pixel, and the exactly-integrated image should match both the erf
+    // volume and a densely-sampled one.
+    const double cx = 10.3, cy = 8.8, std = 2.2, volume = 5000;
+    Integrated_Gaussian_image sampled(0, 20, 0, 17, 10, 0, cx, cy, std, volume, 4);
+    Integrated_Gaussian_image exact(0, 20, 0, 17, 10, 0, cx, cy, std, volume, 0);
+    double  maxsampled = 0, maxexact = 0, maxdense = 0;
+    int x, y;
+    for (y = 0; y <= 17; y++) {
+      for (x = 0; x <= 20; x++) {
+        if ( (x < floor(cx - 3.5*std)) || (x > ceil(cx + 3.5*std)) ||
+             (y < floor(cy - 3.5*std)) || (y > ceil(cy + 3.5*std)) ) { continue; }
+        double x0 = (x - cx) - 0.5, y0 = (y - cy) - 0.5;
+        double diff = fabs(sampled.read_pixel_nocheck(x, y) - 10 -
+                           ComputeGaussianVolume(volume, std, x0, x0+1, y0, y0+1, 4));
+        if (diff > maxsampled) { maxsampled = diff; }
+        diff = fabs(exact.read_pixel_nocheck(x, y) - 10 -
+                    ComputeGaussianVolumeExact(volume, std, x0, x0+1, y0, y0+1));
+        if (diff > maxexact) { maxexact = diff; }
+        diff = fabs(exact.read_pixel_nocheck(x, y) - 10 -
+                    ComputeGaussianVolume(volume, std, x0, x0+1, y0, y0+1, 64));
+        if (diff > maxdense) { maxdense = diff; }
+      }
+    }
+    printf("  max differences: oversampled %lg, exact %lg, exact vs. dense sampling %lg (%s)\n",
+      maxsampled, maxexact, maxdense,
+      (maxsampled < 1e-9) && (maxexact < 1e-9) && (maxdense < 1e-2) ? "match" : "MISMATCH");
+  }
+
+  printf("Checking the Levenberg-Marquardt and Newton optimizers against the pattern search\n");
+  {
+    // Track the same spots from the same nearby starting points with and
+    // without each optimizer, counting the fitness (or model) evaluations.
+    Gaussian_LM_optimizer lm;
+    Newton_spot_optimizer newton;
+    const int trials = 20;
+    double  err[4] = { 0, 0, 0, 0 };
+    unsigned long evals[4] = { 0, 0, 0, 0 };
+    unsigned  fell_back = 0;
+    int t, k;
+    for (t = 0; t < trials; t++) {
+      double  tx = 31.5 + 3 * (rand()/(double)(RAND_MAX));
+      double  ty = 31.5 + 3 * (rand()/(double)(RAND_MAX));
+      double  sx = tx + 2 * ((rand()/(double)(RAND_MAX)) - 0.5);
+      double  sy = ty + 2 * ((rand()/(double)(RAND_MAX)) - 0.5);
+      Integrated_Gaussian_image gaussian(0, 63, 0, 63, 100, 0, tx, ty, 2.0, 8000, 0);
+      disc_image disc(0, 63, 0, 63, 127, 0, tx, ty, 5.5, 250);
+      for (k = 0; k < 2; k++) {
+        Counting_tracker<FIONA_spot_tracker> fiona(2.5, 0.01);
+        Counting_tracker<symmetric_spot_tracker_interp> symmetric(7.0, 0.01);
+        if (k == 1) {
+          fiona.set_optimizer(&lm);
+          symmetric.set_optimizer(&newton);
+        }
+        double  x, y;
+        fiona.optimize(gaussian, 0, x, y, sx, sy);
+        err[k] += sqrt( (x-tx)*(x-tx) + (y-ty)*(y-ty) );
+        evals[k] += fiona.d_checks;
+        if (k == 1) {
+          const spot_optimizer_status &status = fiona.get_optimizer_status();
+          if (status.converged) { evals[k] += status.evaluations - 1; } else { fell_back++; }
+        }
+        symmetric.optimize_xy(disc, 0, x, y, sx, sy);
+        err[2+k] += sqrt( (x-tx)*(x-tx) + (y-ty)*(y-ty) );
+        evals[2+k] += symmetric.d_checks;
+        if ( (k == 1) && !symmetric.get_optimizer_status().converged ) { fell_back++; }
+      }
+    }
+    printf("  FIONA pattern search: mean err %lg, %lg evaluations; Levenberg-Marquardt: mean err %lg, %lg evaluations\n",
+      err[0]/trials, evals[0]/(double)trials, err[1]/trials, evals[1]/(double)trials);
+    printf("  Symmetric pattern search: mean err %lg, %lg evaluations; Newton: mean err %lg, %lg evaluations\n",
+      err[2]/trials, evals[2]/(double)trials, err[3]/trials, evals[3]/(double)trials);
+    printf("  %u fell back to the pattern search (%s)\n", fell_back,
+      (err[1] <= err[0] + 0.01*trials) && (err[3] <= err[2] + 0.01*trials) &&
+      (10*evals[1] <= evals[0]) && (10*evals[3] <= evals[2]) && (fell_back == 0) ? "match" : "MISMATCH");
+  }
+
+  printf("Checking the fitness cache used by the pattern search\n");
+  {
+    // Every fitness the tracker computes should be a cache miss, and the
+    // pattern search should come back to some positions.  A new version of
+    // the same image must not reuse the old values.
+    Counting_tracker<symmetric_spot_tracker_interp> tracker(7.0, 0.01);
+    Integrated_Gaussian_image spot(0, 63, 0, 63, 100, 0, 31.3, 32.8, 3.0, 8000, 0);
+    double  x, y;
+    tracker.optimize_xy(spot, 0, x, y, 30, 34);
+    unsigned long hits = tracker.get_fitness_cache_hits();
+    unsigned long misses = tracker.get_fitness_cache_misses();
+    bool ok = (hits > 0) && (misses == tracker.d_checks);
+    spot.recompute(100, 0, 31.3, 32.8, 3.0, 8000, 0);
+    tracker.set_location(30, 34);
+    double  fitness = tracker.check_fitness(spot, 0);
+    tracker.optimize_xy(spot, 0, x, y, 30, 34);
+    ok = ok && (tracker.get_fitness_cache_misses() - misses > 1) &&
+      (tracker.get_fitness_cache_misses() + 1 == tracker.d_checks);
+    printf("  %lu hits, %lu misses in the first search; found %g,%g (start fitness %g) (%s)\n",
+      hits, misses, x, y, fitness, ok ? "match" : "MISMATCH");
+  }
+
+  printf("Checking the coarse-to-fine local image search against the full one\n");
+  {
+    // A spot that jumps about 40 pixels between frames should be found by
+    // both searches; each pyramid pixel should average the pixels under it.
+    disc_image  before(0, 191, 0, 191, 127, 5, 64.3, 64.6, 8, 250);
+    disc_image  after(0, 191, 0, 191, 127, 5, 97.3, 37.6, 8, 250);
+    image_pyramid previous, current;
+    previous.build(before, 4);
+    current.build(after, 4);
+    double  sum = 0;
+    int x, y;
+    for (y = 20; y < 24; y++) {
+      for (x = 12; x < 16; x++) {
+        sum += after.read_pixel_nocheck(x, y);
+      }
+    }
+    bool ok = (current.num_levels() == 4) && (fabs(current.level(2).read_pixel_nocheck(3, 5) - sum / 16) < 1e-3);
+
+    double  found[2][2];
+    double  times[2];
+    int method;
+    for (method = 0; method < 2; method++) {
+      Tracker_Collection_Manager  mgr(8, 30, 20, 0, 0, false, make_disk_tracker);
+      mgr.add_tracker(64, 65, 8);
+      double  last[2] = { 64, 65 };
+      mgr.tracker(0)->set_last_position(last);
+      vrpn_gettimeofday(&start, NULL);
+      if (method == 0) {
+        mgr.perform_local_image_search(-1, 45, before, after);
+      } else {
+        mgr.perform_local_image_search(-1, 45, previous, current);
+      }
+      vrpn_gettimeofday(&end, NULL);
+      times[method] = duration(end, start);
+      found[method][0] = mgr.tracker(0)->xytracker()->get_x();
+      found[method][1] = mgr.tracker(0)->xytracker()->get_y();
+      ok = ok && (fabs(found[method][0] - 97) <= 1) && (fabs(found[method][1] - 37) <= 1);
+    }
+    printf("  Full search found %g,%g in %lg seconds; coarse-to-fine found %g,%g in %lg seconds (%s)\n",
+      found[0][0], found[0][1], times[0], found[1][0], found[1][1], times[1], ok ? "match" : "MISMATCH");
+  }
+
+  printf("Checking the construction rate of interpolating trackers\n");
+  {
+    // Make 1000 each of the symmetric, disk, and cone trackers.  They
+    // should share one sampling table per kind, which should go away when
+    // the last of them does.  The sample spacing is one that no other
+    // tracker still around is using.
+    const int num_trackers = 1000;
+    unsigned tables_before = spot_sampling_table::num_cached_tables();
+    std::vector<spot_tracker_XY *> trackers;
+    vrpn_gettimeofday(&start, NULL);
+    int i;
+    for (i = 0; i < num_trackers; i++) {
+      trackers.push_back(new symmetric_spot_tracker_interp(5 + (i % 5), false, 0.05, 0.1, 0.75));
+      trackers.push_back(new disk_spot_tracker_interp(5 + (i % 5), false, 0.05, 0.1, 0.75));
+      trackers.push_back(new cone_spot_tracker_interp(5 + (i % 5), false, 0.05, 0.1, 0.75));
+    }
+    vrpn_gettimeofday(&end, NULL);
+    double build_time = duration(end, start);
+    unsigned tables_during = spot_sampling_table::num_cached_tables();
+    for (i = 0; i < (int)trackers.size(); i++) {
+      delete trackers[i];
+    }
+    unsigned tables_after = spot_sampling_table::num_cached_tables();
+    bool ok = (tables_during == tables_before + 3) && (tables_after == tables_before);
+    printf("  %d trackers in %lg seconds (%lg per second), %u shared tables (%s)\n",
+      3 * num_trackers, build_time, 3 * num_trackers / build_time,
+      tables_during - tables_before, ok ? "match" : "MISMATCH");
+  }
+
+  printf("Checking the FFT correlation search against the full one\n");
+  {
+    // The same jump as above.  The FFT search should land within half a
+    // pixel of where the spot moved, and its correlation at one offset
+    // should match one summed directly.
+    disc_image  before(0, 191, 0, 191, 127, 5, 64.3, 64.6, 8, 250);
+    disc_image  after(0, 191, 0, 191, 127, 5, 97.3, 37.6, 8, 250);
+    double  found[2][2];
+    double  times[2];
+    bool ok = true;
+    int method;
+    for (method = 0; method < 2; method++) {
+      Tracker_Collection_Manager  mgr(8, 30, 20, 0, 0, false, make_disk_tracker);
+      mgr.fft_search(method == 1);
+      mgr.add_tracker(64, 65, 8);
+      double  last[2] = { 64, 65 };
+      mgr.tracker(0)->set_last_position(last);
+      vrpn_gettimeofday(&start, NULL);
+      mgr.perform_local_image_search(-1, 45, before, after);
+      vrpn_gettimeofday(&end, NULL);
+      times[method] = duration(end, start);
+      found[method][0] = mgr.tracker(0)->xytracker()->get_x();
+      found[method][1] = mgr.tracker(0)->xytracker()->get_y();
+    }
+    ok = (fabs(found[0][0] - 97) <= 1) && (fabs(found[0][1] - 37) <= 1) &&
+         (fabs(found[1][0] - 97) <= 0.5) && (fabs(found[1][1] - 38) <= 0.5);
+
+    const int trad = 8;
+    const int tsize = 2 * trad + 1;
+    std::vector<double> templ(tsize * tsize), surface;
+    int x, y;
+    double tmean = 0, imean = 0;
+    for (y = 0; y < tsize; y++) {
+      for (x = 0; x < tsize; x++) {
+        templ[x + tsize * y] = before.read_pixel_nocheck(64 - trad + x, 65 - trad + y);
+        tmean += templ[x + tsize * y];
+        imean += after.read_pixel_nocheck(95 - trad + x, 40 - trad + y);
+      }
+    }
+    tmean /= tsize * tsize;
+    imean /= tsize * tsize;
+    double num = 0, tsq = 0, isq = 0;
+    for (y = 0; y < tsize; y++) {
+      for (x = 0; x < tsize; x++) {
+        double t = templ[x + tsize * y] - tmean;
+        double v = after.read_pixel_nocheck(95 - trad + x, 40 - trad + y) - imean;
+        num += t * v; tsq += t * t; isq += v * v;
+      }
+    }
+    fft_correlator correlator;
+    ok = ok && correlator.correlate(&templ[0], trad, after, 0, 97, 38, 5, surface) &&
+         (fabs(surface[(-2 + 5) + 11 * (2 + 5)] - num / sqrt(tsq * isq)) < 1e-9);
+    printf("  Full search found %g,%g in %lg seconds; FFT found %g,%g in %lg seconds (%s)\n",
+      found[0][0], found[0][1], times[0], found[1][0], found[1][1], times[1], ok ? "match" : "MISMATCH");
+  }
+
+  printf("Checking the union of logged video regions\n");
+  {
+    // Boxes around a dense field of trackers, as video logging makes them.
+    // Every pixel in some box should be in exactly one of the rectangles
+    // returned, and no other pixel should be in any.
+    const int width = 256, height = 256;
+    VST_Region_Union regions;
+    int i;
+    for (i = 0; i < 400; i++) {
+      int x = (i * 37) % 240, y = (i * 91) % 240;
+      regions.add(x, y, x + 4 + i % 13, y + 4 + i % 7);
+    }
+    std::vector<VST_Region_Union::Rect> rects;
+    double sent = regions.disjoint_cover(rects);
+    std::vector<int> wanted(width * height, 0), covered(width * height, 0);
+    for (i = 0; i < 400; i++) {
+      int x = (i * 37) % 240, y = (i * 91) % 240;
+      int px, py;
+      for (py = y; py <= y + 4 + i % 7; py++) {
+        for (px = x; px <= x + 4 + i % 13; px++) {
+          wanted[px + width * py] = 1;
+        }
+      }
+    }
+    size_t r;
+    for (r = 0; r < rects.size(); r++) {
+      int px, py;
+      for (py = rects[r].miny; py <= rects[r].maxy; py++) {
+        for (px = rects[r].minx; px <= rects[r].maxx; px++) {
+          covered[px + width * py]++;
+        }
+      }
+    }
+    double union_pixels = 0;
+    bool ok = true;
+    for (i = 0; i < width * height; i++) {
+      union_pixels += wanted[i];
+      if (covered[i] != wanted[i]) { ok = false; }
+    }
+    ok = ok && (sent == union_pixels);
+    printf("  %lg pixels requested, %lg sent in %u rectangles (%s)\n",
+      regions.requested_pixels(), sent, static_cast<unsigned>(rects.size()), ok ? "match" : "MISMATCH");
+  }
+
+  printf("Checking frame snapshots in the source's pixel type\n");
+  {
+    // A float frame should be snapshotted as floats, copying another
+    // snapshot should share its pixels, and refilling one that is shared
+    // should leave the other holding the old frame.
+    const int nx = 1024, ny = 1024;
+    float_image  frame(0, nx-1, 0, ny-1), other(0, nx-1, 0, ny-1);
+    int x, y;
+    for (y = 0; y < ny; y++) {
+      for (x = 0; x < nx; x++) {
+        frame.write_pixel_nocheck(x, y, rand() % 65536);
+        other.write_pixel_nocheck(x, y, rand() % 65536);
+      }
+    }
+    const int count = 20;
+    copy_of_image  snapshot(frame);
+    vrpn_gettimeofday(&start, NULL);
+    int i;
+    for (i = 0; i < count; i++) {
+      snapshot = frame;
+    }
+    vrpn_gettimeofday(&end, NULL);
+    double snap_time = duration(end, start) / count;
+    copy_of_image  last(snapshot);
+    image_buffer_view snap_view, last_view;
+    snapshot.get_buffer_view(snap_view);
+    last.get_buffer_view(last_view);
+    bool ok = (snapshot.pixel_type() == image_buffer_view::FLOAT) && (snap_view.base == last_view.base);
+    snapshot = other;
+    for (y = 0; y < ny; y++) {
+      for (x = 0; x < nx; x++) {
+        if ( (last.read_pixel_nocheck(x, y) != frame.read_pixel_nocheck(x, y)) ||
+             (snapshot.read_pixel_nocheck(x, y) != other.read_pixel_nocheck(x, y)) ) {
+          ok = false;
+        }
+      }
+    }
+    printf("  %dx%d float frame snapshot in %lg seconds (%s)\n", nx, ny, snap_time, ok ? "match" : "MISMATCH");
+  }
+
+  printf("Checking that pooled camera frames are recycled\n");
+  {
+    // Keep the last three frames of a stream, the way the video optimizer
+    // does.  Once the pool has enough buffers it should stop making new
+    // ones, and each frame should still hold the image it was filled from.
+    const int nx = 64, ny = 48;
+    float_image  image(0, nx-1, 0, ny-1);
+    camera_frame_pool *pool = new camera_frame_pool(4);
+    std::vector<camera_frame> history(3);
+    struct timeval now;
+    vrpn_gettimeofday(&now, NULL);
+    std::vector<const void *> buffers_seen;
+    bool ok = true;
+    int frame, x, y;
+    for (frame = 0; frame < 50; frame++) {
+      for (y = 0; y < ny; y++) {
+        for (x = 0; x < nx; x++) {
+          image.write_pixel_nocheck(x, y, frame + x);
+        }
+      }
+      history[0] = history[1];
+      history[1] = history[2];
+      ok = ok && history[2].fill(image, pool, frame, now);
+      image_buffer_view view;
+      history[2].get_buffer_view(view);
+      if (std::find(buffers_seen.begin(), buffers_seen.end(), view.base) == buffers_seen.end()) {
+        buffers_seen.push_back(view.base);
+      }
+      int i;
+      for (i = 0; i < 3; i++) {
+        if ( history[i].valid() &&
+             (history[i].read_pixel_nocheck(5, 7) != history[i].frame_number() + 5) ) {
+          ok = false;
+        }
+      }
+    }
+    ok = ok && (history[0].frame_number() == 47) && (pool->num_in_use() == 3) &&
+         (buffers_seen.size() <= 4);
+    pool->release();
+    history.clear();
+    printf("  %u buffers used for 50 frames (%s)\n", static_cast<unsigned>(buffers_seen.size()),
+      ok ? "match" : "MISMATCH");
+  }
+
+  printf("Checking the background writer's BigTIFF stack\n");
+  {
+    // Queue shifted and cropped frames from an image that changes right
+    // after each is queued, then read the pages back and make sure that
+    // each holds its own frame, in order.
+    const int nx = 64, ny = 48, frames = 20;
+    const int minx = 2, miny = 3, maxx = 41, maxy = 32;
+    const char *stackname = "test_spot_tracker_stack.tif";
+    float_image  image(0, nx-1, 0, ny-1);
+    image_file_writer  writer(2, 4);
+    image_file_writer::Transform  transform;
+    transform.kind = image_file_writer::Transform::TRANSLATE;
+    transform.dx = 3; transform.dy = 1;
+    bool ok = writer.open_stack(stackname);
+    int frame, x, y;
+    for (frame = 0; frame < frames; frame++) {
+      for (y = 0; y < ny; y++) {
+        for (x = 0; x < nx; x++) {
+          image.write_pixel_nocheck(x, y, frame*100 + x + 2*y);
+        }
+      }
+      ok = ok && writer.write(image, transform, minx, miny, maxx, maxy, 0, 1.0, 0.0, true, NULL);
+    }
+    writer.close_stack();
+    ok = ok && (writer.frames_written() == frames) && (writer.frames_failed() == 0);
+
+    // Follow the chain of directories, checking the strip in each.  The
+    // file is little-endian, and the rows are stored top (highest Y) down.
+    FILE *f = fopen(stackname, "rb");
+    std::vector<unsigned char> file;
+    if (f) {
+      int c;
+      while ((c = fgetc(f)) != EOF) { file.push_back(static_cast<unsigned char>(c)); }
+      fclose(f);
+    }
+    int pages = 0;
+    ok = ok && (file.size() > 16) && (file[0] == 'I') && (le_value(file, 2, 2) == 43);
+    size_t ifd = ok ? static_cast<size_t>(le_value(file, 8, 8)) : 0;
+    while (ok && (ifd != 0) && (ifd < file.size())) {
+      unsigned entries = static_cast<unsigned>(le_value(file, ifd, 8));
+      double width = 0, height = 0, strip = 0;
+      unsigned e;
+      for (e = 0; e < entries; e++) {
+        size_t at = ifd + 8 + 20*e;
+        unsigned tag = static_cast<unsigned>(le_value(file, at, 2));
+        double value = le_value(file, at + 12, 8);
+        if (tag == 256) { width = value; }
+        if (tag == 257) { height = value; }
+        if (tag == 273) { strip = value; }
+      }
+      ok = ok && (width == maxx-minx+1) && (height == maxy-miny+1);
+      for (y = 0; ok && (y < height); y++) {
+        for (x = 0; x < width; x++) {
+          size_t at = static_cast<size_t>(strip) + 2 * (y*static_cast<size_t>(width) + x);
+          int srcx = minx + x + 3, srcy = maxy - y + 1;
+          if (le_value(file, at, 2) != pages*100 + srcx + 2*srcy) {
+            ok = false;
+          }
+        }
+      }
+      pages++;
+      ifd = static_cast<size_t>(le_value(file, ifd + 8 + 20*entries, 8));
+    }
+    ok = ok && (pages == frames);
+    unlink(stackname);
+    printf("  %d pages read back, %u waits for the writer (%s)\n", pages,
+      writer.backpressure_waits(), ok ? "match" : "MISMATCH");
+  }
+
+  printf("Checking the whole-frame affine warp against transformed images\n");
+  {
+    // Warp a region that hangs off the edges of the image, so that the
+    // borders are checked, and compare against reading each pixel of the
+    // transformed images.  The vector and scalar code should match exactly.
+    const int nx = 1024, ny = 1024;
+    float_image  image(0, nx-1, 0, ny-1);
+    int x, y;
+    for (y = 0; y < ny; y++) {
+      for (x = 0; x < nx; x++) {
+        image.write_pixel_nocheck(x, y, rand() % 4096);
+      }
+    }
+    const int minx = -20, maxx = nx + 19, miny = -10, maxy = ny + 9;
+    affine_warp_engine  engine;
+    double_image  warped, shifted, scalar;
+    affine_transformed_image  affine(image, 5.3, -7.6, 0.1, 1.05, nx/2.0, ny/2.0);
+    translated_image  translated(image, 3.3, -2.7);
+    vrpn_gettimeofday(&start, NULL);
+    bool ok = engine.transform(image, 5.3, -7.6, 0.1, 1.05, nx/2.0, ny/2.0,
+                               minx, maxx, miny, maxy, warped);
+    vrpn_gettimeofday(&end, NULL);
+    double warp_time = duration(end, start);
+    ok = ok && engine.translate(image, 3.3, -2.7, minx, maxx, miny, maxy, shifted);
+    VST_set_simd_level_limit(VST_SIMD_SCALAR);
+    ok = ok && engine.transform(image, 5.3, -7.6, 0.1, 1.05, nx/2.0, ny/2.0,
+                                minx, maxx, miny, maxy, scalar);
+    VST_set_simd_level_limit(VST_SIMD_AVX2);
+
+    double max_error = 0;
+    vrpn_gettimeofday(&start, NULL);
+    for (y = miny; y <= maxy; y++) {
+      for (x = minx; x <= maxx; x++) {
+        double value;
+        affine.read_pixel(x, y, value);
+        max_error = std::max(max_error, fabs(warped.read_pixel_nocheck(x, y) - value));
+      }
+    }
+    vrpn_gettimeofday(&end, NULL);
+    double pixel_time = duration(end, start);
+    for (y = miny; y <= maxy; y++) {
+      for (x = minx; x <= maxx; x++) {
+        double value;
+        translated.read_pixel(x, y, value);
+        max_error = std::max(max_error, fabs(shifted.read_pixel_nocheck(x, y) - value));
+        if (scalar.read_pixel_nocheck(x, y) != warped.read_pixel_nocheck(x, y)) {
+          ok = false;
+        }
+      }
+    }
+    ok = ok && (max_error < 1e-6);
+    printf("  Warped %dx%d in %lg seconds (%lg reading each pixel), max error %lg (%s)\n",
+      maxx-minx+1, maxy-miny+1, warp_time, pixel_time, max_error, ok ? "match" : "MISMATCH");
+  }
+
+  printf("Checking the radial Z tracker's ring table against pixel-by-pixel fitness\n");
+  {
+    // Make a spread function whose width grows with Z and a bead image at
+    // one of its depths, then compare the tracker's fitness at each depth
+    // with comparing each pixel in the radius, for a bead in the middle of
+    // the image and one hanging off its edge.
+    const int radius = 20, nz = 30, true_z = 7;
+    double_image  radial(0, radius + 1, 0, nz - 1);
+    int x, y, z;
+    for (z = 0; z < nz; z++) {
+      double s = 2 + 0.3 * z;
+      for (x = 0; x <= radius + 1; x++) {
+        radial.write_pixel_nocheck(x, z, 1000 * exp(-x*x / (2*s*s)));
+      }
+    }
+    const double bx = 60.4, by = 70.6;
+    double_image  beads(0, 127, 0, 127);
+    for (y = 0; y < 128; y++) {
+      for (x = 0; x < 128; x++) {
+        double s = 2 + 0.3 * true_z;
+        double d2 = (x-bx)*(x-bx) + (y-by)*(y-by);
+        beads.write_pixel_nocheck(x, y, 1000 * exp(-d2 / (2*s*s)) + (rand() % 16));
+      }
+    }
+
+    radial_average_tracker_Z  ztracker(radial);
+    double max_error = 0;
+    double check_time, direct_time = 0;
+    const double centers[2][2] = { { bx, by }, { 4.3, 100.2 } };
+    int c;
+    for (c = 0; c < 2; c++) {
+      double cx = centers[c][0], cy = centers[c][1];
+      for (z = 1; z < nz - 2; z++) {
+        ztracker.set_z(z + 0.25);
+        double fitness = ztracker.check_fitness(beads, 0, cx, cy);
+
+        vrpn_gettimeofday(&start, NULL);
+        double direct = 0, pixels = 0, lx, ly;
+        for (lx = -radius; lx <= radius; lx++) {
+          for (ly = -radius; ly <= radius; ly++) {
+            double val;
+            if ( (lx*lx + ly*ly <= radius*radius) &&
+                 beads.read_pixel_bilerp(cx+lx, cy+ly, val) ) {
+              double myval = radial.read_pixel_bilerp_nocheck(sqrt(lx*lx + ly*ly), z + 0.25);
+              direct -= (val - myval) * (val - myval);
+              pixels++;
+            }
+          }
+        }
+        direct /= pixels;
+        vrpn_gettimeofday(&end, NULL);
+        if (c == 0) { direct_time += duration(end, start); }
+        max_error = std::max(max_error, fabs(fitness - direct) / fabs(direct));
+      }
+    }
+
+    // Searching all of the depths should take less time than comparing
+    // pixels at each of them.
+    double found_z = 0;
+    vrpn_gettimeofday(&start, NULL);
+    ztracker.locate_best_fit_in_depth(beads, 0, bx, by, found_z);
+    vrpn_gettimeofday(&end, NULL);
+    check_time = duration(end, start);
+    bool ok = (max_error < 1e-9) && (found_z == true_z);
+    printf("  %u rings, Z found at %lg, fitness error %lg, depth search in %lg seconds vs. %lg by pixel (%s)\n",
+      ztracker.num_rings(), found_z, max_error, check_time, direct_time, ok ? "match" : "MISMATCH");
+  }
+
+  printf("Checking mapped raw-file frames against buffered reads\n");
+  {
+    // The file is larger than the 64MB mapped window, so the window has to
+    // move, and its header is not a multiple of the page size.  Each server
+    // reads forwards, backwards, and by seeking, and then reads frames that
+    // are added to the file while it is open.
+    const unsigned nx = 640, ny = 480, header = 100, frame_header = 112, frames = 240;
+    const char *rawname = "test_spot_tracker_raw.raw";
+    bool ok = append_test_raw_frames(rawname, nx, ny, header, frame_header, 0, frames);
+    unsigned moves = 0;
+    {
+      probed_raw_file_server  mapped(rawname, nx, ny, header, frame_header, true);
+      probed_raw_file_server  buffered(rawname, nx, ny, header, frame_header, false);
+      probed_raw_file_server  *servers[2] = { &mapped, &buffered };
+      ok = ok && mapped.working() && buffered.working() && mapped.mapped() && !buffered.mapped() &&
+           (mapped.get_num_frames() == frames) && (buffered.get_num_frames() == frames);
+
+      // Frames to read in order; -1 means reading should fail there, and
+      // -2 means to seek to the frame after it.
+      std::vector<int>  steps;
+      int f;
+      for (f = 0; f < static_cast<int>(frames); f++) { steps.push_back(f); }
+      steps.push_back(-1);
+      const int seeks[] = { 200, 3, 150, frames-1, 0, 120 };
+      unsigned i;
+      for (i = 0; i < sizeof(seeks)/sizeof(seeks[0]); i++) {
+        steps.push_back(-2); steps.push_back(seeks[i]);
+      }
+
+      unsigned s;
+      for (s = 0; s < 2; s++) {
+        raw_file_offset window = mapped.window_start();
+        for (i = 0; ok && (i < steps.size()); i++) {
+          if (steps[i] == -2) {
+            ok = servers[s]->seek_to_frame(steps[++i]);
+          }
+          ok = ok && step_test_raw_file(*servers[s], nx, ny, steps[i]);
+          if ( (s == 0) && (mapped.window_start() != window) ) {
+            window = mapped.window_start();
+            moves++;
+          }
+        }
+
+        // Play backwards from the end, off the start of the file.
+        servers[s]->set_reverse(true);
+        ok = ok && servers[s]->seek_to_frame(frames - 1) && !servers[s]->seek_to_frame(frames);
+        for (f = frames - 1; ok && (f >= -1); f--) {
+          ok = step_test_raw_file(*servers[s], nx, ny, f);
+          if ( (s == 0) && (mapped.window_start() != window) ) {
+            window = mapped.window_start();
+            moves++;
+          }
+        }
+        servers[s]->set_reverse(false);
+      }
+
+      // Add frames, as if the file were still being written, and read on
+      // past the old end of the file with both servers.
+      for (s = 0; s < 2; s++) {
+        ok = ok && servers[s]->seek_to_frame(frames - 1) && step_test_raw_file(*servers[s], nx, ny, frames - 1);
+      }
+      ok = ok && append_test_raw_frames(rawname, nx, ny, header, frame_header, frames, 2);
+      for (s = 0; s < 2; s++) {
+        ok = ok && step_test_raw_file(*servers[s], nx, ny, frames) &&
+             step_test_raw_file(*servers[s], nx, ny, frames + 1) &&
+             step_test_raw_file(*servers[s], nx, ny, -1) &&
+             (servers[s]->get_num_frames() == frames + 2);
+      }
+    }
+    unlink(rawname);
+    ok = ok && (moves >= 2);
+    printf("  %u frames, mapped window moved %u times (%s)\n", frames, moves, ok ? "match" : "MISMATCH");
+  }
+
   return 0;
 }
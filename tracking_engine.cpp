@@ -0,0 +1,671 @@
+#include "tracking_engine.h"
+#include <math.h>
+
+#ifndef	M_PI
+#ifndef M_PI_DEFINED
+const double M_PI = 2*asin(1.0);
+#define M_PI_DEFINED
+#endif
+#endif
+
+//----------------------------------------------------------------------------
+// CSV output
+
+Tracking_CSV_Sink::Tracking_CSV_Sink(const char *filename,
+                                     const Tracking_Engine_Settings &settings,
+                                     bool internal_values)
+  : d_file(NULL)
+  , d_kernel_type(settings.kernel_type)
+  , d_color_index(settings.color_index)
+  , d_internal_values(internal_values)
+{
+  if ( (d_file = fopen(filename, "w")) == NULL) {
+    fprintf(stderr,"Tracking_CSV_Sink::Tracking_CSV_Sink(): Cannot open %s for writing\n", filename);
+    return;
+  }
+  if (d_internal_values) {
+    fprintf(d_file, "FrameNumber,Spot ID,X,Y,Z,Radius,Center Intensity,Orientation (if meaningful),Length (if meaningful), Fit Background (for FIONA), Gaussian Summed Value (for FIONA), Mean Background (FIONA), Summed Value (for FIONA), Region Size, Sensitivity\n");
+  } else {
+    fprintf(d_file, "FrameNumber,Spot ID,X,Y,Z,Radius,Center Intensity,Orientation (if meaningful),Length (if meaningful), Fit Background (for FIONA), Gaussian Summed Value (for FIONA), Mean Background (FIONA), Summed Value (for FIONA)\n");
+  }
+}
+
+Tracking_CSV_Sink::~Tracking_CSV_Sink()
+{
+  finish();
+}
+
+bool Tracking_CSV_Sink::finish(void)
+{
+  if (d_file == NULL) {
+    return true;
+  }
+  bool ret = (fclose(d_file) == 0);
+  d_file = NULL;
+  return ret;
+}
+
+// The values written are computed the same way that video_spot_tracker
+// computes them in save_log_frame().
+bool Tracking_CSV_Sink::frame_done(int frame_number, const image_wrapper &image,
+                                   const std::vector<Tracked_Spot> &spots)
+{
+  if (d_file == NULL) {
+    return false;
+  }
+
+  size_t i;
+  for (i = 0; i < spots.size(); i++) {
+    const Tracked_Spot &spot = spots[i];
+    if (spot.lost) { continue; }
+
+    double x = spot.x;
+    double y = spot.y;
+    double mean_background = 0.0, computedsummedvalue = 0.0;
+    double center_intensity = 0.0;
+    double value;
+    if (image.read_pixel_bilerp(x, y, value, d_color_index)) {
+      center_intensity = value;
+    }
+
+    if (d_kernel_type == KT_FIONA) {
+      // Mean of the pixels on a 5-pixel-radius circle around the center.
+      double theta, r = 5;
+      unsigned count = 0;
+      for (theta = 0; theta < 2*M_PI; theta += r / (2 * M_PI) ) {
+        if (image.read_pixel_bilerp(x + r * cos(theta), y + r * sin(theta), value, d_color_index)) {
+          mean_background += value;
+          count++;
+        }
+      }
+      if (count != 0) {
+        mean_background /= count;
+      }
+
+      // Sum above that background of the pixels within 5 pixels of the center.
+      int ix = static_cast<int>(floor(x+0.5));
+      int iy = static_cast<int>(floor(y+0.5));
+      int loopx, loopy;
+      for (loopx = -5; loopx <= 5; loopx++) {
+        for (loopy = -5; loopy <= 5; loopy++) {
+          if ( (loopx*loopx + loopy*loopy) <= 5*5 ) {
+            double val;
+            image.read_pixel(ix+loopx, iy+loopy, val, d_color_index);
+            computedsummedvalue += val - mean_background;
+          }
+        }
+      }
+    }
+
+    // Flip Y so that it is measured from the top of the image.
+    double flipped_y = image.get_num_rows() - 1 - y;
+    int written;
+    if (d_internal_values) {
+      written = fprintf(d_file, "%d, %d, %lf,%lf,%lf, %lf, %lf, %lf,%lf, %lf,%lf, %lf,%lf, %d, %lf\n",
+              frame_number, spot.index,
+              x, flipped_y, spot.z,
+              spot.radius, center_intensity,
+              spot.orientation, spot.length,
+              spot.background, spot.summedvalue, mean_background, computedsummedvalue,
+              spot.region_size, spot.sensitivity);
+    } else {
+      written = fprintf(d_file, "%d, %d, %lf,%lf,%lf, %lf, %lf, %lf,%lf, %lf,%lf, %lf,%lf\n",
+              frame_number, spot.index,
+              x, flipped_y, spot.z,
+              spot.radius, center_intensity,
+              spot.orientation, spot.length,
+              spot.background, spot.summedvalue, mean_background, computedsummedvalue);
+    }
+    if (written < 0) {
+      fprintf(stderr,"Tracking_CSV_Sink::frame_done(): Write failed\n");
+      return false;
+    }
+  }
+  return true;
+}
+
+//----------------------------------------------------------------------------
+// Pipeline statistics
+
+void Tracking_Pipeline_Statistics::print(FILE *f) const
+{
+  double wall = (wall_seconds > 0) ? wall_seconds : 1;
+  fprintf(f, "%u frames in %.3lf seconds (%.1lf frames/second)\n",
+    frames, wall_seconds, frames / wall);
+  fprintf(f, "  read:  %5.1lf%% busy\n", 100 * read_busy_seconds / wall);
+  fprintf(f, "  track: %5.1lf%% busy, %.2lf frames waiting on average\n",
+    100 * track_busy_seconds / wall, mean_track_queue());
+  fprintf(f, "  log:   %5.1lf%% busy, %.2lf frames waiting on average\n",
+    100 * log_busy_seconds / wall, mean_log_queue());
+}
+
+static double seconds_between(const struct timeval &start, const struct timeval &end)
+{
+  return (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1000000.0;
+}
+
+//----------------------------------------------------------------------------
+// Engine
+
+Tracking_Engine::Tracking_Engine(Tracker_Collection_Manager &trackers,
+                                 const Tracking_Engine_Settings &settings)
+  : d_trackers(trackers)
+  , d_settings(settings)
+  , d_frame_number(-1)
+  , d_tracker_is_lost(false)
+  , d_last_image(NULL)
+  , d_current_pyramid(0)
+  , d_blurred_image(NULL)
+  , d_surround_image(NULL)
+  , d_slotFree(0)
+  , d_slotRead(0)
+  , d_slotTracked(0)
+  , d_threadStart(0)
+  , d_statsLock(1)
+  , d_framesRead(0)
+  , d_framesTracked(0)
+  , d_framesLogged(0)
+  , d_pipelineStop(false)
+  , d_sinkFailed(false)
+  , d_source(NULL)
+  , d_maxFrames(-1)
+{
+  if (d_settings.check_bead_count_interval == 0) {
+    d_settings.check_bead_count_interval = 1;
+  }
+}
+
+Tracking_Engine::~Tracking_Engine()
+{
+  if (d_last_image) { delete d_last_image; d_last_image = NULL; }
+  if (d_blurred_image) { delete d_blurred_image; d_blurred_image = NULL; }
+  if (d_surround_image) { delete d_surround_image; d_surround_image = NULL; }
+  size_t i;
+  for (i = 0; i < d_slots.size(); i++) {
+    if (d_slots[i].image) { delete d_slots[i].image; }
+  }
+}
+
+// Make the blurred and surround-subtracted images used to check for lost
+// trackers and to find new ones, if they are turned on.  The surround
+// image is the difference between the blurred image and one blurred by
+// the sum of the blur and surround settings.
+void Tracking_Engine::make_lost_and_found_images(const image_wrapper &image)
+{
+  // The images are kept from frame to frame so that their buffers are
+  // reused; they are only freed when they are turned off.
+  double blur = d_settings.blur_lost_and_found;
+  double surround = d_settings.surround_lost_and_found;
+  if ( (blur <= 0) || (surround <= 0) ) {
+    if (d_surround_image) { delete d_surround_image; d_surround_image = NULL; }
+  }
+  if (blur <= 0) {
+    if (d_blurred_image) { delete d_blurred_image; d_blurred_image = NULL; }
+    return;
+  }
+
+  unsigned aperture = 1 + static_cast<unsigned>(2*blur);
+  int maxx = image.get_num_columns() - 1;
+  int maxy = image.get_num_rows() - 1;
+  if (d_blurred_image == NULL) {
+    d_blurred_image = new float_image(0, maxx, 0, maxy);
+  }
+  if ( (d_blurred_image == NULL) || !d_blurred_image->resize(0, maxx, 0, maxy) ) {
+    fprintf(stderr, "Tracking_Engine::make_lost_and_found_images(): Could not create blurred image\n");
+    if (d_blurred_image) { delete d_blurred_image; d_blurred_image = NULL; }
+    return;
+  }
+
+  if (surround <= 0) {
+    d_blur_engine.blur(image, aperture, static_cast<float>(blur), *d_blurred_image,
+      gaussian_blur_engine::AUTOMATIC);
+    return;
+  }
+  if (d_surround_image == NULL) {
+    d_surround_image = new float_image(0, maxx, 0, maxy);
+  }
+  if ( (d_surround_image == NULL) || !d_surround_image->resize(0, maxx, 0, maxy) ) {
+    fprintf(stderr, "Tracking_Engine::make_lost_and_found_images(): Could not create surround-subtracted image\n");
+    if (d_surround_image) { delete d_surround_image; d_surround_image = NULL; }
+    d_blur_engine.blur(image, aperture, static_cast<float>(blur), *d_blurred_image,
+      gaussian_blur_engine::AUTOMATIC);
+    return;
+  }
+  unsigned surround_aperture = 1 + static_cast<unsigned>(2 * (blur + surround));
+  d_blur_engine.difference_of_gaussians(image,
+    aperture, static_cast<float>(blur),
+    surround_aperture, static_cast<float>(blur + surround),
+    0.5, *d_blurred_image, *d_surround_image, gaussian_blur_engine::AUTOMATIC);
+}
+
+// This follows optimize_all_trackers() in video_spot_tracker.
+void Tracking_Engine::optimize_trackers(const image_wrapper &image, const image_wrapper &laf_image)
+{
+  int max_to_opt = d_settings.max_trackers_to_optimize;
+
+  if (d_settings.predict) {
+    d_trackers.take_prediction_step(max_to_opt);
+  }
+  if (d_settings.search_radius > 0) {
+    if (d_settings.search_pyramid_levels > 1) {
+      const image_pyramid &previous = d_pyramids[1 - d_current_pyramid];
+      if (previous.num_levels() > 0) {
+        d_trackers.perform_local_image_search(max_to_opt, d_settings.search_radius,
+          previous, d_pyramids[d_current_pyramid]);
+      }
+    } else if (d_last_image) {
+      d_trackers.fft_search(d_settings.fft_search);
+      d_trackers.perform_local_image_search(max_to_opt, d_settings.search_radius, *d_last_image, image);
+    }
+  }
+
+  // Tell the trackers which optimizer to use; trackers can be added at any
+  // time, so we do this every frame.
+  const spot_tracker_optimizer *optimizer = NULL;
+  if (d_settings.fast_optimizer) {
+    if (d_settings.kernel_type == KT_FIONA) { optimizer = &d_lm_optimizer; }
+    if (d_settings.kernel_type == KT_SYMMETRIC) { optimizer = &d_newton_optimizer; }
+  }
+  unsigned i;
+  for (i = 0; i < d_trackers.tracker_count(); i++) {
+    d_trackers.tracker(i)->xytracker()->set_optimizer(optimizer);
+  }
+
+  d_trackers.optimize_based_on(image, max_to_opt, d_settings.color_index,
+    d_settings.kernel_type == KT_FIONA, d_settings.parabolafit);
+
+  // Mark the trackers that are lost for any of the reasons we're checking.
+  d_trackers.mark_all_beads_not_lost();
+  if (d_settings.loss_sensitivity > 0) {
+    d_trackers.mark_lost_brightfield_beads_in(laf_image,
+      static_cast<float>(d_settings.loss_sensitivity), d_settings.kernel_type);
+  }
+  if (d_settings.intensity_loss_sensitivity > 0) {
+    d_trackers.mark_lost_fluorescent_beads_in(laf_image,
+      static_cast<float>(d_settings.intensity_loss_sensitivity));
+  }
+  if (d_settings.border_dead_zone > 0) {
+    d_trackers.min_border_distance(static_cast<float>(d_settings.border_dead_zone));
+    d_trackers.mark_edge_beads_in(image);
+  }
+  if (d_settings.tracker_dead_zone > 0) {
+    d_trackers.min_bead_separation(static_cast<float>(d_settings.tracker_dead_zone));
+    d_trackers.mark_colliding_beads_in(image);
+  }
+
+  // Lost trackers go back to where they were on the last frame.
+  for (i = 0; i < d_trackers.tracker_count(); i++) {
+    Spot_Information *tracker = d_trackers.tracker(i);
+    if (tracker->lost()) {
+      double last_pos[2];
+      tracker->get_last_position(last_pos);
+      tracker->xytracker()->set_location(last_pos[0], last_pos[1]);
+    }
+  }
+
+  if (d_settings.optimize_z) {
+    d_trackers.optimize_z_based_on(image, max_to_opt, d_settings.color_index);
+  }
+
+  // Delete lost trackers if we're supposed to; otherwise note that one
+  // is lost.
+  if (d_settings.lost_behavior == Tracking_Engine_Settings::LOST_DELETE) {
+    d_trackers.delete_beads_marked_as_lost();
+  } else {
+    for (i = 0; i < d_trackers.tracker_count(); i++) {
+      if (d_trackers.tracker(i)->lost()) {
+        d_trackers.set_active_tracker_index(i);
+        d_tracker_is_lost = true;
+        break;
+      }
+    }
+  }
+}
+
+void Tracking_Engine::track_image(const image_wrapper &image)
+{
+  d_frame_number++;
+  d_tracker_is_lost = false;
+
+  make_lost_and_found_images(image);
+  const image_wrapper *laf_image = &image;
+  bool use_pyramids = (d_settings.search_radius > 0) && (d_settings.search_pyramid_levels > 1);
+  if (use_pyramids) {
+    d_pyramids[d_current_pyramid].build(image, d_settings.search_pyramid_levels, d_settings.color_index);
+  }
+  if (d_blurred_image) { laf_image = d_blurred_image; }
+  if (d_surround_image) { laf_image = d_surround_image; }
+
+  optimize_trackers(image, *laf_image);
+
+  // Look for more beads if we don't have as many as we're supposed to
+  // maintain, then optimize again so that the new ones settle in.
+  if ( (d_frame_number % d_settings.check_bead_count_interval == 0) &&
+       (!d_settings.first_frame_only_autofind || (d_frame_number == 0)) ) {
+    bool found_more_beads = false;
+    if (d_settings.find_brightfield_beads > d_trackers.tracker_count()) {
+      if (d_trackers.find_more_brightfield_beads_in(*laf_image,
+            d_settings.sliding_window_radius,
+            d_settings.candidate_spot_threshold,
+            d_settings.find_brightfield_beads - d_trackers.tracker_count(),
+            d_vert_candidates, d_hori_candidates)) {
+        found_more_beads = true;
+      }
+    }
+    if (d_settings.find_fluorescent_beads > d_trackers.tracker_count()) {
+      if (d_trackers.autofind_fluorescent_beads_in(*laf_image,
+            static_cast<float>(d_settings.fluorescent_spot_threshold),
+            static_cast<float>(d_settings.intensity_loss_sensitivity),
+            d_settings.fluorescent_max_regions,
+            d_settings.fluorescent_max_region_size)) {
+        found_more_beads = true;
+      }
+      d_trackers.delete_edge_beads_in(*laf_image);
+    }
+    if (found_more_beads) {
+      optimize_trackers(image, *laf_image);
+    }
+  }
+
+  // Keep a copy of this frame (or its pyramid) if we need it to search on
+  // the next one.
+  if (use_pyramids) {
+    d_current_pyramid = 1 - d_current_pyramid;
+  } else if (d_settings.search_radius > 0) {
+    if (d_last_image == NULL) {
+      d_last_image = new copy_of_image(image);
+    } else {
+      *d_last_image = image;
+    }
+  }
+}
+
+// Copy the state of each tracker into the vector, reusing its storage.
+void Tracking_Engine::snapshot_trackers(std::vector<Tracked_Spot> &spots) const
+{
+  spots.resize(d_trackers.tracker_count());
+  unsigned i;
+  for (i = 0; i < d_trackers.tracker_count(); i++) {
+    Spot_Information *tracker = d_trackers.tracker(i);
+    spot_tracker_XY *xy = tracker->xytracker();
+    Tracked_Spot &spot = spots[i];
+
+    spot.index = tracker->index();
+    spot.x = xy->get_x();
+    spot.y = xy->get_y();
+    spot.z = tracker->ztracker() ? tracker->ztracker()->get_z() : 0.0;
+    spot.radius = xy->get_radius();
+    spot.orientation = 0.0;
+    spot.length = 0.0;
+    spot.background = 0.0;
+    spot.summedvalue = 0.0;
+    spot.region_size = tracker->get_region_size();
+    spot.sensitivity = tracker->get_sensitivity();
+    spot.lost = tracker->lost();
+
+    rod3_spot_tracker_interp *rod = dynamic_cast<rod3_spot_tracker_interp *>(xy);
+    if (rod) {
+      spot.orientation = rod->get_orientation();
+      spot.length = rod->get_length();
+    }
+    image_oriented_spot_tracker_interp *imageor = dynamic_cast<image_oriented_spot_tracker_interp *>(xy);
+    if (imageor) {
+      spot.orientation = imageor->get_orientation();
+    }
+    if (d_settings.kernel_type == KT_FIONA) {
+      FIONA_spot_tracker *fiona = static_cast<FIONA_spot_tracker *>(xy);
+      spot.background = fiona->get_background();
+      spot.summedvalue = fiona->get_summedvalue();
+    }
+  }
+}
+
+bool Tracking_Engine::track_frame(const image_wrapper &image)
+{
+  track_image(image);
+
+  // Report the results.
+  snapshot_trackers(d_spots);
+  size_t s;
+  for (s = 0; s < d_sinks.size(); s++) {
+    if (!d_sinks[s]->frame_done(d_frame_number, image, d_spots)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool Tracking_Engine::run(Tracking_Frame_Source &source, int max_frames)
+{
+  bool ret = true;
+  int count = 0;
+  const image_wrapper *image;
+  while ( ((max_frames < 0) || (count < max_frames)) &&
+          ((image = source.next_frame()) != NULL) ) {
+    count++;
+    if (!track_frame(*image)) {
+      ret = false;
+      break;
+    }
+    if (d_tracker_is_lost && (d_settings.lost_behavior == Tracking_Engine_Settings::LOST_STOP)) {
+      fprintf(stderr, "Tracking_Engine::run(): Lost in frame %d\n", d_frame_number);
+      break;
+    }
+  }
+
+  size_t s;
+  for (s = 0; s < d_sinks.size(); s++) {
+    if (!d_sinks[s]->finish()) {
+      ret = false;
+    }
+  }
+  return ret;
+}
+
+//----------------------------------------------------------------------------
+// Pipelined runs
+
+void Tracking_Engine::read_thread_func(vrpn_ThreadData &threadData)
+{
+  static_cast<Tracking_Engine *>(threadData.pvUD)->read_frames();
+}
+
+void Tracking_Engine::log_thread_func(vrpn_ThreadData &threadData)
+{
+  static_cast<Tracking_Engine *>(threadData.pvUD)->log_frames();
+}
+
+// Fill slots from the source until it runs out, we have read as many
+// frames as we were asked to, or the tracker tells us to stop.  The last
+// slot is always an END slot so that the other stages know we're done.
+void Tracking_Engine::read_frames(void)
+{
+  d_threadStart.p();
+  size_t next = 0;
+  int count = 0;
+  while (true) {
+    d_slotFree.p();
+    Pipeline_Slot &slot = d_slots[next];
+    next = (next + 1) % d_slots.size();
+
+    struct timeval start, end;
+    vrpn_gettimeofday(&start, NULL);
+    const image_wrapper *image = NULL;
+    if (!d_pipelineStop && ((d_maxFrames < 0) || (count < d_maxFrames))) {
+      image = d_source->next_frame();
+    }
+    if (image == NULL) {
+      slot.state = Pipeline_Slot::END;
+      d_slotRead.v();
+      return;
+    }
+    if (slot.image == NULL) {
+      slot.image = new copy_of_image(*image);
+    } else {
+      *slot.image = *image;
+    }
+    slot.state = Pipeline_Slot::FRAME;
+    count++;
+    vrpn_gettimeofday(&end, NULL);
+
+    d_statsLock.p();
+    d_stats.read_busy_seconds += seconds_between(start, end);
+    d_framesRead++;
+    d_statsLock.v();
+    d_slotRead.v();
+  }
+}
+
+// Hand the results for each slot to the sinks, in order, until we get the
+// END slot.  If a sink fails, we stop calling them and tell the tracker to
+// stop, but keep freeing slots until the end.
+void Tracking_Engine::log_frames(void)
+{
+  d_threadStart.p();
+  size_t next = 0;
+  while (true) {
+    d_slotTracked.p();
+    Pipeline_Slot &slot = d_slots[next];
+    next = (next + 1) % d_slots.size();
+    if (slot.state == Pipeline_Slot::END) {
+      return;
+    }
+
+    if ( (slot.state == Pipeline_Slot::FRAME) && !d_sinkFailed ) {
+      d_statsLock.p();
+      d_stats.log_queue_sum += d_framesTracked - d_framesLogged - 1;
+      d_statsLock.v();
+
+      struct timeval start, end;
+      vrpn_gettimeofday(&start, NULL);
+      size_t s;
+      for (s = 0; s < d_sinks.size(); s++) {
+        if (!d_sinks[s]->frame_done(slot.frame_number, *slot.image, slot.spots)) {
+          d_sinkFailed = true;
+          d_pipelineStop = true;
+          break;
+        }
+      }
+      vrpn_gettimeofday(&end, NULL);
+      d_statsLock.p();
+      d_stats.log_busy_seconds += seconds_between(start, end);
+      d_framesLogged++;
+      d_statsLock.v();
+    }
+    d_slotFree.v();
+  }
+}
+
+bool Tracking_Engine::run_pipelined(Tracking_Frame_Source &source, int max_frames,
+                                    unsigned queue_depth)
+{
+  // Make the ring, keeping any images from a previous run.  We need at least
+  // one slot for each stage to be working on at once.
+  if (queue_depth < 3) { queue_depth = 3; }
+  while (d_slots.size() > queue_depth) {
+    if (d_slots.back().image) { delete d_slots.back().image; }
+    d_slots.pop_back();
+  }
+  d_slots.resize(queue_depth);
+  d_slotFree.reset(queue_depth);
+  d_slotRead.reset(0);
+  d_slotTracked.reset(0);
+  d_threadStart.reset(0);
+  d_framesRead = d_framesTracked = d_framesLogged = 0;
+  d_pipelineStop = false;
+  d_sinkFailed = false;
+  d_source = &source;
+  d_maxFrames = max_frames;
+  d_stats.clear();
+
+  struct timeval run_start, run_end;
+  vrpn_gettimeofday(&run_start, NULL);
+
+  // Start the reader and logger.  They wait on d_threadStart so that each
+  // is sure to still be running when go() returns.
+  vrpn_ThreadData td;
+  td.pvUD = this;
+  td.ps = NULL;
+  vrpn_Thread reader(read_thread_func, td);
+  vrpn_Thread logger(log_thread_func, td);
+  if (!reader.go()) {
+    fprintf(stderr,"Tracking_Engine::run_pipelined(): Can't run reader thread\n");
+    return false;
+  }
+  if (!logger.go()) {
+    // Let the reader run to its END slot so that it exits.
+    fprintf(stderr,"Tracking_Engine::run_pipelined(): Can't run logger thread\n");
+    d_pipelineStop = true;
+    d_threadStart.v();
+    size_t next = 0;
+    bool done = false;
+    while (!done) {
+      d_slotRead.p();
+      done = (d_slots[next].state == Pipeline_Slot::END);
+      next = (next + 1) % d_slots.size();
+      d_slotFree.v();
+    }
+    while (reader.running()) { vrpn_SleepMsecs(1); }
+    return false;
+  }
+  d_threadStart.v();
+  d_threadStart.v();
+
+  // Track each slot in order.  Once we've been told to stop, pass the rest
+  // along as SKIP slots until the reader sends END.
+  size_t next = 0;
+  while (true) {
+    d_slotRead.p();
+    Pipeline_Slot &slot = d_slots[next];
+    next = (next + 1) % d_slots.size();
+    if (slot.state == Pipeline_Slot::END) {
+      d_slotTracked.v();
+      break;
+    }
+    if (d_pipelineStop) {
+      slot.state = Pipeline_Slot::SKIP;
+      d_slotTracked.v();
+      continue;
+    }
+
+    d_statsLock.p();
+    d_stats.track_queue_sum += d_framesRead - d_framesTracked - 1;
+    d_statsLock.v();
+
+    struct timeval start, end;
+    vrpn_gettimeofday(&start, NULL);
+    track_image(*slot.image);
+    slot.frame_number = d_frame_number;
+    snapshot_trackers(slot.spots);
+    vrpn_gettimeofday(&end, NULL);
+
+    d_statsLock.p();
+    d_stats.track_busy_seconds += seconds_between(start, end);
+    d_stats.frames++;
+    d_framesTracked++;
+    d_statsLock.v();
+    d_slotTracked.v();
+
+    if (d_tracker_is_lost && (d_settings.lost_behavior == Tracking_Engine_Settings::LOST_STOP)) {
+      fprintf(stderr, "Tracking_Engine::run_pipelined(): Lost in frame %d\n", d_frame_number);
+      d_pipelineStop = true;
+    }
+  }
+
+  // Both threads exit once they have seen the END slot.
+  while (reader.running() || logger.running()) {
+    vrpn_SleepMsecs(1);
+  }
+  vrpn_gettimeofday(&run_end, NULL);
+  d_stats.wall_seconds = seconds_between(run_start, run_end);
+  d_source = NULL;
+
+  bool ret = !d_sinkFailed;
+  size_t s;
+  for (s = 0; s < d_sinks.size(); s++) {
+    if (!d_sinks[s]->finish()) {
+      ret = false;
+    }
+  }
+  return ret;
+}
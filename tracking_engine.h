@@ -0,0 +1,294 @@
+#ifndef	TRACKING_ENGINE_H
+#define	TRACKING_ENGINE_H
+
+#include "spot_tracker.h"
+#include "counting_semaphore.h"
+#include <stdio.h>
+#include <vector>
+#include <vrpn_Shared.h>
+
+//----------------------------------------------------------------------------
+// Headless tracking engine.  This does the per-frame work that
+// video_spot_tracker does in its idle function (optimizing the trackers,
+// marking and handling lost ones, auto-finding new ones, and logging the
+// results) as a plain loop over frames from a source, with no GUI or Tcl
+// involved.  The application fills in the settings, adds any trackers it
+// wants to start with to the Tracker_Collection_Manager it passes in, adds
+// output sinks, and then calls run() to process the whole video.  Calling
+// run_pipelined() instead reads frames and writes results on their own
+// threads, so that decoding and logging overlap with the tracking.
+
+//----------------------------------------------------------------------------
+// Settings that control the tracking.  The defaults match the defaults in
+// video_spot_tracker.
+
+class Tracking_Engine_Settings {
+public:
+  // What to do with a tracker that gets lost.  These match the values
+  // used by video_spot_tracker.
+  enum Lost_Behavior { LOST_STOP = 0, LOST_DELETE = 1, LOST_HOVER = 2 };
+
+  Tracking_Engine_Settings()
+    : kernel_type(KT_SYMMETRIC)
+    , color_index(0)
+    , parabolafit(false)
+    , fast_optimizer(false)
+    , predict(false)
+    , search_radius(0)
+    , search_pyramid_levels(0)
+    , fft_search(false)
+    , optimize_z(false)
+    , lost_behavior(LOST_STOP)
+    , loss_sensitivity(0)
+    , intensity_loss_sensitivity(0)
+    , border_dead_zone(0)
+    , tracker_dead_zone(0)
+    , blur_lost_and_found(0)
+    , surround_lost_and_found(0)
+    , find_brightfield_beads(0)
+    , sliding_window_radius(10)
+    , candidate_spot_threshold(5)
+    , find_fluorescent_beads(0)
+    , fluorescent_spot_threshold(0.5)
+    , fluorescent_max_regions(1000)
+    , fluorescent_max_region_size(60000)
+    , check_bead_count_interval(5)
+    , first_frame_only_autofind(false)
+    , max_trackers_to_optimize(-1)
+  {};
+
+  KERNEL_TYPE   kernel_type;            //< Kernel used by the trackers (for lost checks and FIONA radius)
+  unsigned      color_index;            //< Which color to track in
+  bool          parabolafit;            //< Do a parabolic fit to refine positions?
+  bool          fast_optimizer;         //< Levenberg-Marquardt (FIONA) or Newton (symmetric) instead of pattern search?
+  bool          predict;                //< Predict new positions from previous motion?
+  double        search_radius;          //< Radius of image-matched search (0 for none)
+  unsigned      search_pyramid_levels;  //< Search coarse-to-fine over this many levels (0 or 1 to search every pixel)
+  bool          fft_search;             //< Do the full-resolution search by FFT correlation?
+  bool          optimize_z;             //< Run the Z trackers?
+  Lost_Behavior lost_behavior;          //< What to do with lost trackers
+  double        loss_sensitivity;       //< Brightfield lost-tracker sensitivity (0 for none)
+  double        intensity_loss_sensitivity; //< Fluorescent lost-tracker sensitivity (0 for none)
+  double        border_dead_zone;       //< Trackers this close to the edge are lost (0 for none)
+  double        tracker_dead_zone;      //< Trackers this close to each other are lost (0 for none)
+  double        blur_lost_and_found;    //< Blur used for the lost-and-found image (0 for none)
+  double        surround_lost_and_found; //< Extra blur for the surround image (0 for none)
+  unsigned      find_brightfield_beads; //< Keep at least this many brightfield beads (0 for none)
+  int           sliding_window_radius;  //< Window radius for brightfield autofind
+  double        candidate_spot_threshold; //< Threshold for brightfield autofind
+  unsigned      find_fluorescent_beads; //< Keep at least this many fluorescent beads (0 for none)
+  double        fluorescent_spot_threshold; //< Threshold for fluorescent autofind
+  unsigned      fluorescent_max_regions; //< Most regions to consider in fluorescent autofind
+  unsigned      fluorescent_max_region_size; //< Largest region to consider in fluorescent autofind
+  unsigned      check_bead_count_interval; //< Check for more beads every this many frames
+  bool          first_frame_only_autofind; //< Only autofind in the first frame?
+  int           max_trackers_to_optimize; //< How many trackers to optimize (-1 for all)
+};
+
+//----------------------------------------------------------------------------
+// Where frames come from.  next_frame() returns the next image, or NULL when
+// there are no more.  The image must stay valid until the next call.
+
+class Tracking_Frame_Source {
+public:
+  virtual ~Tracking_Frame_Source() {};
+  virtual const image_wrapper *next_frame(void) = 0;
+};
+
+// Frame source that reads from a camera or video file.  A read failure is
+// taken to be the end of the video, as in video_spot_tracker.
+class Camera_Frame_Source : public Tracking_Frame_Source {
+public:
+  Camera_Frame_Source(base_camera_server *camera, float exposure = 0)
+    : d_camera(camera), d_exposure(exposure) {};
+
+  virtual const image_wrapper *next_frame(void) {
+    if (!d_camera->read_image_to_memory(0, 0, 0, 0, d_exposure)) {
+      return NULL;
+    }
+    return d_camera;
+  }
+
+protected:
+  base_camera_server  *d_camera;
+  float               d_exposure;
+};
+
+//----------------------------------------------------------------------------
+// The state of one tracker at the end of a frame.  The engine copies these
+// out of the trackers so that the results for a frame can be written while
+// the trackers are already working on the next one.
+
+class Tracked_Spot {
+public:
+  unsigned  index;          //< Spot_Information::index()
+  double    x, y, z;        //< Position (Y is in image coordinates, not flipped)
+  double    radius;
+  double    orientation;    //< For rod and oriented-image trackers, else 0
+  double    length;         //< For rod trackers, else 0
+  double    background;     //< Fit background for FIONA trackers, else 0
+  double    summedvalue;    //< Fit summed value for FIONA trackers, else 0
+  int       region_size;    //< Spot_Information::get_region_size()
+  double    sensitivity;    //< Spot_Information::get_sensitivity()
+  bool      lost;
+};
+
+//----------------------------------------------------------------------------
+// Where results go.  frame_done() is called once per frame, in order, after
+// all of the trackers have been optimized and lost ones handled; it should
+// return false to stop the run (on a write error, for example).  finish() is
+// called at the end of a run.  When the engine is pipelined, these are
+// called on the logging thread.
+
+class Tracking_Output_Sink {
+public:
+  virtual ~Tracking_Output_Sink() {};
+  virtual bool frame_done(int frame_number, const image_wrapper &image,
+                          const std::vector<Tracked_Spot> &spots) = 0;
+  virtual bool finish(void) { return true; };
+};
+
+// Writes the same comma-separated format that video_spot_tracker does,
+// including the header line.  Y is flipped so that it is measured from the
+// top of the image, and lost trackers (in hover mode) are not written.
+// The FIONA-only columns are filled in when the kernel type is FIONA.
+class Tracking_CSV_Sink : public Tracking_Output_Sink {
+public:
+  Tracking_CSV_Sink(const char *filename, const Tracking_Engine_Settings &settings,
+                    bool internal_values = false);
+  virtual ~Tracking_CSV_Sink();
+
+  bool working(void) const { return d_file != NULL; }
+  virtual bool frame_done(int frame_number, const image_wrapper &image,
+                          const std::vector<Tracked_Spot> &spots);
+  virtual bool finish(void);
+
+protected:
+  FILE      *d_file;
+  KERNEL_TYPE d_kernel_type;
+  unsigned  d_color_index;
+  bool      d_internal_values;  //< Write region size and sensitivity?
+};
+
+//----------------------------------------------------------------------------
+// How busy each stage of a pipelined run was.  The busy times are the time
+// spent reading (including copying the frame), tracking, and calling the
+// sinks; dividing them by the wall-clock time gives the occupancy of each
+// stage.  The queue lengths are the mean number of frames that were waiting
+// each time the tracking and logging stages went to get their next one.
+
+class Tracking_Pipeline_Statistics {
+public:
+  Tracking_Pipeline_Statistics() { clear(); };
+  void clear(void) {
+    frames = 0; wall_seconds = 0;
+    read_busy_seconds = track_busy_seconds = log_busy_seconds = 0;
+    track_queue_sum = log_queue_sum = 0;
+  }
+
+  unsigned  frames;               //< Frames tracked
+  double    wall_seconds;
+  double    read_busy_seconds;
+  double    track_busy_seconds;
+  double    log_busy_seconds;
+  double    track_queue_sum;      //< Sum over frames of frames waiting to be tracked
+  double    log_queue_sum;        //< Sum over frames of frames waiting to be logged
+
+  double mean_track_queue(void) const { return frames ? track_queue_sum / frames : 0; }
+  double mean_log_queue(void) const { return frames ? log_queue_sum / frames : 0; }
+
+  // Print a one-line-per-stage summary.
+  void print(FILE *f) const;
+};
+
+//----------------------------------------------------------------------------
+// The engine itself.  It does not own the trackers, the source, or the sinks.
+
+class Tracking_Engine {
+public:
+  Tracking_Engine(Tracker_Collection_Manager &trackers,
+                  const Tracking_Engine_Settings &settings);
+  ~Tracking_Engine();
+
+  void add_sink(Tracking_Output_Sink *sink) { d_sinks.push_back(sink); }
+
+  // Track the next frame of a video, then pass the results to the sinks.
+  // Returns false if a sink failed.
+  bool track_frame(const image_wrapper &image);
+
+  // Track every frame from the source, stopping early after max_frames
+  // (if it is not negative) or when a tracker is lost in LOST_STOP mode.
+  // Calls finish() on each sink at the end.  Returns false if a sink failed.
+  bool run(Tracking_Frame_Source &source, int max_frames = -1);
+
+  // Same as run(), but with the source read on one thread and the sinks
+  // called on another, while the trackers are optimized on this one.  Up to
+  // queue_depth frames are copied and in flight at once.  Frames reach the
+  // trackers and the sinks in order, and each frame is tracked starting from
+  // where the previous one left the trackers, so the results are the same as
+  // from run().
+  bool run_pipelined(Tracking_Frame_Source &source, int max_frames = -1,
+                     unsigned queue_depth = 4);
+
+  int   frame_number(void) const { return d_frame_number; }   //< Last frame tracked (-1 before any)
+  bool  tracker_is_lost(void) const { return d_tracker_is_lost; }
+  const Tracking_Pipeline_Statistics &pipeline_statistics(void) const { return d_stats; }
+
+protected:
+  Tracker_Collection_Manager  &d_trackers;
+  Tracking_Engine_Settings    d_settings;
+  std::vector<Tracking_Output_Sink *> d_sinks;
+  int                         d_frame_number;
+  bool                        d_tracker_is_lost;
+  copy_of_image               *d_last_image;      //< Previous frame, for image-matched search
+  image_pyramid               d_pyramids[2];      //< This frame's and the previous frame's, for coarse-to-fine search
+  unsigned                    d_current_pyramid;  //< Which of them is this frame's
+  float_image                 *d_blurred_image;   //< Lost-and-found blurred image
+  float_image                 *d_surround_image;  //< Lost-and-found surround-subtracted image
+  gaussian_blur_engine        d_blur_engine;      //< Makes the lost-and-found images, reusing its buffers
+  Gaussian_LM_optimizer       d_lm_optimizer;     //< Used for FIONA trackers when fast_optimizer is set
+  Newton_spot_optimizer       d_newton_optimizer; //< Used for symmetric trackers when fast_optimizer is set
+  std::vector<int>            d_vert_candidates;  //< Brightfield autofind scratch
+  std::vector<int>            d_hori_candidates;
+  std::vector<Tracked_Spot>   d_spots;            //< Results for run() and track_frame()
+
+  void make_lost_and_found_images(const image_wrapper &image);
+  void optimize_trackers(const image_wrapper &image, const image_wrapper &laf_image);
+  void track_image(const image_wrapper &image);
+  void snapshot_trackers(std::vector<Tracked_Spot> &spots) const;
+
+  //------------------------------------------------------------------
+  // Pipelined runs.  The slots form a ring that the reader, the tracker,
+  // and the logger each walk in order, so frames can't pass each other.
+  // A slot is handed from one stage to the next by raising that stage's
+  // semaphore.
+  class Pipeline_Slot {
+  public:
+    Pipeline_Slot() : state(FRAME), image(NULL), frame_number(-1) {};
+    enum { FRAME, SKIP, END } state;  //< SKIP frames are read after a stop
+    copy_of_image             *image;
+    int                       frame_number;
+    std::vector<Tracked_Spot> spots;
+  };
+  std::vector<Pipeline_Slot>  d_slots;
+  counting_semaphore          d_slotFree;         //< Counts slots the reader can fill
+  counting_semaphore          d_slotRead;         //< Counts slots waiting to be tracked
+  counting_semaphore          d_slotTracked;      //< Counts slots waiting to be logged
+  counting_semaphore          d_threadStart;      //< Holds the threads until go() returns
+  vrpn_Semaphore              d_statsLock;        //< Protects d_stats and the counts below
+  unsigned                    d_framesRead;
+  unsigned                    d_framesTracked;
+  unsigned                    d_framesLogged;
+  volatile bool               d_pipelineStop;     //< Tells the reader to stop reading
+  volatile bool               d_sinkFailed;       //< Set by the logger if a sink fails
+  Tracking_Frame_Source       *d_source;
+  int                         d_maxFrames;
+  Tracking_Pipeline_Statistics  d_stats;
+
+  void read_frames(void);
+  void log_frames(void);
+  static void read_thread_func(vrpn_ThreadData &threadData);
+  static void log_thread_func(vrpn_ThreadData &threadData);
+};
+
+#endif
@@ -231,7 +231,7 @@ unsigned            g_camera_bit_depth = 8;       //< Bit depth of the particula
 
 image_wrapper       *g_image;                     //< Image, possibly from camera and possibly computed
 image_metric	    *g_mean_image = NULL;	  //< Accumulates mean of images, if we're doing background subtract
-image_wrapper	    *g_calculated_image = NULL;	  //< Image calculated from the camera image and other parameters
+subtracted_image    *g_calculated_image = NULL;	  //< Image calculated from the camera image and other parameters
 unsigned            g_background_count = 0;       //< Number of frames we've already averaged over
 copy_of_image	    *g_last_image = NULL;	  //< Copy of the last image we had, if any
 image_wrapper       *g_blurred_image = NULL;      //< Blurred image used for autofind/delete, if any
@@ -426,6 +426,8 @@ double			g_log_offset_x, g_log_offset_y, g_log_offset_z;
 Tclvar_int              g_logging("logging"); //< Accessor for the GUI logging button so rewind can turn it off.
 bool g_video_valid = false; // Do we have a valid video frame in memory?
 int		        g_log_frame_number_last_logged = -1;
+double                  g_log_video_pixels_requested = 0; //< Pixels of video around trackers and full frames asked for
+double                  g_log_video_pixels_sent = 0;      //< Pixels of video actually sent after removing overlaps
 
 //--------------------------------------------------------------------------
 spot_tracker_XY  *create_appropriate_xytracker(double x, double y, double r);
@@ -879,6 +881,15 @@ static	bool  save_log_frame(int frame_number)
       0, g_camera->get_num_rows()-1);
   }
 
+  // The video around each tracker is gathered up and sent after all of the
+  // trackers have been logged, so that pixels near more than one tracker
+  // are only sent once.  None of it needs to be sent on frames where the
+  // whole region of interest is sent (see below).
+  static VST_Region_Union video_regions;
+  video_regions.clear();
+  bool send_full_frame = g_log_video &&
+       ((frame_number % g_video_full_frame_every == 0) || (g_deleted_trackers.tracker_count() > 0));
+
   unsigned loopi;
   for (loopi = 0; loopi < g_trackers.tracker_count(); loopi++) {
     Spot_Information *tracker = g_trackers.tracker(loopi);
@@ -990,10 +1001,7 @@ static	bool  save_log_frame(int frame_number)
       if (minY < *g_minY) { minY = *g_minY; }
       if (static_cast<unsigned>(maxX) > *g_maxX) { maxX = *g_maxX; }
       if (static_cast<unsigned>(maxY) > *g_maxY) { maxY = *g_maxY; }
-      if (!fill_and_send_video_region(minX, minY, maxX, maxY)) {
-        fprintf(stderr, "Could not fill and send video for tracker\n");
-        return false;
-      }
+      video_regions.add(minX, minY, maxX, maxY);
     }
 
     // Rotation about the Z axis, reported in radians.
@@ -1049,16 +1057,31 @@ static	bool  save_log_frame(int frame_number)
   // frame, store the entire frame.  We used to just store the video around
   // where the trackers were when they got lost but sometimes they wander
   // far off (sometimes even off screen), so we need to save the whole frame. 
-  if ( g_log_video &&
-       ((frame_number % g_video_full_frame_every == 0) || (g_deleted_trackers.tracker_count() > 0)) ) {
+  if (send_full_frame) {
     // Send the current frame over to the client in chunks as big as possible (limited by vrpn_IMAGER_MAX_REGION).
     if (!fill_and_send_video_region(*g_minX, *g_minY, *g_maxX, *g_maxY)) {
       fprintf(stderr, "Could not fill and send region of interest\n");
       return false;
     }
+    double roi_pixels = (*g_maxX - *g_minX + 1) * (*g_maxY - *g_minY + 1);
+    g_log_video_pixels_requested += video_regions.requested_pixels() + roi_pixels;
+    g_log_video_pixels_sent += roi_pixels;
 
     // Don't remember the ones from previous frames.
     g_deleted_trackers.delete_trackers();
+
+  // Otherwise, send the union of the regions around the trackers.
+  } else if (g_log_video) {
+    static std::vector<VST_Region_Union::Rect> rects;
+    g_log_video_pixels_requested += video_regions.requested_pixels();
+    g_log_video_pixels_sent += video_regions.disjoint_cover(rects);
+    size_t r;
+    for (r = 0; r < rects.size(); r++) {
+      if (!fill_and_send_video_region(rects[r].minx, rects[r].miny, rects[r].maxx, rects[r].maxy)) {
+        fprintf(stderr, "Could not fill and send video for trackers\n");
+        return false;
+      }
+    }
   }
 
   // If we're logging video, send an end-of-frame event.
@@ -2528,13 +2551,16 @@ void myIdleFunc(void)
       }
     }
 
-    // Get rid of the old calculated image, if we have one
-    if (g_calculated_image) { delete g_calculated_image; g_calculated_image = NULL; }
     // Calculate the new image and then point the image to display at it.
+    // Reuse the calculated image from the last frame, if we have one.
     // The offset is determined by the maximum value that can be displayed in an
     // image with half as many values as the present image.
     double offset = (1 << (((unsigned)(g_camera_bit_depth))-1) ) - 1;
-    g_calculated_image = new subtracted_image(*g_image, *g_mean_image, offset);
+    if (g_calculated_image) {
+      g_calculated_image->recompute(*g_image, *g_mean_image, offset);
+    } else {
+      g_calculated_image = new subtracted_image(*g_image, *g_mean_image, offset);
+    }
     if (g_calculated_image == NULL) {
       fprintf(stderr, "Out of memory when calculating image\n");
       cleanup();
@@ -2574,51 +2600,71 @@ void myIdleFunc(void)
     time_to_blur = true;
     last_blur_setting = g_blurLostAndFound;
   }
-  if (g_blurred_image && time_to_blur) {
-    delete g_blurred_image;
-    g_blurred_image = NULL;
-  }
-  if ( time_to_blur && (g_blurLostAndFound > 0) ) {
-    unsigned aperture = 1 + static_cast<unsigned>(2*g_blurLostAndFound);
-    g_blurred_image = new gaussian_blurred_image(*g_image, aperture, g_blurLostAndFound);
-    if (g_blurred_image == NULL) {
-      fprintf(stderr, "Could not create blurred image!\n");
-    }
-  }
-  image_wrapper *laf_image = g_image;
-  if (g_blurred_image) {
-    laf_image = g_blurred_image;
-  }
 
-  // If we have gotten a new video frame and we're making a surround-subtract image
-  // for the lost-and-found images, then make a new one here.  Then set the
-  // lost-and-found (LAF) image to point to it.  If we change the setting
-  // for blurring or surround, also redo surround.  We form the image as the difference
+  // Same thing for the surround-subtract image.  We form the image as the difference
   // between the blurred image and and image formed by blurring to the
-  // larger sum of blur and surround settings.
+  // larger sum of blur and surround settings.  If we change the setting
+  // for blurring or surround, also redo surround.  The blur engine makes
+  // both images at once, so whenever we redo the surround we also redo the blur.
   static double last_surround_setting = 0;
   bool time_to_surround = g_video_valid;
   if ( time_to_blur || (last_surround_setting != g_surroundLostAndFound) ) {
     time_to_surround = true;
     last_surround_setting = g_surroundLostAndFound;
   }
-  if (g_surround_image && time_to_surround) {
-    delete g_surround_image;
+  bool make_surround = time_to_surround && (g_blurLostAndFound > 0) && (g_surroundLostAndFound > 0);
+  if (make_surround) {
+    time_to_blur = true;
+  }
+
+  if (time_to_blur) {
+    g_blurred_image = NULL;
+  }
+  if (time_to_surround) {
     g_surround_image = NULL;
   }
-  if ( time_to_surround && (g_blurLostAndFound > 0) && (g_surroundLostAndFound > 0) ) {
-    unsigned aperture = 1 + static_cast<unsigned>(2 * (g_blurLostAndFound+g_surroundLostAndFound) );
-    image_wrapper *large_blur = new gaussian_blurred_image(*g_image, aperture, (g_blurLostAndFound+g_surroundLostAndFound) );
-    if (large_blur == NULL) {
-      fprintf(stderr, "Could not create larger-blurred image!\n");
-    } else {
-      g_surround_image = new subtracted_image(*g_blurred_image, *large_blur, 0.5);
-      if (g_surround_image == NULL) {
+
+  // The images and the engine stay around from frame to frame so that
+  // their buffers are reused rather than reallocated for each new frame.
+  static gaussian_blur_engine blur_engine;
+  static float_image *blurred = NULL;
+  static float_image *surround = NULL;
+  if ( time_to_blur && (g_blurLostAndFound > 0) ) {
+    unsigned aperture = 1 + static_cast<unsigned>(2*g_blurLostAndFound);
+    int maxx = g_image->get_num_columns() - 1;
+    int maxy = g_image->get_num_rows() - 1;
+    if (blurred == NULL) {
+      blurred = new float_image(0, maxx, 0, maxy);
+    }
+    if ( (blurred == NULL) || !blurred->resize(0, maxx, 0, maxy) ) {
+      fprintf(stderr, "Could not create blurred image!\n");
+    } else if (make_surround) {
+      unsigned surround_aperture = 1 + static_cast<unsigned>(2 * (g_blurLostAndFound+g_surroundLostAndFound) );
+      if (surround == NULL) {
+        surround = new float_image(0, maxx, 0, maxy);
+      }
+      if ( (surround == NULL) || !surround->resize(0, maxx, 0, maxy) ) {
         fprintf(stderr, "Could not create surround-subtracted image!\n");
+        blur_engine.blur(*g_image, aperture, g_blurLostAndFound, *blurred,
+          gaussian_blur_engine::AUTOMATIC);
+      } else {
+        blur_engine.difference_of_gaussians(*g_image,
+          aperture, g_blurLostAndFound,
+          surround_aperture, g_blurLostAndFound+g_surroundLostAndFound,
+          0.5, *blurred, *surround, gaussian_blur_engine::AUTOMATIC);
+        g_surround_image = surround;
       }
-      delete large_blur;
+      g_blurred_image = blurred;
+    } else {
+      blur_engine.blur(*g_image, aperture, g_blurLostAndFound, *blurred,
+        gaussian_blur_engine::AUTOMATIC);
+      g_blurred_image = blurred;
     }
   }
+  image_wrapper *laf_image = g_image;
+  if (g_blurred_image) {
+    laf_image = g_blurred_image;
+  }
   if (g_surround_image) {
     laf_image = g_surround_image;
   }
@@ -2904,22 +2950,7 @@ void myIdleFunc(void)
 // tracker, and moved it to the specified location.
 void  activate_and_drag_nearest_tracker_to(double x, double y)
 {
-  // Looks for the minimum squared distance and the tracker that is
-  // there.
-  double  minDist2 = 1e100;
-  int minTracker = -1;
-  double  dist2;
-
-  unsigned i;
-  for (i = 0; i < g_trackers.tracker_count(); i++) {
-    Spot_Information *tracker = g_trackers.tracker(i);
-    dist2 = (x - tracker->xytracker()->get_x())*(x - tracker->xytracker()->get_x()) +
-      (y - tracker->xytracker()->get_y())*(y - tracker->xytracker()->get_y());
-    if (dist2 < minDist2) {
-      minDist2 = dist2;
-      minTracker = i;
-    }
-  }
+  int minTracker = g_trackers.nearest_tracker_index(x, y);
   if (minTracker < 0) {
     fprintf(stderr, "No tracker to pick out of %d\n", g_trackers.tracker_count());
   } else {
@@ -3146,6 +3177,15 @@ void  logfilename_changed(char *newvalue, void *)
     }
   }
 
+  // Report how much video was saved by sending overlapping regions once.
+  if ( (strlen(newvalue) == 0) && (g_log_video_pixels_requested > 0) ) {
+    double bytes_per_pixel = (g_camera_bit_depth == 8) ? 1 : 2;
+    printf("Logged %lg bytes of video (%lg bytes saved by not repeating overlapping regions)\n",
+           g_log_video_pixels_sent * bytes_per_pixel,
+           (g_log_video_pixels_requested - g_log_video_pixels_sent) * bytes_per_pixel);
+    g_log_video_pixels_requested = g_log_video_pixels_sent = 0;
+  }
+
   // The logging thread will take care of closing the client tracker
   // and connection as needed when the file name changes.
 